@@ -0,0 +1,99 @@
+#!/usr/bin/env python3
+#
+# scpi_benchmark.py
+#
+# Measure SCPI command throughput (commands per second) of a FanPico
+# unit, using chained (';' separated) queries as used by automation.
+# Run against old and new firmware to compare.
+#
+# Usage:
+#   scpi_benchmark.py [-n rounds] [-c chain] /dev/ttyACM0
+#   scpi_benchmark.py [-n rounds] [-c chain] host[:port]   (telnet raw mode)
+#
+
+import sys
+import time
+import socket
+import argparse
+
+
+QUERIES = [
+    'MEAS:FAN{}:RPM?',
+    'MEAS:FAN{}:PWM?',
+    'MEAS:MBFAN{}:RPM?',
+    'MEAS:SENSOR{}:TEMP?',
+]
+
+
+class SerialConn:
+    def __init__(self, dev):
+        import serial
+        self.s = serial.Serial(dev, 115200, timeout=5)
+
+    def write(self, data):
+        self.s.write(data)
+
+    def readline(self):
+        return self.s.readline()
+
+
+class TcpConn:
+    def __init__(self, host, port):
+        self.s = socket.create_connection((host, port), timeout=5)
+        self.f = self.s.makefile('rb')
+
+    def write(self, data):
+        self.s.sendall(data)
+
+    def readline(self):
+        return self.f.readline()
+
+
+def build_chain(count):
+    cmds = []
+    i = 0
+    while len(cmds) < count:
+        q = QUERIES[i % len(QUERIES)]
+        cmds.append(q.format((i // len(QUERIES)) % 3 + 1))
+        i += 1
+    return cmds
+
+
+def main():
+    parser = argparse.ArgumentParser(description='FanPico SCPI throughput benchmark')
+    parser.add_argument('-n', '--rounds', type=int, default=100,
+                        help='number of command lines to send')
+    parser.add_argument('-c', '--chain', type=int, default=12,
+                        help='number of chained queries per command line')
+    parser.add_argument('target', help='serial device or host[:port]')
+    args = parser.parse_args()
+
+    if args.target.startswith('/dev/') or args.target.startswith('COM'):
+        conn = SerialConn(args.target)
+    else:
+        host, _, port = args.target.partition(':')
+        conn = TcpConn(host, int(port) if port else 23)
+
+    cmds = build_chain(args.chain)
+    line = (';'.join(cmds) + '\r\n').encode()
+
+    # Warm up (and make sure unit responds)
+    conn.write(b'*IDN?\r\n')
+    conn.readline()
+
+    start = time.time()
+    for n in range(args.rounds):
+        conn.write(line)
+        for c in cmds:
+            if not conn.readline():
+                print('timeout waiting for response')
+                sys.exit(1)
+    elapsed = time.time() - start
+
+    total = args.rounds * len(cmds)
+    print('%d commands in %.2fs: %.1f commands/s (%.1f command lines/s)' %
+          (total, elapsed, total / elapsed, args.rounds / elapsed))
+
+
+if __name__ == '__main__':
+    main()
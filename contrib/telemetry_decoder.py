@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+#
+# telemetry_decoder.py
+#
+# Receive and decode binary UDP telemetry packets sent by FanPico
+# units (see SYS:TELEMetry:SERVer). Telemetry can be sent to a unicast
+# address (this host) or a multicast group (use -g to join the group).
+#
+# Usage:
+#   telemetry_decoder.py [-p port] [-g group] [-j]
+#
+
+import sys
+import json
+import socket
+import struct
+import argparse
+
+
+MAGIC = b'FPTL'
+HEADER = struct.Struct('<4sBBBBBBHIIIHH8s')
+
+
+def decode(data):
+    if len(data) < HEADER.size or data[0:4] != MAGIC:
+        raise ValueError('not a telemetry packet')
+    (magic, version, hdr_len, fans, mbfans, sensors, vsensors, _,
+     seq, uptime, generation, faults, lost, unit_id) = HEADER.unpack_from(data)
+    if version != 1:
+        raise ValueError('unsupported version: %d' % version)
+    if len(data) < hdr_len + fans * 4 + mbfans * 4 + sensors * 2 + vsensors * 2:
+        raise ValueError('truncated packet')
+
+    pkt = {
+        'unit': unit_id.hex().upper(),
+        'seq': seq,
+        'uptime': uptime,
+        'generation': generation,
+        'fans': [],
+        'mbfans': [],
+        'sensors': [],
+        'vsensors': [],
+    }
+    ofs = hdr_len
+    for i in range(fans):
+        rpm, duty = struct.unpack_from('<HH', data, ofs)
+        pkt['fans'].append({'rpm': rpm, 'duty': duty / 100.0,
+                            'fault': bool(faults & (1 << i))})
+        ofs += 4
+    for i in range(mbfans):
+        rpm, duty = struct.unpack_from('<HH', data, ofs)
+        pkt['mbfans'].append({'rpm': rpm, 'duty': duty / 100.0,
+                              'pwm_lost': bool(lost & (1 << i))})
+        ofs += 4
+    for i in range(sensors):
+        temp, = struct.unpack_from('<h', data, ofs)
+        pkt['sensors'].append(temp / 100.0)
+        ofs += 2
+    for i in range(vsensors):
+        temp, = struct.unpack_from('<h', data, ofs)
+        pkt['vsensors'].append(temp / 100.0)
+        ofs += 2
+    return pkt
+
+
+def format_packet(addr, pkt):
+    out = ['%s %s #%d up %ds' % (addr, pkt['unit'], pkt['seq'], pkt['uptime'])]
+    for i, f in enumerate(pkt['fans']):
+        out.append('fan%d=%d/%.1f%%%s' % (i + 1, f['rpm'], f['duty'],
+                                          '!' if f['fault'] else ''))
+    for i, f in enumerate(pkt['mbfans']):
+        out.append('mbfan%d=%d/%.1f%%%s' % (i + 1, f['rpm'], f['duty'],
+                                            '!' if f['pwm_lost'] else ''))
+    for i, t in enumerate(pkt['sensors']):
+        out.append('sensor%d=%.1fC' % (i + 1, t))
+    for i, t in enumerate(pkt['vsensors']):
+        out.append('vsensor%d=%.1fC' % (i + 1, t))
+    return ' '.join(out)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='FanPico UDP telemetry decoder')
+    parser.add_argument('-p', '--port', type=int, default=5515,
+                        help='UDP port to listen on')
+    parser.add_argument('-g', '--group',
+                        help='multicast group to join')
+    parser.add_argument('-j', '--json', action='store_true',
+                        help='output packets as JSON (one per line)')
+    args = parser.parse_args()
+
+    s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    s.bind(('', args.port))
+    if args.group:
+        mreq = struct.pack('4s4s', socket.inet_aton(args.group),
+                           socket.inet_aton('0.0.0.0'))
+        s.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, mreq)
+
+    last_seq = {}
+    while True:
+        data, addr = s.recvfrom(2048)
+        try:
+            pkt = decode(data)
+        except ValueError as e:
+            print('%s: %s' % (addr[0], e), file=sys.stderr)
+            continue
+
+        prev = last_seq.get(pkt['unit'])
+        if prev is not None and pkt['seq'] != (prev + 1) & 0xffffffff:
+            print('%s: lost %d packet(s)' % (pkt['unit'],
+                  (pkt['seq'] - prev - 1) & 0xffffffff), file=sys.stderr)
+        last_seq[pkt['unit']] = pkt['seq']
+
+        if args.json:
+            pkt['address'] = addr[0]
+            print(json.dumps(pkt))
+        else:
+            print(format_packet(addr[0], pkt))
+        sys.stdout.flush()
+
+
+if __name__ == '__main__':
+    main()
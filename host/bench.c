@@ -0,0 +1,437 @@
+/* bench.c
+   Copyright (C) 2021-2024 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of FanPico.
+
+   FanPico is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   FanPico is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with FanPico. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "pico/stdlib.h"
+#include "cJSON.h"
+
+#include "fanpico.h"
+#include "sim.h"
+
+
+/*
+ * Micro-benchmarks of the fan control pipeline (host build).
+ *
+ * Same synthetic input trace as SYS:PERF:PIPEline? on the device, run
+ * for a number of rounds and timed with the host monotonic clock.
+ * Results (mean ns per call and a checksum of the results) can be saved,
+ * and compared against a saved baseline: mean time increasing more than
+ * the threshold percentage is reported as a regression (exit code 1), and
+ * checksum differences are reported as warnings (results changed).
+ */
+
+#define BENCH_SAMPLES 256
+#define BENCH_MAX     24
+
+/* command.c, config.c */
+struct cmd_t {
+	const char   *cmd;
+	uint8_t       min_match;
+	const struct cmd_t *subcmds;
+	int (*func)(const char *cmd, const char *args, int query, char *prev_cmd);
+};
+extern const struct cmd_t commands[];
+const struct cmd_t* run_cmd(char *cmd, const struct cmd_t *cmd_level, char **prev_subcmd);
+extern struct fanpico_config fanpico_config;
+void clear_config(struct fanpico_config *cfg);
+cJSON *config_to_json(const struct fanpico_config *cfg);
+int json_to_config(cJSON *config, struct fanpico_config *cfg);
+
+struct bench_result {
+	const char *name;
+	uint64_t calls;
+	double ns;
+	double sum;
+};
+
+static struct bench_result results[BENCH_MAX];
+static int result_count = 0;
+static int rounds = 64;
+static double clock_overhead = 0.0;
+
+static struct fanpico_control_config *c;
+static struct fanpico_state *s;
+
+
+static uint64_t bench_ns()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void bench_report(const char *name, uint64_t t, uint64_t calls, double sum)
+{
+	struct bench_result *r;
+
+	assert(result_count < BENCH_MAX);
+	r = &results[result_count++];
+	r->name = name;
+	r->calls = calls;
+	r->ns = (calls > 0 ? (double)t / calls : 0.0);
+	r->sum = sum;
+}
+
+static void print_results()
+{
+	struct bench_result *r;
+
+	printf("function                  calls    mean_ns       checksum\n");
+	for (int i = 0; i < result_count; i++) {
+		r = &results[i];
+		printf("%-20s %10llu %10.1f %14.2f\n", r->name,
+			(unsigned long long)r->calls, r->ns, r->sum);
+	}
+}
+
+/* Synthetic input trace (see pipe_bench_trace() in command.c) */
+static void bench_trace(int n, struct fanpico_state *s)
+{
+	int phase = n % 64;
+	float ramp = (phase < 32 ? phase : 64 - phase) / 32.0;
+	int i;
+
+	for (i = 0; i < SENSOR_MAX_COUNT; i++)
+		s->temp[i] = 20.0 + 60.0 * ramp + i;
+	for (i = 0; i < MBFAN_MAX_COUNT; i++)
+		s->mbfan_duty[i] = ((n * 7 + i * 13) % 101);
+	for (i = 0; i < FAN_MAX_COUNT; i++)
+		s->fan_freq[i] = 10.0 + ((n * 3 + i * 5) % 90);
+}
+
+
+#define BENCH_LOOP(name, count, setup, expr)				\
+	do {								\
+		double sum = 0.0;					\
+		uint64_t t = 0, t_start;				\
+		for (int r = 0; r < rounds; r++) {			\
+			for (int n = 0; n < BENCH_SAMPLES; n++) {	\
+				setup;					\
+				t_start = bench_ns();			\
+				for (int i = 0; i < (count); i++)	\
+					sum += (expr);			\
+				t += bench_ns() - t_start;		\
+			}						\
+		}							\
+		uint64_t ovh = clock_overhead * rounds * BENCH_SAMPLES;	\
+		t = (t > ovh ? t - ovh : 0);				\
+		bench_report(name, t, (uint64_t)rounds * BENCH_SAMPLES * (count), sum); \
+	} while (0)
+
+
+/* Cost of reading the clock (subtracted from results) */
+static void bench_clock_overhead()
+{
+	uint64_t t = 0, t_start;
+
+	for (int n = 0; n < BENCH_SAMPLES * 16; n++) {
+		t_start = bench_ns();
+		t += bench_ns() - t_start;
+	}
+	clock_overhead = (double)t / (BENCH_SAMPLES * 16);
+}
+
+/* One evaluation of all outputs, as done by core1 each control iteration */
+static double bench_control_iteration()
+{
+	double sum = 0.0;
+	int i;
+
+	for (i = 0; i < VSENSOR_COUNT; i++)
+		sum += get_vsensor(i, c, s);
+	for (i = 0; i < FAN_COUNT; i++)
+		sum += calculate_pwm_duty(s, c, i);
+	for (i = 0; i < MBFAN_COUNT; i++)
+		sum += calculate_tacho_freq(s, c, i);
+
+	return sum;
+}
+
+static void bench_filter(const char *name, enum signal_filter_types type, const char *args)
+{
+	char buf[16];
+	void *ctx;
+
+	strncopy(buf, args, sizeof(buf));
+	if (!(ctx = filter_parse_args(type, buf))) {
+		fprintf(stderr, "%s: invalid filter arguments: %s\n", name, args);
+		return;
+	}
+	BENCH_LOOP(name, 1, , filter(type, ctx, n % 101));
+	filter_free_private_ctx(ctx);
+}
+
+/* Reference copy of the original pwm_map() (linear search and a division
+ * on every call), that curve_eval() replaced. */
+static float ref_pwm_map(const struct pwm_map *map, float val)
+{
+	int i;
+	float a;
+
+	if (val <= map->pwm[0][0])
+		return map->pwm[0][1];
+
+	i = 1;
+	while (i < map->points - 1 && map->pwm[i][0] < val)
+		i++;
+
+	if (val >= map->pwm[i][0])
+		return map->pwm[i][1];
+
+	a = (float)(map->pwm[i][1] - map->pwm[i-1][1]) / (float)(map->pwm[i][0] - map->pwm[i-1][0]);
+	return map->pwm[i-1][1] + a * (val - map->pwm[i-1][0]);
+}
+
+/* Compiled curve vs. the original linear search, using a map with
+ * all MAX_MAP_POINTS points (worst case for linear search). */
+static void bench_curve()
+{
+	static struct pwm_map map;
+	static struct curve curve;
+	const int last = MAX_MAP_POINTS - 1;
+	float v, err, max_err = 0.0;
+
+	map.points = MAX_MAP_POINTS;
+	for (int i = 0; i < MAX_MAP_POINTS; i++) {
+		map.pwm[i][0] = i * 100 / last;
+		map.pwm[i][1] = i * i * 100 / (last * last);
+	}
+	pwm_map_compile(&map, &curve);
+
+	for (v = -1.0; v <= 101.0; v += 0.125) {
+		err = fabsf(curve_eval(&curve, v) - ref_pwm_map(&map, v));
+		if (err > max_err)
+			max_err = err;
+	}
+	if (max_err > 0.05)
+		printf("WARNING: curve_eval: differs from linear search by %.3f\n", max_err);
+
+	BENCH_LOOP("pwm_map_linear", 1, , ref_pwm_map(&map, (n % 101) + 0.5));
+	BENCH_LOOP("curve_eval", 1, , curve_eval(&curve, (n % 101) + 0.5));
+}
+
+static void bench_run_cmd()
+{
+	const char *cmdlist[] = {
+		"CONF:FAN1:PWMMap 0,0,50,20,100,100",
+		"CONF:FAN1:PWMMap?",
+		"CONF:MBFAN1:RPMMap?",
+		"CONF:SENSOR1:TEMPMap?",
+		"MEAS:FAN1:RPM?",
+		"*IDN?",
+	};
+	const int count = sizeof(cmdlist) / sizeof(cmdlist[0]);
+	char buf[128];
+	char *prev_subcmd;
+	int fd, stdout_fd;
+
+	/* Set up command context (state and config) */
+	strncopy(buf, "*CLS", sizeof(buf));
+	process_command(fanpico_state, &fanpico_config, buf);
+
+	/* Discard command output while benchmarking */
+	fflush(stdout);
+	stdout_fd = dup(STDOUT_FILENO);
+	if ((fd = open("/dev/null", O_WRONLY)) >= 0) {
+		dup2(fd, STDOUT_FILENO);
+		close(fd);
+	}
+
+	BENCH_LOOP("run_cmd", count,
+		prev_subcmd = NULL,
+		(strncopy(buf, cmdlist[i], sizeof(buf)),
+			run_cmd(buf, commands, &prev_subcmd) != NULL ? 1 : 0));
+
+	fflush(stdout);
+	dup2(stdout_fd, STDOUT_FILENO);
+	close(stdout_fd);
+}
+
+static void bench_json_to_config()
+{
+	struct fanpico_config *tmp;
+	cJSON *json;
+
+	if (!(tmp = calloc(1, sizeof(*tmp))))
+		return;
+	clear_config(tmp);
+	if (!(json = config_to_json(cfg))) {
+		free(tmp);
+		return;
+	}
+
+	/* Much slower than the rest, so only call once per round */
+	double sum = 0.0;
+	uint64_t t_start = bench_ns();
+	for (int r = 0; r < rounds; r++)
+		sum += json_to_config(json, tmp) + tmp->fans[0].map.points;
+	bench_report("json_to_config", bench_ns() - t_start, rounds, sum);
+
+	cJSON_Delete(json);
+	clear_config(tmp);
+	free(tmp);
+}
+
+
+static int load_baseline(const char *filename, double threshold)
+{
+	char name[64];
+	double ns, sum;
+	int ret = 0;
+	FILE *fp;
+
+	if (!(fp = fopen(filename, "r"))) {
+		fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+		return -1;
+	}
+
+	while (fscanf(fp, "%63s %lf %lf", name, &ns, &sum) == 3) {
+		for (int i = 0; i < result_count; i++) {
+			struct bench_result *r = &results[i];
+
+			if (strcmp(r->name, name))
+				continue;
+			if (ns > 0 && (r->ns - ns) / ns * 100.0 > threshold) {
+				printf("REGRESSION: %s: %.1f ns -> %.1f ns (%+.1f%%)\n",
+					name, ns, r->ns, (r->ns - ns) / ns * 100.0);
+				ret = 1;
+			}
+			if (fabs(r->sum - sum) > 0.005 * (1.0 + fabs(sum)))
+				printf("WARNING: %s: checksum %.2f differs from baseline %.2f\n",
+					name, r->sum, sum);
+		}
+	}
+	fclose(fp);
+
+	return ret;
+}
+
+static int save_results(const char *filename)
+{
+	FILE *fp;
+
+	if (!(fp = fopen(filename, "w"))) {
+		fprintf(stderr, "%s: %s\n", filename, strerror(errno));
+		return -1;
+	}
+	for (int i = 0; i < result_count; i++)
+		fprintf(fp, "%s %.1f %.2f\n", results[i].name, results[i].ns, results[i].sum);
+	fclose(fp);
+
+	return 0;
+}
+
+
+int main(int argc, char **argv)
+{
+	const char *baseline = NULL;
+	const char *save = NULL;
+	double threshold = 10.0;
+	int opt, ret = 0;
+
+	while ((opt = getopt(argc, argv, "n:b:t:s:h")) != -1) {
+		switch (opt) {
+		case 'n':
+			rounds = (atoi(optarg) > 0 ? atoi(optarg) : 1);
+			break;
+		case 'b':
+			baseline = optarg;
+			break;
+		case 't':
+			threshold = atof(optarg);
+			break;
+		case 's':
+			save = optarg;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n <rounds>] [-b <baseline> [-t <threshold%%>]] [-s <results>]\n",
+				argv[0]);
+			return (opt == 'h' ? 0 : 2);
+		}
+	}
+
+	sim_init();
+
+	/* Private copies of configuration and state, with filters disabled
+	   (same as SYS:PERF:PIPEline?) */
+	c = malloc(sizeof(*c));
+	s = malloc(sizeof(*s));
+	if (!c || !s)
+		return 2;
+	config_to_control(cfg, c);
+	memcpy(s, fanpico_state, sizeof(*s));
+	for (int i = 0; i < FAN_MAX_COUNT; i++)
+		c->fans[i].filter = FILTER_NONE;
+	for (int i = 0; i < MBFAN_MAX_COUNT; i++)
+		c->mbfans[i].filter = FILTER_NONE;
+	for (int i = 0; i < VSENSOR_MAX_COUNT; i++)
+		c->vsensors[i].filter = FILTER_NONE;
+	/* Exercise the aggregate virtual sensor modes (default config is manual) */
+	for (int i = 0; i < VSENSOR_COUNT; i++) {
+		c->vsensors[i].mode = VSMODE_MAX + (i % 3);
+		c->vsensors[i].sensors[0] = 1;
+		c->vsensors[i].sensors[1] = 2;
+		c->vsensors[i].sensors[2] = 0;
+	}
+
+	bench_clock_overhead();
+	BENCH_LOOP("calculate_pwm_duty", FAN_COUNT, bench_trace(n, s),
+		calculate_pwm_duty(s, c, i));
+	BENCH_LOOP("calculate_tacho_freq", MBFAN_COUNT, bench_trace(n, s),
+		calculate_tacho_freq(s, c, i));
+	BENCH_LOOP("get_vsensor", VSENSOR_COUNT, bench_trace(n, s),
+		get_vsensor(i, c, s));
+	BENCH_LOOP("control_iteration", 1, bench_trace(n, s),
+		bench_control_iteration());
+	BENCH_LOOP("fan_curve", 1, ,
+		curve_eval(&c->fans[n % FAN_COUNT].curve, n % 101));
+	BENCH_LOOP("mbfan_curve", 1, ,
+		curve_eval(&c->mbfans[n % MBFAN_COUNT].curve, n * 10));
+	BENCH_LOOP("sensor_curve", 1, ,
+		curve_eval(&c->sensors[n % SENSOR_COUNT].curve, 20.0 + (n % 64)));
+	bench_curve();
+	bench_filter("sma_filter", FILTER_SMA, "8");
+	bench_filter("lossy_peak_filter", FILTER_LOSSYPEAK, "10,5");
+	bench_run_cmd();
+	bench_json_to_config();
+	print_results();
+
+	if (baseline)
+		ret = load_baseline(baseline, threshold);
+	if (save && save_results(save) < 0)
+		ret = 2;
+
+	free(c);
+	free(s);
+
+	return (ret < 0 ? 2 : ret);
+}
+
+
+/* eof :-) */
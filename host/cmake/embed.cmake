@@ -0,0 +1,20 @@
+# embed.cmake
+#
+# Generate C source file with contents of INPUT file as (null terminated)
+# char array SYMBOL.
+#
+#   cmake -DINPUT=<file> -DOUTPUT=<file.c> -DSYMBOL=<name> -P embed.cmake
+#
+
+file(READ ${INPUT} data HEX)
+string(REGEX REPLACE "([0-9a-f][0-9a-f])" "0x\\1," data "${data}")
+string(REGEX REPLACE "(0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,0x..,)" "\\1\n" data "${data}")
+get_filename_component(name ${INPUT} NAME)
+
+file(WRITE ${OUTPUT}
+  "/* ${name} (generated by embed.cmake, do not edit) */\n\n"
+  "const char ${SYMBOL}[] = {\n${data}\n0x00 };\n"
+  "const char ${SYMBOL}_end[] = { 0x00 };\n"
+  )
+
+# eof
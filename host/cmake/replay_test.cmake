@@ -0,0 +1,27 @@
+# replay_test.cmake
+#
+# Replay a trace through the simulated firmware and compare output
+# against the expected output.
+#
+#   cmake -DREPLAY=<fanpico-replay> -DTRACE=<trace.csv> -DOUTPUT=<file>
+#         -DEXPECTED=<file> -P replay_test.cmake
+#
+
+execute_process(
+  COMMAND ${REPLAY} ${TRACE} ${OUTPUT}
+  RESULT_VARIABLE res
+  OUTPUT_QUIET
+  )
+if (NOT res EQUAL 0)
+  message(FATAL_ERROR "${REPLAY} ${TRACE} failed: ${res}")
+endif()
+
+execute_process(
+  COMMAND ${CMAKE_COMMAND} -E compare_files ${OUTPUT} ${EXPECTED}
+  RESULT_VARIABLE res
+  )
+if (NOT res EQUAL 0)
+  message(FATAL_ERROR "Output differs from ${EXPECTED} (see ${OUTPUT})")
+endif()
+
+# eof
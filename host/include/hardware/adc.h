@@ -0,0 +1,2 @@
+/* hardware/adc.h (host build stub) */
+#include "host_sdk.h"
@@ -0,0 +1,2 @@
+/* hardware/clocks.h (host build stub) */
+#include "host_sdk.h"
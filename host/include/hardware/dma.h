@@ -0,0 +1,2 @@
+/* hardware/dma.h (host build stub) */
+#include "host_sdk.h"
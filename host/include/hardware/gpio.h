@@ -0,0 +1,2 @@
+/* hardware/gpio.h (host build stub) */
+#include "host_sdk.h"
@@ -0,0 +1,2 @@
+/* hardware/i2c.h (host build stub) */
+#include "host_sdk.h"
@@ -0,0 +1,2 @@
+/* hardware/irq.h (host build stub) */
+#include "host_sdk.h"
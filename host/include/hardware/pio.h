@@ -0,0 +1,2 @@
+/* hardware/pio.h (host build stub) */
+#include "host_sdk.h"
@@ -0,0 +1,2 @@
+/* hardware/pwm.h (host build stub) */
+#include "host_sdk.h"
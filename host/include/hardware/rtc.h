@@ -0,0 +1,2 @@
+/* hardware/rtc.h (host build stub) */
+#include "host_sdk.h"
@@ -0,0 +1,2 @@
+/* hardware/structs/systick.h (host build stub) */
+#include "host_sdk.h"
@@ -0,0 +1,2 @@
+/* hardware/sync.h (host build stub) */
+#include "host_sdk.h"
@@ -0,0 +1,2 @@
+/* hardware/vreg.h (host build stub) */
+#include "host_sdk.h"
@@ -0,0 +1,2 @@
+/* hardware/watchdog.h (host build stub) */
+#include "host_sdk.h"
@@ -0,0 +1,613 @@
+/* host_sdk.h
+   Copyright (C) 2021-2024 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of FanPico.
+
+   FanPico is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   FanPico is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with FanPico. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Minimal stand-in for the parts of Pico SDK used by the firmware
+ * sources compiled into the host (simulation) build.
+ *
+ * All SDK headers in host/include (pico/stdlib.h, hardware/pwm.h, ...)
+ * just include this file. Hardware (GPIO/PWM/ADC/PIO/DMA) and time are
+ * mocked in mock_hw.c, see mock_hw.h for the simulation side interface.
+ */
+
+#ifndef HOST_SDK_H
+#define HOST_SDK_H 1
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <time.h>
+
+typedef unsigned int uint;
+
+#define PICO_SDK_VERSION_STRING  "host"
+#define PICO_CMAKE_BUILD_TYPE    "host"
+#define PICO_BOARD               "host"
+#define PICO_DEFAULT_LED_PIN     25
+#define PICO_ERROR_TIMEOUT       -1
+#define PICO_ERROR_NO_DATA       -3
+#define PICO_ERROR_GENERIC       -1
+#define PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY 0x80
+#define SRAM_BASE                0x20000000
+#define SRAM_END                 0x20042000
+#define XIP_BASE                 0x10000000
+#define PICO_FLASH_SIZE_BYTES    (2 * 1024 * 1024)
+#define FLASH_SECTOR_SIZE        4096
+#define FLASH_PAGE_SIZE          256
+
+#define __not_in_flash_func(f) f
+#define __time_critical_func(f) f
+#define __no_inline_not_in_flash_func(f) f
+#define __uninitialized_ram(v) v
+#define __unused __attribute__((unused))
+#define tight_loop_contents() do { } while (0)
+#define __compiler_memory_barrier() __asm__ volatile ("" : : : "memory")
+#define __dmb() __compiler_memory_barrier()
+
+#define count_of(a) (sizeof(a) / sizeof((a)[0]))
+
+#ifndef MIN
+#define MIN(a, b) ((b) > (a) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
+#endif
+
+void panic(const char *fmt, ...) __attribute__((noreturn));
+
+
+/* pico/time.h */
+
+typedef uint64_t absolute_time_t;
+typedef int32_t alarm_id_t;
+
+#define ABSOLUTE_TIME_INITIALIZED_VAR(name, value) name = (value)
+extern const absolute_time_t at_the_end_of_time;
+extern const absolute_time_t nil_time;
+
+static inline uint64_t to_us_since_boot(absolute_time_t t) { return t; }
+static inline absolute_time_t from_us_since_boot(uint64_t us) { return us; }
+static inline uint32_t to_ms_since_boot(absolute_time_t t) { return (uint32_t)(t / 1000); }
+static inline void update_us_since_boot(absolute_time_t *t, uint64_t us) { *t = us; }
+static inline bool is_nil_time(absolute_time_t t) { return t == 0; }
+static inline bool is_at_the_end_of_time(absolute_time_t t) { return t == at_the_end_of_time; }
+static inline int64_t absolute_time_diff_us(absolute_time_t from, absolute_time_t to)
+{
+	return (int64_t)(to - from);
+}
+static inline absolute_time_t absolute_time_min(absolute_time_t a, absolute_time_t b)
+{
+	return (a < b ? a : b);
+}
+
+uint64_t time_us_64();
+uint32_t time_us_32();
+absolute_time_t get_absolute_time();
+absolute_time_t make_timeout_time_us(uint64_t us);
+absolute_time_t make_timeout_time_ms(uint32_t ms);
+absolute_time_t delayed_by_us(absolute_time_t t, uint64_t us);
+absolute_time_t delayed_by_ms(absolute_time_t t, uint32_t ms);
+bool time_reached(absolute_time_t t);
+void sleep_us(uint64_t us);
+void sleep_ms(uint32_t ms);
+void sleep_until(absolute_time_t t);
+bool best_effort_wfe_or_timeout(absolute_time_t timeout_timestamp);
+void busy_wait_us(uint64_t us);
+void busy_wait_us_32(uint32_t us);
+void busy_wait_ms(uint32_t ms);
+
+
+/* pico/util/datetime.h, hardware/rtc.h */
+
+typedef struct {
+	int16_t year;
+	int8_t month;
+	int8_t day;
+	int8_t dotw;
+	int8_t hour;
+	int8_t min;
+	int8_t sec;
+} datetime_t;
+
+void rtc_init();
+bool rtc_set_datetime(const datetime_t *t);
+bool rtc_get_datetime(datetime_t *t);
+bool rtc_running();
+
+
+/* pico/mutex.h, hardware/sync.h */
+
+typedef struct {
+	int owner;
+	int count;
+} mutex_t;
+typedef mutex_t recursive_mutex_t;
+typedef int32_t lock_owner_id_t;
+
+#define auto_init_mutex(name) static mutex_t name = { -1, 0 }
+#define auto_init_recursive_mutex(name) static recursive_mutex_t name = { -1, 0 }
+
+void mutex_init(mutex_t *mtx);
+void mutex_enter_blocking(mutex_t *mtx);
+bool mutex_try_enter(mutex_t *mtx, uint32_t *owner_out);
+bool mutex_enter_timeout_ms(mutex_t *mtx, uint32_t timeout_ms);
+bool mutex_enter_timeout_us(mutex_t *mtx, uint32_t timeout_us);
+void mutex_exit(mutex_t *mtx);
+void recursive_mutex_init(recursive_mutex_t *mtx);
+void recursive_mutex_enter_blocking(recursive_mutex_t *mtx);
+void recursive_mutex_exit(recursive_mutex_t *mtx);
+
+uint32_t save_and_disable_interrupts();
+void restore_interrupts(uint32_t status);
+uint __get_current_exception();
+uint get_core_num();
+
+
+/* pico/unique_id.h, pico/rand.h, pico/bootrom.h, pico/multicore.h */
+
+#define PICO_UNIQUE_BOARD_ID_SIZE_BYTES 8
+typedef struct {
+	uint8_t id[PICO_UNIQUE_BOARD_ID_SIZE_BYTES];
+} pico_unique_board_id_t;
+
+void pico_get_unique_board_id(pico_unique_board_id_t *id_out);
+void pico_get_unique_board_id_string(char *id_out, uint len);
+uint32_t get_rand_32();
+uint64_t get_rand_64();
+void reset_usb_boot(uint32_t gpio_activity_pin_mask, uint32_t disable_interface_mask);
+void multicore_launch_core1(void (*entry)(void));
+void multicore_reset_core1();
+void multicore_lockout_victim_init();
+bool multicore_lockout_start_timeout_us(uint64_t timeout_us);
+bool multicore_lockout_end_timeout_us(uint64_t timeout_us);
+uint8_t rp2040_chip_version();
+uint8_t rp2040_rom_version();
+
+
+/* hardware/clocks.h */
+
+enum clock_index {
+	clk_gpout0 = 0,
+	clk_gpout1,
+	clk_gpout2,
+	clk_gpout3,
+	clk_ref,
+	clk_sys,
+	clk_peri,
+	clk_usb,
+	clk_adc,
+	clk_rtc,
+	CLK_COUNT
+};
+
+uint32_t clock_get_hz(enum clock_index clk_index);
+uint32_t frequency_count_khz(uint src);
+
+
+/* hardware/gpio.h */
+
+enum gpio_function {
+	GPIO_FUNC_XIP = 0,
+	GPIO_FUNC_SPI = 1,
+	GPIO_FUNC_UART = 2,
+	GPIO_FUNC_I2C = 3,
+	GPIO_FUNC_PWM = 4,
+	GPIO_FUNC_SIO = 5,
+	GPIO_FUNC_PIO0 = 6,
+	GPIO_FUNC_PIO1 = 7,
+	GPIO_FUNC_GPCK = 8,
+	GPIO_FUNC_USB = 9,
+	GPIO_FUNC_NULL = 0x1f,
+};
+
+#define GPIO_OUT 1
+#define GPIO_IN  0
+
+enum gpio_irq_level {
+	GPIO_IRQ_LEVEL_LOW = 0x1u,
+	GPIO_IRQ_LEVEL_HIGH = 0x2u,
+	GPIO_IRQ_EDGE_FALL = 0x4u,
+	GPIO_IRQ_EDGE_RISE = 0x8u,
+};
+
+typedef void (*gpio_irq_callback_t)(uint gpio, uint32_t event_mask);
+
+void gpio_init(uint gpio);
+void gpio_deinit(uint gpio);
+void gpio_set_function(uint gpio, enum gpio_function fn);
+enum gpio_function gpio_get_function(uint gpio);
+void gpio_set_dir(uint gpio, bool out);
+bool gpio_is_dir_out(uint gpio);
+void gpio_put(uint gpio, bool value);
+bool gpio_get(uint gpio);
+uint32_t gpio_get_all();
+void gpio_pull_up(uint gpio);
+void gpio_pull_down(uint gpio);
+void gpio_disable_pulls(uint gpio);
+void gpio_set_irq_enabled(uint gpio, uint32_t events, bool enabled);
+void gpio_set_irq_enabled_with_callback(uint gpio, uint32_t events, bool enabled,
+					gpio_irq_callback_t callback);
+void gpio_acknowledge_irq(uint gpio, uint32_t events);
+
+
+/* hardware/pwm.h */
+
+enum pwm_chan {
+	PWM_CHAN_A = 0,
+	PWM_CHAN_B = 1,
+};
+
+enum pwm_clkdiv_mode {
+	PWM_DIV_FREE_RUNNING = 0,
+	PWM_DIV_B_HIGH = 1,
+	PWM_DIV_B_RISING = 2,
+	PWM_DIV_B_FALLING = 3,
+};
+
+typedef struct {
+	float clkdiv;
+	bool phase_correct;
+	enum pwm_clkdiv_mode clkdiv_mode;
+	uint16_t wrap;
+} pwm_config;
+
+typedef struct {
+	volatile uint32_t en;
+	volatile uint32_t intr;
+} pwm_hw_t;
+extern pwm_hw_t *pwm_hw;
+
+#define NUM_PWM_SLICES 8
+
+static inline uint pwm_gpio_to_slice_num(uint gpio) { return (gpio >> 1) & 7; }
+static inline uint pwm_gpio_to_channel(uint gpio) { return gpio & 1; }
+
+pwm_config pwm_get_default_config();
+void pwm_config_set_clkdiv(pwm_config *c, float div);
+void pwm_config_set_clkdiv_int(pwm_config *c, uint div);
+void pwm_config_set_clkdiv_mode(pwm_config *c, enum pwm_clkdiv_mode mode);
+void pwm_config_set_phase_correct(pwm_config *c, bool phase_correct);
+void pwm_config_set_wrap(pwm_config *c, uint16_t wrap);
+void pwm_init(uint slice_num, pwm_config *c, bool start);
+void pwm_set_enabled(uint slice_num, bool enabled);
+void pwm_set_mask_enabled(uint32_t mask);
+void pwm_set_both_levels(uint slice_num, uint16_t level_a, uint16_t level_b);
+void pwm_set_chan_level(uint slice_num, uint chan, uint16_t level);
+void pwm_set_gpio_level(uint gpio, uint16_t level);
+uint16_t pwm_get_counter(uint slice_num);
+void pwm_set_counter(uint slice_num, uint16_t c);
+
+static inline void hw_set_bits(volatile uint32_t *addr, uint32_t mask) { *addr |= mask; }
+static inline void hw_clear_bits(volatile uint32_t *addr, uint32_t mask) { *addr &= ~mask; }
+
+
+/* hardware/adc.h */
+
+typedef struct {
+	volatile uint32_t cs;
+	volatile uint32_t result;
+	volatile uint32_t fcs;
+	volatile uint32_t fifo;
+} adc_hw_t;
+extern adc_hw_t *adc_hw;
+
+void adc_init();
+void adc_gpio_init(uint gpio);
+void adc_select_input(uint input);
+uint adc_get_selected_input();
+uint16_t adc_read();
+void adc_set_temp_sensor_enabled(bool enable);
+void adc_set_round_robin(uint input_mask);
+void adc_fifo_setup(bool en, bool dreq_en, uint16_t dreq_thresh, bool err_in_fifo, bool byte_shift);
+void adc_set_clkdiv(float clkdiv);
+void adc_run(bool run);
+
+
+/* hardware/dma.h, hardware/irq.h */
+
+enum dma_channel_transfer_size {
+	DMA_SIZE_8 = 0,
+	DMA_SIZE_16 = 1,
+	DMA_SIZE_32 = 2,
+};
+
+#define DREQ_ADC   36
+#define DREQ_FORCE 63
+#define DMA_IRQ_0  11
+#define DMA_IRQ_1  12
+#define NUM_DMA_CHANNELS 12
+
+typedef struct {
+	uint32_t ctrl;
+} dma_channel_config;
+
+typedef struct {
+	volatile uint32_t read_addr;
+	volatile uint32_t write_addr;
+	volatile uint32_t transfer_count;
+	volatile uint32_t ctrl_trig;
+	volatile uint32_t al1_ctrl;
+	volatile uint32_t al1_read_addr;
+	volatile uint32_t al1_write_addr;
+	volatile uint32_t al1_transfer_count_trig;
+	volatile uint32_t al2_ctrl;
+	volatile uint32_t al2_transfer_count;
+	volatile uint32_t al2_read_addr;
+	volatile uint32_t al2_write_addr_trig;
+	volatile uint32_t al3_ctrl;
+	volatile uint32_t al3_write_addr;
+	volatile uint32_t al3_transfer_count;
+	volatile uint32_t al3_read_addr_trig;
+} dma_channel_hw_t;
+
+typedef struct {
+	dma_channel_hw_t ch[NUM_DMA_CHANNELS];
+	volatile uint32_t sniff_ctrl;
+	volatile uint32_t sniff_data;
+} dma_hw_t;
+extern dma_hw_t *dma_hw;
+
+typedef void (*irq_handler_t)(void);
+
+int dma_claim_unused_channel(bool required);
+void dma_channel_claim(uint channel);
+void dma_channel_unclaim(uint channel);
+dma_channel_config dma_channel_get_default_config(uint channel);
+void channel_config_set_transfer_data_size(dma_channel_config *c, enum dma_channel_transfer_size size);
+void channel_config_set_read_increment(dma_channel_config *c, bool incr);
+void channel_config_set_write_increment(dma_channel_config *c, bool incr);
+void channel_config_set_ring(dma_channel_config *c, bool write, uint size_bits);
+void channel_config_set_dreq(dma_channel_config *c, uint dreq);
+void channel_config_set_chain_to(dma_channel_config *c, uint chain_to);
+void channel_config_set_sniff_enable(dma_channel_config *c, bool sniff_enable);
+void dma_sniffer_enable(uint channel, uint mode, bool force_channel_enable);
+void dma_sniffer_disable();
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr,
+			const volatile void *read_addr, uint transfer_count, bool trigger);
+void dma_channel_start(uint channel);
+void dma_channel_abort(uint channel);
+bool dma_channel_is_busy(uint channel);
+void dma_channel_wait_for_finish_blocking(uint channel);
+void dma_channel_set_irq1_enabled(uint channel, bool enabled);
+bool dma_channel_get_irq1_status(uint channel);
+void dma_channel_acknowledge_irq1(uint channel);
+void irq_add_shared_handler(uint num, irq_handler_t handler, uint8_t order_priority);
+void irq_remove_handler(uint num, irq_handler_t handler);
+void irq_set_enabled(uint num, bool enabled);
+bool irq_is_enabled(uint num);
+
+
+/* hardware/pio.h */
+
+#define NUM_PIOS 2
+#define NUM_PIO_STATE_MACHINES 4
+
+#define PIO_INSTRUCTION_COUNT 32
+#define PIO_FDEBUG_RXSTALL_LSB 0
+
+typedef struct pio_hw {
+	uint index;
+	uint32_t sm_claimed;
+	uint32_t instr_used;
+	volatile uint32_t fdebug;
+	volatile uint32_t txf[NUM_PIO_STATE_MACHINES];
+	volatile uint32_t rxf[NUM_PIO_STATE_MACHINES];
+	uint16_t instr_mem[PIO_INSTRUCTION_COUNT];
+} pio_hw_t;
+typedef pio_hw_t *PIO;
+
+extern pio_hw_t mock_pio_hw[NUM_PIOS];
+#define pio0 (&mock_pio_hw[0])
+#define pio1 (&mock_pio_hw[1])
+
+typedef struct {
+	const uint16_t *instructions;
+	uint8_t length;
+	int8_t origin;
+} pio_program_t;
+
+enum pio_fifo_join {
+	PIO_FIFO_JOIN_NONE = 0,
+	PIO_FIFO_JOIN_TX = 1,
+	PIO_FIFO_JOIN_RX = 2,
+};
+
+typedef struct {
+	float clkdiv;
+	uint wrap_target;
+	uint wrap;
+	uint in_base;
+	bool in_shift_right;
+	bool out_shift_right;
+	enum pio_fifo_join fifo_join;
+} pio_sm_config;
+
+static inline pio_sm_config pio_get_default_sm_config(void)
+{
+	pio_sm_config c = { 1.0, 0, 31, 0, true, true, PIO_FIFO_JOIN_NONE };
+	return c;
+}
+static inline void sm_config_set_wrap(pio_sm_config *c, uint wrap_target, uint wrap)
+{
+	c->wrap_target = wrap_target;
+	c->wrap = wrap;
+}
+static inline void sm_config_set_in_pins(pio_sm_config *c, uint in_base) { c->in_base = in_base; }
+static inline void sm_config_set_in_shift(pio_sm_config *c, bool shift_right, bool autopush,
+					uint push_threshold) { c->in_shift_right = shift_right; }
+static inline void sm_config_set_out_shift(pio_sm_config *c, bool shift_right, bool autopull,
+					uint pull_threshold) { c->out_shift_right = shift_right; }
+static inline void sm_config_set_fifo_join(pio_sm_config *c, enum pio_fifo_join join) { c->fifo_join = join; }
+static inline void sm_config_set_clkdiv(pio_sm_config *c, float div) { c->clkdiv = div; }
+
+/* hardware/pio_instructions.h (low 3 bits are the instruction field value) */
+enum pio_src_dest {
+	pio_pins = 0,
+	pio_x = 1,
+	pio_y = 2,
+	pio_null = 3,
+	pio_pindirs = 4 | 0x10,
+	pio_exec_mov = 4 | 0x20,
+	pio_status = 5 | 0x10,
+	pio_pc = 5 | 0x20,
+	pio_isr = 6,
+	pio_osr = 7 | 0x10,
+	pio_exec_out = 7 | 0x20,
+};
+
+static inline uint pio_encode_instr(uint op, uint arg1, uint arg2)
+{
+	return (op << 13) | ((arg1 & 7) << 5) | (arg2 & 0x1f);
+}
+static inline uint pio_encode_jmp(uint addr) { return pio_encode_instr(0, 0, addr); }
+static inline uint pio_encode_jmp_not_x(uint addr) { return pio_encode_instr(0, 1, addr); }
+static inline uint pio_encode_jmp_x_dec(uint addr) { return pio_encode_instr(0, 2, addr); }
+static inline uint pio_encode_jmp_not_y(uint addr) { return pio_encode_instr(0, 3, addr); }
+static inline uint pio_encode_jmp_y_dec(uint addr) { return pio_encode_instr(0, 4, addr); }
+static inline uint pio_encode_jmp_x_ne_y(uint addr) { return pio_encode_instr(0, 5, addr); }
+static inline uint pio_encode_jmp_pin(uint addr) { return pio_encode_instr(0, 6, addr); }
+static inline uint pio_encode_in(enum pio_src_dest src, uint count) { return pio_encode_instr(2, src, count); }
+static inline uint pio_encode_out(enum pio_src_dest dest, uint count) { return pio_encode_instr(3, dest, count); }
+static inline uint pio_encode_push(bool if_full, bool block) { return pio_encode_instr(4, (if_full << 1) | block, 0); }
+static inline uint pio_encode_pull(bool if_empty, bool block) { return pio_encode_instr(4, 4 | (if_empty << 1) | block, 0); }
+static inline uint pio_encode_mov(enum pio_src_dest dest, enum pio_src_dest src) { return pio_encode_instr(5, dest, src & 7); }
+static inline uint pio_encode_mov_not(enum pio_src_dest dest, enum pio_src_dest src) { return pio_encode_instr(5, dest, (1 << 3) | (src & 7)); }
+static inline uint pio_encode_set(enum pio_src_dest dest, uint value) { return pio_encode_instr(7, dest, value); }
+
+static inline uint pio_get_index(PIO pio) { return pio->index; }
+void pio_sm_claim(PIO pio, uint sm);
+void pio_sm_unclaim(PIO pio, uint sm);
+int pio_claim_unused_sm(PIO pio, bool required);
+bool pio_sm_is_claimed(PIO pio, uint sm);
+bool pio_can_add_program(PIO pio, const pio_program_t *program);
+int pio_add_program(PIO pio, const pio_program_t *program);
+void pio_remove_program(PIO pio, const pio_program_t *program, uint loaded_offset);
+int pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config);
+void pio_sm_exec(PIO pio, uint sm, uint instr);
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled);
+uint pio_sm_get_rx_fifo_level(PIO pio, uint sm);
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm);
+uint32_t pio_sm_get(PIO pio, uint sm);
+void pio_sm_put(PIO pio, uint sm, uint32_t data);
+void pio_sm_clear_fifos(PIO pio, uint sm);
+uint pio_get_dreq(PIO pio, uint sm, bool is_tx);
+
+
+/* hardware/i2c.h */
+
+typedef struct i2c_inst {
+	uint index;
+	uint baudrate;
+} i2c_inst_t;
+
+extern i2c_inst_t mock_i2c_inst[2];
+#define i2c0 (&mock_i2c_inst[0])
+#define i2c1 (&mock_i2c_inst[1])
+
+uint i2c_init(i2c_inst_t *i2c, uint baudrate);
+void i2c_deinit(i2c_inst_t *i2c);
+int i2c_write_timeout_us(i2c_inst_t *i2c, uint8_t addr, const uint8_t *src, size_t len,
+			bool nostop, uint timeout_us);
+int i2c_read_timeout_us(i2c_inst_t *i2c, uint8_t addr, uint8_t *dst, size_t len,
+			bool nostop, uint timeout_us);
+int i2c_write_blocking(i2c_inst_t *i2c, uint8_t addr, const uint8_t *src, size_t len, bool nostop);
+int i2c_read_blocking(i2c_inst_t *i2c, uint8_t addr, uint8_t *dst, size_t len, bool nostop);
+
+
+/* hardware/vreg.h, hardware/structs/vreg_and_chip_reset.h */
+
+enum vreg_voltage {
+	VREG_VOLTAGE_1_10 = 0b1011,
+	VREG_VOLTAGE_DEFAULT = VREG_VOLTAGE_1_10,
+};
+
+typedef struct {
+	volatile uint32_t vreg;
+	volatile uint32_t bod;
+	volatile uint32_t chip_reset;
+} vreg_and_chip_reset_hw_t;
+extern vreg_and_chip_reset_hw_t *vreg_and_chip_reset_hw;
+
+void vreg_set_voltage(enum vreg_voltage voltage);
+
+
+/* hardware/uart.h, pico/stdio_uart.h */
+
+typedef struct uart_inst {
+	uint index;
+} uart_inst_t;
+
+extern uart_inst_t mock_uart_inst[2];
+#define uart0 (&mock_uart_inst[0])
+#define uart1 (&mock_uart_inst[1])
+
+void stdio_uart_init_full(uart_inst_t *uart, uint baud_rate, int tx_pin, int rx_pin);
+
+
+/* hardware/watchdog.h */
+
+typedef struct {
+	volatile uint32_t ctrl;
+	volatile uint32_t load;
+	volatile uint32_t reason;
+	volatile uint32_t scratch[8];
+} watchdog_hw_t;
+extern watchdog_hw_t *watchdog_hw;
+
+void watchdog_enable(uint32_t delay_ms, bool pause_on_debug);
+void watchdog_update();
+void watchdog_reboot(uint32_t pc, uint32_t sp, uint32_t delay_ms);
+bool watchdog_caused_reboot();
+bool watchdog_enable_caused_reboot();
+
+
+/* hardware/structs/systick.h */
+
+#define M0PLUS_SYST_CSR_ENABLE_BITS    0x00000001
+#define M0PLUS_SYST_CSR_TICKINT_BITS   0x00000002
+#define M0PLUS_SYST_CSR_CLKSOURCE_BITS 0x00000004
+
+typedef struct {
+	volatile uint32_t csr;
+	volatile uint32_t rvr;
+	volatile uint32_t cvr;
+	volatile uint32_t calib;
+} systick_hw_t;
+
+/* Reading current value of the (mock) SysTick counter updates it from
+   simulated time, so the struct is accessed through a function. */
+systick_hw_t *mock_systick_hw();
+#define systick_hw (mock_systick_hw())
+
+
+/* stdio (pico/stdio.h) */
+
+int getchar_timeout_us(uint32_t timeout_us);
+bool stdio_init_all();
+bool stdio_usb_init();
+bool stdio_usb_connected();
+
+
+#endif /* HOST_SDK_H */
+
+/* eof :-) */
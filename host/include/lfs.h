@@ -0,0 +1 @@
+/* lfs.h (host build stub, flash filesystem is not simulated) */
@@ -0,0 +1,2 @@
+/* pico/bootrom.h (host build stub) */
+#include "host_sdk.h"
@@ -0,0 +1,2 @@
+/* pico/multicore.h (host build stub) */
+#include "host_sdk.h"
@@ -0,0 +1,2 @@
+/* pico/mutex.h (host build stub) */
+#include "host_sdk.h"
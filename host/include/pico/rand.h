@@ -0,0 +1,2 @@
+/* pico/rand.h (host build stub) */
+#include "host_sdk.h"
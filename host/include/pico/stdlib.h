@@ -0,0 +1,2 @@
+/* pico/stdlib.h (host build stub) */
+#include "host_sdk.h"
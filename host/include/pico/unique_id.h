@@ -0,0 +1,2 @@
+/* pico/unique_id.h (host build stub) */
+#include "host_sdk.h"
@@ -0,0 +1,2 @@
+/* pico/util/datetime.h (host build stub) */
+#include "host_sdk.h"
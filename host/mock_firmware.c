@@ -0,0 +1,285 @@
+/* mock_firmware.c
+   Copyright (C) 2021-2024 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of FanPico.
+
+   FanPico is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   FanPico is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with FanPico. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+
+#include "fanpico.h"
+
+
+/*
+ * Stand-ins for firmware modules that are not part of the host build
+ * (display, network, flash filesystem and RP2040 specific utilities).
+ *
+ * Flash filesystem is replaced by an in-memory file store, where writes
+ * complete immediately.
+ */
+
+#define MOCK_FLASH_FS_SIZE  (1024 * 1024)
+#define MOCK_FLASH_FILES    16
+
+
+/* display.c */
+
+void display_init()
+{
+}
+
+void clear_display()
+{
+}
+
+void display_message(int rows, const char **text_lines)
+{
+}
+
+void display_status(const struct fanpico_state *state, const struct fanpico_config *config)
+{
+}
+
+bool display_poll(uint32_t budget_us)
+{
+	return false;
+}
+
+bool display_busy()
+{
+	return false;
+}
+
+
+/* network.c */
+
+void network_reserve_pio()
+{
+}
+
+void network_init()
+{
+}
+
+void network_poll()
+{
+}
+
+
+/* bi_decl.c */
+
+void set_binary_info()
+{
+}
+
+
+/* flash.c */
+
+struct mock_file {
+	char name[64];
+	char *buf;
+	uint32_t size;
+};
+
+static struct mock_file mock_files[MOCK_FLASH_FILES];
+
+
+static struct mock_file *mock_file_find(const char *filename, bool create)
+{
+	struct mock_file *free_slot = NULL;
+
+	for (int i = 0; i < MOCK_FLASH_FILES; i++) {
+		if (mock_files[i].name[0] == 0) {
+			if (!free_slot)
+				free_slot = &mock_files[i];
+		} else if (!strcmp(mock_files[i].name, filename)) {
+			return &mock_files[i];
+		}
+	}
+	if (!create || !free_slot)
+		return NULL;
+	strncopy(free_slot->name, filename, sizeof(free_slot->name));
+	free_slot->buf = NULL;
+	free_slot->size = 0;
+
+	return free_slot;
+}
+
+void lfs_setup()
+{
+	log_msg(LOG_NOTICE, "Flash filesystem (in-memory): %u bytes", MOCK_FLASH_FS_SIZE);
+}
+
+int flash_read_file(char **bufptr, uint32_t *sizeptr, const char *filename)
+{
+	struct mock_file *f;
+
+	if (!bufptr || !sizeptr || !filename)
+		return -42;
+	*bufptr = NULL;
+	*sizeptr = 0;
+
+	if (!(f = mock_file_find(filename, false)))
+		return -3;
+	if (f->size > 0) {
+		if (!(*bufptr = malloc(f->size)))
+			return -4;
+		memcpy(*bufptr, f->buf, f->size);
+		*sizeptr = f->size;
+	}
+
+	return 0;
+}
+
+static int mock_file_write(const char *buf, uint32_t size, const char *filename, bool append)
+{
+	struct mock_file *f;
+	char *nbuf;
+	uint32_t offset;
+
+	if (!buf || !filename)
+		return -42;
+	if (!(f = mock_file_find(filename, true)))
+		return -2;
+
+	offset = (append ? f->size : 0);
+	if (!(nbuf = realloc(f->buf, offset + size + 1)))
+		return -4;
+	memcpy(nbuf + offset, buf, size);
+	f->buf = nbuf;
+	f->size = offset + size;
+
+	return FLASH_WRITE_QUEUED;
+}
+
+int flash_write_file(const char *buf, uint32_t size, const char *filename)
+{
+	return mock_file_write(buf, size, filename, false);
+}
+
+int flash_append_file(const char *buf, uint32_t size, const char *filename)
+{
+	return mock_file_write(buf, size, filename, true);
+}
+
+int flash_delete_file(const char *filename)
+{
+	struct mock_file *f;
+
+	if (!filename)
+		return -42;
+	if (!(f = mock_file_find(filename, false)))
+		return -2;
+	free(f->buf);
+	memset(f, 0, sizeof(*f));
+
+	return 0;
+}
+
+bool flash_poll()
+{
+	return false;
+}
+
+int flash_flush()
+{
+	return 0;
+}
+
+void flash_core1_poll()
+{
+}
+
+int flash_get_fs_info(size_t *size, size_t *free, size_t *files,
+		size_t *directories, size_t *filesizetotal)
+{
+	size_t count = 0;
+	size_t total = 0;
+
+	if (!size || !free)
+		return -1;
+
+	for (int i = 0; i < MOCK_FLASH_FILES; i++) {
+		if (mock_files[i].name[0]) {
+			count++;
+			total += mock_files[i].size;
+		}
+	}
+	*size = MOCK_FLASH_FS_SIZE;
+	*free = MOCK_FLASH_FS_SIZE - total;
+	if (files)
+		*files = count;
+	if (directories)
+		*directories = 1;
+	if (filesizetotal)
+		*filesizetotal = total;
+
+	return 0;
+}
+
+void print_rp2040_flashinfo()
+{
+	printf("Flash memory size:                     %u\n", PICO_FLASH_SIZE_BYTES);
+	printf("LittleFS size:                         %u\n", MOCK_FLASH_FS_SIZE);
+}
+
+
+/* util_rp2040.c */
+
+void print_rp2040_meminfo()
+{
+	printf("Host build (no RP2040 memory map)\n");
+}
+
+void watchdog_disable()
+{
+}
+
+const char *rp2040_model_str()
+{
+	return "RP2040-host";
+}
+
+const char *pico_serial_str()
+{
+	static char buf[PICO_UNIQUE_BOARD_ID_SIZE_BYTES * 2 + 1];
+
+	pico_get_unique_board_id_string(buf, sizeof(buf));
+
+	return buf;
+}
+
+int time_passed(absolute_time_t *t, uint32_t ms)
+{
+	absolute_time_t t_now = get_absolute_time();
+
+	if (t == NULL)
+		return -1;
+
+	if (to_us_since_boot(*t) == 0 ||
+	    to_us_since_boot(delayed_by_ms(*t, ms)) < to_us_since_boot(t_now)) {
+		*t = t_now;
+		return 1;
+	}
+
+	return 0;
+}
+
+
+/* eof :-) */
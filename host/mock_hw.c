@@ -0,0 +1,1213 @@
+/* mock_hw.c
+   Copyright (C) 2021-2024 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of FanPico.
+
+   FanPico is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   FanPico is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with FanPico. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+#include "mock_hw.h"
+
+
+/*
+ * Mocked Pico SDK hardware interfaces for the host (simulation) build.
+ *
+ * Only as much of the hardware is modelled as firmware needs to run
+ * its fan control pipeline: GPIO levels and edge interrupts, PWM output
+ * levels and (gated) input counters, ADC inputs, I2C registers, PIO
+ * resource allocation and tacho output (square wave) frequencies.
+ *
+ * DMA is not simulated: dma_claim_unused_channel() always fails, so
+ * firmware uses its fallback paths (blocking ADC reads, software CRC-32).
+ * Other PIO programs (PWM capture, 1-Wire) fail to load for the same
+ * reason.
+ */
+
+#define MOCK_GPIO_COUNT   30
+#define MOCK_SPIN_LIMIT   1000000  /* time reads without time advancing */
+
+
+/* time */
+
+static uint64_t mock_now = 0;
+static uint32_t mock_spin = 0;
+
+const absolute_time_t at_the_end_of_time = UINT64_MAX;
+const absolute_time_t nil_time = 0;
+
+void mock_time_set(uint64_t us)
+{
+	if (us > mock_now)
+		mock_now = us;
+	mock_spin = 0;
+}
+
+void mock_time_advance(uint64_t us)
+{
+	mock_now += us;
+	mock_spin = 0;
+}
+
+uint64_t time_us_64()
+{
+	/* Let busy loops waiting for time to pass eventually finish... */
+	if (++mock_spin >= MOCK_SPIN_LIMIT)
+		mock_time_advance(1);
+	return mock_now;
+}
+
+uint32_t time_us_32()
+{
+	return (uint32_t)time_us_64();
+}
+
+absolute_time_t get_absolute_time()
+{
+	return time_us_64();
+}
+
+absolute_time_t make_timeout_time_us(uint64_t us)
+{
+	return get_absolute_time() + us;
+}
+
+absolute_time_t make_timeout_time_ms(uint32_t ms)
+{
+	return get_absolute_time() + (uint64_t)ms * 1000;
+}
+
+absolute_time_t delayed_by_us(absolute_time_t t, uint64_t us)
+{
+	return (UINT64_MAX - t < us ? UINT64_MAX : t + us);
+}
+
+absolute_time_t delayed_by_ms(absolute_time_t t, uint32_t ms)
+{
+	return delayed_by_us(t, (uint64_t)ms * 1000);
+}
+
+bool time_reached(absolute_time_t t)
+{
+	return (get_absolute_time() >= t);
+}
+
+void sleep_until(absolute_time_t t)
+{
+	if (t != at_the_end_of_time)
+		mock_time_set(t);
+}
+
+bool best_effort_wfe_or_timeout(absolute_time_t timeout_timestamp)
+{
+	sleep_until(timeout_timestamp);
+	return true;
+}
+
+void sleep_us(uint64_t us)
+{
+	mock_time_advance(us);
+}
+
+void sleep_ms(uint32_t ms)
+{
+	mock_time_advance((uint64_t)ms * 1000);
+}
+
+void busy_wait_us(uint64_t us)
+{
+	mock_time_advance(us);
+}
+
+void busy_wait_us_32(uint32_t us)
+{
+	mock_time_advance(us);
+}
+
+void busy_wait_ms(uint32_t ms)
+{
+	mock_time_advance((uint64_t)ms * 1000);
+}
+
+
+/* systick (24bit down counter running at clk_sys) */
+
+static systick_hw_t mock_systick;
+
+systick_hw_t *mock_systick_hw()
+{
+	if (!mock_systick.rvr)
+		mock_systick.rvr = 0x00ffffff;
+	mock_systick.cvr = mock_systick.rvr
+		- ((mock_now * (MOCK_CLK_SYS_HZ / 1000000)) % (mock_systick.rvr + 1));
+	return &mock_systick;
+}
+
+
+/* rtc */
+
+static datetime_t mock_rtc;
+static bool mock_rtc_running = false;
+
+void rtc_init()
+{
+}
+
+bool rtc_set_datetime(const datetime_t *t)
+{
+	mock_rtc = *t;
+	mock_rtc_running = true;
+	return true;
+}
+
+bool rtc_get_datetime(datetime_t *t)
+{
+	if (!mock_rtc_running)
+		return false;
+	*t = mock_rtc;
+	return true;
+}
+
+bool rtc_running()
+{
+	return mock_rtc_running;
+}
+
+
+/* execution context, interrupts and locking */
+
+static uint mock_core = 0;
+static uint mock_exception = 0;
+static uint32_t mock_irq_disabled = 0;
+
+void mock_set_core(uint core)
+{
+	mock_core = core;
+}
+
+uint get_core_num()
+{
+	return mock_core;
+}
+
+uint __get_current_exception()
+{
+	return mock_exception;
+}
+
+uint32_t save_and_disable_interrupts()
+{
+	return mock_irq_disabled++;
+}
+
+void restore_interrupts(uint32_t status)
+{
+	mock_irq_disabled = status;
+}
+
+void panic(const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	fprintf(stderr, "panic: ");
+	vfprintf(stderr, fmt, ap);
+	fprintf(stderr, "\n");
+	va_end(ap);
+	abort();
+}
+
+void mutex_init(mutex_t *mtx)
+{
+	mtx->owner = -1;
+	mtx->count = 0;
+}
+
+bool mutex_try_enter(mutex_t *mtx, uint32_t *owner_out)
+{
+	if (mtx->count > 0) {
+		if (owner_out)
+			*owner_out = mtx->owner;
+		return false;
+	}
+	mtx->owner = mock_core;
+	mtx->count = 1;
+	return true;
+}
+
+void mutex_enter_blocking(mutex_t *mtx)
+{
+	/* Everything runs in one thread, so waiting would never end. */
+	if (!mutex_try_enter(mtx, NULL))
+		panic("mutex_enter_blocking(): deadlock (owner=core%d)", mtx->owner);
+}
+
+bool mutex_enter_timeout_ms(mutex_t *mtx, uint32_t timeout_ms)
+{
+	return mutex_try_enter(mtx, NULL);
+}
+
+bool mutex_enter_timeout_us(mutex_t *mtx, uint32_t timeout_us)
+{
+	return mutex_try_enter(mtx, NULL);
+}
+
+void mutex_exit(mutex_t *mtx)
+{
+	mtx->owner = -1;
+	mtx->count = 0;
+}
+
+void recursive_mutex_init(recursive_mutex_t *mtx)
+{
+	mutex_init(mtx);
+}
+
+void recursive_mutex_enter_blocking(recursive_mutex_t *mtx)
+{
+	mtx->owner = mock_core;
+	mtx->count++;
+}
+
+void recursive_mutex_exit(recursive_mutex_t *mtx)
+{
+	if (mtx->count > 0 && --mtx->count == 0)
+		mtx->owner = -1;
+}
+
+
+/* chip, clocks, watchdog, bootrom, multicore */
+
+static watchdog_hw_t mock_watchdog;
+static vreg_and_chip_reset_hw_t mock_vreg;
+watchdog_hw_t *watchdog_hw = &mock_watchdog;
+vreg_and_chip_reset_hw_t *vreg_and_chip_reset_hw = &mock_vreg;
+uart_inst_t mock_uart_inst[2] = { { 0 }, { 1 } };
+
+uint32_t clock_get_hz(enum clock_index clk_index)
+{
+	return (clk_index == clk_sys ? MOCK_CLK_SYS_HZ : 48000000);
+}
+
+uint32_t frequency_count_khz(uint src)
+{
+	return MOCK_CLK_SYS_HZ / 1000;
+}
+
+void vreg_set_voltage(enum vreg_voltage voltage)
+{
+}
+
+uint8_t rp2040_chip_version()
+{
+	return 2;
+}
+
+uint8_t rp2040_rom_version()
+{
+	return 3;
+}
+
+void pico_get_unique_board_id(pico_unique_board_id_t *id_out)
+{
+	for (int i = 0; i < PICO_UNIQUE_BOARD_ID_SIZE_BYTES; i++)
+		id_out->id[i] = 0xe0 + i;
+}
+
+void pico_get_unique_board_id_string(char *id_out, uint len)
+{
+	pico_unique_board_id_t id;
+
+	pico_get_unique_board_id(&id);
+	for (int i = 0; i < PICO_UNIQUE_BOARD_ID_SIZE_BYTES && (i * 2 + 2) < len; i++)
+		snprintf(id_out + i * 2, 3, "%02X", id.id[i]);
+}
+
+uint32_t get_rand_32()
+{
+	return (uint32_t)random();
+}
+
+uint64_t get_rand_64()
+{
+	return ((uint64_t)get_rand_32() << 32) | get_rand_32();
+}
+
+void watchdog_enable(uint32_t delay_ms, bool pause_on_debug)
+{
+}
+
+void watchdog_update()
+{
+}
+
+void watchdog_reboot(uint32_t pc, uint32_t sp, uint32_t delay_ms)
+{
+	fprintf(stderr, "watchdog_reboot(): simulation ends\n");
+	exit(3);
+}
+
+bool watchdog_caused_reboot()
+{
+	return false;
+}
+
+bool watchdog_enable_caused_reboot()
+{
+	return false;
+}
+
+void reset_usb_boot(uint32_t gpio_activity_pin_mask, uint32_t disable_interface_mask)
+{
+	fprintf(stderr, "reset_usb_boot(): simulation ends\n");
+	exit(3);
+}
+
+void multicore_launch_core1(void (*entry)(void))
+{
+	/* Simulation runs core1 tasks itself (see sim.c) */
+	panic("multicore_launch_core1() not supported");
+}
+
+void multicore_reset_core1()
+{
+}
+
+void multicore_lockout_victim_init()
+{
+}
+
+bool multicore_lockout_start_timeout_us(uint64_t timeout_us)
+{
+	return true;
+}
+
+bool multicore_lockout_end_timeout_us(uint64_t timeout_us)
+{
+	return true;
+}
+
+
+/* stdio */
+
+int getchar_timeout_us(uint32_t timeout_us)
+{
+	return PICO_ERROR_TIMEOUT;
+}
+
+bool stdio_init_all()
+{
+	return true;
+}
+
+bool stdio_usb_init()
+{
+	return true;
+}
+
+bool stdio_usb_connected()
+{
+	return true;
+}
+
+void stdio_uart_init_full(uart_inst_t *uart, uint baud_rate, int tx_pin, int rx_pin)
+{
+}
+
+
+/* GPIO */
+
+struct mock_gpio {
+	enum gpio_function func;
+	bool out;
+	bool out_level;
+	bool in_level;
+	uint32_t irq_events;
+};
+
+static struct mock_gpio mock_gpio[MOCK_GPIO_COUNT];
+static gpio_irq_callback_t mock_gpio_callback = NULL;
+
+void gpio_init(uint gpio)
+{
+	assert(gpio < MOCK_GPIO_COUNT);
+	mock_gpio[gpio].func = GPIO_FUNC_SIO;
+	mock_gpio[gpio].out = false;
+	mock_gpio[gpio].out_level = false;
+}
+
+void gpio_deinit(uint gpio)
+{
+	assert(gpio < MOCK_GPIO_COUNT);
+	mock_gpio[gpio].func = GPIO_FUNC_NULL;
+}
+
+void gpio_set_function(uint gpio, enum gpio_function fn)
+{
+	assert(gpio < MOCK_GPIO_COUNT);
+	mock_gpio[gpio].func = fn;
+}
+
+enum gpio_function gpio_get_function(uint gpio)
+{
+	assert(gpio < MOCK_GPIO_COUNT);
+	return mock_gpio[gpio].func;
+}
+
+void gpio_set_dir(uint gpio, bool out)
+{
+	assert(gpio < MOCK_GPIO_COUNT);
+	mock_gpio[gpio].out = out;
+}
+
+bool gpio_is_dir_out(uint gpio)
+{
+	assert(gpio < MOCK_GPIO_COUNT);
+	return mock_gpio[gpio].out;
+}
+
+void gpio_put(uint gpio, bool value)
+{
+	assert(gpio < MOCK_GPIO_COUNT);
+	mock_gpio[gpio].out_level = value;
+}
+
+bool gpio_get(uint gpio)
+{
+	assert(gpio < MOCK_GPIO_COUNT);
+	if (mock_gpio[gpio].out)
+		return mock_gpio[gpio].out_level;
+	return mock_gpio[gpio].in_level;
+}
+
+uint32_t gpio_get_all()
+{
+	uint32_t val = 0;
+
+	for (uint i = 0; i < MOCK_GPIO_COUNT && i < 32; i++) {
+		if (gpio_get(i))
+			val |= (1 << i);
+	}
+	return val;
+}
+
+void gpio_pull_up(uint gpio)
+{
+}
+
+void gpio_pull_down(uint gpio)
+{
+}
+
+void gpio_disable_pulls(uint gpio)
+{
+}
+
+void gpio_set_irq_enabled(uint gpio, uint32_t events, bool enabled)
+{
+	assert(gpio < MOCK_GPIO_COUNT);
+	if (enabled)
+		mock_gpio[gpio].irq_events |= events;
+	else
+		mock_gpio[gpio].irq_events &= ~events;
+}
+
+void gpio_set_irq_enabled_with_callback(uint gpio, uint32_t events, bool enabled,
+					gpio_irq_callback_t callback)
+{
+	gpio_set_irq_enabled(gpio, events, enabled);
+	if (callback)
+		mock_gpio_callback = callback;
+}
+
+void gpio_acknowledge_irq(uint gpio, uint32_t events)
+{
+	assert(gpio < MOCK_GPIO_COUNT);
+}
+
+void mock_gpio_set_input(uint gpio, bool level)
+{
+	struct mock_gpio *g;
+	uint32_t events;
+
+	assert(gpio < MOCK_GPIO_COUNT);
+	g = &mock_gpio[gpio];
+	if (g->in_level == level)
+		return;
+	g->in_level = level;
+
+	events = g->irq_events & (level ? GPIO_IRQ_EDGE_RISE : GPIO_IRQ_EDGE_FALL);
+	if (events && mock_gpio_callback && !mock_irq_disabled) {
+		mock_exception = 16 + 13; /* IO_IRQ_BANK0 */
+		mock_gpio_callback(gpio, events);
+		mock_exception = 0;
+	}
+}
+
+bool mock_gpio_get_output(uint gpio)
+{
+	assert(gpio < MOCK_GPIO_COUNT);
+	return mock_gpio[gpio].out_level;
+}
+
+
+/* PWM */
+
+struct mock_pwm_slice {
+	pwm_config config;
+	uint16_t level[2];
+	bool enabled;
+	float input_duty;
+	double count;
+	uint64_t count_t;
+};
+
+static struct mock_pwm_slice mock_pwm[NUM_PWM_SLICES];
+static pwm_hw_t mock_pwm_regs;
+pwm_hw_t *pwm_hw = &mock_pwm_regs;
+
+/* Update (gated) counter of a slice up to current time. */
+static void mock_pwm_count(struct mock_pwm_slice *s)
+{
+	uint64_t now = mock_now;
+	double rate;
+
+	if (s->enabled && s->config.clkdiv_mode == PWM_DIV_B_HIGH && s->config.clkdiv > 0) {
+		rate = MOCK_CLK_SYS_HZ / s->config.clkdiv / 1000000.0;
+		s->count += (now - s->count_t) * rate * s->input_duty / 100.0;
+	}
+	s->count_t = now;
+}
+
+pwm_config pwm_get_default_config()
+{
+	pwm_config c;
+
+	c.clkdiv = 1.0;
+	c.phase_correct = false;
+	c.clkdiv_mode = PWM_DIV_FREE_RUNNING;
+	c.wrap = 0xffff;
+	return c;
+}
+
+void pwm_config_set_clkdiv(pwm_config *c, float div)
+{
+	c->clkdiv = div;
+}
+
+void pwm_config_set_clkdiv_int(pwm_config *c, uint div)
+{
+	c->clkdiv = div;
+}
+
+void pwm_config_set_clkdiv_mode(pwm_config *c, enum pwm_clkdiv_mode mode)
+{
+	c->clkdiv_mode = mode;
+}
+
+void pwm_config_set_phase_correct(pwm_config *c, bool phase_correct)
+{
+	c->phase_correct = phase_correct;
+}
+
+void pwm_config_set_wrap(pwm_config *c, uint16_t wrap)
+{
+	c->wrap = wrap;
+}
+
+void pwm_init(uint slice_num, pwm_config *c, bool start)
+{
+	struct mock_pwm_slice *s = &mock_pwm[slice_num];
+
+	assert(slice_num < NUM_PWM_SLICES);
+	s->config = *c;
+	s->level[0] = s->level[1] = 0;
+	s->count = 0;
+	s->count_t = mock_now;
+	pwm_set_enabled(slice_num, start);
+}
+
+void pwm_set_enabled(uint slice_num, bool enabled)
+{
+	struct mock_pwm_slice *s = &mock_pwm[slice_num];
+
+	assert(slice_num < NUM_PWM_SLICES);
+	mock_pwm_count(s);
+	s->enabled = enabled;
+	if (enabled)
+		pwm_hw->en |= (1 << slice_num);
+	else
+		pwm_hw->en &= ~(1 << slice_num);
+}
+
+void pwm_set_mask_enabled(uint32_t mask)
+{
+	for (uint i = 0; i < NUM_PWM_SLICES; i++)
+		pwm_set_enabled(i, mask & (1 << i));
+}
+
+void pwm_set_both_levels(uint slice_num, uint16_t level_a, uint16_t level_b)
+{
+	assert(slice_num < NUM_PWM_SLICES);
+	mock_pwm[slice_num].level[PWM_CHAN_A] = level_a;
+	mock_pwm[slice_num].level[PWM_CHAN_B] = level_b;
+}
+
+void pwm_set_chan_level(uint slice_num, uint chan, uint16_t level)
+{
+	assert(slice_num < NUM_PWM_SLICES && chan < 2);
+	mock_pwm[slice_num].level[chan] = level;
+}
+
+void pwm_set_gpio_level(uint gpio, uint16_t level)
+{
+	pwm_set_chan_level(pwm_gpio_to_slice_num(gpio), pwm_gpio_to_channel(gpio), level);
+}
+
+uint16_t pwm_get_counter(uint slice_num)
+{
+	struct mock_pwm_slice *s = &mock_pwm[slice_num];
+
+	assert(slice_num < NUM_PWM_SLICES);
+	if (s->config.clkdiv_mode != PWM_DIV_B_HIGH)
+		return 0;
+	mock_pwm_count(s);
+	return (uint64_t)s->count % ((uint32_t)s->config.wrap + 1);
+}
+
+void pwm_set_counter(uint slice_num, uint16_t c)
+{
+	struct mock_pwm_slice *s = &mock_pwm[slice_num];
+
+	assert(slice_num < NUM_PWM_SLICES);
+	s->count = c;
+	s->count_t = mock_now;
+}
+
+float mock_pwm_gpio_duty(uint gpio)
+{
+	struct mock_pwm_slice *s = &mock_pwm[pwm_gpio_to_slice_num(gpio)];
+
+	if (!(pwm_hw->en & (1 << pwm_gpio_to_slice_num(gpio))))
+		return 0.0;
+	return s->level[pwm_gpio_to_channel(gpio)] * 100.0 / ((uint32_t)s->config.wrap + 1);
+}
+
+void mock_pwm_set_input_duty(uint gpio, float duty)
+{
+	struct mock_pwm_slice *s = &mock_pwm[pwm_gpio_to_slice_num(gpio)];
+
+	mock_pwm_count(s);
+	s->input_duty = duty;
+}
+
+
+/* ADC */
+
+static adc_hw_t mock_adc_regs;
+adc_hw_t *adc_hw = &mock_adc_regs;
+static uint16_t mock_adc_raw[5];
+static uint mock_adc_input = 0;
+
+void adc_init()
+{
+}
+
+void adc_gpio_init(uint gpio)
+{
+	gpio_set_function(gpio, GPIO_FUNC_NULL);
+}
+
+void adc_select_input(uint input)
+{
+	assert(input < 5);
+	mock_adc_input = input;
+}
+
+uint adc_get_selected_input()
+{
+	return mock_adc_input;
+}
+
+uint16_t adc_read()
+{
+	/* Conversion takes 96 ADC clock cycles (2us) */
+	mock_time_advance(2);
+	return mock_adc_raw[mock_adc_input];
+}
+
+void adc_set_temp_sensor_enabled(bool enable)
+{
+}
+
+void adc_set_round_robin(uint input_mask)
+{
+}
+
+void adc_fifo_setup(bool en, bool dreq_en, uint16_t dreq_thresh, bool err_in_fifo, bool byte_shift)
+{
+}
+
+void adc_set_clkdiv(float clkdiv)
+{
+}
+
+void adc_run(bool run)
+{
+}
+
+void mock_adc_set_raw(uint input, uint16_t raw)
+{
+	assert(input < 5);
+	mock_adc_raw[input] = (raw < 4096 ? raw : 4095);
+}
+
+
+/* DMA (not available) and IRQs */
+
+static dma_hw_t mock_dma_regs;
+dma_hw_t *dma_hw = &mock_dma_regs;
+
+int dma_claim_unused_channel(bool required)
+{
+	if (required)
+		panic("No DMA channels available");
+	return -1;
+}
+
+void dma_channel_claim(uint channel)
+{
+	panic("dma_channel_claim(%u): DMA not available", channel);
+}
+
+void dma_channel_unclaim(uint channel)
+{
+}
+
+dma_channel_config dma_channel_get_default_config(uint channel)
+{
+	dma_channel_config c = { 0 };
+	return c;
+}
+
+void channel_config_set_transfer_data_size(dma_channel_config *c, enum dma_channel_transfer_size size)
+{
+}
+
+void channel_config_set_read_increment(dma_channel_config *c, bool incr)
+{
+}
+
+void channel_config_set_write_increment(dma_channel_config *c, bool incr)
+{
+}
+
+void channel_config_set_ring(dma_channel_config *c, bool write, uint size_bits)
+{
+}
+
+void channel_config_set_dreq(dma_channel_config *c, uint dreq)
+{
+}
+
+void channel_config_set_chain_to(dma_channel_config *c, uint chain_to)
+{
+}
+
+void channel_config_set_sniff_enable(dma_channel_config *c, bool sniff_enable)
+{
+}
+
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr,
+			const volatile void *read_addr, uint transfer_count, bool trigger)
+{
+	panic("dma_channel_configure(%u): DMA not available", channel);
+}
+
+void dma_channel_start(uint channel)
+{
+}
+
+void dma_channel_abort(uint channel)
+{
+}
+
+bool dma_channel_is_busy(uint channel)
+{
+	return false;
+}
+
+void dma_channel_wait_for_finish_blocking(uint channel)
+{
+}
+
+void dma_channel_set_irq1_enabled(uint channel, bool enabled)
+{
+}
+
+bool dma_channel_get_irq1_status(uint channel)
+{
+	return false;
+}
+
+void dma_channel_acknowledge_irq1(uint channel)
+{
+}
+
+void dma_sniffer_enable(uint channel, uint mode, bool force_channel_enable)
+{
+}
+
+void dma_sniffer_disable()
+{
+}
+
+void irq_add_shared_handler(uint num, irq_handler_t handler, uint8_t order_priority)
+{
+}
+
+void irq_remove_handler(uint num, irq_handler_t handler)
+{
+}
+
+void irq_set_enabled(uint num, bool enabled)
+{
+}
+
+bool irq_is_enabled(uint num)
+{
+	return false;
+}
+
+
+/* I2C (devices with 16bit registers, register pointer set by a write) */
+
+#define MOCK_I2C_REGS 4
+
+struct mock_i2c_dev {
+	uint8_t addr;
+	uint8_t reg_ptr;
+	uint8_t reg[MOCK_I2C_REGS];
+	uint16_t value[MOCK_I2C_REGS];
+	uint regs;
+};
+
+static struct mock_i2c_dev mock_i2c_devs[8];
+static uint mock_i2c_dev_count = 0;
+i2c_inst_t mock_i2c_inst[2] = { { 0, 0 }, { 1, 0 } };
+
+static struct mock_i2c_dev *mock_i2c_dev(uint8_t addr)
+{
+	for (uint i = 0; i < mock_i2c_dev_count; i++) {
+		if (mock_i2c_devs[i].addr == addr)
+			return &mock_i2c_devs[i];
+	}
+	return NULL;
+}
+
+void mock_i2c_set_reg(uint8_t addr, uint8_t reg, uint16_t value)
+{
+	struct mock_i2c_dev *d = mock_i2c_dev(addr);
+	uint i;
+
+	if (!d) {
+		assert(mock_i2c_dev_count < count_of(mock_i2c_devs));
+		d = &mock_i2c_devs[mock_i2c_dev_count++];
+		memset(d, 0, sizeof(*d));
+		d->addr = addr;
+	}
+	for (i = 0; i < d->regs; i++) {
+		if (d->reg[i] == reg)
+			break;
+	}
+	if (i == d->regs) {
+		assert(d->regs < MOCK_I2C_REGS);
+		d->reg[d->regs++] = reg;
+	}
+	d->value[i] = value;
+}
+
+uint i2c_init(i2c_inst_t *i2c, uint baudrate)
+{
+	i2c->baudrate = baudrate;
+	return baudrate;
+}
+
+void i2c_deinit(i2c_inst_t *i2c)
+{
+	i2c->baudrate = 0;
+}
+
+int i2c_write_timeout_us(i2c_inst_t *i2c, uint8_t addr, const uint8_t *src, size_t len,
+			bool nostop, uint timeout_us)
+{
+	struct mock_i2c_dev *d = mock_i2c_dev(addr);
+
+	if (!i2c->baudrate || !d || len < 1)
+		return PICO_ERROR_GENERIC;
+	d->reg_ptr = src[0];
+	return len;
+}
+
+int i2c_read_timeout_us(i2c_inst_t *i2c, uint8_t addr, uint8_t *dst, size_t len,
+			bool nostop, uint timeout_us)
+{
+	struct mock_i2c_dev *d = mock_i2c_dev(addr);
+	uint16_t v = 0;
+
+	if (!i2c->baudrate || !d)
+		return PICO_ERROR_GENERIC;
+	for (uint i = 0; i < d->regs; i++) {
+		if (d->reg[i] == d->reg_ptr)
+			v = d->value[i];
+	}
+	for (size_t i = 0; i < len; i++)
+		dst[i] = (i == 0 ? v >> 8 : (i == 1 ? v & 0xff : 0));
+	return len;
+}
+
+int i2c_write_blocking(i2c_inst_t *i2c, uint8_t addr, const uint8_t *src, size_t len, bool nostop)
+{
+	return i2c_write_timeout_us(i2c, addr, src, len, nostop, 0);
+}
+
+int i2c_read_blocking(i2c_inst_t *i2c, uint8_t addr, uint8_t *dst, size_t len, bool nostop)
+{
+	return i2c_read_timeout_us(i2c, addr, dst, len, nostop, 0);
+}
+
+
+/* PIO (resource allocation only) */
+
+#define MOCK_PIO_INSTR_MEM 32
+
+pio_hw_t mock_pio_hw[NUM_PIOS] = { { 0, 0, 0 }, { 1, 0, 0 } };
+
+void pio_sm_claim(PIO pio, uint sm)
+{
+	assert(sm < NUM_PIO_STATE_MACHINES);
+	if (pio->sm_claimed & (1 << sm))
+		panic("PIO%u SM%u already claimed", pio->index, sm);
+	pio->sm_claimed |= (1 << sm);
+}
+
+void pio_sm_unclaim(PIO pio, uint sm)
+{
+	assert(sm < NUM_PIO_STATE_MACHINES);
+	pio->sm_claimed &= ~(1 << sm);
+}
+
+int pio_claim_unused_sm(PIO pio, bool required)
+{
+	for (uint sm = 0; sm < NUM_PIO_STATE_MACHINES; sm++) {
+		if (!(pio->sm_claimed & (1 << sm))) {
+			pio->sm_claimed |= (1 << sm);
+			return sm;
+		}
+	}
+	if (required)
+		panic("No free PIO%u state machines", pio->index);
+	return -1;
+}
+
+bool pio_sm_is_claimed(PIO pio, uint sm)
+{
+	return (pio->sm_claimed & (1 << sm));
+}
+
+static int mock_pio_find_offset(PIO pio, uint length)
+{
+	uint32_t mask = (length >= 32 ? 0xffffffff : (1u << length) - 1);
+
+	for (int offset = MOCK_PIO_INSTR_MEM - length; offset >= 0; offset--) {
+		if (!(pio->instr_used & (mask << offset)))
+			return offset;
+	}
+	return -1;
+}
+
+bool pio_can_add_program(PIO pio, const pio_program_t *program)
+{
+	return (mock_pio_find_offset(pio, program->length) >= 0);
+}
+
+int pio_add_program(PIO pio, const pio_program_t *program)
+{
+	int offset = mock_pio_find_offset(pio, program->length);
+
+	if (offset < 0)
+		panic("No program space in PIO%u", pio->index);
+	pio->instr_used |= ((1u << program->length) - 1) << offset;
+	return offset;
+}
+
+void pio_remove_program(PIO pio, const pio_program_t *program, uint loaded_offset)
+{
+	pio->instr_used &= ~(((1u << program->length) - 1) << loaded_offset);
+}
+
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled)
+{
+}
+
+uint pio_sm_get_rx_fifo_level(PIO pio, uint sm)
+{
+	return 0;
+}
+
+bool pio_sm_is_rx_fifo_empty(PIO pio, uint sm)
+{
+	return true;
+}
+
+uint32_t pio_sm_get(PIO pio, uint sm)
+{
+	return 0;
+}
+
+void pio_sm_put(PIO pio, uint sm, uint32_t data)
+{
+}
+
+void pio_sm_clear_fifos(PIO pio, uint sm)
+{
+}
+
+uint pio_get_dreq(PIO pio, uint sm, bool is_tx)
+{
+	return pio->index * 8 + sm + (is_tx ? 0 : 4);
+}
+
+
+/* PIO programs (square_wave_gen.c, pwm_capture.c, onewire.c, tacho_edge.c) */
+
+#define SQUARE_WAVE_GEN_PROGRAM_LEN 6
+
+static const uint16_t mock_program_instr[SQUARE_WAVE_GEN_PROGRAM_LEN];
+static const pio_program_t square_wave_gen_program = {
+	.instructions = mock_program_instr,
+	.length = SQUARE_WAVE_GEN_PROGRAM_LEN,
+	.origin = -1,
+};
+static float mock_square_wave[NUM_PIOS][NUM_PIO_STATE_MACHINES];
+static bool mock_square_wave_on[NUM_PIOS][NUM_PIO_STATE_MACHINES];
+
+uint square_wave_gen_load_program(PIO pio)
+{
+	return pio_add_program(pio, &square_wave_gen_program);
+}
+
+void square_wave_gen_program_init(PIO pio, uint sm, uint offset, uint pin)
+{
+	gpio_set_function(pin, (pio->index ? GPIO_FUNC_PIO1 : GPIO_FUNC_PIO0));
+	mock_square_wave[pio->index][sm] = 0.0;
+}
+
+void square_wave_gen_enabled(PIO pio, uint sm, bool enabled)
+{
+	mock_square_wave_on[pio->index][sm] = enabled;
+}
+
+void square_wave_gen_set_period(PIO pio, uint sm, uint32_t period)
+{
+	mock_square_wave[pio->index][sm] = (period > 0 ? (float)MOCK_CLK_SYS_HZ / period : 0.0);
+}
+
+void square_wave_gen_set_freq(PIO pio, uint sm, float freq)
+{
+	mock_square_wave[pio->index][sm] = (freq > 0 ? freq : 0.0);
+}
+
+float mock_square_wave_freq(PIO pio, uint sm)
+{
+	if (!mock_square_wave_on[pio->index][sm])
+		return 0.0;
+	return mock_square_wave[pio->index][sm];
+}
+
+int pwm_capture_load_program(PIO pio)
+{
+	return -1;
+}
+
+void pwm_capture_program_init(PIO pio, uint sm, uint offset, uint pin)
+{
+}
+
+void pwm_capture_set_pin(PIO pio, uint sm, uint offset, uint pin)
+{
+}
+
+int onewire_load_program(PIO pio)
+{
+	return -1;
+}
+
+void onewire_program_init(PIO pio, uint sm, uint offset, uint pin)
+{
+}
+
+void onewire_reset(PIO pio, uint sm, uint offset)
+{
+}
+
+bool onewire_put_bit(PIO pio, uint sm, uint bit)
+{
+	return false;
+}
+
+int onewire_get_bit(PIO pio, uint sm)
+{
+	return -1;
+}
+
+int tacho_edge_load_program(PIO pio, uint32_t pin_mask)
+{
+	return -1;
+}
+
+void tacho_edge_program_init(PIO pio, uint sm, uint offset)
+{
+}
+
+void tacho_edge_unload_program(PIO pio, uint offset)
+{
+}
+
+void tacho_edge_enabled(PIO pio, uint sm, bool enabled)
+{
+}
+
+bool tacho_edge_rx_stalled(PIO pio, uint sm)
+{
+	return false;
+}
+
+int tacho_edge_sample_pin(uint bit)
+{
+	return -1;
+}
+
+uint tacho_edge_loop_cycles()
+{
+	return 0;
+}
+
+
+/* eof :-) */
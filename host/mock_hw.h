@@ -0,0 +1,62 @@
+/* mock_hw.h
+   Copyright (C) 2021-2024 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of FanPico.
+
+   FanPico is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   FanPico is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with FanPico. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MOCK_HW_H
+#define MOCK_HW_H 1
+
+#include "host_sdk.h"
+
+/* Simulation side interface to the mocked hardware (mock_hw.c).
+ *
+ * Time does not advance by itself: it is moved forward by the simulation
+ * (and by sleep/busy wait calls made by the firmware), so that runs are
+ * fully deterministic.
+ */
+
+#define MOCK_CLK_SYS_HZ 125000000
+
+/* time */
+void mock_time_set(uint64_t us);
+void mock_time_advance(uint64_t us);
+
+/* execution context (core number, interrupt handler) */
+void mock_set_core(uint core);
+
+/* GPIO: drive input pin (calls GPIO IRQ callback on matching edges) */
+void mock_gpio_set_input(uint gpio, bool level);
+bool mock_gpio_get_output(uint gpio);
+
+/* PWM: output level readback, input duty cycle for gated counters */
+float mock_pwm_gpio_duty(uint gpio);
+void mock_pwm_set_input_duty(uint gpio, float duty);
+
+/* ADC: raw (12bit) value of input 0..4 */
+void mock_adc_set_raw(uint input, uint16_t raw);
+
+/* I2C: 16bit register of a device (device responds once set) */
+void mock_i2c_set_reg(uint8_t addr, uint8_t reg, uint16_t value);
+
+/* PIO square wave generators (tacho outputs) */
+float mock_square_wave_freq(PIO pio, uint sm);
+
+#endif /* MOCK_HW_H */
+
+/* eof :-) */
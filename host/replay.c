@@ -0,0 +1,191 @@
+/* replay.c
+   Copyright (C) 2021-2024 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of FanPico.
+
+   FanPico is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   FanPico is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with FanPico. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include "pico/stdlib.h"
+
+#include "fanpico.h"
+#include "sim.h"
+
+
+/*
+ * Replay input trace through the simulated firmware.
+ *
+ * Trace is a CSV file with lines: <time_ms>,<input>,<value>
+ * where time is relative to the end of boot, and input is one of:
+ *
+ *   sensorN   sensor temperature (C)
+ *   fanN      fan tachometer signal frequency (Hz)
+ *   mbfanN    motherboard PWM input duty cycle (%)
+ *   cmd       command (rest of the line) entered on console
+ *   sample    output sample interval (ms), default 1000
+ *   end       end of trace
+ *
+ * Lines starting with '#' are comments. Outputs (as seen by fans and
+ * motherboard) and system state are written as CSV once per sample
+ * interval, to stdout or to the given output file.
+ */
+
+#define REPLAY_LINE_MAX 1024
+
+
+static void replay_header(FILE *out)
+{
+	int i;
+
+	fprintf(out, "time_ms");
+	for (i = 0; i < SENSOR_COUNT; i++)
+		fprintf(out, ",temp%d", i + 1);
+	for (i = 0; i < VSENSOR_COUNT; i++)
+		fprintf(out, ",vtemp%d", i + 1);
+	for (i = 0; i < FAN_COUNT; i++)
+		fprintf(out, ",fan%d_pwm", i + 1);
+	for (i = 0; i < FAN_COUNT; i++)
+		fprintf(out, ",fan%d_tacho", i + 1);
+	for (i = 0; i < MBFAN_COUNT; i++)
+		fprintf(out, ",mbfan%d_pwm", i + 1);
+	for (i = 0; i < MBFAN_COUNT; i++)
+		fprintf(out, ",mbfan%d_tacho", i + 1);
+	fprintf(out, "\n");
+}
+
+static void replay_sample(FILE *out, uint32_t t)
+{
+	struct fanpico_state st;
+	int i;
+
+	copy_system_state(&st);
+
+	fprintf(out, "%lu", (unsigned long)t);
+	for (i = 0; i < SENSOR_COUNT; i++)
+		fprintf(out, ",%.1f", st.temp[i]);
+	for (i = 0; i < VSENSOR_COUNT; i++)
+		fprintf(out, ",%.1f", st.vtemp[i]);
+	for (i = 0; i < FAN_COUNT; i++)
+		fprintf(out, ",%.1f", sim_fan_duty(i));
+	for (i = 0; i < FAN_COUNT; i++)
+		fprintf(out, ",%.1f", st.fan_freq[i]);
+	for (i = 0; i < MBFAN_COUNT; i++)
+		fprintf(out, ",%.1f", st.mbfan_duty[i]);
+	for (i = 0; i < MBFAN_COUNT; i++)
+		fprintf(out, ",%.1f", sim_mbfan_freq(i));
+	fprintf(out, "\n");
+}
+
+static int replay_input(const char *input, const char *value)
+{
+	int n;
+
+	if (!strcmp(input, "cmd")) {
+		sim_command(value);
+	}
+	else if (sscanf(input, "sensor%d", &n) == 1 && n >= 1 && n <= SENSOR_COUNT) {
+		sim_set_temp(n - 1, atof(value));
+	}
+	else if (sscanf(input, "mbfan%d", &n) == 1 && n >= 1 && n <= MBFAN_COUNT) {
+		sim_set_pwm_input(n - 1, atof(value));
+	}
+	else if (sscanf(input, "fan%d", &n) == 1 && n >= 1 && n <= FAN_COUNT) {
+		sim_set_tacho(n - 1, atof(value));
+	}
+	else {
+		return -1;
+	}
+
+	return 0;
+}
+
+
+int main(int argc, char **argv)
+{
+	char line[REPLAY_LINE_MAX];
+	char *input, *value, *saveptr;
+	uint32_t t, t_sample = 0;
+	uint32_t interval = 1000;
+	uint64_t t_base;
+	FILE *trace, *out = stdout;
+	int lineno = 0;
+	bool end = false;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <trace.csv> [<output.csv>]\n", argv[0]);
+		return 1;
+	}
+	if (!(trace = fopen(argv[1], "r"))) {
+		fprintf(stderr, "%s: %s\n", argv[1], strerror(errno));
+		return 1;
+	}
+	if (argc > 2 && !(out = fopen(argv[2], "w"))) {
+		fprintf(stderr, "%s: %s\n", argv[2], strerror(errno));
+		return 1;
+	}
+
+	sim_init();
+	t_base = sim_time();
+	replay_header(out);
+
+	while (!end && fgets(line, sizeof(line), trace)) {
+		lineno++;
+		line[strcspn(line, "\r\n")] = 0;
+		if (line[0] == '#' || line[0] == 0)
+			continue;
+		if (!(input = strchr(line, ','))) {
+			fprintf(stderr, "%s:%d: invalid line\n", argv[1], lineno);
+			return 2;
+		}
+		t = strtoul(line, NULL, 10);
+		input = strtok_r(input + 1, ",", &saveptr);
+		value = (saveptr ? saveptr : "");
+		if (!input) {
+			fprintf(stderr, "%s:%d: no input\n", argv[1], lineno);
+			return 2;
+		}
+
+		/* Run simulation up to the time of this input... */
+		while (t_sample <= t) {
+			sim_run(t_base + (uint64_t)t_sample * 1000);
+			replay_sample(out, t_sample);
+			t_sample += interval;
+		}
+		sim_run(t_base + (uint64_t)t * 1000);
+
+		if (!strcmp(input, "end")) {
+			end = true;
+		} else if (!strcmp(input, "sample")) {
+			interval = (atoi(value) > 0 ? atoi(value) : 1000);
+			t_sample = t + interval;
+		} else if (replay_input(input, value) < 0) {
+			fprintf(stderr, "%s:%d: unknown input '%s'\n", argv[1], lineno, input);
+			return 2;
+		}
+	}
+
+	fclose(trace);
+	if (out != stdout)
+		fclose(out);
+
+	return 0;
+}
+
+
+/* eof :-) */
@@ -0,0 +1,287 @@
+/* sim.c
+   Copyright (C) 2021-2024 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of FanPico.
+
+   FanPico is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   FanPico is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with FanPico. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "pico/stdlib.h"
+
+#include "fanpico.h"
+#include "sim.h"
+
+
+/*
+ * Simulation of the firmware running on (mocked) hardware.
+ *
+ * Firmware is booted with setup() (same as on the device), after which
+ * the core1 task table (core1_task_list) is run by a scheduler that
+ * mirrors core1_main(), interleaved with the core0 main loop duties
+ * that affect fan control (deferred logging, command queue, config
+ * autosave, digital sensors). Both "cores" run in the same thread,
+ * time only moves forward between events.
+ *
+ * Inputs are modelled as physical signals: sensor temperatures are
+ * converted into ADC readings, fan tachometer signals are generated
+ * as GPIO edges (through the tacho input multiplexer on boards that
+ * have one), and PWM input duty cycles drive the gated PWM counters.
+ */
+
+#define SIM_CORE0_PERIOD  1000     /* us */
+#define SIM_START_TIME    1000000  /* us (time at boot) */
+#define SIM_MAX_TASKS     16
+#define SIM_AMBIENT_TEMP  25.0     /* C (initial sensor temperature) */
+
+/* fanpico.c, pwm.c, tacho.c, sensors.c */
+void setup();
+extern uint8_t fan_gpio_pwm_map[FAN_MAX_COUNT];
+extern uint8_t mbfan_gpio_pwm_map[MBFAN_MAX_COUNT];
+extern uint8_t fan_gpio_tacho_map[FAN_MAX_COUNT];
+extern uint8_t sensor_adc_map[SENSOR_MAX_COUNT];
+
+struct sim_tacho {
+	float freq;
+	bool level;
+	double next_edge;
+};
+
+static struct fanpico_control_config sim_config;
+static struct fanpico_state sim_state;
+static absolute_time_t sim_next_run[SIM_MAX_TASKS];
+static absolute_time_t sim_core0_next;
+static absolute_time_t sim_history_next;
+static struct sim_tacho sim_tacho[FAN_MAX_COUNT];
+
+
+uint64_t sim_time()
+{
+	return to_us_since_boot(get_absolute_time());
+}
+
+
+/* Tachometer signal of a fan, as seen by the firmware. */
+static void sim_tacho_update_pins()
+{
+#if TACHO_READ_MULTIPLEX > 0
+	uint port = (mock_gpio_get_output(FAN_TACHO_READ_S0_PIN) ? 1 : 0)
+		| (mock_gpio_get_output(FAN_TACHO_READ_S1_PIN) ? 2 : 0)
+		| (mock_gpio_get_output(FAN_TACHO_READ_S2_PIN) ? 4 : 0);
+	bool level = false;
+
+	for (int i = 0; i < FAN_COUNT; i++) {
+		if (fan_gpio_tacho_map[i] == port)
+			level = sim_tacho[i].level;
+	}
+	mock_gpio_set_input(FAN_TACHO_READ_PIN, level);
+#else
+	for (int i = 0; i < FAN_COUNT; i++)
+		mock_gpio_set_input(fan_gpio_tacho_map[i], sim_tacho[i].level);
+#endif
+}
+
+static double sim_tacho_next_edge()
+{
+	double next = INFINITY;
+
+	for (int i = 0; i < FAN_COUNT; i++) {
+		if (sim_tacho[i].freq > 0 && sim_tacho[i].next_edge < next)
+			next = sim_tacho[i].next_edge;
+	}
+
+	return next;
+}
+
+static void sim_tacho_edges(uint64_t now)
+{
+	struct sim_tacho *t;
+
+	for (int i = 0; i < FAN_COUNT; i++) {
+		t = &sim_tacho[i];
+		while (t->freq > 0 && t->next_edge <= now) {
+			t->level = !t->level;
+			t->next_edge += 500000.0 / t->freq;
+		}
+	}
+}
+
+void sim_set_tacho(int fan, float freq)
+{
+	struct sim_tacho *t = &sim_tacho[fan];
+
+	assert(fan < FAN_COUNT);
+	if (freq > 0 && !(t->freq > 0))
+		t->next_edge = sim_time() + 500000.0 / freq;
+	t->freq = (freq > 0 ? freq : 0.0);
+}
+
+
+/* Convert temperature to ADC reading (inverse of sensor_raw_to_temp()). */
+void sim_set_temp(int sensor, float temp)
+{
+	const struct sensor_input *s = &cfg->sensors[sensor];
+	double t, r, volt, raw;
+
+	assert(sensor < SENSOR_COUNT);
+	t = (temp - s->temp_offset) / s->temp_coefficient;
+	if (s->type == TEMP_INTERNAL) {
+		volt = 0.706 - (t - 27.0) * 0.001721;
+		raw = volt / ADC_REF_VOLTAGE * ADC_MAX_VALUE;
+	} else {
+		r = s->thermistor_nominal * exp(s->beta_coefficient
+						* (1.0 / (t + 273.15) - 1.0 / (s->temp_nominal + 273.15)));
+		raw = ADC_MAX_VALUE * r / (r + SENSOR_SERIES_RESISTANCE);
+	}
+	if (raw < 0)
+		raw = 0;
+	mock_adc_set_raw(sensor_adc_map[sensor], lround(raw));
+}
+
+void sim_set_pwm_input(int mbfan, float duty)
+{
+	assert(mbfan < MBFAN_COUNT);
+	mock_pwm_set_input_duty(mbfan_gpio_pwm_map[mbfan], duty);
+}
+
+
+/* Outputs (as seen by fans and motherboard) */
+
+float sim_fan_duty(int fan)
+{
+	assert(fan < FAN_COUNT);
+	return mock_pwm_gpio_duty(fan_gpio_pwm_map[fan]);
+}
+
+float sim_mbfan_freq(int mbfan)
+{
+	assert(mbfan < MBFAN_COUNT);
+	return mock_square_wave_freq(TACHO_OUTPUT_PIO, mbfan);
+}
+
+
+/* Run command as if it had been entered on the console. */
+void sim_command(const char *cmd)
+{
+	char buf[1024];
+
+	strncopy(buf, cmd, sizeof(buf));
+	mock_set_core(0);
+	cmdq_console_command(buf);
+}
+
+
+void sim_init()
+{
+	const struct core1_task *t;
+	int i;
+
+	mock_time_set(SIM_START_TIME);
+	mock_set_core(0);
+	setup();
+	perf_init();
+	log_flush();
+	for (i = 0; i < SENSOR_COUNT; i++)
+		sim_set_temp(i, SIM_AMBIENT_TEMP);
+
+	/* Start "core1"... */
+	mock_set_core(1);
+	config_to_control(cfg, &sim_config);
+	memcpy(&sim_state, fanpico_state, sizeof(sim_state));
+	perf_init();
+	setup_tacho_input_interrupts();
+	update_sensor_tables(&sim_config);
+	for (t = core1_task_list, i = 0; t->name; t++, i++) {
+		assert(i < SIM_MAX_TASKS);
+		sim_next_run[i] = get_absolute_time();
+	}
+	reset_core1_task_stats();
+	mock_set_core(0);
+
+	sim_core0_next = get_absolute_time();
+	sim_history_next = sim_core0_next;
+}
+
+
+/* Run all core1 tasks that are due (see core1_main()). */
+static void sim_core1(absolute_time_t t_now)
+{
+	const struct core1_task *t;
+	int i;
+
+	mock_set_core(1);
+	for (t = core1_task_list, i = 0; t->name; t++, i++) {
+		if (absolute_time_diff_us(sim_next_run[i], t_now) < 0)
+			continue;
+		t->func(&sim_state, &sim_config);
+		/* Schedule next run, skip missed periods... */
+		sim_next_run[i] = delayed_by_ms(sim_next_run[i], t->period);
+		if (absolute_time_diff_us(sim_next_run[i], get_absolute_time()) >= 0)
+			sim_next_run[i] = delayed_by_ms(get_absolute_time(), t->period);
+		t_now = get_absolute_time();
+	}
+	mock_set_core(0);
+}
+
+/* Core0 main loop duties (see main()). */
+static void sim_core0(absolute_time_t t_now)
+{
+	log_flush();
+	config_autosave_poll();
+	flash_poll();
+	dsensors_poll();
+	if (absolute_time_diff_us(sim_history_next, t_now) >= 0) {
+		update_system_state();
+		history_update(fanpico_state);
+		sim_history_next = delayed_by_ms(sim_history_next, 1000);
+	}
+	cmdq_poll(5000);
+}
+
+void sim_run(uint64_t until_us)
+{
+	const struct core1_task *t;
+	absolute_time_t t_now, t_next;
+	double t_edge;
+	int i;
+
+	while ((t_now = get_absolute_time()) < until_us) {
+		sim_tacho_edges(t_now);
+		sim_tacho_update_pins();
+		sim_core1(t_now);
+		sim_tacho_update_pins();
+		if (absolute_time_diff_us(sim_core0_next, get_absolute_time()) >= 0) {
+			sim_core0(get_absolute_time());
+			sim_core0_next = delayed_by_us(get_absolute_time(), SIM_CORE0_PERIOD);
+		}
+
+		/* Advance time to next event */
+		t_next = MIN(until_us, sim_core0_next);
+		for (t = core1_task_list, i = 0; t->name; t++, i++)
+			t_next = MIN(t_next, sim_next_run[i]);
+		t_edge = sim_tacho_next_edge();
+		if (t_edge < t_next)
+			t_next = ceil(t_edge);
+		if (t_next <= get_absolute_time())
+			t_next = get_absolute_time() + 1;
+		mock_time_set(t_next);
+	}
+}
+
+
+/* eof :-) */
@@ -0,0 +1,40 @@
+/* sim.h
+   Copyright (C) 2021-2024 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of FanPico.
+
+   FanPico is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   FanPico is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with FanPico. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SIM_H
+#define SIM_H 1
+
+#include "mock_hw.h"
+
+/* sim.c */
+void sim_init();
+void sim_run(uint64_t until_us);
+uint64_t sim_time();
+void sim_set_temp(int sensor, float temp);
+void sim_set_tacho(int fan, float freq);
+void sim_set_pwm_input(int mbfan, float duty);
+void sim_command(const char *cmd);
+float sim_fan_duty(int fan);
+float sim_mbfan_freq(int mbfan);
+
+#endif /* SIM_H */
+
+/* eof :-) */
@@ -0,0 +1,313 @@
+/* test_pipeline.c
+   Copyright (C) 2021-2024 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of FanPico.
+
+   FanPico is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   FanPico is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with FanPico. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "pico/stdlib.h"
+#include "cJSON.h"
+
+#include "fanpico.h"
+#include "sim.h"
+
+
+/* command.c, config.c */
+extern struct fanpico_config fanpico_config;
+void clear_config(struct fanpico_config *cfg);
+cJSON *config_to_json(const struct fanpico_config *cfg);
+int json_to_config(cJSON *config, struct fanpico_config *cfg);
+
+static int failures = 0;
+static int checks = 0;
+
+#define CHECK(cond) do {						\
+		checks++;						\
+		if (!(cond)) {						\
+			fprintf(stderr, "%s:%d: check failed: %s\n",	\
+				__FILE__, __LINE__, #cond);		\
+			failures++;					\
+		}							\
+	} while (0)
+
+#define CHECK_NEAR(val, expected, tolerance)				\
+	CHECK(fabs((double)(val) - (double)(expected)) <= (tolerance))
+
+
+static int command(const char *cmd)
+{
+	char buf[256];
+
+	strncopy(buf, cmd, sizeof(buf));
+	process_command(fanpico_state, &fanpico_config, buf);
+
+	return last_command_status();
+}
+
+
+static void test_commands()
+{
+	CHECK(command("CONF:FAN1:PWMMap 0,0,50,20,100,100") == 0);
+	CHECK(cfg->fans[0].map.points == 3);
+	CHECK(cfg->fans[0].map.pwm[1][0] == 50 && cfg->fans[0].map.pwm[1][1] == 20);
+	CHECK(command("CONF:FAN1:PWMMap 0,0,50") == -102);
+	CHECK(cfg->fans[0].map.points == 3);
+
+	CHECK(command("CONF:MBFAN1:RPMMap 0,0,1000,500,10000,10000") == 0);
+	CHECK(cfg->mbfans[0].map.points == 3);
+
+	CHECK(command("CONF:SENSOR1:TEMPMap 20,0,30,10,50,100") == 0);
+	CHECK(cfg->sensors[0].map.points == 3);
+
+	CHECK(command("CONF:FAN2:NAME test fan") == 0);
+	CHECK(!strcmp(cfg->fans[1].name, "test fan"));
+
+	CHECK(command("CONF:FOO:BAR 1") == -113);
+	CHECK(command("*IDN?") == 0);
+}
+
+static void test_maps()
+{
+	const struct fanpico_config *c = cfg;
+
+	CHECK_NEAR(pwm_map(&c->fans[0].map, 0), 0.0, 0.01);
+	CHECK_NEAR(pwm_map(&c->fans[0].map, 25), 10.0, 0.01);
+	CHECK_NEAR(pwm_map(&c->fans[0].map, 50), 20.0, 0.01);
+	CHECK_NEAR(pwm_map(&c->fans[0].map, 75), 60.0, 0.01);
+	CHECK_NEAR(pwm_map(&c->fans[0].map, 100), 100.0, 0.01);
+	CHECK_NEAR(pwm_map(&c->fans[2].map, 42), 42.0, 0.01);
+
+	CHECK_NEAR(tacho_map(&c->mbfans[0].map, 500), 250.0, 0.01);
+	CHECK_NEAR(tacho_map(&c->mbfans[0].map, 1000), 500.0, 0.01);
+	CHECK_NEAR(tacho_map(&c->mbfans[1].map, 1234), 1234.0, 0.01);
+
+	CHECK_NEAR(sensor_get_duty(&c->sensors[0].map, 10), 0.0, 0.01);
+	CHECK_NEAR(sensor_get_duty(&c->sensors[0].map, 25), 5.0, 0.01);
+	CHECK_NEAR(sensor_get_duty(&c->sensors[0].map, 40), 55.0, 0.01);
+	CHECK_NEAR(sensor_get_duty(&c->sensors[0].map, 60), 100.0, 0.01);
+	CHECK_NEAR(sensor_get_duty(&c->sensors[1].map, 35), 50.0, 0.01);
+}
+
+static void test_calculate()
+{
+	struct fanpico_control_config *c = malloc(sizeof(*c));
+	struct fanpico_state *s = malloc(sizeof(*s));
+
+	CHECK(c != NULL && s != NULL);
+	if (!c || !s)
+		return;
+	config_to_control(cfg, c);
+	memcpy(s, fanpico_state, sizeof(*s));
+
+	/* fan1: mbfan1 -> pwm map */
+	s->mbfan_duty[0] = 75.0;
+	CHECK_NEAR(calculate_pwm_duty(s, c, 0), 60.0, 0.01);
+	s->mbfan_duty[2] = 33.0;
+	CHECK_NEAR(calculate_pwm_duty(s, c, 2), 33.0, 0.01);
+
+	/* mbfan1: fan1 tacho -> rpm map */
+	s->fan_freq[0] = 50.0;  /* 1500 RPM */
+	CHECK_NEAR(calculate_tacho_freq(s, c, 0), (500.0 + 500.0 * 9500.0 / 9000.0) / 60 * 2, 0.01);
+	s->fan_freq[1] = 40.0;
+	CHECK_NEAR(calculate_tacho_freq(s, c, 1), 40.0, 0.01);
+
+	/* vsensor1: manual mode, value from WRITE:VSENSOR1 */
+	CHECK(command("WRITE:VSENSOR1 42.5") == 0);
+	config_to_control(cfg, c);
+	CHECK_NEAR(get_vsensor(0, c, s), 42.5, 0.01);
+
+	/* vsensor2: max of sensor1 and sensor2 */
+	CHECK(command("CONF:VSENSOR2:SOURCE max,1,2") == 0);
+	config_to_control(cfg, c);
+	s->temp[0] = 30.0;
+	s->temp[1] = 35.5;
+	CHECK_NEAR(get_vsensor(1, c, s), 35.5, 0.01);
+	CHECK(command("CONF:VSENSOR2:SOURCE avg,1,2") == 0);
+	config_to_control(cfg, c);
+	CHECK_NEAR(get_vsensor(1, c, s), 32.75, 0.01);
+
+	free(c);
+	free(s);
+}
+
+static void test_filters()
+{
+	char args[16];
+	void *ctx, *ctx2;
+	float val = 0;
+
+	strncopy(args, "4", sizeof(args));
+	ctx = filter_parse_args(FILTER_SMA, args);
+	CHECK(ctx != NULL);
+	if (ctx) {
+		for (int i = 0; i < 8; i++)
+			val = filter(FILTER_SMA, ctx, (i < 4 ? 0 : 40));
+		CHECK_NEAR(val, 40.0, 0.01);
+		val = filter(FILTER_SMA, ctx, 80);
+		CHECK_NEAR(val, 50.0, 0.01);
+		filter_free_private_ctx(ctx);
+	}
+
+	strncopy(args, "10,5", sizeof(args));
+	ctx = filter_parse_args(FILTER_LOSSYPEAK, args);
+	CHECK(ctx != NULL);
+	if (ctx) {
+		CHECK_NEAR(filter(FILTER_LOSSYPEAK, ctx, 100), 100.0, 0.01);
+		mock_time_advance(1000000);
+		CHECK_NEAR(filter(FILTER_LOSSYPEAK, ctx, 0), 100.0, 0.01);
+		mock_time_advance(5000000);
+		CHECK_NEAR(filter(FILTER_LOSSYPEAK, ctx, 0), 90.0, 0.01);
+		filter_free_private_ctx(ctx);
+	}
+
+	strncopy(args, "foo", sizeof(args));
+	CHECK(filter_parse_args(FILTER_LOSSYPEAK, args) == NULL);
+
+	/* Released context is not reused until core1 has picked up
+	   a newer configuration */
+	strncopy(args, "4", sizeof(args));
+	ctx = filter_parse_args(FILTER_SMA, args);
+	CHECK(ctx != NULL);
+	filter_free_ctx(ctx);
+	strncopy(args, "4", sizeof(args));
+	ctx2 = filter_parse_args(FILTER_SMA, args);
+	CHECK(ctx2 != NULL && ctx2 != ctx);
+	filter_free_private_ctx(ctx2);
+	config_generation++;
+	sim_run(sim_time() + 1000000);
+	strncopy(args, "4", sizeof(args));
+	ctx2 = filter_parse_args(FILTER_SMA, args);
+	CHECK(ctx2 == ctx);
+	filter_free_private_ctx(ctx2);
+}
+
+static void test_json_config()
+{
+	struct fanpico_config *c = calloc(1, sizeof(*c));
+	cJSON *json;
+
+	CHECK(c != NULL);
+	if (!c)
+		return;
+	clear_config(c);
+
+	json = config_to_json(cfg);
+	CHECK(json != NULL);
+	CHECK(json_to_config(json, c) == 0);
+	cJSON_Delete(json);
+
+	for (int i = 0; i < FAN_COUNT; i++) {
+		CHECK(!strcmp(c->fans[i].name, cfg->fans[i].name));
+		CHECK(c->fans[i].map.points == cfg->fans[i].map.points);
+		for (int j = 0; j < cfg->fans[i].map.points; j++) {
+			CHECK(c->fans[i].map.pwm[j][0] == cfg->fans[i].map.pwm[j][0]);
+			CHECK(c->fans[i].map.pwm[j][1] == cfg->fans[i].map.pwm[j][1]);
+		}
+		CHECK(c->fans[i].s_type == cfg->fans[i].s_type);
+		CHECK(c->fans[i].s_id == cfg->fans[i].s_id);
+	}
+	for (int i = 0; i < MBFAN_COUNT; i++) {
+		CHECK(c->mbfans[i].map.points == cfg->mbfans[i].map.points);
+		CHECK(c->mbfans[i].max_rpm == cfg->mbfans[i].max_rpm);
+	}
+	for (int i = 0; i < SENSOR_COUNT; i++) {
+		CHECK(c->sensors[i].type == cfg->sensors[i].type);
+		CHECK(c->sensors[i].map.points == cfg->sensors[i].map.points);
+	}
+	for (int i = 0; i < VSENSOR_COUNT; i++) {
+		CHECK(c->vsensors[i].mode == cfg->vsensors[i].mode);
+		CHECK(!memcmp(c->vsensors[i].sensors, cfg->vsensors[i].sensors,
+				sizeof(c->vsensors[i].sensors)));
+	}
+
+	clear_config(c);
+	free(c);
+}
+
+/* Inputs through the simulated hardware, outputs as seen by fans and motherboard. */
+static void test_simulation()
+{
+	struct fanpico_state st;
+
+	sim_set_temp(0, 35.0);
+	sim_set_temp(2, 30.0);
+	sim_set_pwm_input(1, 40.0);
+	sim_set_tacho(1, 60.0);
+	sim_run(sim_time() + 5000000);
+
+	copy_system_state(&st);
+	CHECK_NEAR(st.temp[0], 35.0, 0.5);
+	CHECK_NEAR(st.temp[2], 30.0, 0.5);
+	CHECK_NEAR(st.mbfan_duty[1], 40.0, 1.0);
+	CHECK_NEAR(sim_fan_duty(1), 40.0, 1.0);
+	CHECK_NEAR(st.fan_freq[1], 60.0, 1.0);
+	CHECK_NEAR(sim_mbfan_freq(1), 60.0, 1.0);
+
+	sim_command("CONF:FAN2:PWMMap 0,0,50,20,100,100");
+	sim_run(sim_time() + 2000000);
+	CHECK_NEAR(sim_fan_duty(1), 16.0, 1.0);
+}
+
+/* Settings outside struct fanpico_config are restored from snapshot too. */
+static void test_config_snapshot()
+{
+	int log_level = get_log_level();
+	int debug_level = get_debug_level();
+
+	CHECK(command("SYS:LOG WARNING") == 0);
+	CHECK(command("SYS:DEBUG 2") == 0);
+	CHECK(compact_config(true) == 0);
+	set_log_level(LOG_ERR);
+	set_debug_level(0);
+	read_config();
+	CHECK(get_log_level() == LOG_WARNING);
+	CHECK(get_debug_level() == 2);
+
+	/* Changing only these, must still be saved */
+	CHECK(command("SYS:LOG NOTICE") == 0);
+	CHECK(command("CONF:SAVe") == 0);
+	set_log_level(LOG_ERR);
+	read_config();
+	CHECK(get_log_level() == LOG_NOTICE);
+
+	set_log_level(log_level);
+	set_debug_level(debug_level);
+}
+
+
+int main(int argc, char **argv)
+{
+	sim_init();
+
+	test_simulation();
+	test_commands();
+	test_maps();
+	test_calculate();
+	test_filters();
+	test_json_config();
+	test_config_snapshot();
+
+	printf("%d checks, %d failures\n", checks, failures);
+
+	return (failures > 0 ? 1 : 0);
+}
+
+
+/* eof :-) */
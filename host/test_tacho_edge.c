@@ -0,0 +1,453 @@
+/* test_tacho_edge.c
+   Copyright (C) 2021-2024 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of FanPico.
+
+   FanPico is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   FanPico is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with FanPico. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+/* Test for tacho_edge.c: runs the generated edge sampler program in a
+   (minimal) PIO state machine emulator with tacho inputs and other
+   signals (PWM outputs, tacho outputs, PWM inputs...) toggling. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+
+#include "tacho_edge.h"
+
+
+#define CLK_SYS_HZ    125000000
+#define RX_FIFO_DEPTH 8    /* joined RX FIFO */
+#define MAX_WORDS     (1 << 16)
+
+static int failures = 0;
+static int checks = 0;
+
+#define CHECK(cond) do {						\
+		checks++;						\
+		if (!(cond)) {						\
+			fprintf(stderr, "%s:%d: check failed: %s\n",	\
+				__FILE__, __LINE__, #cond);		\
+			failures++;					\
+		}							\
+	} while (0)
+
+
+/* Input signals (square waves) */
+struct test_signal {
+	uint pin;
+	uint32_t half_period;  /* clock cycles */
+	uint32_t phase;
+};
+
+static struct test_signal signals[32];
+static int signal_count = 0;
+
+static void add_signal(uint pin, float freq, uint32_t phase)
+{
+	struct test_signal *s = &signals[signal_count++];
+
+	s->pin = pin;
+	s->half_period = CLK_SYS_HZ / freq / 2;
+	s->phase = phase;
+}
+
+static bool signal_level(const struct test_signal *s, uint64_t cycle)
+{
+	return ((cycle + s->phase) / s->half_period) & 1;
+}
+
+static uint32_t test_pins(uint64_t cycle)
+{
+	uint32_t pins = 0;
+
+	for (int i = 0; i < signal_count; i++) {
+		if (signal_level(&signals[i], cycle))
+			pins |= (1u << signals[i].pin);
+	}
+	return pins;
+}
+
+
+/* Minimal PIO emulator (only what edge sampler program needs) */
+
+pio_hw_t mock_pio_hw[NUM_PIOS] = { { 0 }, { 1 } };
+
+static struct test_sm {
+	pio_sm_config config;
+	uint pc;
+	uint32_t x, y, isr, osr;
+	uint32_t fifo[RX_FIFO_DEPTH];
+	uint64_t fifo_sample[RX_FIFO_DEPTH];
+	uint fifo_level;
+	bool enabled;
+	uint64_t last_sample; /* cycle of last "mov osr, pins" */
+} sm_state;
+
+static uint32_t words[MAX_WORDS];
+static uint64_t word_sample[MAX_WORDS];
+static uint word_count = 0;
+
+bool pio_can_add_program(PIO pio, const pio_program_t *program)
+{
+	return (program->length <= PIO_INSTRUCTION_COUNT);
+}
+
+int pio_add_program(PIO pio, const pio_program_t *program)
+{
+	uint offset = PIO_INSTRUCTION_COUNT - program->length;
+
+	for (uint i = 0; i < program->length; i++) {
+		uint16_t instr = program->instructions[i];
+		/* relocate JMPs */
+		pio->instr_mem[offset + i] = ((instr >> 13) == 0 ? instr + offset : instr);
+	}
+	return offset;
+}
+
+void pio_remove_program(PIO pio, const pio_program_t *program, uint loaded_offset)
+{
+}
+
+int pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config)
+{
+	memset(&sm_state, 0, sizeof(sm_state));
+	sm_state.config = *config;
+	sm_state.pc = initial_pc;
+	return 0;
+}
+
+static uint32_t sm_read_pins(uint64_t cycle)
+{
+	uint32_t pins = test_pins(cycle);
+	uint base = sm_state.config.in_base;
+
+	return (base ? (pins >> base) | (pins << (32 - base)) : pins);
+}
+
+static uint32_t sm_source(uint src, uint64_t cycle)
+{
+	switch (src) {
+	case 0: return sm_read_pins(cycle);
+	case 1: return sm_state.x;
+	case 2: return sm_state.y;
+	case 3: return 0;
+	case 6: return sm_state.isr;
+	case 7: return sm_state.osr;
+	}
+	fprintf(stderr, "unsupported source: %u\n", src);
+	exit(2);
+}
+
+static void sm_dest(uint dest, uint32_t val)
+{
+	switch (dest) {
+	case 1: sm_state.x = val; return;
+	case 2: sm_state.y = val; return;
+	case 6: sm_state.isr = val; return;
+	case 7: sm_state.osr = val; return;
+	}
+	fprintf(stderr, "unsupported destination: %u\n", dest);
+	exit(2);
+}
+
+/* Execute one instruction (one clock cycle). */
+static void sm_step(PIO pio, uint sm, uint64_t cycle, uint instr)
+{
+	uint op = instr >> 13;
+	uint arg1 = (instr >> 5) & 7;
+	uint arg2 = instr & 0x1f;
+	uint count = (arg2 ? arg2 : 32);
+	uint32_t val;
+	bool jump = false;
+
+	switch (op) {
+	case 0: /* JMP */
+		switch (arg1) {
+		case 0: jump = true; break;
+		case 4: jump = (sm_state.y-- != 0); break;
+		case 5: jump = (sm_state.x != sm_state.y); break;
+		default:
+			fprintf(stderr, "unsupported jmp condition: %u\n", arg1);
+			exit(2);
+		}
+		break;
+	case 2: /* IN */
+		val = sm_source(arg1, cycle);
+		if (count < 32) {
+			val &= (1u << count) - 1;
+			sm_state.isr = (sm_state.isr >> count) | (val << (32 - count));
+		} else {
+			sm_state.isr = val;
+		}
+		break;
+	case 3: /* OUT */
+		if (arg1 != 3) {
+			fprintf(stderr, "unsupported out destination: %u\n", arg1);
+			exit(2);
+		}
+		sm_state.osr = (count < 32 ? sm_state.osr >> count : 0);
+		break;
+	case 4: /* PUSH */
+		if (arg1 != 1) {
+			fprintf(stderr, "unsupported push/pull: %u\n", arg1);
+			exit(2);
+		}
+		if (sm_state.fifo_level >= RX_FIFO_DEPTH) {
+			pio->fdebug |= (1u << (PIO_FDEBUG_RXSTALL_LSB + sm));
+			return; /* stall */
+		}
+		sm_state.fifo_sample[sm_state.fifo_level] = sm_state.last_sample;
+		sm_state.fifo[sm_state.fifo_level++] = sm_state.isr;
+		sm_state.isr = 0;
+		break;
+	case 5: /* MOV */
+		if ((arg2 >> 3) != 0) {
+			fprintf(stderr, "unsupported mov operation\n");
+			exit(2);
+		}
+		if ((arg2 & 7) == 0)
+			sm_state.last_sample = cycle;
+		sm_dest(arg1, sm_source(arg2 & 7, cycle));
+		break;
+	case 7: /* SET */
+		sm_dest(arg1, arg2);
+		break;
+	default:
+		fprintf(stderr, "unsupported instruction: %04x\n", instr);
+		exit(2);
+	}
+
+	if (op == 0 && jump)
+		sm_state.pc = arg2;
+	else if (sm_state.pc == sm_state.config.wrap)
+		sm_state.pc = sm_state.config.wrap_target;
+	else
+		sm_state.pc = (sm_state.pc + 1) & (PIO_INSTRUCTION_COUNT - 1);
+}
+
+void pio_sm_exec(PIO pio, uint sm, uint instr)
+{
+	uint pc = sm_state.pc;
+
+	sm_step(pio, sm, 0, instr);
+	if ((instr >> 13) != 0)
+		sm_state.pc = pc;
+}
+
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled)
+{
+	sm_state.enabled = enabled;
+}
+
+/* Run state machine for given number of cycles, with DMA emptying RX FIFO
+   every 'drain' cycles. */
+static void sm_run(PIO pio, uint sm, uint64_t start, uint64_t cycles, uint drain)
+{
+	for (uint64_t cycle = start; cycle < start + cycles; cycle++) {
+		if (sm_state.enabled)
+			sm_step(pio, sm, cycle, pio->instr_mem[sm_state.pc]);
+		if (drain && cycle % drain == 0) {
+			for (uint i = 0; i < sm_state.fifo_level; i++) {
+				if (word_count < MAX_WORDS) {
+					word_sample[word_count] = sm_state.fifo_sample[i];
+					words[word_count++] = sm_state.fifo[i];
+				}
+			}
+			sm_state.fifo_level = 0;
+		}
+	}
+}
+
+
+/* Fan tacho inputs and other signals as on 0804 board */
+static const uint tacho_pins[] = { 2, 3, 20, 21, 22, 26, 1, 0 };
+#define TACHO_PIN_COUNT (sizeof(tacho_pins) / sizeof(tacho_pins[0]))
+
+static void setup_signals()
+{
+	int i;
+
+	signal_count = 0;
+	/* fan tacho inputs */
+	for (i = 0; i < TACHO_PIN_COUNT; i++)
+		add_signal(tacho_pins[i], 150.0 + 97.0 * i, 1000 * i);
+	/* fan PWM outputs (25kHz) */
+	for (i = 4; i <= 11; i++)
+		add_signal(i, 25000.0, 300 * i);
+	/* motherboard fan tacho outputs and PWM inputs (25kHz) */
+	for (i = 12; i <= 18; i += 2) {
+		add_signal(i, 100.0 + i, 0);
+		add_signal(i + 1, 25000.0, 77 * i);
+	}
+	/* WiFi SPI etc. */
+	add_signal(23, 1000000.0, 0);
+	add_signal(24, 3000000.0, 5);
+	add_signal(25, 500000.0, 11);
+	add_signal(29, 10000000.0, 3);
+}
+
+static uint32_t tacho_mask()
+{
+	uint32_t mask = 0;
+
+	for (int i = 0; i < TACHO_PIN_COUNT; i++)
+		mask |= (1u << tacho_pins[i]);
+	return mask;
+}
+
+
+static void test_program()
+{
+	uint32_t mask = tacho_mask();
+	int pin, i;
+
+	/* Sample bits are tacho pins in GPIO order */
+	CHECK(tacho_edge_load_program(pio1, mask) >= 0);
+	for (i = 0; (pin = tacho_edge_sample_pin(i)) >= 0; i++) {
+		CHECK(mask & (1u << pin));
+		CHECK(i == 0 || pin > tacho_edge_sample_pin(i - 1));
+	}
+	CHECK(i == TACHO_PIN_COUNT);
+	CHECK(tacho_edge_loop_cycles() <= 12);
+	/* Must fit next to PWM capture (or cyw43), see PIO allocation in fanpico.h */
+	CHECK(tacho_edge_program_len(mask) == 18);
+	CHECK(tacho_edge_program_len(1u << 28) == 14);
+
+	CHECK(tacho_edge_load_program(pio1, 0xffffffff) >= 0);
+	CHECK(tacho_edge_sample_pin(31) == 31);
+	CHECK(tacho_edge_load_program(pio1, 1u << 28) >= 0);
+	CHECK(tacho_edge_sample_pin(0) == 28 && tacho_edge_sample_pin(1) < 0);
+	/* Wraps around GPIO31 -> GPIO0 */
+	CHECK(tacho_edge_load_program(pio1, 0xc0000001) >= 0);
+	CHECK(tacho_edge_sample_pin(0) == 30 && tacho_edge_sample_pin(2) == 0);
+	CHECK(tacho_edge_loop_cycles() == 6 + 2);
+
+	/* Too many separate pins to fit in instruction memory */
+	CHECK(tacho_edge_load_program(pio1, 0x55555555) < 0);
+	CHECK(tacho_edge_load_program(pio1, 0) < 0);
+}
+
+static void test_sampling()
+{
+	const uint64_t run_cycles = CLK_SYS_HZ / 20;  /* 50ms */
+	uint32_t last_sample, last_ts, sample, ts, changed;
+	uint rising[TACHO_PIN_COUNT], expected[TACHO_PIN_COUNT];
+	uint64_t cycles, t, first;
+	uint loop, pairs, bits;
+	int offset, i, j, pin;
+
+	setup_signals();
+	word_count = 0;
+	pio1->fdebug = 0;
+	CHECK((offset = tacho_edge_load_program(pio1, tacho_mask())) >= 0);
+	tacho_edge_program_init(pio1, 0, offset);
+	tacho_edge_enabled(pio1, 0, true);
+	loop = tacho_edge_loop_cycles();
+	for (bits = 0; tacho_edge_sample_pin(bits) >= 0; bits++)
+		;
+
+	/* DMA keeps up when only the tacho pins generate samples */
+	sm_run(pio1, 0, 0, run_cycles, 64);
+	CHECK(!tacho_edge_rx_stalled(pio1, 0));
+	CHECK(word_count % 2 == 0);
+
+	/* Expected rising edges on tacho pins */
+	first = word_sample[0];
+	for (i = 0; i < TACHO_PIN_COUNT; i++) {
+		expected[i] = 0;
+		rising[i] = 0;
+		for (t = first + 1; t < word_sample[word_count - 1] + 1; t++) {
+			if (signal_level(&signals[i], t) && !signal_level(&signals[i], t - 1))
+				expected[i]++;
+		}
+	}
+
+	pairs = word_count / 2;
+	printf("%u samples in %llu cycles (%u cycles/loop)\n", pairs,
+		(unsigned long long)run_cycles, loop);
+	CHECK(pairs > 10 && pairs < 2 * 2 * 10000 * run_cycles / CLK_SYS_HZ);
+
+	last_sample = words[0];
+	last_ts = words[1];
+	cycles = first;
+	for (i = 1; i < pairs; i++) {
+		sample = words[i * 2];
+		ts = words[i * 2 + 1];
+
+		/* Timestamps give exact time between samples */
+		cycles += (uint64_t)(last_ts - ts) * loop + TACHO_EDGE_PUSH_CYCLES;
+		CHECK(cycles == word_sample[i * 2]);
+
+		/* Sample matches tacho pins, and there was a change */
+		CHECK((sample >> bits) == 0);
+		CHECK(sample != last_sample);
+		for (j = 0; j < bits; j++) {
+			pin = tacho_edge_sample_pin(j);
+			CHECK(((sample >> j) & 1) == ((test_pins(cycles) >> pin) & 1));
+		}
+
+		changed = sample & ~last_sample;
+		for (j = 0; j < bits; j++) {
+			if (!(changed & (1u << j)))
+				continue;
+			pin = tacho_edge_sample_pin(j);
+			for (int k = 0; k < TACHO_PIN_COUNT; k++) {
+				if (tacho_pins[k] == pin)
+					rising[k]++;
+			}
+		}
+		last_sample = sample;
+		last_ts = ts;
+	}
+	for (i = 0; i < TACHO_PIN_COUNT; i++)
+		CHECK(rising[i] == expected[i]);
+}
+
+static void test_stall()
+{
+	int offset;
+
+	setup_signals();
+	word_count = 0;
+	pio1->fdebug = 0;
+	CHECK((offset = tacho_edge_load_program(pio1, tacho_mask())) >= 0);
+	tacho_edge_program_init(pio1, 0, offset);
+	tacho_edge_enabled(pio1, 0, true);
+
+	/* RX FIFO is not emptied: state machine stalls, samples stay in pairs */
+	sm_run(pio1, 0, 0, CLK_SYS_HZ / 100, 0);
+	CHECK(sm_state.fifo_level == RX_FIFO_DEPTH);
+	CHECK(tacho_edge_rx_stalled(pio1, 0));
+}
+
+
+int main(int argc, char **argv)
+{
+	test_program();
+	test_sampling();
+	test_stall();
+
+	printf("%d checks, %d failures\n", checks, failures);
+
+	return (failures > 0 ? 1 : 0);
+}
+
+
+/* eof :-) */
@@ -37,8 +37,12 @@ void set_binary_info()
 
 #if TX_PIN >= 0
 	bi_decl(bi_1pin_with_name(TX_PIN, "TX (Serial) / MISO (SPI)"));
+#if ONEWIRE_PIN == RX_PIN
+	bi_decl(bi_1pin_with_name(RX_PIN, "RX (Serial) / CS (SPI) / 1-Wire"));
+#else
 	bi_decl(bi_1pin_with_name(RX_PIN, "RX (Serial) / CS (SPI)"));
 #endif
+#endif
 #if SDA_PIN >= 0
 	bi_decl(bi_1pin_with_name(SDA_PIN, "SDA (I2C) / SCK (SPI)"));
 	bi_decl(bi_1pin_with_name(SCL_PIN, "SCL (I2C) / MOSI (SPI)"));
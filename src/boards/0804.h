@@ -77,6 +77,9 @@
 #define TX_PIN   -1
 #define RX_PIN   -1
 
+/* 1-Wire */
+#define ONEWIRE_PIN  -1
+
 /* SPI */
 #define SCK_PIN  -1
 #define MOSI_PIN -1
@@ -76,6 +76,9 @@
 #define TX_PIN    0
 #define RX_PIN    1
 
+/* 1-Wire */
+#define ONEWIRE_PIN  1 /* shared with RX (Serial) / CS (SPI) */
+
 /* SPI */
 #define SCK_PIN        2
 #define MOSI_PIN       3
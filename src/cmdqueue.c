@@ -0,0 +1,241 @@
+/* cmdqueue.c
+   Copyright (C) 2021-2024 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of FanPico.
+
+   FanPico is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   FanPico is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with FanPico. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+
+#include "fanpico.h"
+
+
+/*
+ * Command queue.
+ *
+ * All SCPI command sources (console, telnet and MQTT) queue commands here, and
+ * queue is serviced from the core0 main loop (cmdq_poll()) within given
+ * time budget. Commands are processed in the order received, and the
+ * result is routed back to the source of the command.
+ *
+ * Commands may be queued from interrupt context (lwIP callbacks), so
+ * queue is protected by disabling interrupts.
+ */
+
+#define CMDQ_LEN         8
+#define CMDQ_CMD_MAX_LEN 256
+
+struct cmdq_entry {
+	enum cmd_source source;
+	int8_t session;   /* telnet session (or -1) */
+	uint64_t queued;  /* us since boot */
+	char cmd[CMDQ_CMD_MAX_LEN];
+};
+
+static struct cmdq_entry cmdq[CMDQ_LEN];
+static volatile uint32_t cmdq_head = 0;
+static volatile uint32_t cmdq_tail = 0;
+static struct cmdq_stats stats;
+
+
+static const char *cmd_source_names[] = {
+	"console",
+	"mqtt",
+	"telnet",
+};
+
+const char* cmd_source2str(enum cmd_source source)
+{
+	if (source < 0 || source >= CMD_SOURCE_COUNT)
+		return "unknown";
+	return cmd_source_names[source];
+}
+
+
+static int cmdq_add(enum cmd_source source, int session, const char *cmd)
+{
+	struct cmdq_entry *e;
+	uint32_t irq, depth;
+
+	if (!cmd || source < 0 || source >= CMD_SOURCE_COUNT)
+		return -1;
+	if (strlen(cmd) >= CMDQ_CMD_MAX_LEN)
+		return -2;
+
+	irq = save_and_disable_interrupts();
+	depth = cmdq_head - cmdq_tail;
+	if (depth >= CMDQ_LEN) {
+		stats.rejected[source]++;
+		restore_interrupts(irq);
+		return -3;
+	}
+	e = &cmdq[cmdq_head % CMDQ_LEN];
+	e->source = source;
+	e->session = session;
+	e->queued = to_us_since_boot(get_absolute_time());
+	strncopy(e->cmd, cmd, sizeof(e->cmd));
+	cmdq_head++;
+	stats.queued[source]++;
+	if (++depth > stats.max_depth)
+		stats.max_depth = depth;
+	restore_interrupts(irq);
+
+	return 0;
+}
+
+
+int cmdq_enqueue(enum cmd_source source, const char *cmd)
+{
+	return cmdq_add(source, -1, cmd);
+}
+
+
+static void cmdq_select_output(enum cmd_source source, int session)
+{
+#ifdef WIFI_SUPPORT
+	/* Output of telnet commands goes only to the session that sent it */
+	if (source == CMD_SRC_TELNET)
+		telnetserver_select(session);
+#endif
+}
+
+
+static void cmdq_route_response(enum cmd_source source, const char *cmd, int status)
+{
+	switch (source) {
+#ifdef WIFI_SUPPORT
+	case CMD_SRC_MQTT:
+		fanpico_mqtt_scpi_response(cmd, status);
+		break;
+#endif
+	default:
+		/* Console output goes directly to stdio */
+		break;
+	}
+}
+
+
+/* Process one command from the queue. Returns false if queue was empty. */
+bool cmdq_process_one()
+{
+	struct cmdq_entry e;
+	char cmd[CMDQ_CMD_MAX_LEN];
+	uint32_t irq;
+	uint64_t latency;
+
+	irq = save_and_disable_interrupts();
+	if (cmdq_head == cmdq_tail) {
+		restore_interrupts(irq);
+		return false;
+	}
+	memcpy(&e, &cmdq[cmdq_tail % CMDQ_LEN], sizeof(e));
+	cmdq_tail++;
+	restore_interrupts(irq);
+
+	latency = to_us_since_boot(get_absolute_time()) - e.queued;
+	stats.processed[e.source]++;
+	stats.latency_total += latency;
+	if (latency > stats.latency_max)
+		stats.latency_max = latency;
+
+	/* process_command() modifies the command buffer */
+	strncopy(cmd, e.cmd, sizeof(cmd));
+	update_system_state();
+	cmdq_select_output(e.source, e.session);
+	process_command(fanpico_state, (struct fanpico_config *)cfg, cmd);
+	cmdq_select_output(e.source, -1);
+	cmdq_route_response(e.source, e.cmd, last_command_status());
+
+	return true;
+}
+
+
+/* Process queued commands until queue is empty or time budget is used.
+ * (at least one command is processed per call). */
+void cmdq_poll(uint32_t budget_us)
+{
+	absolute_time_t deadline = make_timeout_time_us(budget_us);
+
+	while (cmdq_process_one()) {
+		if (time_reached(deadline))
+			break;
+	}
+}
+
+
+/* Run command synchronously (after any commands queued before it), as
+ * some commands read further input from the console (or session).
+ * Commands that do not fit in the queue (or if queue is full) are
+ * processed directly. */
+static void cmdq_run_command(enum cmd_source source, int session, char *cmd)
+{
+	int res;
+
+	res = cmdq_add(source, session, cmd);
+	while (cmdq_process_one())
+		;
+	if (res < 0) {
+		update_system_state();
+		cmdq_select_output(source, session);
+		process_command(fanpico_state, (struct fanpico_config *)cfg, cmd);
+		cmdq_select_output(source, -1);
+	}
+}
+
+
+/* Run command from console. */
+void cmdq_console_command(char *cmd)
+{
+	cmdq_run_command(CMD_SRC_CONSOLE, -1, cmd);
+}
+
+
+/* Run command from telnet session. */
+void cmdq_telnet_command(int session, char *cmd)
+{
+	cmdq_run_command(CMD_SRC_TELNET, session, cmd);
+}
+
+
+void cmdq_get_stats(struct cmdq_stats *s)
+{
+	uint32_t irq;
+
+	if (!s)
+		return;
+
+	irq = save_and_disable_interrupts();
+	memcpy(s, &stats, sizeof(*s));
+	s->depth = cmdq_head - cmdq_tail;
+	restore_interrupts(irq);
+}
+
+
+void cmdq_reset_stats()
+{
+	uint32_t irq;
+
+	irq = save_and_disable_interrupts();
+	memset(&stats, 0, sizeof(stats));
+	restore_interrupts(irq);
+}
+
+
+/* eof :-) */
@@ -26,6 +26,7 @@
 #include <ctype.h>
 #include <wctype.h>
 #include <assert.h>
+#include <malloc.h>
 #include "pico/stdlib.h"
 #include "pico/unique_id.h"
 #include "pico/bootrom.h"
@@ -33,6 +34,7 @@
 #include "pico/rand.h"
 #include "hardware/watchdog.h"
 #include "hardware/rtc.h"
+#include "hardware/clocks.h"
 #include "cJSON.h"
 #include "lfs.h"
 #include "fanpico.h"
@@ -230,6 +232,10 @@ int cmd_usb_boot(const char *cmd, const char *args, int query, char *prev_cmd)
 
 	snprintf(buf, sizeof(buf), " fanpico-%s-%s", FANPICO_MODEL, PICO_BOARD);
 	display_message(8, msg);
+	/* Firmware may get upgraded, make sure JSON config is up to date */
+	compact_config(false);
+	if (flash_flush() < 0)
+		log_msg(LOG_ERR, "Failed to save pending file(s) to flash");
 
 	reset_usb_boot(0, 0);
 	return 0; /* should never get this far... */
@@ -376,6 +382,77 @@ int cmd_syslog_level(const char *cmd, const char *args, int query, char *prev_cm
 	return 0;
 }
 
+int cmd_syslog_rate(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+#ifdef WIFI_SUPPORT
+	return uint32_setting(cmd, args, query, prev_cmd,
+			&conf->syslog_rate, 0, 1000, "Syslog Rate Limit");
+#else
+	return 1;
+#endif
+}
+
+int cmd_faults(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+	int i;
+
+	if (!query)
+		return 1;
+
+	for (i = 0; i < FAN_COUNT; i++) {
+		printf("fan%d,\"%s\",%s\n", i + 1, conf->fans[i].name,
+			fan_fault2str(st->fan_fault[i]));
+	}
+
+	return 0;
+}
+
+int cmd_fault_failsafe(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+	return bool_setting(cmd, args, query, prev_cmd,
+			&conf->fault_failsafe, "Fan Fault Fail-safe Mode");
+}
+
+int cmd_fault_stall_time(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+	return uint32_setting(cmd, args, query, prev_cmd,
+			&conf->fault_stall_time, 50, 10000, "Fan Stall Detection Time");
+}
+
+int cmd_interval_tacho(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+	return uint32_setting(cmd, args, query, prev_cmd, &conf->tacho_interval,
+			MIN_TACHO_INTERVAL, MAX_TASK_INTERVAL, "Tacho Input Update Interval");
+}
+
+int cmd_interval_pwm_input(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+	return uint32_setting(cmd, args, query, prev_cmd, &conf->pwm_input_interval,
+			MIN_PWM_INPUT_INTERVAL, MAX_TASK_INTERVAL, "PWM Input Update Interval");
+}
+
+int cmd_interval_sensors(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+	return uint32_setting(cmd, args, query, prev_cmd, &conf->sensor_interval,
+			MIN_SENSOR_INTERVAL, MAX_TASK_INTERVAL, "Sensor Update Interval");
+}
+
+int cmd_interval_outputs(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+	return uint32_setting(cmd, args, query, prev_cmd, &conf->output_interval,
+			MIN_OUTPUT_INTERVAL, MAX_TASK_INTERVAL, "Output Update Interval");
+}
+
+int cmd_syslog_batch(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+#ifdef WIFI_SUPPORT
+	return bool_setting(cmd, args, query, prev_cmd,
+			&conf->syslog_batch, "Syslog Batching");
+#else
+	return 1;
+#endif
+}
+
 int cmd_echo(const char *cmd, const char *args, int query, char *prev_cmd)
 {
 	return bool_setting(cmd, args, query, prev_cmd,
@@ -419,6 +496,8 @@ int cmd_reset(const char *cmd, const char *args, int query, char *prev_cmd)
 	log_msg(LOG_ALERT, "Initiating reboot...");
 	display_message(1, msg);
 	update_persistent_memory();
+	if (flash_flush() < 0)
+		log_msg(LOG_ERR, "Failed to save pending file(s) to flash");
 
 	watchdog_disable();
 	sleep_ms(500);
@@ -437,6 +516,19 @@ int cmd_save_config(const char *cmd, const char *args, int query, char *prev_cmd
 	return 0;
 }
 
+int cmd_compact_config(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+	if (query)
+		return 1;
+	return (compact_config(true) < 0 ? 2 : 0);
+}
+
+int cmd_autosave(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+	return uint32_setting(cmd, args, query, prev_cmd,
+			&conf->config_autosave, 0, 86400, "Config Autosave Delay");
+}
+
 int cmd_print_config(const char *cmd, const char *args, int query, char *prev_cmd)
 {
 	if (!query)
@@ -467,6 +559,34 @@ int cmd_zero(const char *cmd, const char *args, int query, char *prev_cmd)
 	return 0;
 }
 
+int cmd_history(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+	struct history_iter it;
+	char *param, *tok, *saveptr;
+	char buf[64];
+	int res, count = 0;
+
+	if (!query)
+		return 1;
+
+	param = strdup(args);
+	tok = strtok_r(param, ", ", &saveptr);
+	res = str2history_res(tok);
+	if (tok && (tok = strtok_r(NULL, ", ", &saveptr))) {
+		if (!str_to_int(tok, &count, 10) || count < 0)
+			res = -1;
+	}
+	free(param);
+	if (res < 0)
+		return 2;
+
+	history_iter_init(&it, res, count);
+	while (history_iter_next(&it, buf, sizeof(buf)) > 0)
+		printf("%s", buf);
+
+	return 0;
+}
+
 int cmd_read(const char *cmd, const char *args, int query, char *prev_cmd)
 {
 	int i;
@@ -679,8 +799,7 @@ int cmd_fan_filter(const char *cmd, const char *args, int query, char *prev_cmd)
 			new_ctx = filter_parse_args(new_filter, tok);
 			if (new_filter == FILTER_NONE || new_ctx != NULL) {
 				f->filter = new_filter;
-				if (f->filter_ctx)
-					free(f->filter_ctx);
+				filter_free_ctx(f->filter_ctx);
 				f->filter_ctx = new_ctx;
 			} else {
 				ret = 1;
@@ -717,6 +836,107 @@ int cmd_fan_rpm_factor(const char *cmd, const char *args, int query, char *prev_
 	return 1;
 }
 
+int cmd_fan_max_rpm(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+	int fan;
+	int val;
+
+	fan = atoi(&prev_cmd[3]) - 1;
+	if (fan >= 0 && fan < FAN_COUNT) {
+		if (query) {
+			printf("%u\n", conf->fans[fan].max_rpm);
+		} else if (str_to_int(args, &val, 10)) {
+			if (val >= 0 && val <= 50000) {
+				log_msg(LOG_NOTICE, "fan%d: change nominal max RPM %u --> %d",
+					fan + 1, conf->fans[fan].max_rpm, val);
+				conf->fans[fan].max_rpm = val;
+			} else {
+				log_msg(LOG_WARNING, "fan%d: invalid new value for max RPM: %d",
+					fan + 1, val);
+				return 2;
+			}
+		}
+		return 0;
+	}
+	return 1;
+}
+
+int cmd_fan_mode(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+	int fan;
+	bool rpm_mode;
+
+	fan = atoi(&prev_cmd[3]) - 1;
+	if (fan < 0 || fan >= FAN_COUNT)
+		return 1;
+
+	if (query) {
+		printf("%s\n", (conf->fans[fan].rpm_mode ? "RPM" : "PWM"));
+		return 0;
+	}
+
+	if (!strncasecmp(args, "rpm", 4)) {
+		rpm_mode = true;
+	} else if (!strncasecmp(args, "pwm", 4)) {
+		rpm_mode = false;
+	} else {
+		log_msg(LOG_WARNING, "fan%d: invalid control mode: %s", fan + 1, args);
+		return 2;
+	}
+	if (rpm_mode && conf->fans[fan].max_rpm == 0)
+		log_msg(LOG_WARNING, "fan%d: RPM mode requires RPMMax to be set", fan + 1);
+	if (conf->fans[fan].rpm_mode != rpm_mode) {
+		log_msg(LOG_NOTICE, "fan%d: change control mode %s --> %s", fan + 1,
+			(conf->fans[fan].rpm_mode ? "RPM" : "PWM"), (rpm_mode ? "RPM" : "PWM"));
+		conf->fans[fan].rpm_mode = rpm_mode;
+	}
+
+	return 0;
+}
+
+int cmd_fan_pid(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+	struct fan_output *f;
+	float gains[3];
+	char *arg, *t, *saveptr;
+	int fan, count = 0;
+	int ret = 0;
+
+	fan = atoi(&prev_cmd[3]) - 1;
+	if (fan < 0 || fan >= FAN_COUNT)
+		return 1;
+	f = &conf->fans[fan];
+
+	if (query) {
+		printf("%f,%f,%f\n", f->pid_kp, f->pid_ki, f->pid_kd);
+		return 0;
+	}
+
+	if (!(arg = strdup(args)))
+		return 2;
+	t = strtok_r(arg, ",", &saveptr);
+	while (t && count < 3) {
+		if (!str_to_float(t, &gains[count]) || gains[count] < 0.0)
+			break;
+		count++;
+		t = strtok_r(NULL, ",", &saveptr);
+	}
+	if (count == 3 && !t) {
+		log_msg(LOG_NOTICE, "fan%d: change PID gains %f,%f,%f --> %f,%f,%f",
+			fan + 1, f->pid_kp, f->pid_ki, f->pid_kd,
+			gains[0], gains[1], gains[2]);
+		f->pid_kp = gains[0];
+		f->pid_ki = gains[1];
+		f->pid_kd = gains[2];
+	} else {
+		log_msg(LOG_WARNING, "fan%d: invalid PID gains: %s", fan + 1, args);
+		ret = 2;
+	}
+	free(arg);
+
+	return ret;
+}
+
 int cmd_fan_source(const char *cmd, const char *args, int query, char *prev_cmd)
 {
 	int fan;
@@ -742,7 +962,12 @@ int cmd_fan_source(const char *cmd, const char *args, int query, char *prev_cmd)
 			d_n = (type != PWM_FIXED ? 1 : 0);
 			if ((tok = strtok_r(NULL, ",", &saveptr)) != NULL) {
 				val = atoi(tok) - d_n;
-				if (valid_pwm_source_ref(type, val)) {
+				if (type == PWM_FAN && valid_pwm_source_ref(type, val)
+					&& pwm_source_loop(conf, fan, type, val)) {
+					log_msg(LOG_WARNING, "fan%d: source would create a loop: %s",
+						fan + 1, args);
+					ret = 2;
+				} else if (valid_pwm_source_ref(type, val)) {
 					d_o = (conf->fans[fan].s_type != PWM_FIXED ? 1 : 0);
 					log_msg(LOG_NOTICE, "fan%d: change source %s,%u --> %s,%u",
 						fan + 1,
@@ -804,6 +1029,56 @@ int cmd_fan_tacho(const char *cmd, const char *args, int query, char *prev_cmd)
 	return 1;
 }
 
+int cmd_fan_age(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+	int fan;
+	int64_t age;
+
+	if (!query)
+		return 1;
+
+	fan = atoi(&prev_cmd[3]) - 1;
+	if (fan >= 0 && fan < FAN_COUNT) {
+		age = absolute_time_diff_us(st->fan_freq_updated[fan], get_absolute_time());
+		printf("%lld\n", age / 1000);
+		return 0;
+	}
+
+	return 1;
+}
+
+int cmd_fan_target(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+	int fan;
+
+	if (!query)
+		return 1;
+
+	fan = atoi(&prev_cmd[3]) - 1;
+	if (fan >= 0 && fan < FAN_COUNT) {
+		printf("%.0f\n", st->fan_rpm_target[fan]);
+		return 0;
+	}
+
+	return 1;
+}
+
+int cmd_fan_fault(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+	int fan;
+
+	if (!query)
+		return 1;
+
+	fan = atoi(&prev_cmd[3]) - 1;
+	if (fan >= 0 && fan < FAN_COUNT) {
+		printf("%s\n", fan_fault2str(st->fan_fault[fan]));
+		return 0;
+	}
+
+	return 1;
+}
+
 int cmd_fan_pwm(const char *cmd, const char *args, int query, char *prev_cmd)
 {
 	int fan;
@@ -1190,6 +1465,24 @@ int cmd_mbfan_read(const char *cmd, const char *args, int query, char *prev_cmd)
 	return 1;
 }
 
+int cmd_mbfan_signal(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+	int fan;
+
+	if (query) {
+		fan = atoi(&prev_cmd[5]) - 1;
+		if (fan >= 0 && fan < MBFAN_COUNT) {
+			log_msg(LOG_DEBUG, "mbfan%d duty = %f%%, freq = %fHz, lost = %d",
+				fan + 1, st->mbfan_duty[fan], st->mbfan_pwm_freq[fan],
+				st->mbfan_pwm_lost[fan]);
+			printf("%.1f,%.1f,%s\n", st->mbfan_duty[fan], st->mbfan_pwm_freq[fan],
+				(st->mbfan_pwm_lost[fan] ? "LOST" : "OK"));
+			return 0;
+		}
+	}
+	return 1;
+}
+
 int cmd_mbfan_filter(const char *cmd, const char *args, int query, char *prev_cmd)
 {
 	int mbfan;
@@ -1221,8 +1514,7 @@ int cmd_mbfan_filter(const char *cmd, const char *args, int query, char *prev_cm
 			new_ctx = filter_parse_args(new_filter, tok);
 			if (new_filter == FILTER_NONE || new_ctx != NULL) {
 				m->filter = new_filter;
-				if (m->filter_ctx)
-					free(m->filter_ctx);
+				filter_free_ctx(m->filter_ctx);
 				m->filter_ctx = new_ctx;
 			} else {
 				ret = 1;
@@ -1475,8 +1767,7 @@ int cmd_sensor_filter(const char *cmd, const char *args, int query, char *prev_c
 			new_ctx = filter_parse_args(new_filter, tok);
 			if (new_filter == FILTER_NONE || new_ctx != NULL) {
 				s->filter = new_filter;
-				if (s->filter_ctx)
-					free(s->filter_ctx);
+				filter_free_ctx(s->filter_ctx);
 				s->filter_ctx = new_ctx;
 			} else {
 				ret = 1;
@@ -1510,10 +1801,11 @@ int cmd_vsensor_name(const char *cmd, const char *args, int query, char *prev_cm
 int cmd_vsensor_source(const char *cmd, const char *args, int query, char *prev_cmd)
 {
 	int sensor, val, i;
-	uint8_t vsmode, selected[SENSOR_MAX_COUNT];
+	uint8_t vsmode, selected[VSENSOR_SOURCE_MAX_COUNT];
 	float default_temp;
-	int timeout;
-	char *tok, *saveptr, *param, temp_str[32], tmp[8];
+	int timeout, type;
+	uint64_t addr;
+	char *tok, *saveptr, *param, temp_str[64], tmp[8], src[8];
 	int ret = 0;
 	int count = 0;
 
@@ -1528,10 +1820,18 @@ int cmd_vsensor_source(const char *cmd, const char *args, int query, char *prev_
 			printf(",%0.2f,%ld",
 				conf->vsensors[sensor].default_temp,
 				conf->vsensors[sensor].timeout);
+		} else if (vsmode == VSMODE_ONEWIRE) {
+			printf(",%016llX,%0.2f", conf->vsensors[sensor].onewire_addr,
+				conf->vsensors[sensor].default_temp);
+		} else if (vsmode == VSMODE_I2C) {
+			printf(",%s,0x%02x,%0.2f", i2c_type2str(conf->vsensors[sensor].i2c_type),
+				conf->vsensors[sensor].i2c_addr,
+				conf->vsensors[sensor].default_temp);
 		} else {
-			for(i = 0; i < SENSOR_COUNT; i++) {
+			for(i = 0; i < VSENSOR_SOURCE_MAX_COUNT; i++) {
 				if (conf->vsensors[sensor].sensors[i]) {
-					printf(",%d", conf->vsensors[sensor].sensors[i]);
+					printf(",%s", vsensor_source2str(conf->vsensors[sensor].sensors[i],
+									tmp, sizeof(tmp)));
 				}
 			}
 		}
@@ -1561,17 +1861,49 @@ int cmd_vsensor_source(const char *cmd, const char *args, int query, char *prev_
 						ret = 0;
 					}
 				}
+			} else if (vsmode == VSMODE_ONEWIRE) {
+				tok = strtok_r(NULL, ",", &saveptr);
+				addr = (tok ? strtoull(tok, NULL, 16) : 0);
+				tok = strtok_r(NULL, ",", &saveptr);
+				default_temp = DSENSOR_FAILSAFE_TEMP;
+				if (addr && (!tok || str_to_float(tok, &default_temp))) {
+					log_msg(LOG_NOTICE, "vsensor%d: set source to %s,%016llX,%0.2f",
+						sensor + 1, vsmode2str(vsmode), addr, default_temp);
+					conf->vsensors[sensor].mode = vsmode;
+					conf->vsensors[sensor].onewire_addr = addr;
+					conf->vsensors[sensor].default_temp = default_temp;
+					ret = 0;
+				}
+			} else if (vsmode == VSMODE_I2C) {
+				tok = strtok_r(NULL, ",", &saveptr);
+				type = str2i2c_type(tok);
+				tok = strtok_r(NULL, ",", &saveptr);
+				if (type > 0 && str_to_int(tok, &val, 0) && val > 0 && val < 0x80) {
+					tok = strtok_r(NULL, ",", &saveptr);
+					default_temp = DSENSOR_FAILSAFE_TEMP;
+					if (!tok || str_to_float(tok, &default_temp)) {
+						log_msg(LOG_NOTICE, "vsensor%d: set source to %s,%s,0x%02x,%0.2f",
+							sensor + 1, vsmode2str(vsmode), i2c_type2str(type), val,
+							default_temp);
+						conf->vsensors[sensor].mode = vsmode;
+						conf->vsensors[sensor].i2c_type = type;
+						conf->vsensors[sensor].i2c_addr = val;
+						conf->vsensors[sensor].default_temp = default_temp;
+						ret = 0;
+					}
+				}
 			} else {
 				temp_str[0] = 0;
-				for(i = 0; i < SENSOR_MAX_COUNT; i++)
+				for(i = 0; i < VSENSOR_SOURCE_MAX_COUNT; i++)
 					selected[i] = 0;
 				while((tok = strtok_r(NULL, ",", &saveptr)) != NULL) {
-					if (count < SENSOR_MAX_COUNT && str_to_int(tok, &val, 10)) {
-						if (val >= 1 && val <= SENSOR_COUNT) {
-							selected[count++] = val;
-							snprintf(tmp, sizeof(tmp), ",%d", val);
-							strncatenate(temp_str, tmp, sizeof(temp_str));
-						}
+					val = str2vsensor_source(tok);
+					if (count < VSENSOR_SOURCE_MAX_COUNT && val > 0
+						&& val != (VSENSOR_SOURCE_VSENSOR | (sensor + 1))) {
+						selected[count++] = val;
+						snprintf(tmp, sizeof(tmp), ",%s",
+							vsensor_source2str(val, src, sizeof(src)));
+						strncatenate(temp_str, tmp, sizeof(temp_str));
 					}
 				}
 				if (count >= 2) {
@@ -1580,7 +1912,7 @@ int cmd_vsensor_source(const char *cmd, const char *args, int query, char *prev_
 						vsmode2str(vsmode),
 						temp_str);
 					conf->vsensors[sensor].mode = vsmode;
-					for(i = 0; i < SENSOR_COUNT; i++) {
+					for(i = 0; i < VSENSOR_SOURCE_MAX_COUNT; i++) {
 						conf->vsensors[sensor].sensors[i] = selected[i];
 					}
 					ret = 0;
@@ -1693,8 +2025,7 @@ int cmd_vsensor_filter(const char *cmd, const char *args, int query, char *prev_
 			new_ctx = filter_parse_args(new_filter, tok);
 			if (new_filter == FILTER_NONE || new_ctx != NULL) {
 				s->filter = new_filter;
-				if (s->filter_ctx)
-					free(s->filter_ctx);
+				filter_free_ctx(s->filter_ctx);
 				s->filter_ctx = new_ctx;
 			} else {
 				ret = 1;
@@ -1917,6 +2248,24 @@ int cmd_mqtt_duty_interval(const char *cmd, const char *args, int query, char *p
 			&conf->mqtt_duty_interval, 0, (86400 * 30), "MQTT Publish PWM Interval");
 }
 
+int cmd_mqtt_bulk_interval(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+	return uint32_setting(cmd, args, query, prev_cmd,
+			&conf->mqtt_bulk_interval, 0, (86400 * 30), "MQTT Publish Bulk Interval");
+}
+
+int cmd_mqtt_change_only(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+	return bool_setting(cmd, args, query, prev_cmd,
+			&conf->mqtt_change_only, "MQTT Publish Only Changes");
+}
+
+int cmd_mqtt_heartbeat(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+	return uint32_setting(cmd, args, query, prev_cmd,
+			&conf->mqtt_heartbeat, 0, (86400 * 30), "MQTT Heartbeat Interval");
+}
+
 int cmd_mqtt_allow_scpi(const char *cmd, const char *args, int query, char *prev_cmd)
 {
 	return bool_setting(cmd, args, query, prev_cmd,
@@ -1944,6 +2293,13 @@ int cmd_mqtt_resp_topic(const char *cmd, const char *args, int query, char *prev
 			sizeof(conf->mqtt_resp_topic), "MQTT Response Topic", NULL);
 }
 
+int cmd_mqtt_bulk_topic(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+	return string_setting(cmd, args, query, prev_cmd,
+			conf->mqtt_bulk_topic,
+			sizeof(conf->mqtt_bulk_topic), "MQTT Bulk Topic", NULL);
+}
+
 int cmd_mqtt_temp_topic(const char *cmd, const char *args, int query, char *prev_cmd)
 {
 	return string_setting(cmd, args, query, prev_cmd,
@@ -2079,7 +2435,7 @@ int cmd_tls_pkey(const char *cmd, const char *args, int query, char *prev_cmd)
 		}
 		if (res == 0) {
 			res = flash_write_file(buf, strlen(buf) + 1, "key.pem");
-			if (res) {
+			if (res < 0 || flash_flush() < 0) {
 				printf("Failed to save private key.\n");
 				res = 2;
 			} else {
@@ -2146,7 +2502,7 @@ int cmd_tls_cert(const char *cmd, const char *args, int query, char *prev_cmd)
 			res = 2;
 		} else {
 			res = flash_write_file(buf, strlen(buf) + 1, "cert.pem");
-			if (res) {
+			if (res < 0 || flash_flush() < 0) {
 				printf("Failed to save certificate.\n");
 				res = 2;
 			} else {
@@ -2212,6 +2568,33 @@ int cmd_telnet_pass(const char *cmd, const char *args, int query, char *prev_cmd
 	}
 	return 0;
 }
+
+int cmd_telemetry(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+	if (!query)
+		return 1;
+
+	telemetry_status();
+	return 0;
+}
+
+int cmd_telemetry_server(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+	return ip_change(cmd, args, query, prev_cmd, "Telemetry Server", &conf->telemetry_server);
+}
+
+int cmd_telemetry_port(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+	return uint32_setting(cmd, args, query, prev_cmd,
+			&conf->telemetry_port, 0, 65535, "Telemetry Port");
+}
+
+int cmd_telemetry_interval(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+	return uint32_setting(cmd, args, query, prev_cmd,
+			&conf->telemetry_interval, MIN_TELEMETRY_INTERVAL, 3600 * 1000,
+			"Telemetry Interval");
+}
 #endif /* WIFI_SUPPOERT */
 
 int cmd_time(const char *cmd, const char *args, int query, char *prev_cmd)
@@ -2311,6 +2694,403 @@ int cmd_flash(const char *cmd, const char *args, int query, char *prev_cmd)
 }
 
 
+int cmd_tasks(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+	const struct core1_task *t;
+
+	if (!query)
+		return 1;
+
+	printf("task           period     runs  overruns  jitter_avg  jitter_max  runtime_max\n");
+	for (t = core1_task_list; t->name; t++) {
+		printf("%-12s %6lums %8lu %9lu %9lluus %9luus %10luus\n",
+			t->name, t->period, t->runs, t->overruns,
+			(t->runs > 0 ? t->jitter_total / t->runs : 0),
+			t->jitter_max, t->runtime_max);
+	}
+	printf("log messages dropped: %lu\n", log_dropped_messages());
+
+	return 0;
+}
+
+
+int cmd_boot(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+	const struct boot_phase *list;
+	uint64_t prev = 0;
+	int count, i;
+
+	if (!query)
+		return 1;
+
+	count = get_boot_phases(&list);
+	printf("phase          time_ms  duration_ms\n");
+	for (i = 0; i < count; i++) {
+		printf("%-12s %9.1f %12.1f\n", list[i].name,
+			list[i].t / 1000.0, (list[i].t - prev) / 1000.0);
+		prev = list[i].t;
+	}
+
+	return 0;
+}
+
+
+int cmd_cmdqueue(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+	struct cmdq_stats s;
+	uint32_t processed = 0;
+	int i;
+
+	if (!query) {
+		/* Any (non-query) form of the command resets the counters. */
+		cmdq_reset_stats();
+		return 0;
+	}
+
+	cmdq_get_stats(&s);
+	printf("source       queued  processed   rejected\n");
+	for (i = 0; i < CMD_SOURCE_COUNT; i++) {
+		printf("%-10s %8lu %10lu %10lu\n", cmd_source2str(i),
+			s.queued[i], s.processed[i], s.rejected[i]);
+		processed += s.processed[i];
+	}
+	printf("depth: %lu (max %lu)\n", s.depth, s.max_depth);
+	printf("latency: avg %lluus, max %lluus\n",
+		(processed > 0 ? s.latency_total / processed : 0), s.latency_max);
+
+	return 0;
+}
+
+
+int cmd_analytics(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+	struct pmem_analytics a;
+	int i;
+
+	if (!query) {
+		/* Any (non-query) form of the command resets the counters. */
+		reset_analytics();
+		return 0;
+	}
+
+	get_analytics(&a);
+	printf("fan   run_hours     stalls  rpm_min  rpm_max\n");
+	for (i = 0; i < FAN_COUNT; i++) {
+		printf("%-3d %11.2f %10lu %8u %8u\n", i + 1,
+			a.fans[i].run_time / 3600.0, a.fans[i].stalls,
+			a.fans[i].rpm_min, a.fans[i].rpm_max);
+	}
+	printf("sensor  temp_max\n");
+	for (i = 0; i < SENSOR_COUNT; i++) {
+		if (a.temp_valid & (1 << i))
+			printf("%-6d %9.1f\n", i + 1, a.temp_max[i]);
+		else
+			printf("%-6d %9s\n", i + 1, "-");
+	}
+
+	return 0;
+}
+
+int cmd_perf(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+	struct perf_counter c;
+	int i, j;
+
+	if (!query) {
+		/* Any (non-query) form of the command resets the counters. */
+		perf_reset();
+		return 0;
+	}
+
+	printf("probe           core      count    mean_us     max_us  histogram (log2(cycles):count)\n");
+	for (i = 0; i < PERF_PROBE_COUNT; i++) {
+		if (perf_get(i, &c))
+			continue;
+		printf("%-15s %4u %10lu %10.1f %10.1f ",
+			c.name, c.core, c.count,
+			(c.count > 0 ? perf_cycles_to_us(c.total / c.count) : 0.0),
+			perf_cycles_to_us(c.max));
+		for (j = 0; j < PERF_HIST_BUCKETS; j++) {
+			if (c.hist[j] > 0)
+				printf(" %d:%lu", j, c.hist[j]);
+		}
+		printf("\n");
+	}
+
+	return 0;
+}
+
+
+#define CRC_BENCH_ROUNDS  20
+#define CRC_BENCH_MAX_LEN 4096
+
+int cmd_perf_crc(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+	unsigned char *buf;
+	uint32_t crc_sw = 0, crc_dma = 0;
+	uint64_t t_start, t_sw, t_dma;
+	size_t len, crossover = 0;
+	int i;
+
+	if (!query)
+		return 1;
+	if (!crc32_dma_available()) {
+		printf("DMA CRC-32 not available\n");
+		return 0;
+	}
+	if (!(buf = malloc(CRC_BENCH_MAX_LEN)))
+		return 2;
+	for (i = 0; i < CRC_BENCH_MAX_LEN; i++)
+		buf[i] = i;
+
+	printf("  bytes      sw_us     dma_us  match\n");
+	for (len = 8; len <= CRC_BENCH_MAX_LEN; len <<= 1) {
+		t_start = time_us_64();
+		for (i = 0; i < CRC_BENCH_ROUNDS; i++)
+			crc_sw = xcrc32(buf, len, 0xffffffff);
+		t_sw = time_us_64() - t_start;
+		t_start = time_us_64();
+		for (i = 0; i < CRC_BENCH_ROUNDS; i++)
+			crc_dma = dma_crc32(buf, len, 0xffffffff);
+		t_dma = time_us_64() - t_start;
+		if (!crossover && t_dma < t_sw)
+			crossover = len;
+		printf("%7u %10.2f %10.2f  %s\n", len,
+			(double)t_sw / CRC_BENCH_ROUNDS,
+			(double)t_dma / CRC_BENCH_ROUNDS,
+			(crc_sw == crc_dma ? "yes" : "NO"));
+	}
+	printf("crossover: %u bytes\n", crossover);
+	free(buf);
+
+	return 0;
+}
+
+
+#define PIPE_BENCH_SAMPLES 256
+
+/* Replayable (synthetic) input trace: sensor temperature, PWM input and
+   fan tacho values sweep through their ranges with different periods, so
+   that all segments of the maps get exercised. */
+static void pipe_bench_trace(int n, struct fanpico_state *s)
+{
+	int phase = n % 64;
+	float ramp = (phase < 32 ? phase : 64 - phase) / 32.0;
+	int i;
+
+	for (i = 0; i < SENSOR_MAX_COUNT; i++)
+		s->temp[i] = 20.0 + 60.0 * ramp + i;
+	for (i = 0; i < MBFAN_MAX_COUNT; i++)
+		s->mbfan_duty[i] = ((n * 7 + i * 13) % 101);
+	for (i = 0; i < FAN_MAX_COUNT; i++)
+		s->fan_freq[i] = 10.0 + ((n * 3 + i * 5) % 90);
+}
+
+static void pipe_bench_report(const char *name, uint64_t t, uint calls, double sum)
+{
+	double mean = (calls > 0 ? (double)t / calls : 0.0);
+
+	printf("%-20s %8u %10.3f %10.0f %12.2f\n", name, calls, mean,
+		mean * clock_get_hz(clk_sys) / 1000000, sum);
+}
+
+int cmd_perf_pipeline(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+	struct fanpico_control_config *c;
+	struct fanpico_state *s;
+	void *sma, *lossy;
+	char fargs[16];
+	uint64_t t_start, t;
+	double sum;
+	int i, n;
+
+	if (!query)
+		return 1;
+
+	/* Run pipeline against private copies of configuration and state,
+	   and with filters disabled so that live filter state is not touched */
+	c = malloc(sizeof(*c));
+	s = malloc(sizeof(*s));
+	if (!c || !s) {
+		free(c);
+		free(s);
+		return 2;
+	}
+	config_to_control(conf, c);
+	memcpy(s, st, sizeof(*s));
+	for (i = 0; i < FAN_MAX_COUNT; i++)
+		c->fans[i].filter = FILTER_NONE;
+	for (i = 0; i < MBFAN_MAX_COUNT; i++)
+		c->mbfans[i].filter = FILTER_NONE;
+	for (i = 0; i < VSENSOR_MAX_COUNT; i++)
+		c->vsensors[i].filter = FILTER_NONE;
+	strncopy(fargs, "8", sizeof(fargs));
+	sma = filter_parse_args(FILTER_SMA, fargs);
+	strncopy(fargs, "10,5", sizeof(fargs));
+	lossy = filter_parse_args(FILTER_LOSSYPEAK, fargs);
+
+	printf("function                calls    mean_us     cycles     checksum\n");
+
+	/* One evaluation of all outputs, as done by core1 each control iteration */
+	sum = 0.0;
+	t = 0;
+	for (n = 0; n < PIPE_BENCH_SAMPLES; n++) {
+		pipe_bench_trace(n, s);
+		t_start = time_us_64();
+		for (i = 0; i < VSENSOR_COUNT; i++)
+			sum += get_vsensor(i, c, s);
+		for (i = 0; i < FAN_COUNT; i++)
+			sum += calculate_pwm_duty(s, c, i);
+		for (i = 0; i < MBFAN_COUNT; i++)
+			sum += calculate_tacho_freq(s, c, i);
+		t += time_us_64() - t_start;
+	}
+	pipe_bench_report("control_iteration", t, PIPE_BENCH_SAMPLES, sum);
+
+	sum = 0.0;
+	t = 0;
+	for (n = 0; n < PIPE_BENCH_SAMPLES; n++) {
+		pipe_bench_trace(n, s);
+		t_start = time_us_64();
+		for (i = 0; i < FAN_COUNT; i++)
+			sum += calculate_pwm_duty(s, c, i);
+		t += time_us_64() - t_start;
+	}
+	pipe_bench_report("calculate_pwm_duty", t, PIPE_BENCH_SAMPLES * FAN_COUNT, sum);
+
+	sum = 0.0;
+	t = 0;
+	for (n = 0; n < PIPE_BENCH_SAMPLES; n++) {
+		pipe_bench_trace(n, s);
+		t_start = time_us_64();
+		for (i = 0; i < MBFAN_COUNT; i++)
+			sum += calculate_tacho_freq(s, c, i);
+		t += time_us_64() - t_start;
+	}
+	pipe_bench_report("calculate_tacho_freq", t, PIPE_BENCH_SAMPLES * MBFAN_COUNT, sum);
+
+	sum = 0.0;
+	t = 0;
+	for (n = 0; n < PIPE_BENCH_SAMPLES; n++) {
+		pipe_bench_trace(n, s);
+		t_start = time_us_64();
+		for (i = 0; i < VSENSOR_COUNT; i++)
+			sum += get_vsensor(i, c, s);
+		t += time_us_64() - t_start;
+	}
+	pipe_bench_report("get_vsensor", t, PIPE_BENCH_SAMPLES * VSENSOR_COUNT, sum);
+
+	sum = 0.0;
+	t_start = time_us_64();
+	for (n = 0; n < PIPE_BENCH_SAMPLES; n++)
+		sum += curve_eval(&c->fans[n % FAN_COUNT].curve, n % 101);
+	t = time_us_64() - t_start;
+	pipe_bench_report("fan_curve", t, PIPE_BENCH_SAMPLES, sum);
+
+	sum = 0.0;
+	t_start = time_us_64();
+	for (n = 0; n < PIPE_BENCH_SAMPLES; n++)
+		sum += curve_eval(&c->mbfans[n % MBFAN_COUNT].curve, n * 10);
+	t = time_us_64() - t_start;
+	pipe_bench_report("mbfan_curve", t, PIPE_BENCH_SAMPLES, sum);
+
+	sum = 0.0;
+	t_start = time_us_64();
+	for (n = 0; n < PIPE_BENCH_SAMPLES; n++)
+		sum += curve_eval(&c->sensors[n % SENSOR_COUNT].curve, 20.0 + (n % 64));
+	t = time_us_64() - t_start;
+	pipe_bench_report("sensor_curve", t, PIPE_BENCH_SAMPLES, sum);
+
+	if (sma) {
+		sum = 0.0;
+		t_start = time_us_64();
+		for (n = 0; n < PIPE_BENCH_SAMPLES; n++)
+			sum += filter(FILTER_SMA, sma, n % 101);
+		t = time_us_64() - t_start;
+		pipe_bench_report("sma_filter", t, PIPE_BENCH_SAMPLES, sum);
+		filter_free_private_ctx(sma);
+	}
+	if (lossy) {
+		sum = 0.0;
+		t_start = time_us_64();
+		for (n = 0; n < PIPE_BENCH_SAMPLES; n++)
+			sum += filter(FILTER_LOSSYPEAK, lossy, n % 101);
+		t = time_us_64() - t_start;
+		pipe_bench_report("lossy_peak_filter", t, PIPE_BENCH_SAMPLES, sum);
+		filter_free_private_ctx(lossy);
+	}
+
+	free(c);
+	free(s);
+
+	return 0;
+}
+
+
+#ifdef WIFI_SUPPORT
+#define BENCH_ROUNDS      10
+#define BENCH_CHUNK_SIZE  192   /* lwIP httpd default LWIP_HTTPD_MAX_TAG_INSERT_LEN */
+
+static void perf_benchmark_status(const char *name,
+				void (*generate)(struct sw_writer *w, const struct fanpico_state *st))
+{
+	char buf[BENCH_CHUNK_SIZE];
+	struct mallinfo m1, m2;
+	struct sw_writer w;
+	size_t total = 0;
+	uint chunks = 0;
+	uint64_t t_start, t_end;
+
+	m1 = mallinfo();
+	t_start = time_us_64();
+	for (int i = 0; i < BENCH_ROUNDS; i++) {
+		total = 0;
+		chunks = 0;
+		/* Generate output in chunks same way as httpd SSI handler does */
+		do {
+			sw_init(&w, buf, sizeof(buf), total);
+			generate(&w, st);
+			total += sw_finish(&w);
+			chunks++;
+		} while (sw_full(&w));
+	}
+	t_end = time_us_64();
+	m2 = mallinfo();
+
+	printf("%-12s %6u %6u %10.1f %10d %10d\n", name, total, chunks,
+		(double)(t_end - t_start) / BENCH_ROUNDS,
+		m2.uordblks - m1.uordblks, m2.arena);
+}
+
+int cmd_perf_benchmark(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+	static char buf[2048];
+	struct mallinfo m1, m2;
+	uint64_t t_start, t_end;
+	int len = 0;
+
+	if (!query)
+		return 1;
+
+	printf("output        bytes chunks    time_us heap_delta  heap_high\n");
+	perf_benchmark_status("status.json", json_status);
+	perf_benchmark_status("status.csv", csv_status);
+
+	m1 = mallinfo();
+	t_start = time_us_64();
+	for (int i = 0; i < BENCH_ROUNDS; i++)
+		len = json_status_message(buf, sizeof(buf));
+	t_end = time_us_64();
+	m2 = mallinfo();
+	printf("%-12s %6d %6u %10.1f %10d %10d\n", "mqtt status", len, 1,
+		(double)(t_end - t_start) / BENCH_ROUNDS,
+		m2.uordblks - m1.uordblks, m2.arena);
+
+	return 0;
+}
+#endif
+
+
 #define TEST_MEM_SIZE (264*1024)
 
 int cmd_memory(const char *cmd, const char *args, int query, char *prev_cmd)
@@ -2382,6 +3162,22 @@ int cmd_spi(const char *cmd, const char *args, int query, char *prev_cmd)
 			&conf->spi_active, "SPI (LCD Display) status");
 }
 
+int cmd_onewire(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+	return bool_setting(cmd, args, query, prev_cmd,
+			&conf->onewire_active, "1-Wire Bus status");
+}
+
+int cmd_onewire_sensors(const char *cmd, const char *args, int query, char *prev_cmd)
+{
+	if (!query)
+		return 1;
+
+	if (onewire_list_devices() < 0)
+		return 2;
+	return 0;
+}
+
 
 const struct cmd_t display_commands[] = {
 	{ "LAYOUTR",   7, NULL,              cmd_display_layout_r },
@@ -2424,6 +3220,7 @@ const struct cmd_t mqtt_interval_commands[] = {
 	{ "TEMP",      4, NULL,              cmd_mqtt_temp_interval },
 	{ "RPM",       3, NULL,              cmd_mqtt_rpm_interval },
 	{ "PWM",       3, NULL,              cmd_mqtt_duty_interval },
+	{ "BULK",      4, NULL,              cmd_mqtt_bulk_interval },
 	{ 0, 0, 0, 0 }
 };
 
@@ -2436,6 +3233,7 @@ const struct cmd_t mqtt_topic_commands[] = {
 	{ "FANPWM",    6, NULL,              cmd_mqtt_fan_duty_topic },
 	{ "MBFANRPM",  8, NULL,              cmd_mqtt_mbfan_rpm_topic },
 	{ "MBFANPWM",  8, NULL,              cmd_mqtt_mbfan_duty_topic },
+	{ "BULK",      4, NULL,              cmd_mqtt_bulk_topic },
 	{ 0, 0, 0, 0 }
 };
 
@@ -2445,6 +3243,8 @@ const struct cmd_t mqtt_commands[] = {
 	{ "USER",      4, NULL,              cmd_mqtt_user },
 	{ "PASSword",  4, NULL,              cmd_mqtt_pass },
 	{ "SCPI",      4, NULL,              cmd_mqtt_allow_scpi },
+	{ "CHANGEonly", 6, NULL,             cmd_mqtt_change_only },
+	{ "HEARTbeat", 5, NULL,              cmd_mqtt_heartbeat },
 #if TLS_SUPPORT
 	{ "TLS",       3, NULL,              cmd_mqtt_tls },
 #endif
@@ -2465,6 +3265,35 @@ const struct cmd_t tls_commands[] = {
 	{ 0, 0, 0, 0 }
 };
 
+const struct cmd_t fault_commands[] = {
+	{ "FAILsafe",  4, NULL,              cmd_fault_failsafe },
+	{ "STALLtime", 5, NULL,              cmd_fault_stall_time },
+	{ 0, 0, 0, 0 }
+};
+
+const struct cmd_t interval_commands[] = {
+	{ "OUTPUTS",   3, NULL,              cmd_interval_outputs },
+	{ "PWMIN",     5, NULL,              cmd_interval_pwm_input },
+	{ "SENSORS",   4, NULL,              cmd_interval_sensors },
+	{ "TACHO",     4, NULL,              cmd_interval_tacho },
+	{ 0, 0, 0, 0 }
+};
+
+const struct cmd_t syslog_commands[] = {
+	{ "BATCH",     5, NULL,              cmd_syslog_batch },
+	{ "RATE",      4, NULL,              cmd_syslog_rate },
+	{ 0, 0, 0, 0 }
+};
+
+const struct cmd_t telemetry_commands[] = {
+#ifdef WIFI_SUPPORT
+	{ "INTerval",  3, NULL,              cmd_telemetry_interval },
+	{ "PORT",      4, NULL,              cmd_telemetry_port },
+	{ "SERVer",    4, NULL,              cmd_telemetry_server },
+#endif
+	{ 0, 0, 0, 0 }
+};
+
 const struct cmd_t telnet_commands[] = {
 #ifdef WIFI_SUPPORT
 	{ "AUTH",      4, NULL,              cmd_telnet_auth },
@@ -2477,13 +3306,32 @@ const struct cmd_t telnet_commands[] = {
 	{ 0, 0, 0, 0 }
 };
 
+const struct cmd_t onewire_commands[] = {
+	{ "SENSORS",   7, NULL,              cmd_onewire_sensors },
+	{ 0, 0, 0, 0 }
+};
+
+const struct cmd_t perf_commands[] = {
+#ifdef WIFI_SUPPORT
+	{ "BENCHmark", 5, NULL,              cmd_perf_benchmark },
+#endif
+	{ "CRC",       3, NULL,              cmd_perf_crc },
+	{ "PIPEline",  4, NULL,              cmd_perf_pipeline },
+	{ 0, 0, 0, 0 }
+};
+
 const struct cmd_t system_commands[] = {
+	{ "ANALytics", 4, NULL,              cmd_analytics },
+	{ "BOOT",      4, NULL,              cmd_boot },
+	{ "CMDQueue",  4, NULL,              cmd_cmdqueue },
 	{ "DEBUG",     5, NULL,              cmd_debug }, /* Obsolete ? */
 	{ "DISPlay",   4, display_commands,  cmd_display_type },
 	{ "ECHO",      4, NULL,              cmd_echo },
 	{ "ERRor",     3, NULL,              cmd_err },
 	{ "FANS",      4, NULL,              cmd_fans },
+	{ "FAULTs",    5, fault_commands,    cmd_faults },
 	{ "FLASH",     5, NULL,              cmd_flash },
+	{ "INTerval",  3, interval_commands, NULL },
 	{ "LED",       3, NULL,              cmd_led },
 	{ "LFS",       3, NULL,              cmd_littlefs },
 	{ "LOG",       3, NULL,              cmd_log_level },
@@ -2493,10 +3341,16 @@ const struct cmd_t system_commands[] = {
 	{ "MQTT",      4, mqtt_commands,     NULL },
 #endif
 	{ "NAME",      4, NULL,              cmd_name },
+	{ "ONEWIRE",   7, onewire_commands,  cmd_onewire },
+	{ "PERF",      4, perf_commands,     cmd_perf },
 	{ "SENSORS",   7, NULL,              cmd_sensors },
 	{ "SERIAL",    6, NULL,              cmd_serial },
 	{ "SPI",       3, NULL,              cmd_spi },
-	{ "SYSLOG",    6, NULL,              cmd_syslog_level },
+	{ "SYSLOG",    6, syslog_commands,   cmd_syslog_level },
+	{ "TASKs",     4, NULL,              cmd_tasks },
+#ifdef WIFI_SUPPORT
+	{ "TELEMetry", 5, telemetry_commands, cmd_telemetry },
+#endif
 	{ "TELNET",    6, telnet_commands,   NULL },
 	{ "TIMEZONE",  8, NULL,              cmd_timezone },
 	{ "TIME",      4, NULL,              cmd_time },
@@ -2513,10 +3367,13 @@ const struct cmd_t fan_c_commands[] = {
 	{ "FILTER",    6, NULL,              cmd_fan_filter },
 	{ "MAXpwm",    3, NULL,              cmd_fan_max_pwm },
 	{ "MINpwm",    3, NULL,              cmd_fan_min_pwm },
+	{ "MODE",      4, NULL,              cmd_fan_mode },
 	{ "NAME",      4, NULL,              cmd_fan_name },
+	{ "PID",       3, NULL,              cmd_fan_pid },
 	{ "PWMCoeff",  4, NULL,              cmd_fan_pwm_coef },
 	{ "PWMMap",    4, NULL,              cmd_fan_pwm_map },
 	{ "RPMFactor", 4, NULL,              cmd_fan_rpm_factor },
+	{ "RPMMax",    4, NULL,              cmd_fan_max_rpm },
 	{ "SOUrce",    3, NULL,              cmd_fan_source },
 	{ 0, 0, 0, 0 }
 };
@@ -2554,6 +3411,8 @@ const struct cmd_t vsensor_c_commands[] = {
 };
 
 const struct cmd_t config_commands[] = {
+	{ "AUTOSAVe",  5, NULL,              cmd_autosave },
+	{ "COMPact",   4, NULL,              cmd_compact_config },
 	{ "DELete",    3, NULL,              cmd_delete_config },
 	{ "FAN",       3, fan_c_commands,    NULL },
 	{ "MBFAN",     5, mbfan_c_commands,  NULL },
@@ -2565,10 +3424,13 @@ const struct cmd_t config_commands[] = {
 };
 
 const struct cmd_t fan_commands[] = {
+	{ "AGE",       3, NULL,              cmd_fan_age },
+	{ "FAULT",     5, NULL,              cmd_fan_fault },
 	{ "PWM",       3, NULL,              cmd_fan_pwm },
 	{ "Read",      1, NULL,              cmd_fan_read },
 	{ "RPM",       3, NULL,              cmd_fan_rpm },
 	{ "TACho",     3, NULL,              cmd_fan_tacho },
+	{ "TARGet",    4, NULL,              cmd_fan_target },
 	{ 0, 0, 0, 0 }
 };
 
@@ -2576,6 +3438,7 @@ const struct cmd_t mbfan_commands[] = {
 	{ "PWM",       3, NULL,              cmd_mbfan_pwm },
 	{ "Read",      1, NULL,              cmd_mbfan_read },
 	{ "RPM",       3, NULL,              cmd_mbfan_rpm },
+	{ "SIGnal",    3, NULL,              cmd_mbfan_signal },
 	{ "TACho",     3, NULL,              cmd_mbfan_tacho },
 	{ 0, 0, 0, 0 }
 };
@@ -2594,6 +3457,7 @@ const struct cmd_t vsensor_commands[] = {
 
 const struct cmd_t measure_commands[] = {
 	{ "FAN",       3, fan_commands,      cmd_fan_read },
+	{ "HISTory",   4, NULL,              cmd_history },
 	{ "MBFAN",     5, mbfan_commands,    cmd_mbfan_read },
 	{ "Read",      1, NULL,              cmd_read },
 	{ "SENSOR",    6, sensor_commands,   cmd_sensor_temp },
@@ -2627,50 +3491,223 @@ const struct cmd_t commands[] = {
 
 
 
+/* Compiled command tree...
+ *
+ * On first use command tables are compiled into an index, where entries
+ * of each table are grouped by their (case folded) first character and
+ * match keys (first min_match characters) are stored pre-folded.
+ * Matching a (sub)command then only requires comparing (memcmp) against
+ * the few entries starting with same character. Table order is preserved
+ * within each group, so first match still wins.
+ *
+ * If command tree does not fit in the index, commands are matched
+ * by scanning the tables (as before).
+ */
+
+#define CMD_MAX_TABLES   48
+#define CMD_MAX_ENTRIES  384
+#define CMD_KEY_LEN      12
+#define CMD_BUCKETS      28
+
+struct cmd_entry {
+	char key[CMD_KEY_LEN];
+	uint8_t key_len;
+	int8_t child;
+	const struct cmd_t *cmd;
+};
+
+struct cmd_node {
+	const struct cmd_t *table;
+	uint16_t first;
+	uint8_t bucket[CMD_BUCKETS + 1];
+};
+
+static struct cmd_node cmd_nodes[CMD_MAX_TABLES];
+static struct cmd_entry cmd_entries[CMD_MAX_ENTRIES];
+static int cmd_node_count = 0;
+static int cmd_entry_count = 0;
+static int cmd_compiled = 0;
+
+
+static inline int cmd_bucket(char c)
+{
+	if (c >= 'a' && c <= 'z')
+		return 1 + (c - 'a');
+	if (c >= 'A' && c <= 'Z')
+		return 1 + (c - 'A');
+	if (c == '*')
+		return 27;
+	return 0;
+}
+
+static int cmd_compile_table(const struct cmd_t *table)
+{
+	struct cmd_node *node;
+	int i, b, n, count, len, idx;
+
+	for (i = 0; i < cmd_node_count; i++) {
+		if (cmd_nodes[i].table == table)
+			return i;
+	}
+
+	for (count = 0; table[count].cmd; count++)
+		;
+	if (cmd_node_count >= CMD_MAX_TABLES || cmd_entry_count + count > CMD_MAX_ENTRIES)
+		return -1;
+
+	idx = cmd_node_count++;
+	node = &cmd_nodes[idx];
+	node->table = table;
+	node->first = cmd_entry_count;
+	cmd_entry_count += count;
+
+	/* Group entries by first character (keeping table order) */
+	n = 0;
+	for (b = 0; b < CMD_BUCKETS; b++) {
+		node->bucket[b] = n;
+		for (i = 0; i < count; i++) {
+			struct cmd_entry *e = &cmd_entries[node->first + n];
+
+			if (cmd_bucket(table[i].cmd[0]) != b)
+				continue;
+			len = strlen(table[i].cmd) + 1;
+			if (len > table[i].min_match)
+				len = table[i].min_match;
+			if (len > CMD_KEY_LEN)
+				return -1;
+			for (int j = 0; j < len; j++)
+				e->key[j] = toupper((unsigned char)table[i].cmd[j]);
+			e->key_len = len;
+			e->child = -1;
+			e->cmd = &table[i];
+			n++;
+		}
+	}
+	node->bucket[CMD_BUCKETS] = n;
+
+	/* Compile subcommand tables */
+	for (i = 0; i < count; i++) {
+		struct cmd_entry *e = &cmd_entries[node->first + i];
+
+		if (e->cmd->subcmds) {
+			if ((n = cmd_compile_table(e->cmd->subcmds)) < 0)
+				return -1;
+			e->child = n;
+		}
+	}
+
+	return idx;
+}
+
+static void cmd_compile()
+{
+	if (cmd_compiled)
+		return;
+
+	cmd_node_count = 0;
+	cmd_entry_count = 0;
+	if (cmd_compile_table(commands) == 0) {
+		cmd_compiled = 1;
+		log_msg(LOG_DEBUG, "Command tree compiled: %d tables, %d commands",
+			cmd_node_count, cmd_entry_count);
+	} else {
+		cmd_compiled = -1;
+		log_msg(LOG_ERR, "Command tree too large to compile");
+	}
+}
+
+static int cmd_node_of(const struct cmd_t *table)
+{
+	if (cmd_compiled < 1)
+		return -1;
+	for (int i = 0; i < cmd_node_count; i++) {
+		if (cmd_nodes[i].table == table)
+			return i;
+	}
+	return -1;
+}
+
+static const struct cmd_t* cmd_lookup(const struct cmd_t *table, int node_idx,
+				const char *s, int *child)
+{
+	*child = -1;
+
+	if (node_idx >= 0) {
+		const struct cmd_node *node = &cmd_nodes[node_idx];
+		char key[CMD_KEY_LEN];
+		int b, i;
+
+		for (i = 0; i < CMD_KEY_LEN && s[i]; i++)
+			key[i] = toupper((unsigned char)s[i]);
+		for (; i < CMD_KEY_LEN; i++)
+			key[i] = 0;
+
+		b = cmd_bucket(s[0]);
+		for (i = node->bucket[b]; i < node->bucket[b + 1]; i++) {
+			const struct cmd_entry *e = &cmd_entries[node->first + i];
+			if (!memcmp(key, e->key, e->key_len)) {
+				*child = e->child;
+				return e->cmd;
+			}
+		}
+		return NULL;
+	}
+
+	for (int i = 0; table[i].cmd; i++) {
+		if (!strncasecmp(s, table[i].cmd, table[i].min_match))
+			return &table[i];
+	}
+	return NULL;
+}
+
+
 const struct cmd_t* run_cmd(char *cmd, const struct cmd_t *cmd_level, char **prev_subcmd)
 {
-	int i, query, cmd_len, total_len;
+	int query, cmd_len, total_len, node, child;
 	char *saveptr1, *saveptr2, *t, *sub, *s, *arg;
+	const struct cmd_t *c;
 	int res = -1;
 
+	cmd_compile();
+
 	total_len = strlen(cmd);
 	t = strtok_r(cmd, " \t", &saveptr1);
-	if (t && strlen(t) > 0) {
+	if (t && *t) {
 		cmd_len = strlen(t);
 		if (*t == ':' || *t == '*') {
 			/* reset command level to 'root' */
 			cmd_level = commands;
 			*prev_subcmd = NULL;
 		}
+		node = cmd_node_of(cmd_level);
 		/* Split command to subcommands and search from command tree ... */
 		sub = strtok_r(t, ":", &saveptr2);
-		while (sub && strlen(sub) > 0) {
+		while (sub && *sub) {
 			s = sub;
 			sub = NULL;
-			i = 0;
-			while (cmd_level[i].cmd) {
-				if (!strncasecmp(s, cmd_level[i].cmd, cmd_level[i].min_match)) {
-					sub = strtok_r(NULL, ":", &saveptr2);
-					if (cmd_level[i].subcmds && sub && strlen(sub) > 0) {
-						/* Match for subcommand...*/
-						*prev_subcmd = s;
-						cmd_level = cmd_level[i].subcmds;
-					} else if (cmd_level[i].func) {
-						/* Match for command */
-						query = (s[strlen(s)-1] == '?' ? 1 : 0);
-						arg = t + cmd_len + 1;
-						if (!query)
-							mutex_enter_blocking(config_mutex);
-						res = cmd_level[i].func(s,
-								(total_len > cmd_len+1 ? arg : ""),
-								query,
-								(*prev_subcmd ? *prev_subcmd : ""));
-						if (!query)
-							mutex_exit(config_mutex);
-					}
-					break;
+			if (!(c = cmd_lookup(cmd_level, node, s, &child)))
+				break;
+			sub = strtok_r(NULL, ":", &saveptr2);
+			if (c->subcmds && sub && *sub) {
+				/* Match for subcommand...*/
+				*prev_subcmd = s;
+				cmd_level = c->subcmds;
+				node = child;
+			} else if (c->func) {
+				/* Match for command */
+				query = (s[strlen(s)-1] == '?' ? 1 : 0);
+				arg = t + cmd_len + 1;
+				if (!query)
+					mutex_enter_blocking(config_mutex);
+				res = c->func(s,
+					(total_len > cmd_len+1 ? arg : ""),
+					query,
+					(*prev_subcmd ? *prev_subcmd : ""));
+				if (!query) {
+					/* Let core1 know that config may have changed */
+					config_generation++;
+					mutex_exit(config_mutex);
 				}
-				i++;
 			}
 		}
 	}
@@ -2700,12 +3737,14 @@ void process_command(const struct fanpico_state *state, struct fanpico_config *c
 	char *saveptr, *cmd;
 	char *prev_subcmd = NULL;
 	const struct cmd_t *cmd_level = commands;
+	uint64_t t;
 
 	if (!state || !config || !command)
 		return;
 
 	st = state;
 	conf = config;
+	t = perf_begin();
 
 	cmd = strtok_r(command, ";", &saveptr);
 	while (cmd) {
@@ -2716,6 +3755,7 @@ void process_command(const struct fanpico_state *state, struct fanpico_config *c
 		}
 		cmd = strtok_r(NULL, ";", &saveptr);
 	}
+	perf_end(PERF_PROCESS_COMMAND, t);
 }
 
 int last_command_status()
@@ -39,6 +39,7 @@ struct fanpico_config fanpico_config;
 const struct fanpico_config *cfg = &fanpico_config;
 auto_init_mutex(config_mutex_inst);
 mutex_t *config_mutex = &config_mutex_inst;
+volatile uint32_t config_generation = 0;
 
 int str2pwm_source(const char *s)
 {
@@ -113,6 +114,10 @@ int str2vsmode(const char *s)
 			ret = VSMODE_AVG;
 		else if (!strncasecmp(s, "delta", 5))
 			ret = VSMODE_DELTA;
+		else if (!strncasecmp(s, "onewire", 7))
+			ret = VSMODE_ONEWIRE;
+		else if (!strncasecmp(s, "i2c", 3))
+			ret = VSMODE_I2C;
 	}
 
 	return ret;
@@ -128,6 +133,10 @@ const char* vsmode2str(enum vsensor_modes mode)
 		return "avg";
 	else if (mode == VSMODE_DELTA)
 		return "delta";
+	else if (mode == VSMODE_ONEWIRE)
+		return "onewire";
+	else if (mode == VSMODE_I2C)
+		return "i2c";
 
 	return "manual";
 }
@@ -229,6 +238,10 @@ void json2filter(cJSON *item, enum signal_filter_types *filter, void **filter_ct
 {
 	cJSON *args;
 
+	if (*filter_ctx) {
+		filter_free_ctx(*filter_ctx);
+		*filter_ctx = NULL;
+	}
 	*filter = str2filter(cJSON_GetStringValue(cJSON_GetObjectItem(item, "name")));
 	if ((args = cJSON_GetObjectItem(item, "args")) && *filter != FILTER_NONE) {
 		*filter_ctx =  filter_parse_args(*filter, cJSON_GetStringValue(args));
@@ -241,12 +254,16 @@ void json2filter(cJSON *item, enum signal_filter_types *filter, void **filter_ct
 cJSON* filter2json(enum signal_filter_types filter, void *filter_ctx)
 {
 	cJSON *o;
+	char *args;
 
 	if ((o = cJSON_CreateObject()) == NULL)
 		return NULL;
 
 	cJSON_AddItemToObject(o, "name", cJSON_CreateString(filter2str(filter)));
-	cJSON_AddItemToObject(o, "args", cJSON_CreateString(filter_print_args(filter, filter_ctx)));
+	args = filter_print_args(filter, filter_ctx);
+	cJSON_AddItemToObject(o, "args", cJSON_CreateString(args ? args : ""));
+	if (args)
+		free(args);
 	return o;
 }
 
@@ -352,19 +369,67 @@ cJSON* temp_map2json(const struct temp_map *map)
 }
 
 
-void json2vsensors(cJSON *item, uint8_t *s)
+int str2vsensor_source(const char *s)
+{
+	int val;
+
+	if (!s)
+		return 0;
+	if (*s == 'V' || *s == 'v') {
+		if (str_to_int(s + 1, &val, 10) && val >= 1 && val <= VSENSOR_COUNT)
+			return VSENSOR_SOURCE_VSENSOR | val;
+	} else {
+		if (str_to_int(s, &val, 10) && val >= 1 && val <= SENSOR_COUNT)
+			return val;
+	}
+	return 0;
+}
+
+
+const char* vsensor_source2str(uint8_t src, char *buf, size_t size)
+{
+	if (src & VSENSOR_SOURCE_VSENSOR)
+		snprintf(buf, size, "V%u", src & ~VSENSOR_SOURCE_VSENSOR);
+	else
+		snprintf(buf, size, "%u", src);
+	return buf;
+}
+
+
+/* Check that virtual sensor source is valid: sensor (1..SENSOR_COUNT) or
+ * other virtual sensor (V1..VSENSOR_COUNT), but not the vsensor itself. */
+static bool valid_vsensor_source(int val, int vsensor)
+{
+	int n = val & ~VSENSOR_SOURCE_VSENSOR;
+
+	if (val < 1 || val > 0xff)
+		return false;
+	if (val & VSENSOR_SOURCE_VSENSOR)
+		return (n >= 1 && n <= VSENSOR_COUNT && n != vsensor + 1);
+	return (n <= SENSOR_COUNT);
+}
+
+
+void json2vsensors(cJSON *item, uint8_t *s, int vsensor)
 {
 	cJSON *o;
 	int i,val;
 	int count = 0;
 
-	for (i = 0; i < SENSOR_MAX_COUNT; i++)
+	for (i = 0; i < VSENSOR_SOURCE_MAX_COUNT; i++)
 		s[i] = 0;
 
 	cJSON_ArrayForEach(o, item) {
-		val = cJSON_GetNumberValue(o);
-		if (count < SENSOR_COUNT && val >= 1 && val <= SENSOR_COUNT) {
+		if (cJSON_IsString(o))
+			val = str2vsensor_source(cJSON_GetStringValue(o));
+		else
+			val = cJSON_GetNumberValue(o);
+		if (count >= VSENSOR_SOURCE_MAX_COUNT)
+			break;
+		if (valid_vsensor_source(val, vsensor)) {
 			s[count++] = val;
+		} else {
+			log_msg(LOG_WARNING, "vsensor%d: invalid source ignored: %d", vsensor + 1, val);
 		}
 	}
 }
@@ -374,12 +439,15 @@ cJSON* vsensors2json(const uint8_t *s)
 {
 	int i;
 	cJSON *o;
+	char buf[8];
 
 	if ((o = cJSON_CreateArray()) == NULL)
 		return NULL;
 
-	for (i = 0; i < SENSOR_COUNT; i++) {
-		if (s[i]) {
+	for (i = 0; i < VSENSOR_SOURCE_MAX_COUNT; i++) {
+		if (s[i] & VSENSOR_SOURCE_VSENSOR) {
+			cJSON_AddItemToArray(o, cJSON_CreateString(vsensor_source2str(s[i], buf, sizeof(buf))));
+		} else if (s[i]) {
 			cJSON_AddItemToArray(o, cJSON_CreateNumber(s[i]));
 		}
 	}
@@ -409,6 +477,7 @@ void clear_config(struct fanpico_config *cfg)
 		s->temp_coefficient = 0.0;
 		s->map.points = 0;
 		s->filter = FILTER_NONE;
+		filter_free_ctx(s->filter_ctx);
 		s->filter_ctx = NULL;
 	}
 
@@ -419,14 +488,18 @@ void clear_config(struct fanpico_config *cfg)
 		vs->mode = VSMODE_MANUAL;
 		vs->default_temp = 0.0;
 		vs->timeout = 30;
-		for (j = 0; j < SENSOR_MAX_COUNT; j++)
+		for (j = 0; j < VSENSOR_SOURCE_MAX_COUNT; j++)
 			vs->sensors[j] = 0;
+		vs->onewire_addr = 0;
+		vs->i2c_type = 0;
+		vs->i2c_addr = 0;
 		vs->map.points = 2;
 		vs->map.temp[0][0] = 20.0;
 		vs->map.temp[0][1] = 0.0;
 		vs->map.temp[1][0] = 50.0;
 		vs->map.temp[1][1] = 100.0;
 		vs->filter = FILTER_NONE;
+		filter_free_ctx(vs->filter_ctx);
 		vs->filter_ctx = NULL;
 
 		cfg->vtemp[i] = 0.0;
@@ -444,7 +517,13 @@ void clear_config(struct fanpico_config *cfg)
 		f->s_id = 0;
 		f->map.points = 0;
 		f->rpm_factor = 2;
+		f->max_rpm = 0;
+		f->rpm_mode = false;
+		f->pid_kp = DEFAULT_PID_KP;
+		f->pid_ki = DEFAULT_PID_KI;
+		f->pid_kd = DEFAULT_PID_KD;
 		f->filter = FILTER_NONE;
+		filter_free_ctx(f->filter_ctx);
 		f->filter_ctx = NULL;
 	}
 
@@ -460,6 +539,7 @@ void clear_config(struct fanpico_config *cfg)
 		m->s_id = 0;
 		m->map.points = 0;
 		m->filter = FILTER_NONE;
+		filter_free_ctx(m->filter_ctx);
 		m->filter_ctx = NULL;
 		for (j = 0; j < FAN_MAX_COUNT; j++)
 			m->sources[j] = 0;
@@ -468,6 +548,14 @@ void clear_config(struct fanpico_config *cfg)
 	cfg->local_echo = false;
 	cfg->spi_active = false;
 	cfg->serial_active = false;
+	cfg->onewire_active = false;
+	cfg->config_autosave = 0;
+	cfg->fault_failsafe = false;
+	cfg->fault_stall_time = DEFAULT_FAULT_STALL_TIME;
+	cfg->tacho_interval = DEFAULT_TACHO_INTERVAL;
+	cfg->pwm_input_interval = DEFAULT_PWM_INPUT_INTERVAL;
+	cfg->sensor_interval = DEFAULT_SENSOR_INTERVAL;
+	cfg->output_interval = DEFAULT_OUTPUT_INTERVAL;
 	cfg->led_mode = 0;
 	strncopy(cfg->name, "fanpico1", sizeof(cfg->name));
 	strncopy(cfg->display_type, "default", sizeof(cfg->display_type));
@@ -509,22 +597,117 @@ void clear_config(struct fanpico_config *cfg)
 	cfg->mqtt_temp_interval = DEFAULT_MQTT_TEMP_INTERVAL;
 	cfg->mqtt_rpm_interval = DEFAULT_MQTT_RPM_INTERVAL;
 	cfg->mqtt_duty_interval = DEFAULT_MQTT_DUTY_INTERVAL;
+	cfg->mqtt_bulk_topic[0] = 0;
+	cfg->mqtt_bulk_interval = DEFAULT_MQTT_BULK_INTERVAL;
+	cfg->mqtt_change_only = false;
+	cfg->mqtt_heartbeat = DEFAULT_MQTT_HEARTBEAT;
 	cfg->telnet_active = false;
 	cfg->telnet_auth = true;
 	cfg->telnet_raw_mode = false;
 	cfg->telnet_port = 0;
 	cfg->telnet_user[0] = 0;
 	cfg->telnet_pwhash[0] = 0;
+	cfg->syslog_rate = DEFAULT_SYSLOG_RATE;
+	cfg->syslog_batch = false;
+	ip_addr_set_any(0, &cfg->telemetry_server);
+	cfg->telemetry_port = 0;
+	cfg->telemetry_interval = DEFAULT_TELEMETRY_INTERVAL;
 #endif
 
+	config_generation++;
 	mutex_exit(config_mutex);
 }
 
 
+/* Build compact control configuration (used by core1) from configuration.
+ * Maps are compiled into curves here (compiled curves are not stored in
+ * fanpico_config). When called from core1, caller must hold config_mutex.
+ */
+void config_to_control(const struct fanpico_config *config, struct fanpico_control_config *ctl)
+{
+	const struct sensor_input *s;
+	const struct vsensor_input *vs;
+	const struct fan_output *f;
+	const struct mb_input *m;
+	int i, j, n;
+
+	for (i = 0; i < SENSOR_MAX_COUNT; i++) {
+		s = &config->sensors[i];
+		ctl->sensors[i].type = s->type;
+		ctl->sensors[i].thermistor_nominal = s->thermistor_nominal;
+		ctl->sensors[i].temp_nominal = s->temp_nominal;
+		ctl->sensors[i].beta_coefficient = s->beta_coefficient;
+		ctl->sensors[i].temp_offset = s->temp_offset;
+		ctl->sensors[i].temp_coefficient = s->temp_coefficient;
+		ctl->sensors[i].filter = s->filter;
+		ctl->sensors[i].filter_ctx = s->filter_ctx;
+		temp_map_compile(&s->map, &ctl->sensors[i].curve);
+	}
+
+	for (i = 0; i < VSENSOR_MAX_COUNT; i++) {
+		vs = &config->vsensors[i];
+		ctl->vsensors[i].mode = vs->mode;
+		ctl->vsensors[i].default_temp = vs->default_temp;
+		ctl->vsensors[i].timeout = vs->timeout;
+		/* Only pass valid sources to core1 (which indexes state arrays with these) */
+		memset(ctl->vsensors[i].sensors, 0, sizeof(ctl->vsensors[i].sensors));
+		for (j = 0, n = 0; j < VSENSOR_SOURCE_MAX_COUNT; j++) {
+			if (valid_vsensor_source(vs->sensors[j], i))
+				ctl->vsensors[i].sensors[n++] = vs->sensors[j];
+		}
+		ctl->vsensors[i].filter = vs->filter;
+		ctl->vsensors[i].filter_ctx = vs->filter_ctx;
+		temp_map_compile(&vs->map, &ctl->vsensors[i].curve);
+	}
+
+	for (i = 0; i < FAN_MAX_COUNT; i++) {
+		f = &config->fans[i];
+		ctl->fans[i].min_pwm = f->min_pwm;
+		ctl->fans[i].max_pwm = f->max_pwm;
+		ctl->fans[i].pwm_coefficient = f->pwm_coefficient;
+		ctl->fans[i].s_type = f->s_type;
+		ctl->fans[i].s_id = f->s_id;
+		ctl->fans[i].filter = f->filter;
+		ctl->fans[i].filter_ctx = f->filter_ctx;
+		ctl->fans[i].rpm_factor = f->rpm_factor;
+		ctl->fans[i].max_rpm = f->max_rpm;
+		ctl->fans[i].rpm_mode = f->rpm_mode;
+		ctl->fans[i].pid_kp = f->pid_kp;
+		ctl->fans[i].pid_ki = f->pid_ki;
+		ctl->fans[i].pid_kd = f->pid_kd;
+		pwm_map_compile(&f->map, &ctl->fans[i].curve);
+	}
+
+	for (i = 0; i < MBFAN_MAX_COUNT; i++) {
+		m = &config->mbfans[i];
+		ctl->mbfans[i].min_rpm = m->min_rpm;
+		ctl->mbfans[i].max_rpm = m->max_rpm;
+		ctl->mbfans[i].rpm_coefficient = m->rpm_coefficient;
+		ctl->mbfans[i].rpm_factor = m->rpm_factor;
+		ctl->mbfans[i].s_type = m->s_type;
+		ctl->mbfans[i].s_id = m->s_id;
+		memcpy(ctl->mbfans[i].sources, m->sources, sizeof(ctl->mbfans[i].sources));
+		ctl->mbfans[i].filter = m->filter;
+		ctl->mbfans[i].filter_ctx = m->filter_ctx;
+		tacho_map_compile(&m->map, &ctl->mbfans[i].curve);
+	}
+
+	ctl->fault_failsafe = config->fault_failsafe;
+	ctl->fault_stall_time = config->fault_stall_time;
+	ctl->tacho_interval = config->tacho_interval;
+	ctl->pwm_input_interval = config->pwm_input_interval;
+	ctl->sensor_interval = config->sensor_interval;
+	ctl->output_interval = config->output_interval;
+	memcpy(ctl->vtemp, config->vtemp, sizeof(ctl->vtemp));
+	memcpy(ctl->vtemp_updated, config->vtemp_updated, sizeof(ctl->vtemp_updated));
+}
+
+
 cJSON *config_to_json(const struct fanpico_config *cfg)
 {
 	cJSON *config = cJSON_CreateObject();
 	cJSON *fans, *mbfans, *sensors, *vsensors, *o;
+	char tmp[20];
 	int i;
 
 	if (!config)
@@ -538,6 +721,22 @@ cJSON *config_to_json(const struct fanpico_config *cfg)
 	cJSON_AddItemToObject(config, "led_mode", cJSON_CreateNumber(cfg->led_mode));
 	cJSON_AddItemToObject(config, "spi_active", cJSON_CreateNumber(cfg->spi_active));
 	cJSON_AddItemToObject(config, "serial_active", cJSON_CreateNumber(cfg->serial_active));
+	if (cfg->onewire_active)
+		cJSON_AddItemToObject(config, "onewire_active", cJSON_CreateNumber(cfg->onewire_active));
+	if (cfg->config_autosave > 0)
+		cJSON_AddItemToObject(config, "config_autosave", cJSON_CreateNumber(cfg->config_autosave));
+	if (cfg->fault_failsafe)
+		cJSON_AddItemToObject(config, "fault_failsafe", cJSON_CreateBool(cfg->fault_failsafe));
+	if (cfg->fault_stall_time != DEFAULT_FAULT_STALL_TIME)
+		cJSON_AddItemToObject(config, "fault_stall_time", cJSON_CreateNumber(cfg->fault_stall_time));
+	if (cfg->tacho_interval != DEFAULT_TACHO_INTERVAL)
+		cJSON_AddItemToObject(config, "tacho_interval", cJSON_CreateNumber(cfg->tacho_interval));
+	if (cfg->pwm_input_interval != DEFAULT_PWM_INPUT_INTERVAL)
+		cJSON_AddItemToObject(config, "pwm_input_interval", cJSON_CreateNumber(cfg->pwm_input_interval));
+	if (cfg->sensor_interval != DEFAULT_SENSOR_INTERVAL)
+		cJSON_AddItemToObject(config, "sensor_interval", cJSON_CreateNumber(cfg->sensor_interval));
+	if (cfg->output_interval != DEFAULT_OUTPUT_INTERVAL)
+		cJSON_AddItemToObject(config, "output_interval", cJSON_CreateNumber(cfg->output_interval));
 	if (strlen(cfg->display_type) > 0)
 		cJSON_AddItemToObject(config, "display_type", cJSON_CreateString(cfg->display_type));
 	if (strlen(cfg->display_theme) > 0)
@@ -657,12 +856,34 @@ cJSON *config_to_json(const struct fanpico_config *cfg)
 	if (strlen(cfg->mqtt_mbfan_duty_topic) > 0)
 		cJSON_AddItemToObject(config, "mqtt_mbfan_duty_topic",
 				cJSON_CreateString(cfg->mqtt_mbfan_duty_topic));
+	if (strlen(cfg->mqtt_bulk_topic) > 0)
+		cJSON_AddItemToObject(config, "mqtt_bulk_topic",
+				cJSON_CreateString(cfg->mqtt_bulk_topic));
+	if (cfg->mqtt_bulk_interval != DEFAULT_MQTT_BULK_INTERVAL)
+		cJSON_AddItemToObject(config, "mqtt_bulk_interval",
+				cJSON_CreateNumber(cfg->mqtt_bulk_interval));
+	if (cfg->mqtt_change_only)
+		cJSON_AddItemToObject(config, "mqtt_change_only",
+				cJSON_CreateNumber(cfg->mqtt_change_only));
+	if (cfg->mqtt_heartbeat != DEFAULT_MQTT_HEARTBEAT)
+		cJSON_AddItemToObject(config, "mqtt_heartbeat",
+				cJSON_CreateNumber(cfg->mqtt_heartbeat));
 	if (cfg->telnet_active)
 		cJSON_AddItemToObject(config, "telnet_active", cJSON_CreateNumber(cfg->telnet_active));
 	if (cfg->telnet_auth != true)
 		cJSON_AddItemToObject(config, "telnet_auth", cJSON_CreateNumber(cfg->telnet_auth));
 	if (cfg->telnet_raw_mode)
 		cJSON_AddItemToObject(config, "telnet_raw_mode", cJSON_CreateNumber(cfg->telnet_raw_mode));
+	if (cfg->syslog_rate != DEFAULT_SYSLOG_RATE)
+		cJSON_AddItemToObject(config, "syslog_rate", cJSON_CreateNumber(cfg->syslog_rate));
+	if (cfg->syslog_batch)
+		cJSON_AddItemToObject(config, "syslog_batch", cJSON_CreateNumber(cfg->syslog_batch));
+	if (!ip_addr_isany(&cfg->telemetry_server))
+		cJSON_AddItemToObject(config, "telemetry_server", cJSON_CreateString(ipaddr_ntoa(&cfg->telemetry_server)));
+	if (cfg->telemetry_port > 0)
+		cJSON_AddItemToObject(config, "telemetry_port", cJSON_CreateNumber(cfg->telemetry_port));
+	if (cfg->telemetry_interval != DEFAULT_TELEMETRY_INTERVAL)
+		cJSON_AddItemToObject(config, "telemetry_interval", cJSON_CreateNumber(cfg->telemetry_interval));
 	if (cfg->telnet_port > 0)
 		cJSON_AddItemToObject(config, "telnet_port", cJSON_CreateNumber(cfg->telnet_port));
 	if (strlen(cfg->telnet_user) > 0)
@@ -690,6 +911,16 @@ cJSON *config_to_json(const struct fanpico_config *cfg)
 		cJSON_AddItemToObject(o, "source_id", cJSON_CreateNumber(f->s_id));
 		cJSON_AddItemToObject(o, "pwm_map", pwm_map2json(&f->map));
 		cJSON_AddItemToObject(o, "rpm_factor", cJSON_CreateNumber(f->rpm_factor));
+		if (f->max_rpm > 0)
+			cJSON_AddItemToObject(o, "max_rpm", cJSON_CreateNumber(f->max_rpm));
+		if (f->rpm_mode)
+			cJSON_AddItemToObject(o, "rpm_mode", cJSON_CreateBool(f->rpm_mode));
+		if (f->pid_kp != DEFAULT_PID_KP || f->pid_ki != DEFAULT_PID_KI
+			|| f->pid_kd != DEFAULT_PID_KD) {
+			cJSON_AddItemToObject(o, "pid_kp", cJSON_CreateNumber(f->pid_kp));
+			cJSON_AddItemToObject(o, "pid_ki", cJSON_CreateNumber(f->pid_ki));
+			cJSON_AddItemToObject(o, "pid_kd", cJSON_CreateNumber(f->pid_kd));
+		}
 		cJSON_AddItemToObject(o, "filter", filter2json(f->filter, f->filter_ctx));
 		cJSON_AddItemToArray(fans, o);
 	}
@@ -767,6 +998,14 @@ cJSON *config_to_json(const struct fanpico_config *cfg)
 		if (s->mode == VSMODE_MANUAL) {
 			cJSON_AddItemToObject(o, "default_temp", cJSON_CreateNumber(s->default_temp));
 			cJSON_AddItemToObject(o, "timeout", cJSON_CreateNumber(s->timeout));
+		} else if (s->mode == VSMODE_ONEWIRE) {
+			snprintf(tmp, sizeof(tmp), "%016llX", s->onewire_addr);
+			cJSON_AddItemToObject(o, "onewire_addr", cJSON_CreateString(tmp));
+			cJSON_AddItemToObject(o, "default_temp", cJSON_CreateNumber(s->default_temp));
+		} else if (s->mode == VSMODE_I2C) {
+			cJSON_AddItemToObject(o, "i2c_type", cJSON_CreateString(i2c_type2str(s->i2c_type)));
+			cJSON_AddItemToObject(o, "i2c_addr", cJSON_CreateNumber(s->i2c_addr));
+			cJSON_AddItemToObject(o, "default_temp", cJSON_CreateNumber(s->default_temp));
 		} else {
 			cJSON_AddItemToObject(o, "sensors", vsensors2json(s->sensors));
 		}
@@ -813,6 +1052,26 @@ int json_to_config(cJSON *config, struct fanpico_config *cfg)
 		cfg->spi_active = cJSON_GetNumberValue(ref);
 	if ((ref = cJSON_GetObjectItem(config, "serial_active")))
 		cfg->serial_active = cJSON_GetNumberValue(ref);
+	if ((ref = cJSON_GetObjectItem(config, "onewire_active")))
+		cfg->onewire_active = cJSON_GetNumberValue(ref);
+	if ((ref = cJSON_GetObjectItem(config, "config_autosave")))
+		cfg->config_autosave = cJSON_GetNumberValue(ref);
+	if ((ref = cJSON_GetObjectItem(config, "fault_failsafe")))
+		cfg->fault_failsafe = (cJSON_IsTrue(ref) ? true : false);
+	if ((ref = cJSON_GetObjectItem(config, "fault_stall_time")))
+		cfg->fault_stall_time = cJSON_GetNumberValue(ref);
+	if ((ref = cJSON_GetObjectItem(config, "tacho_interval")))
+		cfg->tacho_interval = clamp_int(cJSON_GetNumberValue(ref),
+					MIN_TACHO_INTERVAL, MAX_TASK_INTERVAL);
+	if ((ref = cJSON_GetObjectItem(config, "pwm_input_interval")))
+		cfg->pwm_input_interval = clamp_int(cJSON_GetNumberValue(ref),
+					MIN_PWM_INPUT_INTERVAL, MAX_TASK_INTERVAL);
+	if ((ref = cJSON_GetObjectItem(config, "sensor_interval")))
+		cfg->sensor_interval = clamp_int(cJSON_GetNumberValue(ref),
+					MIN_SENSOR_INTERVAL, MAX_TASK_INTERVAL);
+	if ((ref = cJSON_GetObjectItem(config, "output_interval")))
+		cfg->output_interval = clamp_int(cJSON_GetNumberValue(ref),
+					MIN_OUTPUT_INTERVAL, MAX_TASK_INTERVAL);
 	if ((ref = cJSON_GetObjectItem(config, "display_type"))) {
 		if ((val = cJSON_GetStringValue(ref)))
 			strncopy(cfg->display_type, val, sizeof(cfg->display_type));
@@ -973,6 +1232,19 @@ int json_to_config(cJSON *config, struct fanpico_config *cfg)
 		if ((val = cJSON_GetStringValue(ref)))
 			strncopy(cfg->mqtt_mbfan_duty_topic, val, sizeof(cfg->mqtt_mbfan_duty_topic));
 	}
+	if ((ref = cJSON_GetObjectItem(config, "mqtt_bulk_topic"))) {
+		if ((val = cJSON_GetStringValue(ref)))
+			strncopy(cfg->mqtt_bulk_topic, val, sizeof(cfg->mqtt_bulk_topic));
+	}
+	if ((ref = cJSON_GetObjectItem(config, "mqtt_bulk_interval"))) {
+		cfg->mqtt_bulk_interval = cJSON_GetNumberValue(ref);
+	}
+	if ((ref = cJSON_GetObjectItem(config, "mqtt_change_only"))) {
+		cfg->mqtt_change_only = cJSON_GetNumberValue(ref);
+	}
+	if ((ref = cJSON_GetObjectItem(config, "mqtt_heartbeat"))) {
+		cfg->mqtt_heartbeat = cJSON_GetNumberValue(ref);
+	}
 	if ((ref = cJSON_GetObjectItem(config, "telnet_active"))) {
 		cfg->telnet_active = cJSON_GetNumberValue(ref);
 	}
@@ -982,6 +1254,23 @@ int json_to_config(cJSON *config, struct fanpico_config *cfg)
 	if ((ref = cJSON_GetObjectItem(config, "telnet_raw_mode"))) {
 		cfg->telnet_raw_mode = cJSON_GetNumberValue(ref);
 	}
+	if ((ref = cJSON_GetObjectItem(config, "syslog_rate"))) {
+		cfg->syslog_rate = cJSON_GetNumberValue(ref);
+	}
+	if ((ref = cJSON_GetObjectItem(config, "syslog_batch"))) {
+		cfg->syslog_batch = cJSON_GetNumberValue(ref);
+	}
+	if ((ref = cJSON_GetObjectItem(config, "telemetry_server"))) {
+		if ((val = cJSON_GetStringValue(ref)))
+			ipaddr_aton(val, &cfg->telemetry_server);
+	}
+	if ((ref = cJSON_GetObjectItem(config, "telemetry_port"))) {
+		cfg->telemetry_port = cJSON_GetNumberValue(ref);
+	}
+	if ((ref = cJSON_GetObjectItem(config, "telemetry_interval"))) {
+		cfg->telemetry_interval = clamp_int(cJSON_GetNumberValue(ref),
+					MIN_TELEMETRY_INTERVAL, 3600 * 1000);
+	}
 	if ((ref = cJSON_GetObjectItem(config, "telnet_port"))) {
 		cfg->telnet_port = cJSON_GetNumberValue(ref);
 	}
@@ -1015,10 +1304,27 @@ int json_to_config(cJSON *config, struct fanpico_config *cfg)
 			if ((r = cJSON_GetObjectItem(item, "pwm_map")))
 				json2pwm_map(r, &f->map);
 			f->rpm_factor = cJSON_GetNumberValue(cJSON_GetObjectItem(item,"rpm_factor"));
+			if ((r = cJSON_GetObjectItem(item, "max_rpm")))
+				f->max_rpm = cJSON_GetNumberValue(r);
+			if ((r = cJSON_GetObjectItem(item, "rpm_mode")))
+				f->rpm_mode = (cJSON_IsTrue(r) ? true : false);
+			if ((r = cJSON_GetObjectItem(item, "pid_kp")))
+				f->pid_kp = cJSON_GetNumberValue(r);
+			if ((r = cJSON_GetObjectItem(item, "pid_ki")))
+				f->pid_ki = cJSON_GetNumberValue(r);
+			if ((r = cJSON_GetObjectItem(item, "pid_kd")))
+				f->pid_kd = cJSON_GetNumberValue(r);
 			if ((r = cJSON_GetObjectItem(item, "filter")))
 				json2filter(r, &f->filter, &f->filter_ctx);
 		}
 	}
+	for (int i = 0; i < FAN_COUNT; i++) {
+		struct fan_output *f = &cfg->fans[i];
+		if (pwm_source_loop(cfg, i, f->s_type, f->s_id)) {
+			log_msg(LOG_WARNING, "fan%d: source creates a loop (fan%d)",
+				i + 1, f->s_id + 1);
+		}
+	}
 
 	/* MB Fan input configurations */
 	ref = cJSON_GetObjectItem(config, "mbfans");
@@ -1093,9 +1399,22 @@ int json_to_config(cJSON *config, struct fanpico_config *cfg)
 					s->default_temp = cJSON_GetNumberValue(r);
 				if ((r = cJSON_GetObjectItem(item, "timeout")))
 					s->timeout = cJSON_GetNumberValue(r);
+			} else if (s->mode == VSMODE_ONEWIRE || s->mode == VSMODE_I2C) {
+				if (s->mode == VSMODE_ONEWIRE) {
+					if ((val = cJSON_GetStringValue(cJSON_GetObjectItem(item, "onewire_addr"))))
+						s->onewire_addr = strtoull(val, NULL, 16);
+				} else {
+					s->i2c_type = str2i2c_type(cJSON_GetStringValue(cJSON_GetObjectItem(item, "i2c_type")));
+					if ((r = cJSON_GetObjectItem(item, "i2c_addr")))
+						s->i2c_addr = cJSON_GetNumberValue(r);
+				}
+				/* Temperature to use if sensor fails (fail-hot by default) */
+				s->default_temp = DSENSOR_FAILSAFE_TEMP;
+				if ((r = cJSON_GetObjectItem(item, "default_temp")))
+					s->default_temp = cJSON_GetNumberValue(r);
 			} else {
 				if ((r = cJSON_GetObjectItem(item, "sensors")))
-					json2vsensors(r, s->sensors);
+					json2vsensors(r, s->sensors, id);
 			}
 			if ((r = cJSON_GetObjectItem(item, "temp_map")))
 				json2temp_map(r, &s->map);
@@ -1104,7 +1423,588 @@ int json_to_config(cJSON *config, struct fanpico_config *cfg)
 		}
 	}
 
+	config_generation++;
+	mutex_exit(config_mutex);
+	return 0;
+}
+
+
+/*
+ * Binary configuration snapshot.
+ *
+ * In addition to the JSON configuration, a raw image of struct
+ * fanpico_config is saved, so that configuration can be restored at boot
+ * without having to parse JSON. Snapshot is only valid as long as layout
+ * of struct fanpico_config is unchanged (verified using a hash of member
+ * offsets and sizes), otherwise configuration is read from JSON. Bump
+ * CONFIG_SNAPSHOT_VERSION, if meaning of stored values changes (for example
+ * enum values are renumbered) without layout change. Filter contexts
+ * (pointers) are not part of the image, instead filter arguments are
+ * saved as strings after the image. Settings that are not part of
+ * struct fanpico_config (debug and log levels) are saved in the header.
+ */
+
+#define CONFIG_SNAPSHOT_FILE    "fanpico.bin"
+#define CONFIG_SNAPSHOT_MAGIC   0x46504342  /* "FPCB" */
+#define CONFIG_SNAPSHOT_VERSION 4
+#define CONFIG_FILTER_SLOTS     (SENSOR_MAX_COUNT + VSENSOR_MAX_COUNT + FAN_MAX_COUNT + MBFAN_MAX_COUNT)
+
+struct config_snapshot_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t layout_hash;
+	uint32_t config_size;
+	uint32_t data_size;
+	uint32_t crc32;
+	/* CRC covers everything from here to the end of the file */
+	int32_t debug_level;
+	int32_t log_level;
+	int32_t syslog_level;
+};
+
+#define CONFIG_SNAPSHOT_CRC_START offsetof(struct config_snapshot_header, debug_level)
+
+
+#define CFG_LAYOUT(type, field) offsetof(type, field), sizeof(((type*)0)->field)
+
+static const uint32_t config_layout[] = {
+	sizeof(struct config_snapshot_header),
+	CFG_LAYOUT(struct config_snapshot_header, debug_level),
+	CFG_LAYOUT(struct config_snapshot_header, log_level),
+	CFG_LAYOUT(struct config_snapshot_header, syslog_level),
+	sizeof(struct fanpico_config),
+	sizeof(struct sensor_input),
+	sizeof(struct vsensor_input),
+	sizeof(struct fan_output),
+	sizeof(struct mb_input),
+	CFG_LAYOUT(struct temp_map, points),
+	CFG_LAYOUT(struct temp_map, temp),
+	CFG_LAYOUT(struct pwm_map, points),
+	CFG_LAYOUT(struct pwm_map, pwm),
+	CFG_LAYOUT(struct tacho_map, points),
+	CFG_LAYOUT(struct tacho_map, tacho),
+	CFG_LAYOUT(struct sensor_input, type),
+	CFG_LAYOUT(struct sensor_input, name),
+	CFG_LAYOUT(struct sensor_input, thermistor_nominal),
+	CFG_LAYOUT(struct sensor_input, temp_nominal),
+	CFG_LAYOUT(struct sensor_input, beta_coefficient),
+	CFG_LAYOUT(struct sensor_input, temp_offset),
+	CFG_LAYOUT(struct sensor_input, temp_coefficient),
+	CFG_LAYOUT(struct sensor_input, map),
+	CFG_LAYOUT(struct sensor_input, filter),
+	CFG_LAYOUT(struct sensor_input, filter_ctx),
+	CFG_LAYOUT(struct vsensor_input, name),
+	CFG_LAYOUT(struct vsensor_input, mode),
+	CFG_LAYOUT(struct vsensor_input, default_temp),
+	CFG_LAYOUT(struct vsensor_input, timeout),
+	CFG_LAYOUT(struct vsensor_input, sensors),
+	CFG_LAYOUT(struct vsensor_input, onewire_addr),
+	CFG_LAYOUT(struct vsensor_input, i2c_type),
+	CFG_LAYOUT(struct vsensor_input, i2c_addr),
+	CFG_LAYOUT(struct vsensor_input, map),
+	CFG_LAYOUT(struct vsensor_input, filter),
+	CFG_LAYOUT(struct vsensor_input, filter_ctx),
+	CFG_LAYOUT(struct fan_output, name),
+	CFG_LAYOUT(struct fan_output, min_pwm),
+	CFG_LAYOUT(struct fan_output, max_pwm),
+	CFG_LAYOUT(struct fan_output, pwm_coefficient),
+	CFG_LAYOUT(struct fan_output, s_type),
+	CFG_LAYOUT(struct fan_output, s_id),
+	CFG_LAYOUT(struct fan_output, map),
+	CFG_LAYOUT(struct fan_output, filter),
+	CFG_LAYOUT(struct fan_output, filter_ctx),
+	CFG_LAYOUT(struct fan_output, rpm_factor),
+	CFG_LAYOUT(struct fan_output, max_rpm),
+	CFG_LAYOUT(struct fan_output, rpm_mode),
+	CFG_LAYOUT(struct fan_output, pid_kp),
+	CFG_LAYOUT(struct fan_output, pid_ki),
+	CFG_LAYOUT(struct fan_output, pid_kd),
+	CFG_LAYOUT(struct mb_input, name),
+	CFG_LAYOUT(struct mb_input, min_rpm),
+	CFG_LAYOUT(struct mb_input, max_rpm),
+	CFG_LAYOUT(struct mb_input, rpm_coefficient),
+	CFG_LAYOUT(struct mb_input, rpm_factor),
+	CFG_LAYOUT(struct mb_input, s_type),
+	CFG_LAYOUT(struct mb_input, s_id),
+	CFG_LAYOUT(struct mb_input, sources),
+	CFG_LAYOUT(struct mb_input, map),
+	CFG_LAYOUT(struct mb_input, filter),
+	CFG_LAYOUT(struct mb_input, filter_ctx),
+	CFG_LAYOUT(struct fanpico_config, sensors),
+	CFG_LAYOUT(struct fanpico_config, vsensors),
+	CFG_LAYOUT(struct fanpico_config, fans),
+	CFG_LAYOUT(struct fanpico_config, mbfans),
+	CFG_LAYOUT(struct fanpico_config, local_echo),
+	CFG_LAYOUT(struct fanpico_config, led_mode),
+	CFG_LAYOUT(struct fanpico_config, display_type),
+	CFG_LAYOUT(struct fanpico_config, display_theme),
+	CFG_LAYOUT(struct fanpico_config, display_logo),
+	CFG_LAYOUT(struct fanpico_config, display_layout_r),
+	CFG_LAYOUT(struct fanpico_config, name),
+	CFG_LAYOUT(struct fanpico_config, timezone),
+	CFG_LAYOUT(struct fanpico_config, spi_active),
+	CFG_LAYOUT(struct fanpico_config, serial_active),
+	CFG_LAYOUT(struct fanpico_config, onewire_active),
+	CFG_LAYOUT(struct fanpico_config, config_autosave),
+	CFG_LAYOUT(struct fanpico_config, fault_failsafe),
+	CFG_LAYOUT(struct fanpico_config, fault_stall_time),
+	CFG_LAYOUT(struct fanpico_config, tacho_interval),
+	CFG_LAYOUT(struct fanpico_config, pwm_input_interval),
+	CFG_LAYOUT(struct fanpico_config, sensor_interval),
+	CFG_LAYOUT(struct fanpico_config, output_interval),
+#ifdef WIFI_SUPPORT
+	CFG_LAYOUT(struct fanpico_config, wifi_ssid),
+	CFG_LAYOUT(struct fanpico_config, wifi_passwd),
+	CFG_LAYOUT(struct fanpico_config, wifi_country),
+	CFG_LAYOUT(struct fanpico_config, wifi_mode),
+	CFG_LAYOUT(struct fanpico_config, hostname),
+	CFG_LAYOUT(struct fanpico_config, syslog_server),
+	CFG_LAYOUT(struct fanpico_config, ntp_server),
+	CFG_LAYOUT(struct fanpico_config, ip),
+	CFG_LAYOUT(struct fanpico_config, netmask),
+	CFG_LAYOUT(struct fanpico_config, gateway),
+	CFG_LAYOUT(struct fanpico_config, mqtt_server),
+	CFG_LAYOUT(struct fanpico_config, mqtt_port),
+	CFG_LAYOUT(struct fanpico_config, mqtt_tls),
+	CFG_LAYOUT(struct fanpico_config, mqtt_allow_scpi),
+	CFG_LAYOUT(struct fanpico_config, mqtt_user),
+	CFG_LAYOUT(struct fanpico_config, mqtt_pass),
+	CFG_LAYOUT(struct fanpico_config, mqtt_status_topic),
+	CFG_LAYOUT(struct fanpico_config, mqtt_status_interval),
+	CFG_LAYOUT(struct fanpico_config, mqtt_cmd_topic),
+	CFG_LAYOUT(struct fanpico_config, mqtt_resp_topic),
+	CFG_LAYOUT(struct fanpico_config, mqtt_temp_mask),
+	CFG_LAYOUT(struct fanpico_config, mqtt_fan_rpm_mask),
+	CFG_LAYOUT(struct fanpico_config, mqtt_fan_duty_mask),
+	CFG_LAYOUT(struct fanpico_config, mqtt_mbfan_rpm_mask),
+	CFG_LAYOUT(struct fanpico_config, mqtt_mbfan_duty_mask),
+	CFG_LAYOUT(struct fanpico_config, mqtt_temp_topic),
+	CFG_LAYOUT(struct fanpico_config, mqtt_fan_rpm_topic),
+	CFG_LAYOUT(struct fanpico_config, mqtt_fan_duty_topic),
+	CFG_LAYOUT(struct fanpico_config, mqtt_mbfan_rpm_topic),
+	CFG_LAYOUT(struct fanpico_config, mqtt_mbfan_duty_topic),
+	CFG_LAYOUT(struct fanpico_config, mqtt_temp_interval),
+	CFG_LAYOUT(struct fanpico_config, mqtt_rpm_interval),
+	CFG_LAYOUT(struct fanpico_config, mqtt_duty_interval),
+	CFG_LAYOUT(struct fanpico_config, mqtt_bulk_topic),
+	CFG_LAYOUT(struct fanpico_config, mqtt_bulk_interval),
+	CFG_LAYOUT(struct fanpico_config, mqtt_change_only),
+	CFG_LAYOUT(struct fanpico_config, mqtt_heartbeat),
+	CFG_LAYOUT(struct fanpico_config, telnet_active),
+	CFG_LAYOUT(struct fanpico_config, telnet_auth),
+	CFG_LAYOUT(struct fanpico_config, telnet_raw_mode),
+	CFG_LAYOUT(struct fanpico_config, telnet_port),
+	CFG_LAYOUT(struct fanpico_config, telnet_user),
+	CFG_LAYOUT(struct fanpico_config, telnet_pwhash),
+	CFG_LAYOUT(struct fanpico_config, syslog_rate),
+	CFG_LAYOUT(struct fanpico_config, syslog_batch),
+	CFG_LAYOUT(struct fanpico_config, telemetry_server),
+	CFG_LAYOUT(struct fanpico_config, telemetry_port),
+	CFG_LAYOUT(struct fanpico_config, telemetry_interval),
+#endif
+	CFG_LAYOUT(struct fanpico_config, vtemp),
+	CFG_LAYOUT(struct fanpico_config, vtemp_updated),
+};
+
+
+/* Hash of struct fanpico_config layout (member offsets and sizes). */
+static uint32_t config_layout_hash()
+{
+	static uint32_t hash = 0;
+
+	if (!hash)
+		hash = fast_crc32((unsigned char*)config_layout, sizeof(config_layout), 0);
+	return hash;
+}
+
+
+static void** config_filter_slot(struct fanpico_config *c, int i, enum signal_filter_types **filter)
+{
+	if (i < SENSOR_MAX_COUNT) {
+		*filter = &c->sensors[i].filter;
+		return &c->sensors[i].filter_ctx;
+	}
+	i -= SENSOR_MAX_COUNT;
+	if (i < VSENSOR_MAX_COUNT) {
+		*filter = &c->vsensors[i].filter;
+		return &c->vsensors[i].filter_ctx;
+	}
+	i -= VSENSOR_MAX_COUNT;
+	if (i < FAN_MAX_COUNT) {
+		*filter = &c->fans[i].filter;
+		return &c->fans[i].filter_ctx;
+	}
+	i -= FAN_MAX_COUNT;
+	*filter = &c->mbfans[i].filter;
+	return &c->mbfans[i].filter_ctx;
+}
+
+
+static int save_config_snapshot(const struct fanpico_config *c)
+{
+	struct config_snapshot_header *hdr;
+	struct fanpico_config *img;
+	enum signal_filter_types *filter;
+	char *args[CONFIG_FILTER_SLOTS];
+	size_t data_size = 0;
+	size_t size, pos, len;
+	char *buf;
+	void **ctx;
+	int ret = 0;
+	int i;
+
+	memset(args, 0, sizeof(args));
+	for (i = 0; i < CONFIG_FILTER_SLOTS; i++) {
+		ctx = config_filter_slot((struct fanpico_config*)c, i, &filter);
+		args[i] = filter_print_args(*filter, *ctx);
+		data_size += (args[i] ? strlen(args[i]) : 0) + 1;
+	}
+
+	size = sizeof(*hdr) + sizeof(*img) + data_size;
+	if (!(buf = malloc(size))) {
+		log_msg(LOG_ALERT, "Out of memory!");
+		ret = -1;
+		goto done;
+	}
+	hdr = (struct config_snapshot_header*)buf;
+	img = (struct fanpico_config*)(buf + sizeof(*hdr));
+
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->magic = CONFIG_SNAPSHOT_MAGIC;
+	hdr->version = CONFIG_SNAPSHOT_VERSION;
+	hdr->layout_hash = config_layout_hash();
+	hdr->config_size = sizeof(*img);
+	hdr->data_size = data_size;
+	hdr->debug_level = get_debug_level();
+	hdr->log_level = get_log_level();
+	hdr->syslog_level = get_syslog_level();
+
+	memcpy(img, c, sizeof(*img));
+	pos = sizeof(*hdr) + sizeof(*img);
+	for (i = 0; i < CONFIG_FILTER_SLOTS; i++) {
+		ctx = config_filter_slot(img, i, &filter);
+		*ctx = NULL;
+		len = (args[i] ? strlen(args[i]) : 0) + 1;
+		memcpy(buf + pos, (args[i] ? args[i] : ""), len);
+		pos += len;
+	}
+	/* Non-config items */
+	memset(img->vtemp, 0, sizeof(img->vtemp));
+	memset(img->vtemp_updated, 0, sizeof(img->vtemp_updated));
+
+	hdr->crc32 = fast_crc32((unsigned char*)buf + CONFIG_SNAPSHOT_CRC_START,
+				size - CONFIG_SNAPSHOT_CRC_START, 0);
+
+	if (flash_write_file(buf, size, CONFIG_SNAPSHOT_FILE) < 0) {
+		log_msg(LOG_ERR, "Failed to save configuration snapshot");
+		ret = -2;
+	}
+	free(buf);
+
+done:
+	for (i = 0; i < CONFIG_FILTER_SLOTS; i++) {
+		if (args[i])
+			free(args[i]);
+	}
+	return ret;
+}
+
+
+/* Read and validate configuration snapshot from flash. */
+static char* load_config_snapshot(uint32_t *crc)
+{
+	struct config_snapshot_header *hdr;
+	uint32_t file_size, crc32;
+	char *buf = NULL;
+
+	if (flash_read_file(&buf, &file_size, CONFIG_SNAPSHOT_FILE) || !buf) {
+		if (buf)
+			free(buf);
+		return NULL;
+	}
+
+	hdr = (struct config_snapshot_header*)buf;
+	if (file_size < sizeof(*hdr) + sizeof(struct fanpico_config)
+		|| hdr->magic != CONFIG_SNAPSHOT_MAGIC
+		|| hdr->version != CONFIG_SNAPSHOT_VERSION
+		|| hdr->config_size != sizeof(struct fanpico_config)
+		|| hdr->layout_hash != config_layout_hash()
+		|| file_size < sizeof(*hdr) + hdr->config_size + hdr->data_size) {
+		log_msg(LOG_INFO, "Configuration snapshot not compatible");
+		free(buf);
+		return NULL;
+	}
+	crc32 = fast_crc32((unsigned char*)buf + CONFIG_SNAPSHOT_CRC_START,
+			sizeof(*hdr) - CONFIG_SNAPSHOT_CRC_START + hdr->config_size
+			+ hdr->data_size, 0);
+	if (crc32 != hdr->crc32) {
+		log_msg(LOG_NOTICE, "Configuration snapshot CRC mismatch: %08lx (expected %08lx)",
+			crc32, hdr->crc32);
+		free(buf);
+		return NULL;
+	}
+
+	if (crc)
+		*crc = crc32;
+	return buf;
+}
+
+
+/*
+ * Configuration change journal.
+ *
+ * CONF:SAVe only appends the changes made since last save into a journal
+ * file (as a list of changed byte ranges in struct fanpico_config),
+ * instead of rewriting the full configuration. Each journal entry is
+ * tied to the snapshot it applies on (snapshot CRC) and protected with
+ * its own CRC, so a partially written entry (or a journal left over from
+ * an older snapshot) is simply ignored. Journal makes the change durable
+ * immediately, but it is only usable together with the snapshot. So
+ * configuration is compacted (full JSON configuration and snapshot are
+ * written and journal is reset) in the background once there have been no
+ * new saves for CONFIG_COMPACT_DELAY, to keep JSON configuration current
+ * (for firmware upgrades and in case snapshot is lost) while coalescing
+ * bursts of saves into one full write. Configuration is compacted
+ * immediately, if journal grows too big (or filter settings, or settings
+ * saved in snapshot header change).
+ */
+
+#define CONFIG_JOURNAL_FILE      "fanpico.jnl"
+#define CONFIG_JOURNAL_MAGIC     0x4650434a  /* "FPCJ" */
+#define CONFIG_JOURNAL_MAX_SIZE  4096
+#define CONFIG_JOURNAL_MERGE_GAP 8
+#define CONFIG_COMPACT_DELAY     10000  /* ms */
+
+struct config_journal_entry {
+	uint32_t magic;
+	uint32_t base_crc;
+	uint32_t data_size;
+	uint32_t crc32;
+};
+
+struct config_journal_record {
+	uint32_t offset;
+	uint32_t len;
+};
+
+static uint32_t config_journal_size = 0;
+static uint32_t config_saved_generation = 0;
+static bool config_compact_pending = false;
+static absolute_time_t config_compact_time;
+
+
+/* Apply valid journal entries on given config image.
+ * Returns number of journal entries applied. */
+static int apply_config_journal(struct fanpico_config *img, uint32_t base_crc, uint32_t *journal_size)
+{
+	struct config_journal_entry *e;
+	struct config_journal_record *r;
+	uint32_t file_size;
+	uint32_t pos = 0;
+	uint32_t rpos, rend;
+	char *buf = NULL;
+	int count = 0;
+
+	if (journal_size)
+		*journal_size = 0;
+	if (flash_read_file(&buf, &file_size, CONFIG_JOURNAL_FILE) || !buf) {
+		if (buf)
+			free(buf);
+		return 0;
+	}
+
+	while (pos + sizeof(*e) <= file_size) {
+		e = (struct config_journal_entry*)(buf + pos);
+		if (e->magic != CONFIG_JOURNAL_MAGIC || e->base_crc != base_crc
+			|| e->data_size > file_size - pos - sizeof(*e))
+			break;
+		rpos = pos + sizeof(*e);
+		rend = rpos + e->data_size;
+		if (fast_crc32((unsigned char*)buf + rpos, e->data_size, 0) != e->crc32) {
+			log_msg(LOG_NOTICE, "Configuration journal: CRC mismatch at %lu", pos);
+			break;
+		}
+		while (rpos + sizeof(*r) <= rend) {
+			r = (struct config_journal_record*)(buf + rpos);
+			rpos += sizeof(*r);
+			if (r->len > rend - rpos || r->offset > sizeof(*img)
+				|| r->len > sizeof(*img) - r->offset)
+				break;
+			memcpy((uint8_t*)img + r->offset, buf + rpos, r->len);
+			rpos += r->len;
+		}
+		pos = rend;
+		count++;
+	}
+	free(buf);
+
+	if (journal_size)
+		*journal_size = pos;
+	if (count > 0)
+		log_msg(LOG_INFO, "Configuration journal: %d entries applied", count);
+
+	return count;
+}
+
+
+/* Append changes since last save into the journal.
+ * Returns 1 if journal entry was written, 0 if there were no changes,
+ * and -1 if configuration needs to be compacted (full save). */
+static int save_config_journal(const struct fanpico_config *c)
+{
+	struct config_snapshot_header *hdr;
+	struct config_journal_entry *e;
+	struct config_journal_record *r;
+	struct fanpico_config *img;
+	enum signal_filter_types *filter, *cfilter;
+	const uint8_t *a, *b;
+	uint32_t base_crc, jsize, pos;
+	size_t i, start, end, gap;
+	char *buf, *jbuf = NULL;
+	char *args, *argsend, *s;
+	void **ctx, **cctx;
+	int ret = -1;
+	int slot;
+
+	if (!(buf = load_config_snapshot(&base_crc)))
+		return -1;
+	hdr = (struct config_snapshot_header*)buf;
+	img = (struct fanpico_config*)(buf + sizeof(*hdr));
+	apply_config_journal(img, base_crc, &jsize);
+
+	/* Settings in snapshot header cannot be journaled either */
+	if (hdr->debug_level != get_debug_level()
+		|| hdr->log_level != get_log_level()
+		|| hdr->syslog_level != get_syslog_level())
+		goto done;
+
+	/* Filter settings cannot be journaled, check that they match snapshot */
+	args = buf + sizeof(*hdr) + sizeof(*img);
+	argsend = args + hdr->data_size;
+	for (slot = 0; slot < CONFIG_FILTER_SLOTS; slot++) {
+		ctx = config_filter_slot(img, slot, &filter);
+		cctx = config_filter_slot((struct fanpico_config*)c, slot, &cfilter);
+		if (args >= argsend || *filter != *cfilter)
+			goto done;
+		s = filter_print_args(*cfilter, *cctx);
+		if (strcmp(args, (s ? s : ""))) {
+			if (s)
+				free(s);
+			goto done;
+		}
+		if (s)
+			free(s);
+		args += strnlen(args, argsend - args) + 1;
+		/* Exclude pointers (and non-config items) from comparison */
+		*ctx = *cctx;
+	}
+	memcpy(img->vtemp, c->vtemp, sizeof(img->vtemp));
+	memcpy(img->vtemp_updated, c->vtemp_updated, sizeof(img->vtemp_updated));
+
+	if (!(jbuf = malloc(CONFIG_JOURNAL_MAX_SIZE))) {
+		log_msg(LOG_ALERT, "Out of memory!");
+		goto done;
+	}
+
+	/* Collect changed byte ranges... */
+	a = (const uint8_t*)img;
+	b = (const uint8_t*)c;
+	pos = sizeof(*e);
+	i = 0;
+	while (i < sizeof(*img)) {
+		if (a[i] == b[i]) {
+			i++;
+			continue;
+		}
+		start = end = i;
+		gap = 0;
+		while (++i < sizeof(*img) && gap < CONFIG_JOURNAL_MERGE_GAP) {
+			if (a[i] != b[i]) {
+				end = i;
+				gap = 0;
+			} else {
+				gap++;
+			}
+		}
+		if (pos + sizeof(*r) + end - start + 1 > CONFIG_JOURNAL_MAX_SIZE)
+			goto done;
+		r = (struct config_journal_record*)(jbuf + pos);
+		r->offset = start;
+		r->len = end - start + 1;
+		pos += sizeof(*r);
+		memcpy(jbuf + pos, b + start, r->len);
+		pos += r->len;
+		i = end + 1;
+	}
+
+	if (pos == sizeof(*e)) {
+		ret = 0;
+		goto done;
+	}
+	if (jsize + pos > CONFIG_JOURNAL_MAX_SIZE)
+		goto done;
+
+	e = (struct config_journal_entry*)jbuf;
+	e->magic = CONFIG_JOURNAL_MAGIC;
+	e->base_crc = base_crc;
+	e->data_size = pos - sizeof(*e);
+	e->crc32 = fast_crc32((unsigned char*)jbuf + sizeof(*e), e->data_size, 0);
+	if (flash_append_file(jbuf, pos, CONFIG_JOURNAL_FILE) >= 0) {
+		log_msg(LOG_INFO, "Configuration changes saved in journal: %lu bytes", pos);
+		config_journal_size = jsize + pos;
+		ret = 1;
+	}
+
+done:
+	if (jbuf)
+		free(jbuf);
+	free(buf);
+	return ret;
+}
+
+
+static int read_config_snapshot(struct fanpico_config *c)
+{
+	struct config_snapshot_header *hdr;
+	enum signal_filter_types *filter;
+	uint32_t crc;
+	char *buf;
+	char *args, *end;
+	void **ctx;
+	int i;
+
+	if (!(buf = load_config_snapshot(&crc)))
+		return -1;
+	hdr = (struct config_snapshot_header*)buf;
+	apply_config_journal((struct fanpico_config*)(buf + sizeof(*hdr)), crc,
+			&config_journal_size);
+
+	clear_config(c);
+
+	mutex_enter_blocking(config_mutex);
+	memcpy(c, buf + sizeof(*hdr), sizeof(*c));
+	args = buf + sizeof(*hdr) + sizeof(*c);
+	end = args + hdr->data_size;
+	for (i = 0; i < CONFIG_FILTER_SLOTS; i++) {
+		ctx = config_filter_slot(c, i, &filter);
+		*ctx = NULL;
+		if (args < end && *filter != FILTER_NONE) {
+			*ctx = filter_parse_args(*filter, args);
+			if (!*ctx)
+				*filter = FILTER_NONE;
+		} else {
+			*filter = FILTER_NONE;
+		}
+		args += (args < end ? strnlen(args, end - args) + 1 : 0);
+	}
+	config_generation++;
 	mutex_exit(config_mutex);
+
+	set_debug_level(hdr->debug_level);
+	set_log_level(hdr->log_level);
+	set_syslog_level(hdr->syslog_level);
+
+	free(buf);
 	return 0;
 }
 
@@ -1121,6 +2021,19 @@ void read_config()
 
 	log_msg(LOG_INFO, "Reading configuration...");
 
+	if (read_config_snapshot(&fanpico_config) == 0) {
+		log_msg(LOG_INFO, "Configuration restored from snapshot");
+		config_saved_generation = config_generation;
+		return;
+	}
+	config_journal_size = 0;
+	if (flash_read_file(&buf, &file_size, CONFIG_JOURNAL_FILE) == 0 && file_size > 0)
+		log_msg(LOG_WARNING, "Configuration journal discarded (snapshot not usable)");
+	if (buf) {
+		free(buf);
+		buf = NULL;
+	}
+
 	res = flash_read_file(&buf, &file_size, "fanpico.cfg");
 	if (res == 0 && buf != NULL) {
 		/* parse saved config... */
@@ -1151,40 +2064,142 @@ void read_config()
 	if (json_to_config(config, &fanpico_config) < 0) {
 		log_msg(LOG_ERR, "Error parsing JSON configuration");
 	}
+	config_saved_generation = config_generation;
 
 	cJSON_Delete(config);
 }
 
 
-void save_config()
+/* Called once configuration compaction writes have completed. */
+static void config_compact_done(int res)
+{
+	if (res < 0) {
+		log_msg(LOG_ERR, "Failed to write configuration: %d", res);
+		/* Keep the journal, and try again later... */
+		config_compact_pending = true;
+		config_compact_time = get_absolute_time();
+		return;
+	}
+	config_journal_size = 0;
+}
+
+
+/* Save full configuration (JSON and snapshot) and reset the journal.
+ * Unless forced, this is only done if there is something in the journal.
+ * Files are written in the background (in order: snapshot, JSON config,
+ * journal), and journal is only reset if both configuration files were
+ * successfully written (otherwise compaction is retried later).
+ * Returns 0 if writes were queued, < 0 on error. */
+int compact_config(bool force)
 {
 	cJSON *config;
 	char *str;
+	uint32_t seq;
+	int ret = 0;
+
+	if (!force && config_journal_size == 0)
+		return 0;
 
 	log_msg(LOG_NOTICE, "Saving configuration...");
+	seq = flash_write_seq();
+
+	/* Snapshot is queued first, so that it is never older than JSON config. */
+	if (save_config_snapshot(cfg) < 0) {
+		ret = -1;
+		goto fail;
+	}
 
 	config = config_to_json(cfg);
 	if (!config) {
 		log_msg(LOG_ALERT, "Out of memory!");
-		return;
+		ret = -1;
+		goto fail;
 	}
 
 	if ((str = cJSON_Print(config)) == NULL) {
 		log_msg(LOG_ERR, "Failed to generate JSON output");
+		ret = -2;
 	} else {
 		uint32_t config_size = strlen(str) + 1;
-		flash_write_file(str, config_size, "fanpico.cfg");
+		if (flash_write_file(str, config_size, "fanpico.cfg") < 0)
+			ret = -3;
 		free(str);
 	}
 
 	cJSON_Delete(config);
+	if (ret < 0)
+		goto fail;
+
+	if (flash_write_file_after("", 0, CONFIG_JOURNAL_FILE, seq,
+					config_compact_done) < 0) {
+		ret = -4;
+		goto fail;
+	}
+	config_saved_generation = config_generation;
+	config_compact_pending = false;
+	return 0;
+
+fail:
+	/* Keep the journal, and try again later... */
+	config_compact_pending = true;
+	config_compact_time = get_absolute_time();
+	return ret;
+}
+
+
+void save_config()
+{
+	uint32_t gen = config_generation;
+	int res;
+
+	res = save_config_journal(cfg);
+	if (res < 0) {
+		compact_config(true);
+	} else if (res == 0) {
+		log_msg(LOG_INFO, "No configuration changes to save");
+	} else {
+		/* Update full configuration once saves have stopped */
+		config_compact_pending = true;
+		config_compact_time = get_absolute_time();
+	}
+	config_saved_generation = gen;
+}
+
+
+/* Save configuration automatically once it has not been changed
+ * for 'config_autosave' seconds. Also runs pending (background)
+ * configuration compaction. */
+void config_autosave_poll()
+{
+	static uint32_t last_gen = 0;
+	static absolute_time_t last_change;
+	uint32_t gen = config_generation;
+
+	if (config_compact_pending && absolute_time_diff_us(config_compact_time,
+				get_absolute_time()) >= (int64_t)CONFIG_COMPACT_DELAY * 1000)
+		compact_config(false);
+
+	if (cfg->config_autosave == 0 || gen == config_saved_generation)
+		return;
+
+	if (gen != last_gen) {
+		last_gen = gen;
+		last_change = get_absolute_time();
+		return;
+	}
+	if (absolute_time_diff_us(last_change, get_absolute_time())
+		< (int64_t)cfg->config_autosave * 1000000)
+		return;
+
+	log_msg(LOG_INFO, "Configuration idle for %lus, saving...", cfg->config_autosave);
+	save_config();
 }
 
 
 void print_config()
 {
-	cJSON *config;
-	char *str;
+	cJSON *config, *item;
+	char *str, *p;
 
 	config = config_to_json(cfg);
 	if (!config) {
@@ -1192,12 +2207,24 @@ void print_config()
 		return;
 	}
 
-	if ((str = cJSON_Print(config)) == NULL) {
-		log_msg(LOG_ERR, "Failed to generate JSON output");
-	} else {
-		printf("Current Configuration:\n%s\n---\n", str);
+	/* Output one top-level item at a time, so that the whole
+	 * document never needs to be rendered into memory at once. */
+	printf("Current Configuration:\n{\n");
+	cJSON_ArrayForEach(item, config) {
+		if ((str = cJSON_Print(item)) == NULL) {
+			log_msg(LOG_ERR, "Failed to generate JSON output");
+			break;
+		}
+		printf("\t\"%s\":\t", item->string);
+		for (p = str; *p; p++) {
+			putchar(*p);
+			if (*p == '\n')
+				putchar('\t');
+		}
+		printf("%s\n", (item->next ? "," : ""));
 		free(str);
 	}
+	printf("}\n---\n");
 
 	cJSON_Delete(config);
 }
@@ -1211,4 +2238,7 @@ void delete_config()
 	if (res) {
 		log_msg(LOG_ERR, "Failed to delete configuration.");
 	}
+	flash_delete_file(CONFIG_SNAPSHOT_FILE);
+	flash_delete_file(CONFIG_JOURNAL_FILE);
+	config_journal_size = 0;
 }
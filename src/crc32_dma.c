@@ -0,0 +1,135 @@
+/* crc32_dma.c
+   Copyright (C) 2021-2024 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of FanPico.
+
+   FanPico is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   FanPico is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with FanPico. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "pico/mutex.h"
+#include "hardware/dma.h"
+
+#include "fanpico.h"
+
+
+/*
+ * CRC-32 using the DMA sniffer.
+ *
+ * In CRC-32 mode (with no bit reversal or output inversion) the sniffer
+ * calculates MSB-first CRC with polynomial 0x04c11db7, which is the
+ * same CRC as xcrc32() calculates, so the two are interchangeable
+ * (and results can be chained). DMA channel setup has some overhead,
+ * so buffers shorter than CRC32_DMA_MIN_LEN are handled by xcrc32().
+ * See SYS:PERF:CRC? for the crossover point.
+ *
+ * There is only one sniffer, so if it is busy (or if DMA self-test failed)
+ * calculation falls back to xcrc32().
+ */
+
+#define CRC32_DMA_MIN_LEN 64
+#define DMA_SNIFF_CRC32   0x0
+
+auto_init_mutex(crc32_mutex_inst);
+static int crc32_dma = -1;
+static uint32_t crc32_dummy;
+
+
+static uint32_t crc32_dma_calc(const void *buf, size_t len, uint32_t init)
+{
+	dma_channel_config c;
+
+	c = dma_channel_get_default_config(crc32_dma);
+	channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+	channel_config_set_read_increment(&c, true);
+	channel_config_set_write_increment(&c, false);
+	channel_config_set_sniff_enable(&c, true);
+
+	dma_sniffer_enable(crc32_dma, DMA_SNIFF_CRC32, true);
+	dma_hw->sniff_data = init;
+	dma_channel_configure(crc32_dma, &c, &crc32_dummy, buf, len, true);
+	dma_channel_wait_for_finish_blocking(crc32_dma);
+	init = dma_hw->sniff_data;
+	dma_sniffer_disable();
+
+	return init;
+}
+
+
+void crc32_init()
+{
+	unsigned char test[CRC32_DMA_MIN_LEN * 2];
+	uint32_t crc_sw, crc_dma;
+	int i;
+
+	if ((crc32_dma = dma_claim_unused_channel(false)) < 0) {
+		log_msg(LOG_NOTICE, "No DMA channel available for CRC-32");
+		return;
+	}
+
+	/* Make sure DMA sniffer produces same results as xcrc32()... */
+	for (i = 0; i < sizeof(test); i++)
+		test[i] = i * 7 + 3;
+	crc_sw = xcrc32(test, sizeof(test), 0xffffffff);
+	crc_dma = crc32_dma_calc(test, sizeof(test), 0xffffffff);
+	if (crc_sw != crc_dma) {
+		log_msg(LOG_WARNING, "DMA CRC-32 self-test failed (%08lx != %08lx)",
+			crc_dma, crc_sw);
+		dma_channel_unclaim(crc32_dma);
+		crc32_dma = -1;
+	}
+}
+
+
+uint32_t fast_crc32(const void *buf, size_t len, uint32_t init)
+{
+	uint32_t crc;
+
+	if (len < CRC32_DMA_MIN_LEN || crc32_dma < 0
+		|| !mutex_try_enter(&crc32_mutex_inst, NULL))
+		return xcrc32(buf, len, init);
+
+	crc = crc32_dma_calc(buf, len, init);
+	mutex_exit(&crc32_mutex_inst);
+
+	return crc;
+}
+
+
+uint32_t dma_crc32(const void *buf, size_t len, uint32_t init)
+{
+	uint32_t crc;
+
+	if (len == 0 || crc32_dma < 0)
+		return xcrc32(buf, len, init);
+
+	mutex_enter_blocking(&crc32_mutex_inst);
+	crc = crc32_dma_calc(buf, len, init);
+	mutex_exit(&crc32_mutex_inst);
+
+	return crc;
+}
+
+
+bool crc32_dma_available()
+{
+	return (crc32_dma >= 0);
+}
+
+
+/* eof :-) */
@@ -0,0 +1,143 @@
+/* curve.c
+   Copyright (C) 2021-2024 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of FanPico.
+
+   FanPico is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   FanPico is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with FanPico. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "pico/stdlib.h"
+
+#include "fanpico.h"
+
+
+/*
+ * Functions for evaluating (piecewise linear) mapping curves.
+ *
+ * Maps (pwm_map, tacho_map, temp_map) are "compiled" into a fixed-point
+ * representation with precomputed slopes when configuration is passed to
+ * core1 (see config_to_control()).
+ * Evaluation uses binary search to find the segment, and then
+ * just one multiplication to interpolate value within the segment.
+ */
+
+
+static void curve_finalize(struct curve *c, uint8_t points)
+{
+	int i;
+	int64_t dx, dy, slope;
+
+	c->points = points;
+	for (i = 0; i < points; i++) {
+		if (i < points - 1) {
+			dx = c->x[i + 1] - c->x[i];
+			dy = c->y[i + 1] - c->y[i];
+			slope = (dx > 0 ? (dy << CURVE_SLOPE_BITS) / dx : 0);
+			if (slope > INT32_MAX)
+				slope = INT32_MAX;
+			else if (slope < INT32_MIN)
+				slope = INT32_MIN;
+			c->slope[i] = slope;
+		} else {
+			c->slope[i] = 0;
+		}
+	}
+}
+
+
+static inline int32_t curve_fixed(float val)
+{
+	val *= (1 << CURVE_FRAC_BITS);
+	if (val >= (float)INT32_MAX)
+		return INT32_MAX;
+	if (val <= (float)INT32_MIN)
+		return INT32_MIN;
+	return lroundf(val);
+}
+
+
+void pwm_map_compile(const struct pwm_map *map, struct curve *c)
+{
+	for (int i = 0; i < map->points; i++) {
+		c->x[i] = map->pwm[i][0] << CURVE_FRAC_BITS;
+		c->y[i] = map->pwm[i][1] << CURVE_FRAC_BITS;
+	}
+	curve_finalize(c, map->points);
+}
+
+
+void tacho_map_compile(const struct tacho_map *map, struct curve *c)
+{
+	for (int i = 0; i < map->points; i++) {
+		c->x[i] = map->tacho[i][0] << CURVE_FRAC_BITS;
+		c->y[i] = map->tacho[i][1] << CURVE_FRAC_BITS;
+	}
+	curve_finalize(c, map->points);
+}
+
+
+void temp_map_compile(const struct temp_map *map, struct curve *c)
+{
+	for (int i = 0; i < map->points; i++) {
+		c->x[i] = curve_fixed(map->temp[i][0]);
+		c->y[i] = curve_fixed(map->temp[i][1]);
+	}
+	curve_finalize(c, map->points);
+}
+
+
+/* Evaluate curve at given point (fixed-point input and output).
+ */
+int32_t curve_eval_fixed(const struct curve *c, int32_t x)
+{
+	int lo, hi, mid;
+
+	if (c->points < 1)
+		return 0;
+
+	/* Value is equal or smaller than first point */
+	if (x <= c->x[0])
+		return c->y[0];
+
+	/* Value is larger or equal than last point */
+	hi = c->points - 1;
+	if (x >= c->x[hi])
+		return c->y[hi];
+
+	/* Find the segment the value falls in: x[lo] < x <= x[hi] */
+	lo = 0;
+	while (hi - lo > 1) {
+		mid = (lo + hi) >> 1;
+		if (c->x[mid] < x)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return c->y[lo] + (int32_t)(((int64_t)(x - c->x[lo]) * c->slope[lo]) >> CURVE_SLOPE_BITS);
+}
+
+
+float curve_eval(const struct curve *c, float x)
+{
+	return (float)curve_eval_fixed(c, curve_fixed(x)) / (1 << CURVE_FRAC_BITS);
+}
+
+
+/* eof :-) */
@@ -21,6 +21,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "pico/stdlib.h"
 
 #include "fanpico.h"
@@ -54,21 +55,67 @@ void clear_display()
 #endif
 }
 
+/*
+ * Display updates are time-sliced: display_status() only takes a snapshot
+ * of the state to be displayed, actual rendering is done incrementally
+ * by display_poll() (called from main loop), which renders a bounded number
+ * of fields per call, so that rendering does not delay network/USB
+ * processing on core0.
+ */
+
+static struct fanpico_state display_state;
+static const struct fanpico_config *display_config = NULL;
+static bool display_pending = false;
+static bool display_restart = false;
+
+
 void display_status(const struct fanpico_state *state,
 	const struct fanpico_config *config)
 {
+	if (!state || !config)
+		return;
+
+	memcpy(&display_state, state, sizeof(display_state));
+	display_config = config;
+	display_pending = true;
+	display_restart = true;
+}
+
+bool display_poll(uint32_t budget_us)
+{
+	absolute_time_t deadline;
+	int more = 0;
+
+	if (!display_pending)
+		return false;
+
+	deadline = make_timeout_time_us(budget_us);
 #if LCD_DISPLAY
 	if (cfg->spi_active)
-		lcd_display_status(state, config);
+		more = lcd_display_status(&display_state, display_config,
+					display_restart, deadline);
 #endif
 #if OLED_DISPLAY
 	if (!cfg->spi_active)
-		oled_display_status(state, config);
+		more = oled_display_status(&display_state, display_config,
+					display_restart, deadline);
 #endif
+	display_restart = false;
+	display_pending = (more ? true : false);
+
+	return display_pending;
+}
+
+bool display_busy()
+{
+	return display_pending;
 }
 
 void display_message(int rows, const char **text_lines)
 {
+	/* Abort any pending status update */
+	display_pending = false;
+
 #if LCD_DISPLAY
 	if (cfg->spi_active)
 		lcd_display_message(rows, text_lines);
@@ -36,6 +36,24 @@
 static SPILCD lcd;
 static uint8_t lcd_found = 0;
 
+/* Use DMA for SPI transfers (if supported by bb_spi_lcd), so that
+ * drawing does not need to wait for each transfer to complete. */
+#ifdef DRAW_WITH_DMA
+#define LCD_DRAW_MODE (DRAW_TO_LCD | DRAW_WITH_DMA)
+#else
+#define LCD_DRAW_MODE DRAW_TO_LCD
+#endif
+
+/* Last rendered value of each foreground field (only changed fields
+ * are redrawn). */
+#define LCD_FIELD_CACHE_COUNT 64
+#define LCD_FIELD_CACHE_LEN   32
+
+static char field_cache[LCD_FIELD_CACHE_COUNT][LCD_FIELD_CACHE_LEN];
+
+/* Max number of (changed) foreground fields to draw per call. */
+#define LCD_FIELDS_PER_SLICE 4
+
 
 /* Macros for converting RGB888 colorspace to RGB565 */
 
@@ -403,17 +421,28 @@ void lcd_display_init()
 	log_msg(LOG_INFO, "LCD theme: %s", themes[theme_idx].name);
 }
 
+static void invalidate_field_cache()
+{
+	memset(field_cache, 0, sizeof(field_cache));
+}
+
 void lcd_clear_display()
 {
 	if (!lcd_found)
 		return;
 
 	spilcdFill(&lcd, 0, DRAW_TO_LCD);
+	invalidate_field_cache();
 }
 
-void draw_fields(const struct fanpico_state *state, const struct fanpico_config *conf, const struct display_theme *theme, int mode)
+/* Draw fields of a theme. If 'pos' is given, drawing starts from field
+ * *pos and stops once LCD_FIELDS_PER_SLICE fields have been drawn or
+ * deadline has passed. Returns 1 if there are fields left to draw. */
+int draw_fields(const struct fanpico_state *state, const struct fanpico_config *conf, const struct display_theme *theme,
+		int mode, int *pos, absolute_time_t deadline)
 {
-	int i = 0;
+	int i = (pos ? *pos : 0);
+	int drawn = 0;
 	char buf[64];
 	double val;
 	datetime_t t;
@@ -425,6 +454,11 @@ void draw_fields(const struct fanpico_state *state, const struct fanpico_config
 	while (list[i].type > INVALID_FIELDTYPE && list[i].type < DISPLAY_FIELD_TYPE_COUNT) {
 		const display_field_t *f = &list[i];
 
+		if (pos && drawn > 0 && (drawn >= LCD_FIELDS_PER_SLICE || time_reached(deadline))) {
+			*pos = i;
+			return 1;
+		}
+
 		buf[0] = 0;
 		switch (f->data) {
 
@@ -553,31 +587,53 @@ void draw_fields(const struct fanpico_state *state, const struct fanpico_config
 			buf[0] = 0;
 		}
 
-		if (strlen(buf) > 0)
-			spilcdWriteString(&lcd, f->x, f->y, buf, f->fg, f->bg, f->font, DRAW_TO_LCD);
+		if (strlen(buf) > 0) {
+			if (mode && i < LCD_FIELD_CACHE_COUNT) {
+				/* Skip fields that have not changed since last update */
+				if (!strncmp(field_cache[i], buf, LCD_FIELD_CACHE_LEN)) {
+					i++;
+					continue;
+				}
+				if (strlen(buf) < LCD_FIELD_CACHE_LEN)
+					strncopy(field_cache[i], buf, LCD_FIELD_CACHE_LEN);
+				else
+					field_cache[i][0] = 0;
+			}
+			spilcdWriteString(&lcd, f->x, f->y, buf, f->fg, f->bg, f->font, LCD_DRAW_MODE);
+			drawn++;
+		}
 
 		i++;
 	}
+
+	if (pos)
+		*pos = 0;
+	return 0;
 }
 
-void lcd_display_status(const struct fanpico_state *state,
-	const struct fanpico_config *conf)
+int lcd_display_status(const struct fanpico_state *state,
+	const struct fanpico_config *conf, bool restart, absolute_time_t deadline)
 {
 	static uint8_t bg_drawn = 0;
+	static int pos = 0;
 
 
 	if (!lcd_found || !state)
-		return;
+		return 0;
+
+	if (restart)
+		pos = 0;
 
 	if (!bg_drawn) {
 		/* draw background graphics only once... */
 		bg_drawn = 1;
+		invalidate_field_cache();
 		//spilcdRectangle(&lcd, 0, 0, lcd.iCurrentWidth -1, lcd.iCurrentHeight - 1, 0xffff, 0xffff, 0, DRAW_TO_LCD);
 
 		if (theme->bmp) {
 			spilcdDrawBMP(&lcd, theme->bmp, 0, 0,	0, -1, DRAW_TO_LCD);
-			draw_fields(state, conf, theme, 0);
-			return;
+			draw_fields(state, conf, theme, 0, NULL, deadline);
+			return 0;
 		} else {
 			spilcdFill(&lcd, 0x0000, DRAW_TO_LCD);
 			if (bg_color != 0)
@@ -585,11 +641,13 @@ void lcd_display_status(const struct fanpico_state *state,
 						0, 0,
 						lcd.iCurrentWidth - 1, lcd.iCurrentHeight -1 ,
 						10, bg_color);
-			draw_fields(state, conf, theme, 0);
+			draw_fields(state, conf, theme, 0, NULL, deadline);
 		}
+		/* Continue with foreground on next call */
+		return 1;
 	}
 
-	draw_fields(state, conf, theme, 1);
+	return draw_fields(state, conf, theme, 1, &pos, deadline);
 }
 
 void lcd_display_message(int rows, const char **text_lines)
@@ -58,6 +58,24 @@ static uint8_t oled_found = 0;
 static uint8_t r_lines = 8;
 static struct layout_item r_layout[R_LAYOUT_MAX];
 
+/* Cache of strings last sent to the display (by position), so that
+ * only changed parts of the screen need to be transmitted. */
+#define OLED_CACHE_SIZE 32
+#define OLED_CACHE_LEN  24
+
+struct oled_cache_entry {
+	uint8_t x;
+	uint8_t y;
+	uint8_t font;
+	char text[OLED_CACHE_LEN];
+};
+
+static struct oled_cache_entry oled_cache[OLED_CACHE_SIZE];
+static uint8_t oled_cache_count = 0;
+
+/* Max number of strings to transmit per call. */
+#define OLED_WRITES_PER_SLICE 3
+
 
 /* Default screen layouts for inputs/sensors */
 #define R_LAYOUT_128x64  "M1,M2,M3,M4,-,S1,S2,S3"
@@ -123,6 +141,7 @@ void oled_display_init()
 {
 	int res;
 	int retries = 0;
+	uint32_t i2c_speed;
 	int dtype = OLED_128x64;
 	int invert = 0;
 	int flip = 0;
@@ -171,12 +190,15 @@ void oled_display_init()
 	log_msg(LOG_DEBUG, "Set display brightness: %u%% (0x%x)\n",
 		brightness, disp_brightness);
 
-	log_msg(LOG_NOTICE, "Initializing OLED Display...");
+	/* Bus is shared with I2C sensors, so speed is chosen here once */
+	i2c_speed = i2c_bus_speed();
+	log_msg(LOG_NOTICE, "Initializing OLED Display (I2C %lukHz)...", i2c_speed / 1000);
 	do {
 		sleep_ms(50);
 		res = oledInit(&oled, dtype, -1, flip, invert, I2C_HW,
-			SDA_PIN, SCL_PIN, -1, 1000000L);
+			SDA_PIN, SCL_PIN, -1, i2c_speed);
 	} while (res == OLED_NOT_FOUND && retries++ < 10);
+	i2c_bus_set_shared();
 
 	if (res == OLED_NOT_FOUND) {
 		log_msg(LOG_ERR, "No OLED Display Connected!");
@@ -226,65 +248,72 @@ void oled_clear_display()
 		return;
 
 	oledFill(&oled, 0, 1);
+	oled_cache_count = 0;
 }
 
-void oled_display_status(const struct fanpico_state *state,
-	const struct fanpico_config *conf)
+/* Write string to display, unless identical string has already been
+ * written to the same position. Returns 1 if string was written. */
+static int oled_write_string(int x, int y, const char *text, int font)
 {
-	char buf[64];
+	struct oled_cache_entry *e = NULL;
 	int i;
-	double rpm, pwm, temp;
-	datetime_t t;
-	static uint32_t counter = 0;
-	static int bg_drawn = 0;
-
-
-	if (!oled_found || !state)
-		return;
 
-	int h_pos = 70;
-	int fan_row_offset = (oled_height > 64 ? 1 : 0);
-
-	if (!bg_drawn) {
-		/* Draw "background" only once... */
-		oled_clear_display();
-
-		if (oled_height > 64) {
-			oledWriteString(&oled, 0,  0, 0, "Fans", FONT_6x8, 0, 1);
+	for (i = 0; i < oled_cache_count; i++) {
+		if (oled_cache[i].x == x && oled_cache[i].y == y) {
+			e = &oled_cache[i];
+			break;
 		}
+	}
+	if (e) {
+		if (e->font == font && !strncmp(e->text, text, sizeof(e->text)))
+			return 0;
+	} else if (oled_cache_count < OLED_CACHE_SIZE) {
+		e = &oled_cache[oled_cache_count++];
+		e->x = x;
+		e->y = y;
+	}
 
-		for (i = 0; i < r_lines; i++) {
-			struct layout_item *l = &r_layout[i];
-			char label[16];
-			int y = i * 8;
+	oledWriteString(&oled, 0, x, y, (char*)text, font, 0, 1);
 
-			if (l->type == LINE) {
-				oledDrawLine(&oled, h_pos, y + 4, oled_width - 1, y + 4, 1);
-			}
-			else if (l->type == LABEL) {
-				int len = l->idx;
-				if (len >= sizeof(label))
-					len = sizeof(label) - 1;
-				memcpy(label, l->label, len);
-				label[len] = 0;
-				oledWriteString(&oled, 0, h_pos + 2, i, label, FONT_6x8, 0, 1);
-			}
-		}
-		oledDrawLine(&oled, h_pos, 0, h_pos, r_lines * 8 - 1, 1);
-		bg_drawn = 1;
+	if (e) {
+		e->font = font;
+		if (strlen(text) < sizeof(e->text))
+			strncopy(e->text, text, sizeof(e->text));
+		else
+			e->text[0] = 0;
 	}
 
+	return 1;
+}
+
+/* Draw one item (row) of the status screen. Returns number of strings
+ * that were actually transmitted to the display. */
+static int oled_draw_item(const struct fanpico_state *state,
+	const struct fanpico_config *conf, int item)
+{
+	char buf[64];
+	double rpm, pwm, temp;
+	datetime_t t;
+	static uint32_t counter = 0;
+	int h_pos = 70;
+	int fan_row_offset = (oled_height > 64 ? 1 : 0);
+	int ret = 0;
+	int i;
 
-	for (i = 0; i < FAN_COUNT; i++) {
+	if (item < FAN_COUNT) {
+		i = item;
 		rpm = state->fan_freq[i] * 60 / conf->fans[i].rpm_factor;
 		pwm = state->fan_duty[i];
 		snprintf(buf, sizeof(buf), "%d:%4.0lf %3.0lf%%", i + 1, rpm, pwm);
-		oledWriteString(&oled, 0 , 0, i + fan_row_offset, buf, FONT_6x8, 0, 1);
+		return oled_write_string(0, i + fan_row_offset, buf, FONT_6x8);
 	}
-	for (i = 0; i < r_lines; i++) {
-		struct layout_item *l = &r_layout[i];
+	item -= FAN_COUNT;
+
+	if (item < r_lines) {
+		struct layout_item *l = &r_layout[item];
 		int write_buf = 0;
 
+		i = item;
 		if (l->type == MBFAN) {
 			pwm = state->mbfan_duty[l->idx];
 			snprintf(buf, sizeof(buf), "%d: %4.0lf%%  ", l->idx + 1, pwm);
@@ -304,8 +333,9 @@ void oled_display_status(const struct fanpico_state *state,
 			if (oled_height <= 64 && i == 0) {
 				buf[8] = (counter++ % 2 == 0 ? '*' : ' ');
 			}
-			oledWriteString(&oled, 0 , h_pos + 2, i, buf, FONT_6x8, 0, 1);
+			ret = oled_write_string(h_pos + 2, i, buf, FONT_6x8);
 		}
+		return ret;
 	}
 
 	if (oled_height > 64) {
@@ -319,7 +349,7 @@ void oled_display_status(const struct fanpico_state *state,
 			int offset = delta / 2;
 			memset(buf, ' ', 8);
 			snprintf(buf + offset, sizeof(buf), " %s", ip);
-			oledWriteString(&oled, 0, 10 + (delta % 2 ? 3 : 0), 15, buf, FONT_6x8, 0, 1);
+			ret += oled_write_string(10 + (delta % 2 ? 3 : 0), 15, buf, FONT_6x8);
 		}
 
 		/* Uptime & NTP time */
@@ -333,13 +363,74 @@ void oled_display_status(const struct fanpico_state *state,
 			mins % 60,
 			secs % 60);
 		if (rtc_get_datetime(&t)) {
-			oledWriteString(&oled, 0, 28, 14, buf, FONT_6x8, 0, 1);
+			ret += oled_write_string(28, 14, buf, FONT_6x8);
 			snprintf(buf, sizeof(buf), "%02d:%02d:%02d", t.hour, t.min, t.sec);
-			oledWriteString(&oled, 0, 16, 11, buf, FONT_12x16, 0, 1);
+			ret += oled_write_string(16, 11, buf, FONT_12x16);
 		} else {
-			oledWriteString(&oled, 0, 28, 12, buf, FONT_6x8, 0, 1);
+			ret += oled_write_string(28, 12, buf, FONT_6x8);
 		}
 	}
+
+	return ret;
+}
+
+int oled_display_status(const struct fanpico_state *state,
+	const struct fanpico_config *conf, bool restart, absolute_time_t deadline)
+{
+	int i;
+	int written = 0;
+	static int bg_drawn = 0;
+	static int item = 0;
+
+
+	if (!oled_found || !state)
+		return 0;
+
+	int h_pos = 70;
+	int items = FAN_COUNT + r_lines + 1;
+
+	if (restart)
+		item = 0;
+
+	if (!bg_drawn) {
+		/* Draw "background" only once... */
+		oled_clear_display();
+
+		if (oled_height > 64) {
+			oledWriteString(&oled, 0,  0, 0, "Fans", FONT_6x8, 0, 1);
+		}
+
+		for (i = 0; i < r_lines; i++) {
+			struct layout_item *l = &r_layout[i];
+			char label[16];
+			int y = i * 8;
+
+			if (l->type == LINE) {
+				oledDrawLine(&oled, h_pos, y + 4, oled_width - 1, y + 4, 1);
+			}
+			else if (l->type == LABEL) {
+				int len = l->idx;
+				if (len >= sizeof(label))
+					len = sizeof(label) - 1;
+				memcpy(label, l->label, len);
+				label[len] = 0;
+				oledWriteString(&oled, 0, h_pos + 2, i, label, FONT_6x8, 0, 1);
+			}
+		}
+		oledDrawLine(&oled, h_pos, 0, h_pos, r_lines * 8 - 1, 1);
+		bg_drawn = 1;
+		/* Continue with status items on next call */
+		return 1;
+	}
+
+	while (item < items) {
+		if (written >= OLED_WRITES_PER_SLICE || (written > 0 && time_reached(deadline)))
+			return 1;
+		written += oled_draw_item(state, conf, item++);
+	}
+	item = 0;
+
+	return 0;
 }
 
 void oled_display_message(int rows, const char **text_lines)
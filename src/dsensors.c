@@ -0,0 +1,683 @@
+/* dsensors.c
+   Copyright (C) 2021-2024 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of FanPico.
+
+   FanPico is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   FanPico is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with FanPico. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/gpio.h"
+#include "hardware/i2c.h"
+#include "hardware/pio.h"
+#include "hardware/sync.h"
+
+#include "fanpico.h"
+#include "onewire.h"
+
+
+/*
+ * Digital temperature sensors (1-Wire and I2C).
+ *
+ * Digital sensors are used through virtual sensors (in ONEWIRE or I2C
+ * mode), so they can be used as PWM sources and be aggregated by other
+ * virtual sensors like any other sensor.
+ *
+ * Sensors are read asynchronously by dsensors_poll() (called from
+ * the main loop on core0): 1-Wire bus is driven by a PIO state machine
+ * one time slot at a time (main loop just keeps FIFOs fed), and while
+ * DS18B20 sensors are converting (750ms) the bus is left idle. I2C sensors
+ * are running in continuous conversion mode, so the (latest) result is
+ * just read from the sensor, one sensor at a time.
+ *
+ * Latest readings are picked up by get_vsensor() on core1, which never
+ * waits for the sensors. If there has been no valid reading for
+ * DSENSOR_TIMEOUT, sensor is considered to have failed.
+ */
+
+#define DSENSOR_TIMEOUT        10000  /* ms */
+
+#define ONEWIRE_CONVERT_TIME   750    /* ms */
+#define ONEWIRE_MIN_INTERVAL   1000   /* ms */
+#define ONEWIRE_XFER_MAX       20     /* bytes */
+#define ONEWIRE_XFER_TIMEOUT   1000   /* ms */
+#define ONEWIRE_MAX_INFLIGHT   3      /* time slots (RX FIFO must never fill up) */
+#define ONEWIRE_MAX_DEVICES    16
+
+#define ONEWIRE_SKIP_ROM       0xcc
+#define ONEWIRE_MATCH_ROM      0x55
+#define ONEWIRE_SEARCH_ROM     0xf0
+#define DS18X20_CONVERT_T      0x44
+#define DS18X20_READ_SCRATCH   0xbe
+#define DS18S20_FAMILY         0x10
+
+#define I2C_SPEED              400000  /* Hz (I2C sensors configured) */
+#define I2C_DISPLAY_SPEED      1000000 /* Hz (OLED display only) */
+#define I2C_TIMEOUT            2000   /* us */
+
+
+static volatile float dsensor_temp[VSENSOR_MAX_COUNT];
+static volatile uint32_t dsensor_updated[VSENSOR_MAX_COUNT];
+static int8_t dsensor_status[VSENSOR_MAX_COUNT];
+
+
+/* Publish new reading (for core1). */
+static void dsensor_update(uint8_t i, float temp)
+{
+	uint32_t now = to_ms_since_boot(get_absolute_time());
+
+	dsensor_temp[i] = temp;
+	__dmb();
+	dsensor_updated[i] = (now > 0 ? now : 1);
+
+	if (dsensor_status[i] != 1) {
+		log_msg(LOG_INFO, "vsensor%d: sensor ok (%.2fC)", i + 1, temp);
+		dsensor_status[i] = 1;
+	}
+}
+
+
+static void dsensor_error(uint8_t i)
+{
+	if (dsensor_status[i] != -1) {
+		log_msg(LOG_NOTICE, "vsensor%d: failed to read sensor", i + 1);
+		dsensor_status[i] = -1;
+	}
+}
+
+
+/* Get latest reading of a digital sensor (used by core1).
+ * Returns false if there is no valid (recent) reading available.
+ */
+bool dsensor_get_temp(uint8_t i, float *temp)
+{
+	uint32_t updated;
+
+	if (i >= VSENSOR_MAX_COUNT)
+		return false;
+
+	updated = dsensor_updated[i];
+	if (updated == 0 || to_ms_since_boot(get_absolute_time()) - updated > DSENSOR_TIMEOUT)
+		return false;
+	__dmb();
+	*temp = dsensor_temp[i];
+
+	return true;
+}
+
+
+
+/* 1-Wire sensors */
+
+enum onewire_states {
+	OW_IDLE = 0,
+	OW_CONVERT,
+	OW_WAIT,
+	OW_READ_NEXT,
+	OW_READ,
+};
+
+struct onewire_xfer {
+	uint8_t buf[ONEWIRE_XFER_MAX];  /* data to send, replaced with data read */
+	uint len;
+	uint tx_bit;
+	uint rx_bit;
+	bool reset_done;
+	absolute_time_t start;
+};
+
+static PIO ow_pio = NULL;
+static int ow_sm = -1;
+static uint ow_offset = 0;
+static enum onewire_states ow_state = OW_IDLE;
+static struct onewire_xfer ow_xfer;
+static absolute_time_t ow_convert_t;
+static uint8_t ow_vsensor = 0;
+static bool ow_present = true;
+
+
+static uint8_t onewire_crc8(const uint8_t *buf, size_t len)
+{
+	uint8_t crc = 0;
+	uint8_t b;
+	int i;
+
+	while (len--) {
+		b = *buf++;
+		for (i = 0; i < 8; i++) {
+			crc = ((crc ^ b) & 1 ? (crc >> 1) ^ 0x8c : crc >> 1);
+			b >>= 1;
+		}
+	}
+
+	return crc;
+}
+
+
+static void onewire_addr2bytes(uint64_t addr, uint8_t *buf)
+{
+	for (int i = 0; i < 8; i++)
+		buf[i] = addr >> (56 - i * 8);
+}
+
+
+/* Start a transfer: reset followed by 'len' bytes (0xff to read a byte). */
+static void onewire_xfer_start(struct onewire_xfer *x, const uint8_t *data, uint len)
+{
+	memcpy(x->buf, data, len);
+	x->len = len;
+	x->tx_bit = 0;
+	x->rx_bit = 0;
+	x->reset_done = false;
+	x->start = get_absolute_time();
+	onewire_reset(ow_pio, ow_sm, ow_offset);
+}
+
+
+/* Advance transfer, never blocks.
+ * Returns 0 if transfer is still in progress, 1 when transfer has completed,
+ * -1 if there is no device on the bus (or transfer timed out).
+ */
+static int onewire_xfer_poll(struct onewire_xfer *x)
+{
+	uint bits = x->len * 8;
+	uint mask;
+	int bit;
+
+	if (!x->reset_done) {
+		if ((bit = onewire_get_bit(ow_pio, ow_sm)) < 0)
+			goto check_timeout;
+		if (bit)
+			return -1;
+		x->reset_done = true;
+	}
+
+	while (x->rx_bit < bits && (bit = onewire_get_bit(ow_pio, ow_sm)) >= 0) {
+		mask = 1 << (x->rx_bit & 7);
+		if (bit)
+			x->buf[x->rx_bit >> 3] |= mask;
+		else
+			x->buf[x->rx_bit >> 3] &= ~mask;
+		x->rx_bit++;
+	}
+	if (x->rx_bit >= bits)
+		return 1;
+
+	while (x->tx_bit < bits && x->tx_bit - x->rx_bit < ONEWIRE_MAX_INFLIGHT) {
+		if (!onewire_put_bit(ow_pio, ow_sm, x->buf[x->tx_bit >> 3] >> (x->tx_bit & 7)))
+			break;
+		x->tx_bit++;
+	}
+
+check_timeout:
+	if (absolute_time_diff_us(x->start, get_absolute_time()) > ONEWIRE_XFER_TIMEOUT * 1000)
+		return -1;
+	return 0;
+}
+
+
+/* Run single time slot (blocking), returns bit read or -1 on timeout. */
+static int onewire_slot(uint bit)
+{
+	absolute_time_t t_end = make_timeout_time_ms(2);
+	int res;
+
+	onewire_put_bit(ow_pio, ow_sm, bit);
+	while ((res = onewire_get_bit(ow_pio, ow_sm)) < 0) {
+		if (absolute_time_diff_us(get_absolute_time(), t_end) < 0)
+			break;
+	}
+
+	return res;
+}
+
+
+/* Search ROM addresses of all devices on the bus (blocking).
+ * Returns number of devices found.
+ */
+static int onewire_search(uint64_t *list, int max)
+{
+	uint8_t rom[8];
+	int last_discrepancy = 0;
+	int last_zero, bit, id, cmp, dir, i;
+	int count = 0;
+	absolute_time_t t_end;
+	uint64_t addr;
+
+	memset(rom, 0, sizeof(rom));
+
+	while (count < max) {
+		onewire_reset(ow_pio, ow_sm, ow_offset);
+		t_end = make_timeout_time_ms(2);
+		while ((id = onewire_get_bit(ow_pio, ow_sm)) < 0) {
+			if (absolute_time_diff_us(get_absolute_time(), t_end) < 0)
+				break;
+		}
+		if (id != 0)
+			break;
+
+		for (i = 0; i < 8; i++)
+			onewire_slot((ONEWIRE_SEARCH_ROM >> i) & 1);
+
+		last_zero = 0;
+		for (bit = 1; bit <= 64; bit++) {
+			id = onewire_slot(1);
+			cmp = onewire_slot(1);
+			if (id < 0 || cmp < 0 || (id && cmp))
+				return count;
+			if (id != cmp) {
+				dir = id;
+			} else {
+				if (bit < last_discrepancy)
+					dir = (rom[(bit - 1) >> 3] >> ((bit - 1) & 7)) & 1;
+				else
+					dir = (bit == last_discrepancy);
+				if (!dir)
+					last_zero = bit;
+			}
+			if (dir)
+				rom[(bit - 1) >> 3] |= 1 << ((bit - 1) & 7);
+			else
+				rom[(bit - 1) >> 3] &= ~(1 << ((bit - 1) & 7));
+			onewire_slot(dir);
+		}
+
+		if (onewire_crc8(rom, 7) == rom[7]) {
+			for (i = 0, addr = 0; i < 8; i++)
+				addr = (addr << 8) | rom[i];
+			list[count++] = addr;
+		}
+
+		last_discrepancy = last_zero;
+		if (last_discrepancy == 0)
+			break;
+	}
+
+	return count;
+}
+
+
+static bool onewire_sensors_configured()
+{
+	for (int i = 0; i < VSENSOR_COUNT; i++) {
+		if (cfg->vsensors[i].mode == VSMODE_ONEWIRE && cfg->vsensors[i].onewire_addr)
+			return true;
+	}
+	return false;
+}
+
+
+static float ds18x20_temp(uint64_t addr, const uint8_t *sp)
+{
+	int16_t raw = (sp[1] << 8) | sp[0];
+
+	if ((addr >> 56) == DS18S20_FAMILY)
+		return raw / 2.0f;
+	return raw / 16.0f;
+}
+
+
+static void onewire_poll()
+{
+	static absolute_time_t ABSOLUTE_TIME_INITIALIZED_VAR(t_cycle, 0);
+	const struct vsensor_input *s = NULL;
+	const uint8_t *sp;
+	uint8_t buf[ONEWIRE_XFER_MAX];
+	uint32_t interval;
+	int res;
+
+	if (ow_sm < 0)
+		return;
+
+	switch (ow_state) {
+	case OW_IDLE:
+		interval = cfg->sensor_interval;
+		if (interval < ONEWIRE_MIN_INTERVAL)
+			interval = ONEWIRE_MIN_INTERVAL;
+		if (!time_passed(&t_cycle, interval))
+			break;
+		if (!onewire_sensors_configured())
+			break;
+		/* Start conversion on all sensors */
+		buf[0] = ONEWIRE_SKIP_ROM;
+		buf[1] = DS18X20_CONVERT_T;
+		onewire_xfer_start(&ow_xfer, buf, 2);
+		ow_state = OW_CONVERT;
+		break;
+
+	case OW_CONVERT:
+		if ((res = onewire_xfer_poll(&ow_xfer)) == 0)
+			break;
+		if (res < 0) {
+			if (ow_present)
+				log_msg(LOG_NOTICE, "1-Wire: no devices responding");
+			ow_present = false;
+			ow_state = OW_IDLE;
+			break;
+		}
+		ow_present = true;
+		ow_convert_t = get_absolute_time();
+		ow_state = OW_WAIT;
+		break;
+
+	case OW_WAIT:
+		if (absolute_time_diff_us(ow_convert_t, get_absolute_time())
+			< ONEWIRE_CONVERT_TIME * 1000)
+			break;
+		ow_vsensor = 0;
+		ow_state = OW_READ_NEXT;
+		/* fall through */
+
+	case OW_READ_NEXT:
+		while (ow_vsensor < VSENSOR_COUNT) {
+			s = &cfg->vsensors[ow_vsensor];
+			if (s->mode == VSMODE_ONEWIRE && s->onewire_addr)
+				break;
+			ow_vsensor++;
+		}
+		if (ow_vsensor >= VSENSOR_COUNT) {
+			ow_state = OW_IDLE;
+			break;
+		}
+		/* Read scratchpad of the sensor */
+		buf[0] = ONEWIRE_MATCH_ROM;
+		onewire_addr2bytes(s->onewire_addr, &buf[1]);
+		buf[9] = DS18X20_READ_SCRATCH;
+		memset(&buf[10], 0xff, 9);
+		onewire_xfer_start(&ow_xfer, buf, 19);
+		ow_state = OW_READ;
+		break;
+
+	case OW_READ:
+		if ((res = onewire_xfer_poll(&ow_xfer)) == 0)
+			break;
+		s = &cfg->vsensors[ow_vsensor];
+		sp = &ow_xfer.buf[10];
+		if (res > 0 && onewire_crc8(sp, 8) == sp[8]
+			&& (sp[0] | sp[1] | sp[4] | sp[8]) != 0) {
+			dsensor_update(ow_vsensor, ds18x20_temp(s->onewire_addr, sp));
+		} else {
+			dsensor_error(ow_vsensor);
+		}
+		ow_vsensor++;
+		ow_state = OW_READ_NEXT;
+		break;
+	}
+}
+
+
+static void setup_onewire()
+{
+#if ONEWIRE_PIN >= 0
+	uint64_t list[ONEWIRE_MAX_DEVICES];
+	int offset, sm, count, i;
+
+	/* Tacho outputs (and WiFi) have their PIO resources claimed already,
+	 * so only use the PIO assigned for 1-Wire (see fanpico.h). */
+	if ((sm = pio_claim_unused_sm(ONEWIRE_PIO, false)) < 0) {
+		log_msg(LOG_NOTICE, "1-Wire: no free PIO%d state machines",
+			pio_get_index(ONEWIRE_PIO));
+		return;
+	}
+	if ((offset = onewire_load_program(ONEWIRE_PIO)) < 0) {
+		log_msg(LOG_NOTICE, "1-Wire: no room for PIO%d program",
+			pio_get_index(ONEWIRE_PIO));
+		pio_sm_unclaim(ONEWIRE_PIO, sm);
+		return;
+	}
+	ow_pio = ONEWIRE_PIO;
+	ow_sm = sm;
+	ow_offset = offset;
+
+	onewire_program_init(ow_pio, ow_sm, ow_offset, ONEWIRE_PIN);
+	log_msg(LOG_NOTICE, "1-Wire bus initialized: GPIO%d (PIO%d SM%d)",
+		ONEWIRE_PIN, pio_get_index(ow_pio), ow_sm);
+
+	count = onewire_search(list, ONEWIRE_MAX_DEVICES);
+	log_msg(LOG_NOTICE, "1-Wire: %d device(s) found", count);
+	for (i = 0; i < count; i++)
+		log_msg(LOG_INFO, "1-Wire: device%d: %016llX", i + 1, list[i]);
+#endif
+}
+
+
+/* List devices on 1-Wire bus (SYS:ONEWIRE:SENSORS?).
+ * Returns number of devices found, or -1 if 1-Wire bus is not active.
+ */
+int onewire_list_devices()
+{
+	uint64_t list[ONEWIRE_MAX_DEVICES];
+	int count, i, j;
+
+	if (ow_sm < 0)
+		return -1;
+
+	/* Let any transfer in progress finish first */
+	while (ow_state == OW_CONVERT || ow_state == OW_READ)
+		onewire_poll();
+
+	count = onewire_search(list, ONEWIRE_MAX_DEVICES);
+	/* Conversion may have been disturbed, skip reading the results */
+	if (ow_state == OW_WAIT)
+		ow_state = OW_IDLE;
+
+	for (i = 0; i < count; i++) {
+		printf("%d,%016llX", i + 1, list[i]);
+		for (j = 0; j < VSENSOR_COUNT; j++) {
+			if (cfg->vsensors[j].mode == VSMODE_ONEWIRE
+				&& cfg->vsensors[j].onewire_addr == list[i])
+				printf(",vsensor%d", j + 1);
+		}
+		printf("\n");
+	}
+
+	return count;
+}
+
+
+
+/* I2C sensors */
+
+struct i2c_sensor_type {
+	const char *name;
+	uint8_t reg;
+	float (*temp)(const uint8_t *buf);
+};
+
+static float tmp117_temp(const uint8_t *buf)
+{
+	return (int16_t)((buf[0] << 8) | buf[1]) * 0.0078125f;
+}
+
+static float mcp9808_temp(const uint8_t *buf)
+{
+	int16_t raw = ((buf[0] & 0x1f) << 8) | buf[1];
+
+	if (raw & 0x1000)
+		raw -= 0x2000;
+	return raw / 16.0f;
+}
+
+static float lm75_temp(const uint8_t *buf)
+{
+	return (int16_t)((buf[0] << 8) | buf[1]) / 256.0f;
+}
+
+static const struct i2c_sensor_type i2c_sensor_types[] = {
+	{ "none",    0x00, NULL },
+	{ "TMP117",  0x00, tmp117_temp },
+	{ "MCP9808", 0x05, mcp9808_temp },
+	{ "LM75",    0x00, lm75_temp },  /* also PCT2075, TMP75, etc. */
+};
+
+#define I2C_SENSOR_TYPES count_of(i2c_sensor_types)
+
+static i2c_inst_t *i2c_bus = NULL;
+static bool i2c_unavailable = false;
+static bool i2c_bus_shared = false;
+
+
+int str2i2c_type(const char *s)
+{
+	if (s) {
+		for (int i = 1; i < I2C_SENSOR_TYPES; i++) {
+			if (!strcasecmp(s, i2c_sensor_types[i].name))
+				return i;
+		}
+	}
+	return 0;
+}
+
+
+const char* i2c_type2str(int type)
+{
+	if (type < 0 || type >= I2C_SENSOR_TYPES)
+		type = 0;
+	return i2c_sensor_types[type].name;
+}
+
+
+/* Speed for the I2C bus (shared by OLED display and I2C sensors).
+ * Bus speed is chosen once, when OLED display is initialized, as
+ * (re)initializing the bus later would reset the controller. OLED display
+ * runs at 1MHz, unless I2C sensors are configured (that need 400kHz). */
+uint32_t i2c_bus_speed()
+{
+	for (int i = 0; i < VSENSOR_COUNT; i++) {
+		if (cfg->vsensors[i].mode == VSMODE_I2C)
+			return I2C_SPEED;
+	}
+	return I2C_DISPLAY_SPEED;
+}
+
+
+/* Called by OLED display driver once it has initialized the I2C bus. */
+void i2c_bus_set_shared()
+{
+	i2c_bus_shared = true;
+}
+
+
+/* Initialize I2C bus for sensors (unless OLED display driver has
+ * initialized it already). */
+static bool setup_i2c_bus()
+{
+#if SDA_PIN >= 0 && I2C_HW > 0
+	if (i2c_bus)
+		return true;
+	if (i2c_unavailable)
+		return false;
+	if (cfg->spi_active) {
+		log_msg(LOG_NOTICE, "I2C sensors not available (SPI is active)");
+		i2c_unavailable = true;
+		return false;
+	}
+
+	i2c_bus = (I2C_HW == 1 ? i2c0 : i2c1);
+	if (i2c_bus_shared) {
+		log_msg(LOG_NOTICE, "I2C sensors using I2C bus shared with display");
+		return true;
+	}
+	i2c_init(i2c_bus, I2C_SPEED);
+	gpio_set_function(SDA_PIN, GPIO_FUNC_I2C);
+	gpio_set_function(SCL_PIN, GPIO_FUNC_I2C);
+	gpio_pull_up(SDA_PIN);
+	gpio_pull_up(SCL_PIN);
+	log_msg(LOG_NOTICE, "I2C bus initialized for sensors: SDA=GPIO%d, SCL=GPIO%d (%ukHz)",
+		SDA_PIN, SCL_PIN, I2C_SPEED / 1000);
+	return true;
+#else
+	if (!i2c_unavailable)
+		log_msg(LOG_NOTICE, "I2C sensors not supported on this board");
+	i2c_unavailable = true;
+	return false;
+#endif
+}
+
+
+static void i2c_read_sensor(uint8_t i)
+{
+	const struct vsensor_input *s = &cfg->vsensors[i];
+	const struct i2c_sensor_type *type;
+	uint8_t buf[2];
+	int res;
+
+	if (s->i2c_type < 1 || s->i2c_type >= I2C_SENSOR_TYPES)
+		return;
+	if (!setup_i2c_bus())
+		return;
+	type = &i2c_sensor_types[s->i2c_type];
+
+	res = i2c_write_timeout_us(i2c_bus, s->i2c_addr, &type->reg, 1, true, I2C_TIMEOUT);
+	if (res == 1)
+		res = i2c_read_timeout_us(i2c_bus, s->i2c_addr, buf, 2, false, I2C_TIMEOUT);
+	if (res != 2) {
+		dsensor_error(i);
+		return;
+	}
+
+	dsensor_update(i, type->temp(buf));
+}
+
+
+static void i2c_sensors_poll()
+{
+	static absolute_time_t ABSOLUTE_TIME_INITIALIZED_VAR(t_cycle, 0);
+	static uint8_t next = VSENSOR_COUNT;
+
+	if (next >= VSENSOR_COUNT) {
+		if (!time_passed(&t_cycle, cfg->sensor_interval))
+			return;
+		next = 0;
+	}
+
+	/* Read (at most) one sensor per call */
+	while (next < VSENSOR_COUNT && cfg->vsensors[next].mode != VSMODE_I2C)
+		next++;
+	if (next < VSENSOR_COUNT)
+		i2c_read_sensor(next++);
+}
+
+
+
+void setup_dsensors()
+{
+	memset(dsensor_status, 0, sizeof(dsensor_status));
+
+#if ONEWIRE_PIN >= 0
+	if (cfg->onewire_active) {
+		if (cfg->serial_active || cfg->spi_active) {
+			log_msg(LOG_NOTICE, "1-Wire bus not available (pin in use by %s)",
+				(cfg->serial_active ? "serial console" : "SPI"));
+		} else {
+			setup_onewire();
+		}
+	}
+#endif
+}
+
+
+/* Read digital sensors, this is called from main loop (and never blocks). */
+void dsensors_poll()
+{
+	onewire_poll();
+	i2c_sensors_poll();
+}
+
+
+/* eof :-) */
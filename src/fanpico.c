@@ -38,12 +38,15 @@
 #include "hardware/clocks.h"
 #include "hardware/watchdog.h"
 #include "hardware/vreg.h"
+#include "hardware/sync.h"
 
 #include "fanpico.h"
 
 static struct fanpico_state core1_state;
-static struct fanpico_config core1_config;
-static struct fanpico_state transfer_state;
+static struct fanpico_control_config core1_config;
+static volatile uint32_t core1_config_generation = 0;
+static struct fanpico_state transfer_state[2];
+static volatile uint32_t transfer_seq = 0;
 static struct fanpico_state system_state;
 const struct fanpico_state *fanpico_state = &system_state;
 
@@ -53,10 +56,14 @@ struct persistent_memory_block *persistent_mem = &persistent_memory;
 #define PERSISTENT_MEMORY_ID 0x42c0ffee
 #define PERSISTENT_MEMORY_CRC_LEN offsetof(struct persistent_memory_block, crc32)
 
+/* Max time to spend rendering display per main loop iteration */
+#define DISPLAY_SLICE_BUDGET_US 2000
+
+/* Max time to spend processing queued commands per main loop iteration */
+#define CMDQ_BUDGET_US 5000
+
 auto_init_mutex(pmem_mutex_inst);
 mutex_t *pmem_mutex = &pmem_mutex_inst;
-auto_init_mutex(state_mutex_inst);
-mutex_t *state_mutex = &state_mutex_inst;
 bool rebooted_by_watchdog = false;
 
 
@@ -64,7 +71,128 @@ void update_persistent_memory_crc()
 {
 	struct persistent_memory_block *m = persistent_mem;
 
-	m->crc32 = xcrc32((unsigned char*)m, PERSISTENT_MEMORY_CRC_LEN, 0);
+	m->crc32 = fast_crc32(m, PERSISTENT_MEMORY_CRC_LEN, 0);
+}
+
+/*
+ * Per-fan runtime analytics (kept in persistent memory, so that
+ * counters survive soft and watchdog resets).
+ *
+ * Counters are updated every second, so instead of recalculating CRC
+ * over them on every update, two copies are kept: each update is written
+ * into the inactive copy, bracketed by sequence numbers ('seq' at the start
+ * and 'seq_end' at the end). A copy is only valid if both sequence numbers
+ * match, so a reset in middle of an update leaves the previous copy active.
+ */
+#define PMEM_ANALYTICS_ID 0x46414e53
+
+static int analytics_idx = 0;
+static uint64_t analytics_t = 0;
+static uint8_t analytics_fan_fault[FAN_MAX_COUNT];
+
+static bool analytics_valid(const struct pmem_analytics *a)
+{
+	return (a->id == PMEM_ANALYTICS_ID && a->seq != 0 && a->seq == a->seq_end);
+}
+
+static bool init_analytics()
+{
+	struct persistent_memory_block *m = persistent_mem;
+	bool valid0 = analytics_valid(&m->analytics[0]);
+	bool valid1 = analytics_valid(&m->analytics[1]);
+
+	memset(analytics_fan_fault, 0, sizeof(analytics_fan_fault));
+
+	if (valid0 && valid1) {
+		analytics_idx = ((int32_t)(m->analytics[1].seq - m->analytics[0].seq) > 0 ? 1 : 0);
+	} else if (valid0 || valid1) {
+		analytics_idx = (valid1 ? 1 : 0);
+	} else {
+		memset(m->analytics, 0, sizeof(m->analytics));
+		m->analytics[0].id = PMEM_ANALYTICS_ID;
+		m->analytics[0].seq = 1;
+		m->analytics[0].seq_end = 1;
+		analytics_idx = 0;
+		return false;
+	}
+
+	return true;
+}
+
+static void update_analytics(struct pmem_analytics *a, uint32_t seconds)
+{
+	const struct fanpico_state *st = fanpico_state;
+	struct fan_analytics *f;
+	float rpm;
+	int i;
+
+	for (i = 0; i < FAN_COUNT; i++) {
+		f = &a->fans[i];
+		rpm = st->fan_freq[i] * 60 / cfg->fans[i].rpm_factor;
+		if (rpm >= 1.0) {
+			if (rpm > UINT16_MAX)
+				rpm = UINT16_MAX;
+			f->run_time += seconds;
+			if (f->rpm_min == 0 || rpm < f->rpm_min)
+				f->rpm_min = rpm;
+			if (rpm > f->rpm_max)
+				f->rpm_max = rpm;
+		}
+		/* Stalls are detected by the fault engine (see fault.c) */
+		if (st->fan_fault[i] == FAULT_STALL && analytics_fan_fault[i] != FAULT_STALL)
+			f->stalls++;
+		analytics_fan_fault[i] = st->fan_fault[i];
+	}
+
+	for (i = 0; i < SENSOR_COUNT; i++) {
+		if (isnan(st->temp[i]))
+			continue;
+		if (!(a->temp_valid & (1 << i)) || st->temp[i] > a->temp_max[i]) {
+			a->temp_max[i] = st->temp[i];
+			a->temp_valid |= (1 << i);
+		}
+	}
+}
+
+/* Write new copy of analytics counters (call with pmem_mutex held). */
+static void commit_analytics(bool reset, uint32_t seconds)
+{
+	struct persistent_memory_block *m = persistent_mem;
+	struct pmem_analytics *cur = &m->analytics[analytics_idx];
+	struct pmem_analytics *next = &m->analytics[analytics_idx ^ 1];
+	uint32_t seq = cur->seq + 1;
+
+	if (seq == 0)
+		seq = 1;
+
+	next->seq_end = 0;
+	__dmb();
+	if (reset) {
+		memset(next, 0, offsetof(struct pmem_analytics, seq_end));
+		next->id = PMEM_ANALYTICS_ID;
+	} else {
+		memcpy(next, cur, offsetof(struct pmem_analytics, seq_end));
+		update_analytics(next, seconds);
+	}
+	next->seq = seq;
+	__dmb();
+	next->seq_end = seq;
+	analytics_idx ^= 1;
+}
+
+void get_analytics(struct pmem_analytics *a)
+{
+	mutex_enter_blocking(pmem_mutex);
+	memcpy(a, &persistent_mem->analytics[analytics_idx], sizeof(*a));
+	mutex_exit(pmem_mutex);
+}
+
+void reset_analytics()
+{
+	mutex_enter_blocking(pmem_mutex);
+	commit_analytics(true, 0);
+	memcpy(analytics_fan_fault, fanpico_state->fan_fault, sizeof(analytics_fan_fault));
+	mutex_exit(pmem_mutex);
 }
 
 void init_persistent_memory()
@@ -74,7 +202,7 @@ void init_persistent_memory()
 	char s[32];
 
 	if (m->id == PERSISTENT_MEMORY_ID) {
-		crc = xcrc32((unsigned char*)m, PERSISTENT_MEMORY_CRC_LEN, 0);
+		crc = fast_crc32(m, PERSISTENT_MEMORY_CRC_LEN, 0);
 		if (crc == m->crc32) {
 			printf("Found persistent memory block\n");
 			datetime_str(s, sizeof(s), &m->saved_time);
@@ -85,6 +213,9 @@ void init_persistent_memory()
 				m->prev_uptime = m->uptime;
 				update_persistent_memory_crc();
 			}
+			if (init_analytics())
+				printf("Found fan analytics counters (seq %lu)\n",
+					m->analytics[analytics_idx].seq);
 			return;
 		}
 		printf("Found corrupt persistent memory block"
@@ -95,19 +226,31 @@ void init_persistent_memory()
 	memset(m, 0, sizeof(*m));
 	m->id = PERSISTENT_MEMORY_ID;
 	update_persistent_memory_crc();
+	init_analytics();
 }
 
 void update_persistent_memory()
 {
 	struct persistent_memory_block *m = persistent_mem;
 	datetime_t t;
+	uint64_t now = to_us_since_boot(get_absolute_time());
+	uint32_t seconds;
 
 	mutex_enter_blocking(pmem_mutex);
 	if (rtc_get_datetime(&t)) {
 		m->saved_time = t;
 	}
-	m->uptime = to_us_since_boot(get_absolute_time());
+	m->uptime = now;
 	update_persistent_memory_crc();
+
+	/* Update analytics in whole seconds (first call only sets the baseline) */
+	if (analytics_t == 0)
+		analytics_t = now;
+	seconds = (now - analytics_t) / 1000000;
+	if (seconds > 0) {
+		analytics_t += (uint64_t)seconds * 1000000;
+		commit_analytics(false, seconds);
+	}
 	mutex_exit(pmem_mutex);
 }
 
@@ -117,14 +260,98 @@ void boot_reason()
 	printf("WATCHDOG_REASON: %08lx\n", watchdog_hw->reason);
 }
 
+/* Boot timeline (time since reset at the end of each boot phase) */
+#define BOOT_PHASES_MAX 16
+
+static struct boot_phase boot_phases[BOOT_PHASES_MAX];
+static int boot_phase_count = 0;
+
+void boot_phase(const char *name)
+{
+	if (boot_phase_count >= BOOT_PHASES_MAX)
+		return;
+	boot_phases[boot_phase_count].name = name;
+	boot_phases[boot_phase_count].t = to_us_since_boot(get_absolute_time());
+	boot_phase_count++;
+}
+
+int get_boot_phases(const struct boot_phase **list)
+{
+	if (list)
+		*list = boot_phases;
+	return boot_phase_count;
+}
+
+
+/*
+ * Boot is split in two: setup() brings up everything needed for fan
+ * control (configuration, PWM/tacho/ADC), after which core1 is started,
+ * and setup_late() then initializes console, display and network
+ * while core1 is already controlling the fans.
+ */
 void setup()
+{
+	int i;
+
+	rtc_init();
+	crc32_init();
+	boot_phase("init");
+
+	lfs_setup();
+	read_config();
+	boot_phase("config");
+
+	/* Enable ADC */
+	log_msg(LOG_NOTICE, "Initialize ADC...");
+	adc_init();
+	adc_set_temp_sensor_enabled(true);
+	if (SENSOR1_READ_PIN > 0)
+		adc_gpio_init(SENSOR1_READ_PIN);
+	if (SENSOR2_READ_PIN > 0)
+		adc_gpio_init(SENSOR2_READ_PIN);
+	setup_sensor_inputs();
+
+	/* Setup GPIO pins... */
+	log_msg(LOG_NOTICE, "Initialize GPIO...");
+
+	/* Initialize status LED... */
+	if (LED_PIN > 0) {
+		gpio_init(LED_PIN);
+		gpio_set_dir(LED_PIN, GPIO_OUT);
+		gpio_put(LED_PIN, 0);
+	}
+
+	/* Reserve PIO resources for WiFi (initialized later)... */
+	network_reserve_pio();
+
+	/* Configure PWM pins... */
+	setup_pwm_outputs();
+	setup_pwm_inputs();
+
+	for (i = 0; i < FAN_COUNT; i++) {
+		set_pwm_duty_cycle(i, 0);
+	}
+	apply_pwm_duty_cycles();
+
+	/* Configure Tacho pins... */
+	setup_tacho_outputs();
+	setup_tacho_inputs();
+	boot_phase("hardware");
+
+	/* Setup timezone */
+	if (strlen(cfg->timezone) > 1) {
+		log_msg(LOG_NOTICE, "Set Timezone: %s", cfg->timezone);
+		setenv("TZ", cfg->timezone, 1);
+		tzset();
+	}
+}
+
+void setup_late()
 {
 	datetime_t t;
 	char buf[32];
 	int i = 0;
 
-	rtc_init();
-
 	stdio_usb_init();
 	/* Wait a while for USB Serial to connect... */
 	while (i++ < 40) {
@@ -133,9 +360,6 @@ void setup()
 		sleep_ms(50);
 	}
 
-	lfs_setup();
-	read_config();
-
 #if TTL_SERIAL
 	/* Initialize serial console if configured... */
 	if(cfg->serial_active && !cfg->spi_active) {
@@ -143,6 +367,7 @@ void setup()
 				TTL_SERIAL_SPEED, TX_PIN, RX_PIN);
 	}
 #endif
+	boot_phase("console");
 	printf("\n\n");
 #ifndef NDEBUG
 	boot_reason();
@@ -175,49 +400,15 @@ void setup()
 	}
 
 	display_init();
+	boot_phase("display");
+	setup_dsensors();
+	boot_phase("dsensors");
 	network_init(&system_state);
-
-	/* Enable ADC */
-	log_msg(LOG_NOTICE, "Initialize ADC...");
-	adc_init();
-	adc_set_temp_sensor_enabled(true);
-	if (SENSOR1_READ_PIN > 0)
-		adc_gpio_init(SENSOR1_READ_PIN);
-	if (SENSOR2_READ_PIN > 0)
-		adc_gpio_init(SENSOR2_READ_PIN);
-
-	/* Setup GPIO pins... */
-	log_msg(LOG_NOTICE, "Initialize GPIO...");
-
-	/* Initialize status LED... */
-	if (LED_PIN > 0) {
-		gpio_init(LED_PIN);
-		gpio_set_dir(LED_PIN, GPIO_OUT);
-		gpio_put(LED_PIN, 0);
-	}
 #ifdef LIB_PICO_CYW43_ARCH
 	/* On pico_w, LED is connected to the radio GPIO... */
 	cyw43_arch_gpio_put(CYW43_WL_GPIO_LED_PIN, 0);
 #endif
-
-	/* Configure PWM pins... */
-	setup_pwm_outputs();
-	setup_pwm_inputs();
-
-	for (i = 0; i < FAN_COUNT; i++) {
-		set_pwm_duty_cycle(i, 0);
-	}
-
-	/* Configure Tacho pins... */
-	setup_tacho_outputs();
-	setup_tacho_inputs();
-
-	/* Setup timezone */
-	if (strlen(cfg->timezone) > 1) {
-		log_msg(LOG_NOTICE, "Set Timezone: %s", cfg->timezone);
-		setenv("TZ", cfg->timezone, 1);
-		tzset();
-	}
+	boot_phase("network");
 
 	log_msg(LOG_NOTICE, "System initialization complete.");
 }
@@ -230,6 +421,8 @@ void clear_state(struct fanpico_state *s)
 	for (i = 0; i < MBFAN_MAX_COUNT; i++) {
 		s->mbfan_duty[i] = 0.0;
 		s->mbfan_duty_prev[i] = 0.0;
+		s->mbfan_pwm_freq[i] = 0.0;
+		s->mbfan_pwm_lost[i] = false;
 		s->mbfan_freq[i] = 0.0;
 		s->mbfan_freq_prev[i] = 0.0;
 	}
@@ -238,6 +431,7 @@ void clear_state(struct fanpico_state *s)
 		s->fan_duty_prev[i] = 0.0;
 		s->fan_freq[i] = 0.0;
 		s->fan_freq_prev[i] = 0.0;
+		s->fan_freq_updated[i] = from_us_since_boot(0);
 	}
 	for (i = 0; i < SENSOR_MAX_COUNT; i++) {
 		s->temp[i] = 0.0;
@@ -248,43 +442,150 @@ void clear_state(struct fanpico_state *s)
 		s->vtemp_prev[i] = 0.0;
 		s->vtemp_updated[i] = from_us_since_boot(0);
 	}
+	s->generation = 0;
+}
+
+
+/* publish_system_state()
+ *  Core1 publishes its state periodically into double buffer transfer_state.
+ *  New state is always written to the buffer that readers are not
+ *  currently using, and then made visible by incrementing transfer_seq.
+ *  (Writer never blocks.) Unchanged state is not published again.
+ */
+
+static void publish_system_state(const struct fanpico_state *state)
+{
+	uint32_t seq = transfer_seq + 1;
+	const struct fanpico_state *prev = &transfer_state[transfer_seq & 1];
+	struct fanpico_state *buf = &transfer_state[seq & 1];
+	bool changed;
+
+	/* Only bump generation if state has changed, so that generation can
+	   be used to detect changes (for caching, etc.) Fields after
+	   'generation' (update timestamps) are not compared, as they change
+	   on every measurement even if the values do not. */
+	changed = (seq == 1 || memcmp(prev, state, offsetof(struct fanpico_state, generation)));
+	if (!changed && !memcmp(&prev->fan_freq_updated, &state->fan_freq_updated,
+					sizeof(*state) - offsetof(struct fanpico_state, fan_freq_updated)))
+		return;
+
+	memcpy(buf, state, sizeof(*buf));
+	buf->generation = (changed ? seq : prev->generation);
+	__dmb();
+	transfer_seq = seq;
 }
 
 
 /* update_system_state()
- *  System state gets updated by core1 periodically (using state_mutex)
- *  to intermediate buffer transfer_state.
- *  This function updates system state from that buffer.
+ *  This function updates system state from the latest buffer published
+ *  by core1. If core1 published new state while copy was in progress,
+ *  copy is retried (to never return torn data).
+ *  Copy is skipped if nothing has been published since last copy.
  */
 
 void update_system_state()
 {
-	mutex_enter_blocking(state_mutex);
-	memcpy(&system_state, &transfer_state, sizeof(system_state));
-	mutex_exit(state_mutex);
+	static uint32_t system_state_seq = 0;
+	uint32_t seq = transfer_seq;
+
+	if (seq == system_state_seq)
+		return;
+
+	do {
+		seq = transfer_seq;
+		__dmb();
+		memcpy(&system_state, &transfer_state[seq & 1], sizeof(system_state));
+		__dmb();
+	} while (seq != transfer_seq);
+	system_state_seq = seq;
 }
 
 
-void update_outputs(struct fanpico_state *state, const struct fanpico_config *config)
+/* copy_system_state()
+ *  Take a private snapshot of the latest state published by core1.
+ *  Safe to call from IRQ context (lwIP callbacks), as this does not
+ *  touch system_state.
+ */
+
+void copy_system_state(struct fanpico_state *state)
 {
-	int i;
+	uint32_t seq;
+
+	do {
+		seq = transfer_seq;
+		__dmb();
+		memcpy(state, &transfer_state[seq & 1], sizeof(*state));
+		__dmb();
+	} while (seq != transfer_seq);
+}
+
+
+/* update_outputs()
+ *  Fans are evaluated in dependency order (fans using another fan as
+ *  source after their source fan), so chained fans settle in one pass.
+ *  Outputs are only recalculated if their input has changed (or config
+ *  has changed), unless filter is in use for the output.
+ */
+
+void update_outputs(struct fanpico_state *state, const struct fanpico_control_config *config)
+{
+	static uint8_t fan_order[FAN_MAX_COUNT];
+	static float fan_source[FAN_MAX_COUNT];
+	static float fan_freq[FAN_MAX_COUNT];
+	static uint32_t generation = 0;
+	static uint32_t fault_gen = 0;
+	static bool init = true;
+	bool dirty = false;
+	float val, duty;
+	int i, n;
+
+	if (init || generation != core1_config_generation) {
+		if (pwm_fan_eval_order(config, fan_order) > 0)
+			log_msg(LOG_WARNING, "Fan source loop(s) detected");
+		generation = core1_config_generation;
+		init = false;
+		dirty = true;
+	}
+	if (fault_gen != get_fault_generation()) {
+		fault_gen = get_fault_generation();
+		dirty = true;
+	}
 
 	/* Update fan PWM signals */
-	for (i = 0; i < FAN_COUNT; i++) {
-		state->fan_duty[i] = calculate_pwm_duty(state, config, i);
+	for (n = 0; n < FAN_COUNT; n++) {
+		i = fan_order[n];
+		val = pwm_source_value(state, config, i);
+		if (!dirty && config->fans[i].filter == FILTER_NONE && val == fan_source[i])
+			continue;
+		fan_source[i] = val;
+		duty = calculate_pwm_duty(state, config, i);
+		if (rpm_control_enabled(&config->fans[i]))
+			duty = rpm_control_set_target(i, &config->fans[i], duty, state->fan_duty[i]);
+		else
+			rpm_control_reset(i);
+		state->fan_duty[i] = duty;
+		state->fan_rpm_target[i] = rpm_control_target(i);
+		if (fault_fan_boost(i))
+			state->fan_duty[i] = 100.0;
 		if (check_for_change(state->fan_duty_prev[i], state->fan_duty[i], 1.0)) {
 			log_msg(LOG_INFO, "fan%d: Set output PWM %.1f%% --> %.1f%%",
 				i+1,
 				state->fan_duty_prev[i],
 				state->fan_duty[i]);
 			state->fan_duty_prev[i] = state->fan_duty[i];
-			set_pwm_duty_cycle(i, state->fan_duty[i]);
 		}
+		set_pwm_duty_cycle(i, state->fan_duty[i]);
 	}
+	apply_pwm_duty_cycles();
 
-	/* Update mb tacho signals */
+	/* Update mb tacho signals (if any tacho inputs changed) */
+	if (!dirty && !memcmp(fan_freq, state->fan_freq, sizeof(fan_freq)))
+		return;
+	memcpy(fan_freq, state->fan_freq, sizeof(fan_freq));
 	for (i = 0; i < MBFAN_COUNT; i++) {
 		state->mbfan_freq[i] = calculate_tacho_freq(state, config, i);
+		if (fault_mbfan_failed(i))
+			state->mbfan_freq[i] = 0.0;
 		if (check_for_change(state->mbfan_freq_prev[i], state->mbfan_freq[i], 1.0)) {
 			log_msg(LOG_INFO, "mbfan%d: Set output Tacho %.2fHz --> %.2fHz",
 				i+1,
@@ -297,17 +598,208 @@ void update_outputs(struct fanpico_state *state, const struct fanpico_config *co
 }
 
 
+/* Core1 tasks...
+ *
+ * Core1 runs a simple deadline based scheduler: each task has a period
+ * and next deadline, core1 sleeps until the earliest deadline and then
+ * runs all tasks that are due. Tasks are run in table order.
+ */
+
+static void core1_poll_inputs(struct fanpico_state *state, struct fanpico_control_config *config)
+{
+	uint64_t t;
+
+	/* Tachometer inputs from Fans */
+	t = perf_begin();
+	read_tacho_inputs();
+	perf_end(PERF_TACHO_READ, t);
+
+	/* PWM input signals (duty cycles) from "motherboard". */
+	t = perf_begin();
+	get_pwm_duty_cycles(config);
+	perf_end(PERF_PWM_READ, t);
+}
+
+static void core1_update_tacho(struct fanpico_state *state, struct fanpico_control_config *config)
+{
+	/* Calculate frequencies from input tachometer signals peridocially */
+	log_msg(LOG_DEBUG, "Updating tacho input signals.");
+	update_tacho_input_freq(state);
+}
+
+static void core1_read_pwm(struct fanpico_state *state, struct fanpico_control_config *config)
+{
+	log_msg(LOG_DEBUG, "Read PWM inputs");
+	for (int i = 0; i < MBFAN_COUNT; i++) {
+		state->mbfan_duty[i] = roundf(mbfan_pwm_duty[i] * 10) / 10;
+		state->mbfan_pwm_freq[i] = mbfan_pwm_freq[i];
+		state->mbfan_pwm_lost[i] = mbfan_pwm_lost[i];
+		if (check_for_change(state->mbfan_duty_prev[i], state->mbfan_duty[i], 1.5)) {
+			log_msg(LOG_INFO, "mbfan%d: Input PWM change %.1f%% --> %.1f%%",
+				i+1,
+				state->mbfan_duty_prev[i],
+				state->mbfan_duty[i]);
+			state->mbfan_duty_prev[i] = state->mbfan_duty[i];
+		}
+	}
+}
+
+static void core1_read_sensors(struct fanpico_state *state, struct fanpico_control_config *config)
+{
+	uint64_t t;
+
+	log_msg(LOG_DEBUG, "Read temperature sensors");
+	t = perf_begin();
+	for (int i = 0; i < SENSOR_COUNT; i++) {
+		state->temp[i] = get_temperature(i, config);
+		if (check_for_change(state->temp_prev[i], state->temp[i], 0.5)) {
+			log_msg(LOG_INFO, "sensor%d: Temperature change %.1fC --> %.1fC",
+				i+1,
+				state->temp_prev[i],
+				state->temp[i]);
+			state->temp_prev[i] = state->temp[i];
+		}
+	}
+	perf_end(PERF_SENSOR_READ, t);
+
+	log_msg(LOG_DEBUG, "Update virtual sensors");
+	t = perf_begin();
+	for (int i = 0; i < VSENSOR_COUNT; i++) {
+		state->vtemp[i] = get_vsensor(i, config, state);
+		if (check_for_change(state->vtemp_prev[i], state->vtemp[i], 0.5)) {
+			log_msg(LOG_INFO, "vsensor%d: Temperature change %.1fC --> %.1fC",
+				i+1,
+				state->vtemp_prev[i],
+				state->vtemp[i]);
+			state->vtemp_prev[i] = state->vtemp[i];
+		}
+	}
+	perf_end(PERF_VSENSOR_UPDATE, t);
+}
+
+static void core1_update_outputs(struct fanpico_state *state, struct fanpico_control_config *config)
+{
+	uint64_t t;
+
+	log_msg(LOG_DEBUG, "Updating output signals.");
+	t = perf_begin();
+	update_outputs(state, config);
+	perf_end(PERF_UPDATE_OUTPUTS, t);
+}
+
+static void update_core1_task_periods(const struct fanpico_control_config *config);
+
+static void core1_update_config(struct fanpico_state *state, struct fanpico_control_config *config)
+{
+	uint32_t gen = config_generation;
+
+	if (gen == core1_config_generation)
+		return;
+
+	/* Attempt to update config from core0 (only the parts used by core1) */
+	if (mutex_enter_timeout_us(config_mutex, 100)) {
+		gen = config_generation;
+		config_to_control(cfg, config);
+		mutex_exit(config_mutex);
+		core1_config_generation = gen;
+		update_sensor_tables(config);
+		update_core1_task_periods(config);
+		log_msg(LOG_DEBUG, "core1: config updated (generation %lu)", gen);
+	} else {
+		log_msg(LOG_DEBUG, "failed to get config_mutex");
+	}
+}
+
+static void core1_update_state(struct fanpico_state *state, struct fanpico_control_config *config)
+{
+	/* Publish system state for core0 */
+	publish_system_state(state);
+}
+
+static void core1_check_faults(struct fanpico_state *state, struct fanpico_control_config *config)
+{
+	/* Apply fail-safe actions immediately when fault state changes */
+	if (update_fan_faults(state, config)) {
+		update_outputs(state, config);
+		publish_system_state(state);
+	}
+}
+
+static void core1_rpm_control(struct fanpico_state *state, struct fanpico_control_config *config)
+{
+	update_rpm_control(state, config);
+}
+
+#define TASK_CFG(field) offsetof(struct fanpico_control_config, field)
+
+static struct core1_task core1_tasks[] = {
+	{ "poll_inputs",     1, core1_poll_inputs },
+	{ "faults",         50, core1_check_faults },
+	{ "rpm_control",    50, core1_rpm_control },
+	{ "tacho_inputs", DEFAULT_TACHO_INTERVAL, core1_update_tacho, TASK_CFG(tacho_interval) },
+	{ "pwm_inputs", DEFAULT_PWM_INPUT_INTERVAL, core1_read_pwm, TASK_CFG(pwm_input_interval) },
+	{ "sensors",    DEFAULT_SENSOR_INTERVAL, core1_read_sensors, TASK_CFG(sensor_interval) },
+	{ "outputs",    DEFAULT_OUTPUT_INTERVAL, core1_update_outputs, TASK_CFG(output_interval) },
+	{ "config",        100, core1_update_config },
+	{ "state",         500, core1_update_state },
+	{ NULL, 0, NULL }
+};
+
+const struct core1_task *core1_task_list = core1_tasks;
+
+
+/* Apply (configurable) task periods from configuration. */
+static void update_core1_task_periods(const struct fanpico_control_config *config)
+{
+	absolute_time_t t_now = get_absolute_time();
+	absolute_time_t t_next;
+	struct core1_task *t;
+	uint32_t period;
+
+	for (t = core1_tasks; t->name; t++) {
+		if (!t->period_cfg)
+			continue;
+		period = *(const uint32_t*)((const char*)config + t->period_cfg);
+		if (period == 0 || period == t->period)
+			continue;
+		log_msg(LOG_INFO, "core1: %s period %lums --> %lums", t->name, t->period, period);
+		t->period = period;
+		/* Do not wait for the old (possibly much longer) period to expire */
+		t_next = delayed_by_ms(t_now, period);
+		if (absolute_time_diff_us(t_next, t->next_run) > 0)
+			t->next_run = t_next;
+	}
+}
+
+
+/* Return configuration generation core1 is currently using. */
+uint32_t get_core1_config_generation()
+{
+	return core1_config_generation;
+}
+
+
+void reset_core1_task_stats()
+{
+	struct core1_task *t;
+
+	for (t = core1_tasks; t->name; t++) {
+		t->runs = 0;
+		t->overruns = 0;
+		t->jitter_max = 0;
+		t->jitter_total = 0;
+		t->runtime_max = 0;
+	}
+}
+
+
 void core1_main()
 {
-	struct fanpico_config *config = &core1_config;
+	struct fanpico_control_config *config = &core1_config;
 	struct fanpico_state *state = &core1_state;
-	absolute_time_t ABSOLUTE_TIME_INITIALIZED_VAR(t_temp, 0);
-	absolute_time_t ABSOLUTE_TIME_INITIALIZED_VAR(t_tacho, 0);
-	absolute_time_t ABSOLUTE_TIME_INITIALIZED_VAR(t_poll_pwm, 0);
-	absolute_time_t ABSOLUTE_TIME_INITIALIZED_VAR(t_set_outputs, 0);
-	absolute_time_t t_last, t_now, t_config, t_state;
-	int64_t max_delta = 0;
-	int64_t delta;
+	struct core1_task *t;
+	absolute_time_t t_now, t_next, t_end;
+	int64_t late, runtime;
 
 
 	log_msg(LOG_INFO, "core1: started...");
@@ -315,95 +807,55 @@ void core1_main()
 	/* Allow core0 to pause this core... */
 	multicore_lockout_victim_init();
 
+	perf_init();
 	setup_tacho_input_interrupts();
-
-	t_state = t_config = t_last = get_absolute_time();
+	update_sensor_tables(config);
+
+	t_now = get_absolute_time();
+	for (t = core1_tasks; t->name; t++) {
+		t->next_run = t_now;
+		/* First sensor readings are not available right after boot */
+		if (t->func == core1_read_sensors)
+			t->next_run = sensor_inputs_ready_time();
+	}
+	update_core1_task_periods(config);
+	reset_core1_task_stats();
 
 	while (1) {
 		t_now = get_absolute_time();
-		delta = absolute_time_diff_us(t_last, t_now);
-		t_last = t_now;
-
-		if (delta > max_delta) {
-			max_delta = delta;
-			log_msg(LOG_INFO, "core1: max_loop_time=%lld", max_delta);
-		}
-
-		/* Tachometer inputs from Fans */
-		read_tacho_inputs();
-		if (time_passed(&t_tacho, 1000)) {
-			/* Calculate frequencies from input tachometer signals peridocially */
-			log_msg(LOG_DEBUG, "Updating tacho input signals.");
-			update_tacho_input_freq(state);
-		}
-
-		/* PWM input signals (duty cycles) from "motherboard". */
-		get_pwm_duty_cycles(config);
-		if (time_passed(&t_poll_pwm, 200)) {
-			log_msg(LOG_DEBUG, "Read PWM inputs");
-			for (int i = 0; i < MBFAN_COUNT; i++) {
-				state->mbfan_duty[i] = roundf(mbfan_pwm_duty[i]);
-				if (check_for_change(state->mbfan_duty_prev[i], state->mbfan_duty[i], 1.5)) {
-					log_msg(LOG_INFO, "mbfan%d: Input PWM change %.1f%% --> %.1f%%",
-						i+1,
-						state->mbfan_duty_prev[i],
-						state->mbfan_duty[i]);
-					state->mbfan_duty_prev[i] = state->mbfan_duty[i];
-				}
-			}
-		}
-
-		/* Read temperature sensors periodically */
-		if (time_passed(&t_temp, 2000)) {
-			log_msg(LOG_DEBUG, "Read temperature sensors");
-			for (int i = 0; i < SENSOR_COUNT; i++) {
-				state->temp[i] = get_temperature(i, config);
-				if (check_for_change(state->temp_prev[i], state->temp[i], 0.5)) {
-					log_msg(LOG_INFO, "sensor%d: Temperature change %.1fC --> %.1fC",
-						i+1,
-						state->temp_prev[i],
-						state->temp[i]);
-					state->temp_prev[i] = state->temp[i];
-				}
-			}
-
-			log_msg(LOG_DEBUG, "Update virtual sensors");
-			for (int i = 0; i < VSENSOR_COUNT; i++) {
-				state->vtemp[i] = get_vsensor(i, config, state);
-				if (check_for_change(state->vtemp_prev[i], state->vtemp[i], 0.5)) {
-					log_msg(LOG_INFO, "vsensor%d: Temperature change %.1fC --> %.1fC",
-						i+1,
-						state->vtemp_prev[i],
-						state->vtemp[i]);
-					state->vtemp_prev[i] = state->vtemp[i];
+		t_next = at_the_end_of_time;
+
+		for (t = core1_tasks; t->name; t++) {
+			late = absolute_time_diff_us(t->next_run, t_now);
+			if (late >= 0) {
+				t->func(state, config);
+				t_end = get_absolute_time();
+				runtime = absolute_time_diff_us(t_now, t_end);
+
+				t->runs++;
+				t->jitter_total += late;
+				if (late > t->jitter_max)
+					t->jitter_max = late;
+				if (runtime > t->runtime_max)
+					t->runtime_max = runtime;
+
+				/* Schedule next run, skip missed periods (overruns)... */
+				t->next_run = delayed_by_ms(t->next_run, t->period);
+				if (absolute_time_diff_us(t->next_run, t_end) >= 0) {
+					t->overruns++;
+					t->next_run = delayed_by_ms(t_end, t->period);
 				}
+				t_now = t_end;
 			}
+			if (absolute_time_diff_us(t->next_run, t_next) > 0)
+				t_next = t->next_run;
 		}
 
-		if (time_passed(&t_set_outputs, 500)) {
-			log_msg(LOG_DEBUG, "Updating output signals.");
-			update_outputs(state, config);
-		}
-
-		if (time_passed(&t_config, 1000)) {
-			/* Attempt to update config from core0 */
-			if (mutex_enter_timeout_us(config_mutex, 100)) {
-				memcpy(config, cfg, sizeof(*config));
-				mutex_exit(config_mutex);
-			} else {
-				log_msg(LOG_DEBUG, "failed to get config_mutex");
-			}
-		}
-		if (time_passed(&t_state, 500)) {
-			/* Attempt to update system state on core0 */
-			if (mutex_enter_timeout_us(state_mutex, 100)) {
-				memcpy(&transfer_state, state, sizeof(transfer_state));
-				mutex_exit(state_mutex);
-			} else {
-				log_msg(LOG_DEBUG, "failed to get state_mutex");
-			}
-		}
-
+		/* Sleep until next task is due to run, while staying
+		   responsive to flash operations on core0... */
+		flash_core1_poll();
+		while (!best_effort_wfe_or_timeout(t_next))
+			flash_core1_poll();
 	}
 }
 
@@ -412,10 +864,11 @@ int main()
 {
 	absolute_time_t ABSOLUTE_TIME_INITIALIZED_VAR(t_led, 0);
 	absolute_time_t ABSOLUTE_TIME_INITIALIZED_VAR(t_network, 0);
-	absolute_time_t t_now, t_last, t_display, t_ram;
+	absolute_time_t t_now, t_last, t_display, t_ram, t_history;
 	uint8_t led_state = 0;
 	int64_t max_delta = 0;
 	int64_t delta;
+	uint64_t t;
 	int c;
 	char input_buf[1024 + 1];
 	int i_ptr = 0;
@@ -423,19 +876,26 @@ int main()
 
 	set_binary_info();
 	clear_state(&system_state);
-	clear_state(&transfer_state);
+	clear_state(&transfer_state[0]);
+	clear_state(&transfer_state[1]);
 
 	/* Initialize MCU and other hardware... */
 	if (get_debug_level() >= 2)
 		print_mallinfo();
 	setup();
-	if (get_debug_level() >= 2)
-		print_mallinfo();
+	perf_init();
 
-	/* Start second core (core1)... */
-	memcpy(&core1_config, cfg, sizeof(core1_config));
+	/* Start second core (core1), to get fans under control early... */
+	config_to_control(cfg, &core1_config);
+	core1_config_generation = config_generation;
 	memcpy(&core1_state, &system_state, sizeof(core1_state));
 	multicore_launch_core1(core1_main);
+	boot_phase("core1");
+
+	/* Initialize console, display and network... */
+	setup_late();
+	if (get_debug_level() >= 2)
+		print_mallinfo();
 
 #if WATCHDOG_ENABLED
 	watchdog_enable(WATCHDOG_REBOOT_DELAY, 1);
@@ -443,7 +903,7 @@ int main()
 #endif
 
 	t_last = get_absolute_time();
-	t_ram = t_display = t_last;
+	t_ram = t_display = t_history = t_last;
 
 	while (1) {
 		t_now = get_absolute_time();
@@ -456,8 +916,18 @@ int main()
 		}
 
 		if (time_passed(&t_network, 1)) {
+			t = perf_begin();
 			network_poll();
+			perf_end(PERF_NETWORK_POLL, t);
 		}
+		/* Output any log messages deferred by core1 */
+		log_flush();
+		/* Save configuration if autosave is enabled */
+		config_autosave_poll();
+		/* Write out any pending (write-behind) file writes */
+		flash_poll();
+		/* Read digital (1-Wire/I2C) temperature sensors */
+		dsensors_poll();
 		if (time_passed(&t_ram, 1000)) {
 			update_persistent_memory();
 		}
@@ -482,11 +952,25 @@ int main()
 #endif
 		}
 
-		/* Update display every 1000ms */
+		/* Record history every 1000ms */
+		if (time_passed(&t_history, 1000)) {
+			update_system_state();
+			history_update(fanpico_state);
+		}
+
+		/* Update display every 1000ms (rendering is done in slices) */
 		if (time_passed(&t_display, 1000)) {
 			update_system_state();
 			display_status(fanpico_state, cfg);
 		}
+		if (display_busy()) {
+			t = perf_begin();
+			display_poll(DISPLAY_SLICE_BUDGET_US);
+			perf_end(PERF_DISPLAY_STATUS, t);
+		}
+
+		/* Process queued commands (from MQTT, etc.) */
+		cmdq_poll(CMDQ_BUDGET_US);
 
 		/* Process any (user) input */
 		while ((c = getchar_timeout_us(0)) != PICO_ERROR_TIMEOUT) {
@@ -501,8 +985,7 @@ int main()
 				if (cfg->local_echo) printf("\r\n");
 				input_buf[i_ptr] = 0;
 				if (i_ptr > 0) {
-					update_system_state();
-					process_command(fanpico_state, (struct fanpico_config *)cfg, input_buf);
+					cmdq_console_command(input_buf);
 					i_ptr = 0;
 				}
 				continue;
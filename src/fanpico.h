@@ -42,6 +42,63 @@
 
 #define VSENSOR_COUNT 8
 
+#define VSENSOR_SOURCE_MAX_COUNT 8   /* Max number of sources for a virtual sensor */
+#define VSENSOR_SOURCE_VSENSOR   0x80 /* Flag for virtual sensor as a source */
+#define DSENSOR_FAILSAFE_TEMP    100.0 /* Default temperature (C) for failed 1-Wire/I2C sensor */
+
+/* PIO allocation:
+ *   PIO0: tacho output generators (SM0-3, one per mbfan)
+ *   PIO1: cyw43 (WiFi) SPI interface, tacho input edge sampler
+ *         (non-multiplexed boards), 1-Wire bus (boards with ONEWIRE_PIN)
+ *         and PWM input capture (if PWM_CAPTURE_SUPPORT)
+ * Tacho outputs use all state machines of PIO0, so everything else must
+ * fit in PIO1. Edge sampler program is generated on boot for the tacho
+ * input pins (18 instructions on 0804), which leaves no room for PWM
+ * capture next to cyw43, so on non-multiplexed boards with WiFi PWM inputs
+ * are measured using PWM slices instead.
+ * Room for the cyw43 SPI program (and a state machine) is reserved on
+ * boot (network_reserve_pio()), since WiFi is initialized last.
+ */
+#define TACHO_OUTPUT_PIO       pio0
+#define TACHO_INPUT_PIO        pio1
+#define PWM_CAPTURE_PIO        pio1
+#define ONEWIRE_PIO            pio1
+#define CYW43_PIO              pio1
+
+#define PIO_INSTR_MEM_SIZE     32
+#define PIO_SM_COUNT           4
+#define CYW43_PIO_PROGRAM_LEN  6   /* instructions (spi_gap01_sample0) */
+#define PWM_CAPTURE_PROGRAM_LEN 13 /* instructions (pwm_capture.pio) */
+#define ONEWIRE_PROGRAM_LEN    13  /* instructions (onewire.pio) */
+#define TACHO_EDGE_PROGRAM_MIN_LEN 14 /* instructions (single run of input pins) */
+#define PWM_CAPTURE_MAX_SM     2
+
+#if TACHO_READ_MULTIPLEX == 0 && defined(WIFI_SUPPORT)
+#define PWM_CAPTURE_SUPPORT 0
+#else
+#define PWM_CAPTURE_SUPPORT 1
+#endif
+
+#ifdef WIFI_SUPPORT
+#define PIO1_WIFI_LEN  CYW43_PIO_PROGRAM_LEN
+#define PIO1_WIFI_SM   1
+#else
+#define PIO1_WIFI_LEN  0
+#define PIO1_WIFI_SM   0
+#endif
+/* Instructions left in PIO1 for the tacho input edge sampler */
+#define TACHO_EDGE_PIO_BUDGET (PIO_INSTR_MEM_SIZE - PIO1_WIFI_LEN	\
+		- (PWM_CAPTURE_SUPPORT ? PWM_CAPTURE_PROGRAM_LEN : 0)	\
+		- (ONEWIRE_PIN >= 0 ? ONEWIRE_PROGRAM_LEN : 0))
+
+_Static_assert(TACHO_EDGE_PIO_BUDGET >= (TACHO_READ_MULTIPLEX == 0 ? TACHO_EDGE_PROGRAM_MIN_LEN : 0),
+	"PIO1 programs do not fit in instruction memory");
+_Static_assert(MBFAN_COUNT <= PIO_SM_COUNT, "Not enough PIO0 state machines");
+_Static_assert(PIO1_WIFI_SM + (TACHO_READ_MULTIPLEX == 0 ? 1 : 0)
+	+ (ONEWIRE_PIN >= 0 ? 1 : 0)
+	+ (PWM_CAPTURE_SUPPORT ? PWM_CAPTURE_MAX_SM : 0) <= PIO_SM_COUNT,
+	"Not enough PIO1 state machines");
+
 #define SENSOR_SERIES_RESISTANCE 10000.0
 
 #define ADC_REF_VOLTAGE 3.0
@@ -63,6 +120,25 @@
 #define DEFAULT_MQTT_TEMP_INTERVAL    60
 #define DEFAULT_MQTT_RPM_INTERVAL     60
 #define DEFAULT_MQTT_DUTY_INTERVAL    60
+#define DEFAULT_MQTT_BULK_INTERVAL    60
+#define DEFAULT_MQTT_HEARTBEAT        600
+#define DEFAULT_SYSLOG_RATE           20
+#define DEFAULT_TELEMETRY_PORT        5515
+#define DEFAULT_TELEMETRY_INTERVAL    1000 /* ms */
+#define MIN_TELEMETRY_INTERVAL        100  /* ms */
+#define DEFAULT_FAULT_STALL_TIME      300 /* ms */
+#define DEFAULT_TACHO_INTERVAL        1000 /* ms */
+#define DEFAULT_PWM_INPUT_INTERVAL    200  /* ms */
+#define DEFAULT_SENSOR_INTERVAL       2000 /* ms */
+#define DEFAULT_OUTPUT_INTERVAL       500  /* ms */
+#define MIN_TACHO_INTERVAL            50
+#define MIN_PWM_INPUT_INTERVAL        20
+#define MIN_SENSOR_INTERVAL           100
+#define MIN_OUTPUT_INTERVAL           20
+#define MAX_TASK_INTERVAL             10000
+#define DEFAULT_PID_KP                0.02
+#define DEFAULT_PID_KI                0.02
+#define DEFAULT_PID_KD                0.0
 
 #ifdef NDEBUG
 #define WATCHDOG_ENABLED      1
@@ -83,8 +159,11 @@ enum signal_filter_types {
 	FILTER_NONE = 0,      /* No filtering */
 	FILTER_LOSSYPEAK = 1, /* "Lossy Peak Detector" with time decay */
 	FILTER_SMA = 2,       /* Simple moving average */
+	FILTER_EMA = 3,       /* Exponential moving average */
+	FILTER_MEDIAN = 4,    /* Median of N samples (spike rejection) */
+	FILTER_KALMAN = 5,    /* Simple (scalar) Kalman filter */
 };
-#define FILTER_ENUM_MAX 2
+#define FILTER_ENUM_MAX 5
 
 enum tacho_source_types {
 	TACHO_FIXED  = 0,     /* Fixed speed set by s_id */
@@ -95,6 +174,13 @@ enum tacho_source_types {
 };
 #define TACHO_ENUM_MAX 1
 
+enum fan_fault_types {
+	FAULT_NONE       = 0,
+	FAULT_STALL      = 1,
+	FAULT_UNDERSPEED = 2,
+	FAULT_ERRATIC    = 3,
+};
+
 enum temp_sensor_types {
 	TEMP_INTERNAL = 0,
 	TEMP_EXTERNAL = 1,
@@ -107,8 +193,22 @@ enum vsensor_modes {
 	VSMODE_MIN = 2,
 	VSMODE_AVG = 3,
 	VSMODE_DELTA = 4,
+	VSMODE_ONEWIRE = 5,
+	VSMODE_I2C = 6,
+};
+#define VSMODE_ENUM_MAX 6
+
+#define CURVE_FRAC_BITS  8
+#define CURVE_SLOPE_BITS 16
+
+/* Compiled (fixed-point) representation of a map (only kept in
+ * fanpico_control_config, built by config_to_control()). */
+struct curve {
+	uint8_t points;
+	int32_t x[MAX_MAP_POINTS];
+	int32_t y[MAX_MAP_POINTS];
+	int32_t slope[MAX_MAP_POINTS];
 };
-#define VSMODE_ENUM_MAX 4
 
 struct pwm_map {
 	uint8_t points;
@@ -140,6 +240,13 @@ struct fan_output {
 
 	/* input Tacho signal settings */
 	uint8_t rpm_factor;
+	uint16_t max_rpm; /* nominal RPM at 100% duty (0 = unknown) */
+
+	/* closed-loop (RPM) control settings */
+	bool rpm_mode;
+	float pid_kp;
+	float pid_ki;
+	float pid_kd;
 };
 
 struct mb_input {
@@ -178,7 +285,10 @@ struct vsensor_input {
 	uint8_t mode;
 	float default_temp;
 	int32_t timeout;
-	uint8_t sensors[SENSOR_MAX_COUNT];
+	uint8_t sensors[VSENSOR_SOURCE_MAX_COUNT];
+	uint64_t onewire_addr;
+	uint8_t i2c_type;
+	uint8_t i2c_addr;
 	struct temp_map map;
 	enum signal_filter_types filter;
 	void *filter_ctx;
@@ -199,6 +309,14 @@ struct fanpico_config {
 	char timezone[64];
 	bool spi_active;
 	bool serial_active;
+	bool onewire_active;
+	uint32_t config_autosave;
+	bool fault_failsafe;
+	uint32_t fault_stall_time;
+	uint32_t tacho_interval;
+	uint32_t pwm_input_interval;
+	uint32_t sensor_interval;
+	uint32_t output_interval;
 #ifdef WIFI_SUPPORT
 	char wifi_ssid[WIFI_SSID_MAX_LEN + 1];
 	char wifi_passwd[WIFI_PASSWD_MAX_LEN + 1];
@@ -233,34 +351,139 @@ struct fanpico_config {
 	uint32_t mqtt_temp_interval;
 	uint32_t mqtt_rpm_interval;
 	uint32_t mqtt_duty_interval;
+	char mqtt_bulk_topic[MQTT_MAX_TOPIC_LEN];
+	uint32_t mqtt_bulk_interval;
+	bool mqtt_change_only;
+	uint32_t mqtt_heartbeat;
 	bool telnet_active;
 	bool telnet_auth;
 	bool telnet_raw_mode;
 	uint32_t telnet_port;
 	char telnet_user[16 + 1];
 	char telnet_pwhash[128 + 1];
+	uint32_t syslog_rate;
+	bool syslog_batch;
+	ip_addr_t telemetry_server;
+	uint32_t telemetry_port;
+	uint32_t telemetry_interval;
 #endif
 	/* Non-config items */
 	float vtemp[VSENSOR_MAX_COUNT];
 	absolute_time_t vtemp_updated[VSENSOR_MAX_COUNT];
 };
 
+/* Control configuration used by core1.
+ * Compact copy of the parts of fanpico_config that the control loop needs
+ * (no names, raw map points, network settings, etc.), only the compiled
+ * map curves. Built from fanpico_config by config_to_control().
+ */
+struct fan_control {
+	uint8_t min_pwm;
+	uint8_t max_pwm;
+	float pwm_coefficient;
+	enum pwm_source_types s_type;
+	uint16_t s_id;
+	enum signal_filter_types filter;
+	void *filter_ctx;
+	uint8_t rpm_factor;
+	uint16_t max_rpm;
+	bool rpm_mode;
+	float pid_kp;
+	float pid_ki;
+	float pid_kd;
+	struct curve curve;
+};
+
+struct mbfan_control {
+	uint16_t min_rpm;
+	uint16_t max_rpm;
+	float rpm_coefficient;
+	uint8_t rpm_factor;
+	enum tacho_source_types s_type;
+	uint16_t s_id;
+	uint8_t sources[FAN_MAX_COUNT];
+	enum signal_filter_types filter;
+	void *filter_ctx;
+	struct curve curve;
+};
+
+struct sensor_control {
+	enum temp_sensor_types type;
+	float thermistor_nominal;
+	float temp_nominal;
+	float beta_coefficient;
+	float temp_offset;
+	float temp_coefficient;
+	enum signal_filter_types filter;
+	void *filter_ctx;
+	struct curve curve;
+};
+
+struct vsensor_control {
+	uint8_t mode;
+	float default_temp;
+	int32_t timeout;
+	uint8_t sensors[VSENSOR_SOURCE_MAX_COUNT];
+	enum signal_filter_types filter;
+	void *filter_ctx;
+	struct curve curve;
+};
+
+struct fanpico_control_config {
+	struct sensor_control sensors[SENSOR_MAX_COUNT];
+	struct vsensor_control vsensors[VSENSOR_MAX_COUNT];
+	struct fan_control fans[FAN_MAX_COUNT];
+	struct mbfan_control mbfans[MBFAN_MAX_COUNT];
+	bool fault_failsafe;
+	uint32_t fault_stall_time;
+	uint32_t tacho_interval;
+	uint32_t pwm_input_interval;
+	uint32_t sensor_interval;
+	uint32_t output_interval;
+	float vtemp[VSENSOR_MAX_COUNT];
+	absolute_time_t vtemp_updated[VSENSOR_MAX_COUNT];
+};
+
 struct fanpico_state {
 	/* inputs */
 	float mbfan_duty[MBFAN_MAX_COUNT];
 	float mbfan_duty_prev[MBFAN_MAX_COUNT];
+	float mbfan_pwm_freq[MBFAN_MAX_COUNT];
+	bool mbfan_pwm_lost[MBFAN_MAX_COUNT];
 	float fan_freq[FAN_MAX_COUNT];
 	float fan_freq_prev[FAN_MAX_COUNT];
 	float temp[SENSOR_MAX_COUNT];
 	float temp_prev[SENSOR_MAX_COUNT];
 	float vtemp[VSENSOR_MAX_COUNT];
-	absolute_time_t vtemp_updated[VSENSOR_MAX_COUNT];
 	float vtemp_prev[VSENSOR_MAX_COUNT];
 	/* outputs */
 	float fan_duty[FAN_MAX_COUNT];
 	float fan_duty_prev[FAN_MAX_COUNT];
 	float mbfan_freq[MBFAN_MAX_COUNT];
 	float mbfan_freq_prev[MBFAN_MAX_COUNT];
+	uint8_t fan_fault[FAN_MAX_COUNT];
+	float fan_rpm_target[FAN_MAX_COUNT];
+	/* state generation (incremented every time core1 publishes new state) */
+	uint32_t generation;
+	/* timestamps (not compared when checking if state has changed) */
+	absolute_time_t fan_freq_updated[FAN_MAX_COUNT];
+	absolute_time_t vtemp_updated[VSENSOR_MAX_COUNT];
+};
+
+struct fan_analytics {
+	uint32_t run_time; /* seconds */
+	uint32_t stalls;
+	uint16_t rpm_min;
+	uint16_t rpm_max;
+};
+
+struct pmem_analytics {
+	uint32_t id;
+	uint32_t seq;
+	struct fan_analytics fans[FAN_MAX_COUNT];
+	float temp_max[SENSOR_MAX_COUNT];
+	uint16_t temp_valid; /* bitmask of sensors with valid temp_max */
+	uint32_t seq_end;
 };
 
 struct persistent_memory_block {
@@ -269,6 +492,98 @@ struct persistent_memory_block {
 	uint64_t uptime;
 	uint64_t prev_uptime;
 	uint32_t crc32;
+	/* double-buffered (not covered by crc32) */
+	struct pmem_analytics analytics[2];
+};
+
+enum cmd_source {
+	CMD_SRC_CONSOLE = 0,
+	CMD_SRC_MQTT,
+	CMD_SRC_TELNET,
+	CMD_SOURCE_COUNT
+};
+
+struct cmdq_stats {
+	uint32_t depth;
+	uint32_t max_depth;
+	uint32_t queued[CMD_SOURCE_COUNT];
+	uint32_t processed[CMD_SOURCE_COUNT];
+	uint32_t rejected[CMD_SOURCE_COUNT]; /* queue full */
+	uint64_t latency_total; /* us */
+	uint64_t latency_max; /* us */
+};
+
+struct boot_phase {
+	const char *name;
+	uint64_t t; /* us since boot */
+};
+
+struct core1_task {
+	const char *name;
+	uint32_t period; /* ms */
+	void (*func)(struct fanpico_state *state, struct fanpico_control_config *config);
+	size_t period_cfg; /* offset of (configurable) period in fanpico_control_config */
+	absolute_time_t next_run;
+	uint32_t runs;
+	uint32_t overruns;
+	uint32_t jitter_max; /* us */
+	uint64_t jitter_total; /* us */
+	uint32_t runtime_max; /* us */
+};
+
+enum perf_probe {
+	PERF_TACHO_READ = 0,
+	PERF_PWM_READ,
+	PERF_SENSOR_READ,
+	PERF_VSENSOR_UPDATE,
+	PERF_UPDATE_OUTPUTS,
+	PERF_NETWORK_POLL,
+	PERF_DISPLAY_STATUS,
+	PERF_PROCESS_COMMAND,
+	PERF_PROBE_COUNT
+};
+
+#define PERF_HIST_BUCKETS 32
+
+struct perf_counter {
+	const char *name;
+	uint8_t core;
+	uint32_t generation;
+	uint32_t count;
+	uint32_t max; /* cycles */
+	uint64_t total; /* cycles */
+	uint32_t hist[PERF_HIST_BUCKETS]; /* log2(cycles) */
+};
+
+struct sw_writer {
+	char *buf;
+	size_t size;
+	size_t skip;
+	size_t pos;
+	size_t len;
+	bool overflow;
+	uint8_t depth;
+	uint32_t comma;
+};
+
+#define HISTORY_CHANNELS (SENSOR_COUNT + VSENSOR_COUNT + 2 * FAN_COUNT + 2 * MBFAN_COUNT)
+
+enum history_resolution {
+	HISTORY_SEC = 0,
+	HISTORY_MIN = 1,
+	HISTORY_HOUR = 2,
+};
+
+struct history_iter {
+	uint8_t res;
+	bool header;
+	int16_t ch;
+	uint32_t idx;
+	uint32_t end;
+	uint32_t pos;
+	uint32_t seq;
+	uint32_t t;
+	int32_t val[HISTORY_CHANNELS];
 };
 
 
@@ -276,9 +591,17 @@ struct persistent_memory_block {
 extern struct persistent_memory_block *persistent_mem;
 extern const struct fanpico_state *fanpico_state;
 extern bool rebooted_by_watchdog;
-extern mutex_t *state_mutex;
+extern const struct core1_task *core1_task_list;
 void update_display_state();
+void update_system_state();
+void copy_system_state(struct fanpico_state *state);
 void update_persistent_memory();
+void get_analytics(struct pmem_analytics *a);
+void reset_analytics();
+void reset_core1_task_stats();
+uint32_t get_core1_config_generation();
+void boot_phase(const char *name);
+int get_boot_phases(const struct boot_phase **list);
 
 /* bi_decl.c */
 void set_binary_info();
@@ -290,49 +613,100 @@ int last_command_status();
 
 /* config.c */
 extern mutex_t *config_mutex;
+extern volatile uint32_t config_generation;
 extern const struct fanpico_config *cfg;
 int str2pwm_source(const char *s);
 const char* pwm_source2str(enum pwm_source_types source);
 int str2vsmode(const char *s);
 const char* vsmode2str(enum vsensor_modes mode);
+int str2vsensor_source(const char *s);
+const char* vsensor_source2str(uint8_t src, char *buf, size_t size);
 int valid_pwm_source_ref(enum pwm_source_types source, uint16_t s_id);
 int str2tacho_source(const char *s);
 const char* tacho_source2str(enum tacho_source_types source);
 int valid_tacho_source_ref(enum tacho_source_types source, uint16_t s_id);
+void config_to_control(const struct fanpico_config *config, struct fanpico_control_config *ctl);
 void read_config();
 void save_config();
+int compact_config(bool force);
+void config_autosave_poll();
 void delete_config();
 void print_config();
 
+/* curve.c */
+void pwm_map_compile(const struct pwm_map *map, struct curve *c);
+void tacho_map_compile(const struct tacho_map *map, struct curve *c);
+void temp_map_compile(const struct temp_map *map, struct curve *c);
+int32_t curve_eval_fixed(const struct curve *c, int32_t x);
+float curve_eval(const struct curve *c, float x);
+
+/* history.c */
+void history_update(const struct fanpico_state *state);
+int str2history_res(const char *s);
+void history_iter_init(struct history_iter *it, enum history_resolution res, uint32_t count);
+int history_iter_next(struct history_iter *it, char *buf, size_t size);
+
+/* perf.c */
+void perf_init();
+uint64_t perf_begin();
+void perf_end(enum perf_probe probe, uint64_t start);
+void perf_reset();
+int perf_get(enum perf_probe probe, struct perf_counter *c);
+double perf_cycles_to_us(uint64_t cycles);
+
+/* cmdqueue.c */
+const char* cmd_source2str(enum cmd_source source);
+int cmdq_enqueue(enum cmd_source source, const char *cmd);
+bool cmdq_process_one();
+void cmdq_poll(uint32_t budget_us);
+void cmdq_console_command(char *cmd);
+void cmdq_telnet_command(int session, char *cmd);
+void cmdq_get_stats(struct cmdq_stats *s);
+void cmdq_reset_stats();
+
 /* display.c */
 void display_init();
 void clear_display();
 void display_message(int rows, const char **text_lines);
 void display_status(const struct fanpico_state *state, const struct fanpico_config *config);
+bool display_poll(uint32_t budget_us);
+bool display_busy();
 
 /* display_lcd.c */
 void lcd_display_init();
 void lcd_clear_display();
-void lcd_display_status(const struct fanpico_state *state,const struct fanpico_config *conf);
+int lcd_display_status(const struct fanpico_state *state,const struct fanpico_config *conf,
+			bool restart, absolute_time_t deadline);
 void lcd_display_message(int rows, const char **text_lines);
 
 /* display_oled.c */
 void oled_display_init();
 void oled_clear_display();
-void oled_display_status(const struct fanpico_state *state, const struct fanpico_config *conf);
+int oled_display_status(const struct fanpico_state *state, const struct fanpico_config *conf,
+			bool restart, absolute_time_t deadline);
 void oled_display_message(int rows, const char **text_lines);
 
 /* flash.h */
+#define FLASH_WRITE_QUEUED 1
 void lfs_setup();
 int flash_read_file(char **bufptr, uint32_t *sizeptr, const char *filename);
+typedef void (*flash_write_cb_t)(int res);
 int flash_write_file(const char *buf, uint32_t size, const char *filename);
+int flash_write_file_after(const char *buf, uint32_t size, const char *filename,
+			uint32_t after, flash_write_cb_t done);
+uint32_t flash_write_seq();
+int flash_append_file(const char *buf, uint32_t size, const char *filename);
 int flash_delete_file(const char *filename);
+bool flash_poll();
+int flash_flush();
+void flash_core1_poll();
 int flash_get_fs_info(size_t *size, size_t *free, size_t *files,
 		size_t *directories, size_t *filesizetotal);
 void print_rp2040_flashinfo();
 
 
 /* network.c */
+void network_reserve_pio();
 void network_init();
 void network_mac();
 void network_poll();
@@ -343,8 +717,11 @@ const char *network_hostname();
 
 #if WIFI_SUPPORT
 /* httpd.c */
+void fanpico_httpd_init();
 u16_t fanpico_ssi_handler(const char *tag, char *insert, int insertlen,
-			u16_t current_tag_part, u16_t *next_tag_part);
+			u16_t current_tag_part, u16_t *next_tag_part, void *connection_state);
+void csv_status(struct sw_writer *w, const struct fanpico_state *st);
+void json_status(struct sw_writer *w, const struct fanpico_state *st);
 /* mqtt.c */
 void fanpico_setup_mqtt_client();
 int fanpico_mqtt_client_active();
@@ -353,10 +730,18 @@ void fanpico_mqtt_publish();
 void fanpico_mqtt_publish_temp();
 void fanpico_mqtt_publish_rpm();
 void fanpico_mqtt_publish_duty();
-void fanpico_mqtt_scpi_command();
+void fanpico_mqtt_publish_bulk();
+int json_status_message(char *buf, size_t size);
+void fanpico_mqtt_scpi_response(const char *cmd, int res);
+
+/* telemetry.c */
+void telemetry_poll();
+void telemetry_status();
 
 /* telnetd.c */
 void telnetserver_init();
+void telnetserver_poll();
+void telnetserver_select(int session);
 
 
 #endif
@@ -369,36 +754,78 @@ struct altcp_tls_config* tls_server_config();
 
 /* pwm.c */
 extern float mbfan_pwm_duty[MBFAN_MAX_COUNT];
+extern float mbfan_pwm_freq[MBFAN_MAX_COUNT];
+extern bool mbfan_pwm_lost[MBFAN_MAX_COUNT];
 void setup_pwm_inputs();
 void setup_pwm_outputs();
 void set_pwm_duty_cycle(uint fan, float duty);
+void apply_pwm_duty_cycles();
 float get_pwm_duty_cycle(uint fan);
-void get_pwm_duty_cycles(const struct fanpico_config *config);
-double pwm_map(const struct pwm_map *map, double val);
-double calculate_pwm_duty(struct fanpico_state *state, const struct fanpico_config *config, int i);
+void get_pwm_duty_cycles(const struct fanpico_control_config *config);
+float pwm_map(const struct pwm_map *map, float val);
+int pwm_fan_eval_order(const struct fanpico_control_config *config, uint8_t *order);
+bool pwm_source_loop(const struct fanpico_config *config, int fan, enum pwm_source_types type, uint16_t s_id);
+float pwm_source_value(struct fanpico_state *state, const struct fanpico_control_config *config, int i);
+float calculate_pwm_duty(struct fanpico_state *state, const struct fanpico_control_config *config, int i);
 
 /* filters.c */
 int str2filter(const char *s);
 const char* filter2str(enum signal_filter_types source);
 void* filter_parse_args(enum signal_filter_types filter, char *args);
 char* filter_print_args(enum signal_filter_types filter, void *ctx);
+void filter_free_ctx(void *ctx);
+void filter_free_private_ctx(void *ctx);
 float filter(enum signal_filter_types filter, void *ctx, float input);
 
 /* sensors.c */
-double get_temperature(uint8_t input, const struct fanpico_config *config);
-double sensor_get_duty(const struct temp_map *map, double temp);
-double get_vsensor(uint8_t i, struct fanpico_config *config,
+void setup_sensor_inputs();
+absolute_time_t sensor_inputs_ready_time();
+void update_sensor_tables(const struct fanpico_control_config *config);
+float get_temperature(uint8_t input, const struct fanpico_control_config *config);
+float sensor_get_duty(const struct temp_map *map, float temp);
+float sensor_get_lut_duty(uint8_t input, const struct fanpico_control_config *config, float temp);
+float get_vsensor(uint8_t i, struct fanpico_control_config *config,
 		struct fanpico_state *state);
 
+/* dsensors.c */
+void setup_dsensors();
+void dsensors_poll();
+bool dsensor_get_temp(uint8_t i, float *temp);
+int str2i2c_type(const char *s);
+const char* i2c_type2str(int type);
+int onewire_list_devices();
+uint32_t i2c_bus_speed();
+void i2c_bus_set_shared();
+
 /* tacho.c */
+extern float fan_tacho_freq[FAN_MAX_COUNT];
+extern absolute_time_t fan_tacho_updated[FAN_MAX_COUNT];
+extern absolute_time_t fan_tacho_last_edge[FAN_MAX_COUNT];
 void setup_tacho_inputs();
 void setup_tacho_input_interrupts();
 void setup_tacho_outputs();
 void read_tacho_inputs();
+void tacho_poll_start();
+void tacho_poll_end();
+void tacho_poll();
 void update_tacho_input_freq(struct fanpico_state *state);
-void set_tacho_output_freq(uint fan, double frequency);
-double tacho_map(const struct tacho_map *map, double val);
-double calculate_tacho_freq(struct fanpico_state *state, const struct fanpico_config *config, int i);
+void set_tacho_output_freq(uint fan, float frequency);
+float tacho_map(const struct tacho_map *map, float val);
+float calculate_tacho_freq(struct fanpico_state *state, const struct fanpico_control_config *config, int i);
+
+/* fault.c */
+const char* fan_fault2str(enum fan_fault_types fault);
+int update_fan_faults(struct fanpico_state *state, const struct fanpico_control_config *config);
+uint32_t get_fault_generation();
+bool fault_fan_boost(int fan);
+bool fault_mbfan_failed(int mbfan);
+
+/* rpm_control.c */
+bool rpm_control_enabled(const struct fan_control *fan);
+float rpm_control_set_target(int i, const struct fan_control *fan, float target, float duty);
+void rpm_control_reset(int i);
+float rpm_control_target(int i);
+void update_rpm_control(struct fanpico_state *state, const struct fanpico_control_config *config);
 
 /* log.c */
 int str2log_priority(const char *pri);
@@ -406,6 +833,8 @@ const char* log_priority2str(int pri);
 int str2log_facility(const char *facility);
 const char* log_facility2str(int facility);
 void log_msg(int priority, const char *format, ...);
+void log_flush();
+uint32_t log_dropped_messages();
 int get_debug_level();
 void set_debug_level(int level);
 int get_log_level();
@@ -414,6 +843,20 @@ int get_syslog_level();
 void set_syslog_level(int level);
 void debug(int debug_level, const char *fmt, ...);
 
+/* stream_writer.c */
+void sw_init(struct sw_writer *w, char *buf, size_t size, size_t skip);
+void sw_write(struct sw_writer *w, const char *s, size_t len);
+void sw_puts(struct sw_writer *w, const char *s);
+void sw_printf(struct sw_writer *w, const char *fmt, ...);
+size_t sw_finish(struct sw_writer *w);
+void sw_json_str(struct sw_writer *w, const char *s);
+void sw_json_begin(struct sw_writer *w, const char *key, char type);
+void sw_json_end(struct sw_writer *w, char type);
+void sw_json_string(struct sw_writer *w, const char *key, const char *val);
+void sw_json_int(struct sw_writer *w, const char *key, long val);
+void sw_json_float(struct sw_writer *w, const char *key, double val, int decimals);
+#define sw_full(w) ((w)->overflow)
+
 /* util.c */
 void print_mallinfo();
 char *trim_str(char *s);
@@ -426,7 +869,7 @@ struct tm *datetime_to_tm(const datetime_t *t, struct tm *tm);
 time_t datetime_to_time(const datetime_t *datetime);
 const char *mac_address_str(const uint8_t *mac);
 int valid_wifi_country(const char *country);
-int check_for_change(double oldval, double newval, double threshold);
+int check_for_change(float oldval, float newval, float threshold);
 int64_t pow_i64(int64_t x, uint8_t y);
 double round_decimal(double val, unsigned int decimal);
 char* base64encode(const char *input);
@@ -453,5 +896,11 @@ int getstring_timeout_ms(char *str, uint32_t maxlen, uint32_t timeout);
 /* crc32.c */
 unsigned int xcrc32 (const unsigned char *buf, int len, unsigned int init);
 
+/* crc32_dma.c */
+void crc32_init();
+uint32_t fast_crc32(const void *buf, size_t len, uint32_t init);
+uint32_t dma_crc32(const void *buf, size_t len, uint32_t init);
+bool crc32_dma_available();
+
 
 #endif /* FANPICO_H */
@@ -0,0 +1,273 @@
+/* fault.c
+   Copyright (C) 2021-2024 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of FanPico.
+
+   FanPico is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   FanPico is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with FanPico. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "pico/stdlib.h"
+
+#include "fanpico.h"
+
+
+/*
+ * Fan fault detection (runs on core1).
+ *
+ * Works directly from the raw tachometer data (time of last seen pulse
+ * and latest frequency measurement) instead of the (once per second)
+ * published fan_freq values, so faults are detected within a few hundred
+ * milliseconds:
+ *
+ *   STALL      - fan is driven with non-zero duty, but no tacho pulses
+ *                have been seen for 'fault_stall_time' ms. Only fans that
+ *                have been seen running (or have nominal max_rpm set)
+ *                are checked, so unconnected fan headers are not flagged.
+ *   UNDERSPEED - fan speed is less than half of the expected RPM for the
+ *                current duty cycle (based on fan's nominal max_rpm).
+ *   ERRATIC    - tacho frequency keeps jumping while duty cycle is steady.
+ *
+ * With 'fault_failsafe' enabled, other fans in the same group (fans
+ * using the same PWM source) are driven at 100%, and tacho output
+ * of any mbfan that uses the failed fan as its source is set to 0 RPM
+ * so that the motherboard sees the failure.
+ */
+
+#define FAULT_MIN_DUTY          1.0   /* % */
+#define FAULT_SETTLE_TIME       3000  /* ms */
+#define FAULT_UNDERSPEED_RATIO  0.5f
+#define FAULT_ERRATIC_RATIO     0.4f
+#define FAULT_ERRATIC_COUNT     4
+#define FAULT_CLEAR_TIME        2000  /* ms */
+
+struct fan_fault_state {
+	bool seen_running;
+	float last_freq;
+	absolute_time_t last_update;
+	float settle_duty;
+	absolute_time_t settled;
+	uint8_t erratic;
+	absolute_time_t ok_since;
+};
+
+static struct fan_fault_state fault_state[FAN_MAX_COUNT];
+static uint8_t fan_faults[FAN_MAX_COUNT];
+static uint16_t fault_boost_mask = 0;
+static uint16_t fault_failed_mask = 0;
+static uint32_t fault_generation = 0;
+
+
+const char* fan_fault2str(enum fan_fault_types fault)
+{
+	switch (fault) {
+	case FAULT_NONE:
+		return "ok";
+	case FAULT_STALL:
+		return "stall";
+	case FAULT_UNDERSPEED:
+		return "underspeed";
+	case FAULT_ERRATIC:
+		return "erratic";
+	}
+	return "unknown";
+}
+
+
+static enum fan_fault_types check_fan(int i, absolute_time_t now,
+				const struct fanpico_state *state,
+				const struct fanpico_control_config *config)
+{
+	struct fan_fault_state *s = &fault_state[i];
+	const struct fan_control *fan = &config->fans[i];
+	float duty = state->fan_duty[i];
+	float freq = fan_tacho_freq[i];
+	float rpm, expected, delta;
+	bool settled;
+
+	if (freq > 0)
+		s->seen_running = true;
+
+	/* Give fan time to react to (larger) duty cycle changes */
+	if (fabsf(duty - s->settle_duty) > 5.0f) {
+		s->settle_duty = duty;
+		s->settled = delayed_by_ms(now, FAULT_SETTLE_TIME);
+		s->erratic = 0;
+	}
+	settled = (absolute_time_diff_us(s->settled, now) >= 0);
+
+	if (duty < FAULT_MIN_DUTY)
+		return FAULT_NONE;
+
+	/* Stall */
+	if (s->seen_running || (fan->max_rpm > 0 && settled)) {
+#if TACHO_READ_MULTIPLEX == 0
+		if (absolute_time_diff_us(fan_tacho_last_edge[i], now)
+			> (int64_t)config->fault_stall_time * 1000)
+			return FAULT_STALL;
+#else
+		/* Fans are only visited periodically, so stopped fan is seen
+		   as 0Hz reading (or no reading at all for a long time) */
+		if (absolute_time_diff_us(fan_tacho_last_edge[i], now)
+			> (int64_t)(config->fault_stall_time + 2000) * 1000)
+			return FAULT_STALL;
+#endif
+		if (freq == 0 && s->seen_running && absolute_time_diff_us(
+				fan_tacho_last_edge[i], fan_tacho_updated[i]) > 0)
+			return FAULT_STALL;
+	}
+
+	if (!settled)
+		return FAULT_NONE;
+
+	/* Erratic tacho signal (count large jumps between new measurements) */
+	if (absolute_time_diff_us(s->last_update, fan_tacho_updated[i]) != 0) {
+		s->last_update = fan_tacho_updated[i];
+		if (freq > 0 && s->last_freq > 0) {
+			delta = fabsf(freq - s->last_freq) / fmaxf(freq, s->last_freq);
+			if (delta > FAULT_ERRATIC_RATIO) {
+				if (s->erratic < 255)
+					s->erratic++;
+			} else if (s->erratic > 0) {
+				s->erratic--;
+			}
+		}
+		s->last_freq = freq;
+	}
+	if (s->erratic >= FAULT_ERRATIC_COUNT)
+		return FAULT_ERRATIC;
+
+	/* Under-speed */
+	if (fan->max_rpm > 0 && freq > 0) {
+		rpm = freq * 60 / fan->rpm_factor;
+		expected = fan->max_rpm * duty / 100;
+		if (rpm < expected * FAULT_UNDERSPEED_RATIO)
+			return FAULT_UNDERSPEED;
+	}
+
+	return FAULT_NONE;
+}
+
+
+static bool update_fault_masks(const struct fanpico_control_config *config)
+{
+	const struct mbfan_control *m;
+	const struct fan_control *f, *g;
+	uint16_t boost = 0;
+	uint16_t failed = 0;
+	int i, j;
+
+	for (i = 0; i < FAN_COUNT; i++) {
+		if (fan_faults[i] == FAULT_NONE)
+			continue;
+
+		/* Other fans in the same group */
+		f = &config->fans[i];
+		for (j = 0; j < FAN_COUNT; j++) {
+			g = &config->fans[j];
+			if (j != i && g->s_type == f->s_type && g->s_id == f->s_id)
+				boost |= (1 << j);
+		}
+
+		/* MB fans using this fan as source */
+		for (j = 0; j < MBFAN_COUNT; j++) {
+			m = &config->mbfans[j];
+			if ((m->s_type == TACHO_FAN && m->s_id == i)
+				|| (m->s_type >= TACHO_MIN && m->sources[i]))
+				failed |= (1 << j);
+		}
+	}
+
+	if (!config->fault_failsafe) {
+		boost = 0;
+		failed = 0;
+	}
+	if (boost == fault_boost_mask && failed == fault_failed_mask)
+		return false;
+
+	fault_boost_mask = boost;
+	fault_failed_mask = failed;
+	return true;
+}
+
+
+/* Check all fans for faults, returns 1 if fault state changed. */
+int update_fan_faults(struct fanpico_state *state, const struct fanpico_control_config *config)
+{
+	absolute_time_t now = get_absolute_time();
+	struct fan_fault_state *s;
+	enum fan_fault_types fault;
+	bool changed = false;
+	int i;
+
+	for (i = 0; i < FAN_COUNT; i++) {
+		s = &fault_state[i];
+		fault = check_fan(i, now, state, config);
+
+		if (fault == fan_faults[i]) {
+			s->ok_since = now;
+			continue;
+		}
+		if (fault == FAULT_NONE) {
+			/* Require fan to be ok for a while before clearing fault */
+			if (absolute_time_diff_us(s->ok_since, now) < FAULT_CLEAR_TIME * 1000)
+				continue;
+			log_msg(LOG_NOTICE, "fan%d: fault cleared (%s)", i + 1,
+				fan_fault2str(fan_faults[i]));
+		} else {
+			log_msg(LOG_ERR, "fan%d: fault detected: %s (duty %.0f%%, %.1fHz)",
+				i + 1, fan_fault2str(fault), state->fan_duty[i],
+				fan_tacho_freq[i]);
+		}
+		fan_faults[i] = fault;
+		s->ok_since = now;
+		changed = true;
+	}
+
+	/* Fail-safe setting may have changed, so always check masks */
+	if (update_fault_masks(config))
+		changed = true;
+	if (!changed)
+		return 0;
+
+	memcpy(state->fan_fault, fan_faults, sizeof(state->fan_fault));
+	fault_generation++;
+
+	return 1;
+}
+
+
+uint32_t get_fault_generation()
+{
+	return fault_generation;
+}
+
+
+bool fault_fan_boost(int fan)
+{
+	return (fault_boost_mask & (1 << fan) ? true : false);
+}
+
+
+bool fault_mbfan_failed(int mbfan)
+{
+	return (fault_failed_mask & (1 << mbfan) ? true : false);
+}
+
+
+/* eof :-) */
@@ -0,0 +1,89 @@
+/* filter_ema.c
+   Copyright (C) 2023-2024 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of FanPico.
+
+   FanPico is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   FanPico is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with FanPico. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include "pico/stdlib.h"
+
+#include "fanpico.h"
+#include "filters.h"
+
+
+typedef struct ema_context {
+	float alpha;
+	float value;
+	bool init;
+} ema_context_t;
+
+static_assert(sizeof(ema_context_t) <= FILTER_CTX_MAX_SIZE, "ema_context_t too large");
+
+
+int ema_parse_args(char *args, void *ctx)
+{
+	ema_context_t *c = (ema_context_t*)ctx;
+	char *tok, *saveptr;
+	float alpha;
+
+	/* alpha parameter (smoothing factor) */
+	if (!(tok = strtok_r(args, ",", &saveptr)))
+		return -1;
+	if (!str_to_float(tok, &alpha))
+		return -1;
+	if (alpha <= 0.0 || alpha > 1.0)
+		return -1;
+
+	c->alpha = alpha;
+	c->value = 0.0;
+	c->init = false;
+
+	return 0;
+}
+
+char* ema_print_args(void *ctx)
+{
+	ema_context_t *c = (ema_context_t*)ctx;
+	char buf[128];
+
+	snprintf(buf, sizeof(buf), "%f", c->alpha);
+
+	return strdup(buf);
+}
+
+float ema_filter(void *ctx, float input)
+{
+	ema_context_t *c = (ema_context_t*)ctx;
+
+	if (!c->init) {
+		/* Start from first sample instead of zero. */
+		c->value = input;
+		c->init = true;
+	} else {
+		c->value += c->alpha * (input - c->value);
+	}
+
+	return c->value;
+}
+
+
+/* eof :-) */
@@ -0,0 +1,113 @@
+/* filter_kalman.c
+   Copyright (C) 2023-2024 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of FanPico.
+
+   FanPico is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   FanPico is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with FanPico. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include "pico/stdlib.h"
+
+#include "fanpico.h"
+#include "filters.h"
+
+
+/* Simple (scalar) Kalman filter, assuming signal is (nearly) constant
+ * between samples:
+ *   q = process noise (variance), how fast real signal may change
+ *   r = measurement noise (variance)
+ */
+typedef struct kalman_context {
+	float q;
+	float r;
+	float x; /* estimate */
+	float p; /* estimate error (variance) */
+	bool init;
+} kalman_context_t;
+
+static_assert(sizeof(kalman_context_t) <= FILTER_CTX_MAX_SIZE, "kalman_context_t too large");
+
+
+int kalman_parse_args(char *args, void *ctx)
+{
+	kalman_context_t *c = (kalman_context_t*)ctx;
+	char *tok, *saveptr;
+	float q, r;
+
+	/* process noise parameter */
+	if (!(tok = strtok_r(args, ",", &saveptr)))
+		return -1;
+	if (!str_to_float(tok, &q))
+		return -1;
+	if (q <= 0.0)
+		return -1;
+
+	/* measurement noise parameter */
+	if (!(tok = strtok_r(NULL, ",", &saveptr)))
+		return -1;
+	if (!str_to_float(tok, &r))
+		return -1;
+	if (r <= 0.0)
+		return -1;
+
+	c->q = q;
+	c->r = r;
+	c->x = 0.0;
+	c->p = r;
+	c->init = false;
+
+	return 0;
+}
+
+char* kalman_print_args(void *ctx)
+{
+	kalman_context_t *c = (kalman_context_t*)ctx;
+	char buf[128];
+
+	snprintf(buf, sizeof(buf), "%f,%f", c->q, c->r);
+
+	return strdup(buf);
+}
+
+float kalman_filter(void *ctx, float input)
+{
+	kalman_context_t *c = (kalman_context_t*)ctx;
+	float k;
+
+	if (!c->init) {
+		c->x = input;
+		c->init = true;
+		return c->x;
+	}
+
+	/* Predict */
+	c->p += c->q;
+
+	/* Update */
+	k = c->p / (c->p + c->r);
+	c->x += k * (input - c->x);
+	c->p *= (1.0f - k);
+
+	return c->x;
+}
+
+
+/* eof :-) */
@@ -27,6 +27,7 @@
 #include "pico/stdlib.h"
 
 #include "fanpico.h"
+#include "filters.h"
 
 
 typedef struct lossypeak_context {
@@ -38,35 +39,30 @@ typedef struct lossypeak_context {
 	uint8_t state;
 } lossypeak_context_t;
 
+static_assert(sizeof(lossypeak_context_t) <= FILTER_CTX_MAX_SIZE, "lossypeak_context_t too large");
 
-void* lossy_peak_parse_args(char *args)
+
+int lossy_peak_parse_args(char *args, void *ctx)
 {
-	lossypeak_context_t *c;
+	lossypeak_context_t *c = (lossypeak_context_t*)ctx;
 	char *tok, *saveptr;
 	float decay, delay;
 
-	if (!args)
-		return NULL;
-
 	/* decay parameter (points per second) */
 	if (!(tok = strtok_r(args, ",", &saveptr)))
-		return NULL;
+		return -1;
 	if (!str_to_float(tok, &decay))
-		return NULL;
+		return -1;
 	if (decay < 0.0)
-		return NULL;
+		return -1;
 
 	/* delay parameter (seconds) */
 	if (!(tok = strtok_r(NULL, ",", &saveptr)))
-		return NULL;
+		return -1;
 	if (!str_to_float(tok, &delay))
-		return NULL;
+		return -1;
 	if (delay < 0.0)
-		return NULL;
-
-
-	if (!(c = malloc(sizeof(lossypeak_context_t))))
-		return NULL;
+		return -1;
 
 	c->peak = 0.0;
 	c->delay_us = delay * 1000000;
@@ -75,7 +71,7 @@ void* lossy_peak_parse_args(char *args)
 	update_us_since_boot(&c->peak_t, 0);
 	c->state = 0;
 
-	return c;
+	return 0;
 }
 
 char* lossy_peak_print_args(void *ctx)
@@ -111,7 +107,7 @@ float lossy_peak_filter(void *ctx, float input)
 			}
 		}
 		if (c->state == 1) {
-			float decay = (t_d / 1000000.0) * c->decay;
+			float decay = (t_d / 1000000.0f) * c->decay;
 			if (input > c->peak - decay) {
 				c->peak = input;
 			} else {
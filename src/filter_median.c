@@ -0,0 +1,111 @@
+/* filter_median.c
+   Copyright (C) 2023-2024 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of FanPico.
+
+   FanPico is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   FanPico is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with FanPico. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#include "pico/stdlib.h"
+
+#include "fanpico.h"
+#include "filters.h"
+
+
+#define MEDIAN_WINDOW_MAX_SIZE 9
+
+typedef struct median_context {
+	float data[MEDIAN_WINDOW_MAX_SIZE];   /* samples in arrival order (ring buffer) */
+	float sorted[MEDIAN_WINDOW_MAX_SIZE]; /* same samples in sorted order */
+	uint8_t index;
+	uint8_t used;
+	uint8_t window;
+} median_context_t;
+
+static_assert(sizeof(median_context_t) <= FILTER_CTX_MAX_SIZE, "median_context_t too large");
+
+
+int median_parse_args(char *args, void *ctx)
+{
+	median_context_t *c = (median_context_t*)ctx;
+	char *tok, *saveptr;
+	int window;
+
+	/* window parameter (samples) */
+	if (!(tok = strtok_r(args, ",", &saveptr)))
+		return -1;
+	if (!str_to_int(tok, &window, 10))
+		return -1;
+	if (window < 3 || window > MEDIAN_WINDOW_MAX_SIZE || (window & 1) == 0)
+		return -1;
+
+	c->index = 0;
+	c->used = 0;
+	c->window = window;
+
+	return 0;
+}
+
+char* median_print_args(void *ctx)
+{
+	median_context_t *c = (median_context_t*)ctx;
+	char buf[128];
+
+	snprintf(buf, sizeof(buf), "%u", c->window);
+
+	return strdup(buf);
+}
+
+float median_filter(void *ctx, float input)
+{
+	median_context_t *c = (median_context_t*)ctx;
+	int i;
+
+	if (c->used < c->window) {
+		/* Ring buffer not yet full */
+		i = c->used++;
+	} else {
+		/* Remove oldest sample from sorted list. */
+		float old = c->data[c->index];
+		for (i = 0; i < c->used - 1; i++) {
+			if (c->sorted[i] == old)
+				break;
+		}
+		for (; i < c->used - 1; i++)
+			c->sorted[i] = c->sorted[i + 1];
+		i = c->used - 1;
+	}
+
+	/* Insert new sample into sorted list. */
+	while (i > 0 && c->sorted[i - 1] > input) {
+		c->sorted[i] = c->sorted[i - 1];
+		i--;
+	}
+	c->sorted[i] = input;
+
+	c->data[c->index] = input;
+	c->index = ((c->index + 1) % c->window);
+
+	return c->sorted[c->used / 2];
+}
+
+
+/* eof :-) */
@@ -27,47 +27,80 @@
 #include "pico/stdlib.h"
 
 #include "fanpico.h"
+#include "filters.h"
 
 
 #define SMA_WINDOW_MAX_SIZE 32
+#define SMA_DECIMATION_MAX 256
 
+/* Samples are stored as fixed point values, so that running sum
+   is exact (no rounding drift over time). */
+#define SMA_FRAC_BITS 12
+#define SMA_FIXED_MAX ((float)(INT32_MAX >> SMA_FRAC_BITS))
+
+/* In decimated (cascaded) mode first stage averages 'decimation'
+   consecutive samples into a block and second stage calculates
+   moving average over 'window' blocks, giving effective window of
+   window * decimation samples with same memory footprint. */
 typedef struct sma_context {
-	float data[SMA_WINDOW_MAX_SIZE];
-	double sum;
+	int32_t data[SMA_WINDOW_MAX_SIZE];
+	int64_t sum;
+	int64_t block_sum;
+	uint16_t block_count;
+	uint16_t decimation;
 	uint8_t index;
 	uint8_t used;
 	uint8_t window;
 } sma_context_t;
 
+static_assert(sizeof(sma_context_t) <= FILTER_CTX_MAX_SIZE, "sma_context_t too large");
+
 
-void* sma_parse_args(char *args)
+static inline int32_t sma_to_fixed(float val)
 {
-	sma_context_t *c;
-	char *tok, *saveptr;
-	int window, i;
+	if (val > SMA_FIXED_MAX)
+		val = SMA_FIXED_MAX;
+	else if (val < -SMA_FIXED_MAX)
+		val = -SMA_FIXED_MAX;
 
-	if (!args)
-		return NULL;
+	return (int32_t)lroundf(val * (1 << SMA_FRAC_BITS));
+}
+
+
+int sma_parse_args(char *args, void *ctx)
+{
+	sma_context_t *c = (sma_context_t*)ctx;
+	char *tok, *saveptr;
+	int window, decimation, i;
 
 	/* window parameter (samples) */
 	if (!(tok = strtok_r(args, ",", &saveptr)))
-		return NULL;
+		return -1;
 	if (!str_to_int(tok, &window, 10))
-		return NULL;
+		return -1;
 	if (window < 2 || window > SMA_WINDOW_MAX_SIZE)
-		return NULL;
-
-	if (!(c = malloc(sizeof(sma_context_t))))
-		return NULL;
+		return -1;
+
+	/* decimation parameter (samples per block, optional) */
+	decimation = 1;
+	if ((tok = strtok_r(NULL, ",", &saveptr))) {
+		if (!str_to_int(tok, &decimation, 10))
+			return -1;
+		if (decimation < 1 || decimation > SMA_DECIMATION_MAX)
+			return -1;
+	}
 
 	c->index = 0;
 	c->used = 0;
 	c->window = window;
-	c->sum = 0.0;
+	c->decimation = decimation;
+	c->sum = 0;
+	c->block_sum = 0;
+	c->block_count = 0;
 	for(i = 0; i < SMA_WINDOW_MAX_SIZE; i++)
-		c->data[i] = 0.0;
+		c->data[i] = 0;
 
-	return c;
+	return 0;
 }
 
 char* sma_print_args(void *ctx)
@@ -75,7 +108,10 @@ char* sma_print_args(void *ctx)
 	sma_context_t *c = (sma_context_t*)ctx;
 	char buf[128];
 
-	snprintf(buf, sizeof(buf), "%u", c->window);
+	if (c->decimation > 1)
+		snprintf(buf, sizeof(buf), "%u,%u", c->window, c->decimation);
+	else
+		snprintf(buf, sizeof(buf), "%u", c->window);
 
 	return strdup(buf);
 }
@@ -83,7 +119,22 @@ char* sma_print_args(void *ctx)
 float sma_filter(void *ctx, float input)
 {
 	sma_context_t *c = (sma_context_t*)ctx;
-	float output;
+	int32_t val = sma_to_fixed(input);
+
+	if (c->decimation > 1) {
+		/* First stage: average samples into a block. */
+		c->block_sum += val;
+		if (++c->block_count < c->decimation) {
+			if (c->used == 0) {
+				/* No complete blocks yet, return average of current block. */
+				return (float)c->block_sum / ((int64_t)c->block_count << SMA_FRAC_BITS);
+			}
+			return (float)c->sum / ((int64_t)c->used << SMA_FRAC_BITS);
+		}
+		val = c->block_sum / c->decimation;
+		c->block_sum = 0;
+		c->block_count = 0;
+	}
 
 	if (c->used < c->window) {
 		/* Ring buffer not yet full */
@@ -92,17 +143,13 @@ float sma_filter(void *ctx, float input)
 		/* Ring buffer is full, discard oldest value. */
 		c->sum -= c->data[c->index];
 	}
-	c->data[c->index] = input;
-	c->sum += input;
-	output = c->sum / c->used;
-
-	//printf("sma: index=%u,window=%u,used=%u,sum=%lf,input=%f,return=%f\n",
-	// 	c->index, c->window, c->used, c->sum, input, output);
+	c->data[c->index] = val;
+	c->sum += val;
 
 	/* Point index to next slot in the ring buffer. */
 	c->index = ((c->index + 1) % c->window);
 
-	return output;
+	return (float)c->sum / ((int64_t)c->used << SMA_FRAC_BITS);
 }
 
 
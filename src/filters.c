@@ -34,10 +34,115 @@ filter_entry_t filters[] = {
 	{ "none", NULL, NULL, NULL }, /* FILTER_NONE */
 	{ "lossypeak", lossy_peak_parse_args, lossy_peak_print_args, lossy_peak_filter }, /* FILTER_LOSSYPEAK */
 	{ "sma", sma_parse_args, sma_print_args, sma_filter }, /* FILTER_SMA */
+	{ "ema", ema_parse_args, ema_print_args, ema_filter }, /* FILTER_EMA */
+	{ "median", median_parse_args, median_print_args, median_filter }, /* FILTER_MEDIAN */
+	{ "kalman", kalman_parse_args, kalman_print_args, kalman_filter }, /* FILTER_KALMAN */
 	{ NULL, NULL, NULL, NULL }
 };
 
 
+/* Pool for filter contexts.
+ *
+ * Pool has a slot for every channel that can have a filter and some
+ * spare slots, since a released context cannot be reused until core1
+ * has picked up configuration that no longer refers to it: released
+ * slots are tagged with current config_generation and become free once
+ * core1 is using a newer configuration. Slot memory is allocated when
+ * a slot is first used and then kept for reuse (never returned to heap),
+ * so no memory is used if no filters are configured.
+ */
+#define FILTER_POOL_CHANNELS (FAN_COUNT + MBFAN_COUNT + SENSOR_COUNT + VSENSOR_COUNT)
+#define FILTER_POOL_SPARE    8
+#define FILTER_POOL_SIZE     (FILTER_POOL_CHANNELS + FILTER_POOL_SPARE)
+
+enum filter_slot_states {
+	SLOT_FREE = 0,
+	SLOT_USED,
+	SLOT_RELEASED,
+};
+
+typedef struct filter_slot {
+	uint64_t data[FILTER_CTX_MAX_SIZE / sizeof(uint64_t)];
+} filter_slot_t;
+
+static filter_slot_t *filter_pool[FILTER_POOL_SIZE];
+static uint8_t filter_pool_state[FILTER_POOL_SIZE];
+static uint32_t filter_pool_gen[FILTER_POOL_SIZE];
+
+
+static void* filter_alloc_ctx()
+{
+	uint32_t core1_gen = get_core1_config_generation();
+	int i, slot = -1;
+
+	for (i = 0; i < FILTER_POOL_SIZE; i++) {
+		if (filter_pool_state[i] == SLOT_RELEASED
+			&& (int32_t)(core1_gen - filter_pool_gen[i]) > 0)
+			filter_pool_state[i] = SLOT_FREE;
+		if (filter_pool_state[i] != SLOT_FREE)
+			continue;
+		/* Prefer slots that already have memory allocated */
+		if (filter_pool[i]) {
+			slot = i;
+			break;
+		}
+		if (slot < 0)
+			slot = i;
+	}
+	if (slot < 0) {
+		log_msg(LOG_ERR, "filter_alloc_ctx(): filter pool exhausted");
+		return NULL;
+	}
+	if (!filter_pool[slot]) {
+		if (!(filter_pool[slot] = malloc(sizeof(filter_slot_t)))) {
+			log_msg(LOG_ALERT, "filter_alloc_ctx(): out of memory");
+			return NULL;
+		}
+	}
+
+	filter_pool_state[slot] = SLOT_USED;
+	memset(filter_pool[slot], 0, sizeof(filter_slot_t));
+	return filter_pool[slot];
+}
+
+
+static int filter_pool_slot(void *ctx)
+{
+	if (!ctx)
+		return -1;
+	for (int i = 0; i < FILTER_POOL_SIZE; i++) {
+		if (filter_pool[i] == ctx)
+			return (filter_pool_state[i] == SLOT_USED ? i : -1);
+	}
+	return -1;
+}
+
+
+/* Release filter context that may be in use by core1 (referenced
+ * by the configuration). Context is reused only after core1 has
+ * picked up a newer configuration.
+ */
+void filter_free_ctx(void *ctx)
+{
+	int slot = filter_pool_slot(ctx);
+
+	if (slot >= 0) {
+		filter_pool_gen[slot] = config_generation;
+		filter_pool_state[slot] = SLOT_RELEASED;
+	}
+}
+
+
+/* Release filter context that was never visible to core1. */
+void filter_free_private_ctx(void *ctx)
+{
+	int slot = filter_pool_slot(ctx);
+
+	if (slot >= 0)
+		filter_pool_state[slot] = SLOT_FREE;
+}
+
+
 int str2filter(const char *s)
 {
 	int ret = FILTER_NONE;
@@ -69,9 +174,15 @@ void* filter_parse_args(enum signal_filter_types filter, char *args)
 {
 	void *ret = NULL;
 
-	if (filter <= FILTER_ENUM_MAX) {
-		if (filters[filter].parse_args_func)
-			ret = filters[filter].parse_args_func(args);
+	if (filter <= FILTER_ENUM_MAX && args) {
+		if (filters[filter].parse_args_func) {
+			if (!(ret = filter_alloc_ctx()))
+				return NULL;
+			if (filters[filter].parse_args_func(args, ret)) {
+				filter_free_private_ctx(ret);
+				ret = NULL;
+			}
+		}
 	}
 
 	return ret;
@@ -22,7 +22,11 @@
 #ifndef FANPICO_FILTERS_H
 #define FANPICO_FILTERS_H 1
 
-typedef void* (filter_parse_args_func_t)(char *args);
+/* Filter contexts are allocated from a pool (see filters.c),
+   every filter context must fit in a pool slot. */
+#define FILTER_CTX_MAX_SIZE 160
+
+typedef int (filter_parse_args_func_t)(char *args, void *ctx);
 typedef char* (filter_print_args_func_t)(void *ctx);
 typedef float (filter_func_t)(void *ctx, float input);
 
@@ -34,14 +38,29 @@ typedef struct filter_entry {
 } filter_entry_t;
 
 /* filters_lossypeak.c */
-void* lossy_peak_parse_args(char *args);
+int lossy_peak_parse_args(char *args, void *ctx);
 char* lossy_peak_print_args(void *ctx);
 float lossy_peak_filter(void *ctx, float input);
 
 /* filters_sma.c */
-void* sma_parse_args(char *args);
+int sma_parse_args(char *args, void *ctx);
 char* sma_print_args(void *ctx);
 float sma_filter(void *ctx, float input);
 
+/* filters_ema.c */
+int ema_parse_args(char *args, void *ctx);
+char* ema_print_args(void *ctx);
+float ema_filter(void *ctx, float input);
+
+/* filters_median.c */
+int median_parse_args(char *args, void *ctx);
+char* median_print_args(void *ctx);
+float median_filter(void *ctx, float input);
+
+/* filters_kalman.c */
+int kalman_parse_args(char *args, void *ctx);
+char* kalman_print_args(void *ctx);
+float kalman_filter(void *ctx, float input);
+
 
 #endif /* FANPICO_FILTERS_H */
@@ -21,8 +21,13 @@
 
 #include <stdio.h>
 #include <malloc.h>
+#include <string.h>
 #include "pico/stdlib.h"
 #include "pico/mutex.h"
+#include "pico/multicore.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "hardware/watchdog.h"
 #include "pico_lfs.h"
 
 #include "fanpico.h"
@@ -32,19 +37,190 @@ extern char __flash_binary_end;
 
 
 #define FS_SIZE  (256*1024)
+#define FS_OFFSET (PICO_FLASH_SIZE_BYTES - FS_SIZE)
+
+/*
+ * Flash filesystem is mounted once (at boot) and stays mounted.
+ *
+ * Writes are done in the background (write-behind): flash_write_file()
+ * only queues a copy of the data and flash_poll() (called from core0
+ * main loop) writes it out in small chunks, so that network stack etc.
+ * keep getting serviced while file is being written. Files are written
+ * into a temporary file first and then renamed over the original,
+ * so an interrupted write never leaves a partially written file.
+ * Appends (flash_append_file()) are written directly to the file,
+ * so readers must be able to detect a torn (partially written) tail.
+ *
+ * While flash is being erased/programmed (XIP disabled), core1 cannot
+ * execute code from flash. Before each individual erase/program operation,
+ * core1 is asked to enter flash_core1_poll() (RAM resident), where it keeps
+ * sampling tacho inputs (tacho_poll()) with interrupts disabled, until
+ * the operation is complete. Fan PWM outputs (PWM slices) and tacho
+ * outputs (PIO) run in hardware and are not affected. If core1 does not
+ * respond in time (busy running a long task), it is paused using
+ * multicore_lockout instead.
+ *
+ * File writes return FLASH_WRITE_QUEUED, errors in the background write
+ * are logged and returned by the next flash_flush(). Writes queued with
+ * flash_write_file_after() report their result using a callback instead,
+ * and are skipped if any of the writes they depend on failed.
+ */
+
+#define FLASH_WB_QUEUE_LEN  4
+#define FLASH_WB_CHUNK_SIZE 512
+#define FLASH_WB_TMP_SUFFIX ".tmp"
+#define FLASH_CORE1_PAUSE_TIMEOUT  10     /* ms */
+#define FLASH_LOCKOUT_TIMEOUT      100000 /* us */
+
+enum flash_wb_stage {
+	WB_IDLE = 0,
+	WB_OPEN,
+	WB_WRITE,
+	WB_CLOSE,
+	WB_RENAME,
+};
+
+struct flash_wb_entry {
+	char name[LFS_NAME_MAX + 1];
+	char *buf;
+	uint32_t size;
+	bool append;
+	uint32_t seq;
+	uint32_t after;
+	flash_write_cb_t done;
+};
 
 static struct lfs_config *lfs_cfg;
 static lfs_t lfs;
 static lfs_file_t lfs_file;
+static bool lfs_mounted = false;
+
+static struct flash_wb_entry wb_queue[FLASH_WB_QUEUE_LEN];
+static uint wb_count = 0;
+static enum flash_wb_stage wb_stage = WB_IDLE;
+static uint32_t wb_pos = 0;
+static lfs_file_t wb_file;
+static char wb_tmpname[LFS_NAME_MAX + 1];
+static int wb_error = 0;
+static uint32_t wb_seq = 1;
+static uint32_t wb_error_seq = 0;
+
+static volatile bool core1_pause_req = false;
+static volatile bool core1_paused = false;
+
+
+/* Called by core1 (from its main loop), to keep sampling tacho inputs
+ * from RAM while core0 is erasing/programming flash. */
+void __not_in_flash_func(flash_core1_poll)()
+{
+	uint32_t irq;
+
+	if (!core1_pause_req)
+		return;
+
+	tacho_poll_start();
+	irq = save_and_disable_interrupts();
+	core1_paused = true;
+	while (core1_pause_req)
+		tacho_poll();
+	tacho_poll_end();
+	core1_paused = false;
+	restore_interrupts(irq);
+}
+
+
+/* Get core1 out of the way (from executing code from flash).
+ * Returns: 0 = core1 not running, 1 = core1 in flash_core1_poll(),
+ *          2 = core1 in lockout, < 0 = failed to pause core1 */
+static int flash_core1_pause()
+{
+	absolute_time_t t;
+
+	if (!multicore_lockout_victim_is_initialized(1))
+		return 0;
+
+	t = make_timeout_time_ms(FLASH_CORE1_PAUSE_TIMEOUT);
+	while (core1_paused) {
+		/* core1 still leaving from previous (timed out) request */
+		if (time_reached(t))
+			return -1;
+	}
+	core1_pause_req = true;
+	__sev();
+	while (!core1_paused) {
+		if (time_reached(t)) {
+			core1_pause_req = false;
+			if (!multicore_lockout_start_timeout_us(FLASH_LOCKOUT_TIMEOUT))
+				return -2;
+			return 2;
+		}
+	}
+
+	return 1;
+}
+
+
+static void flash_core1_resume(int mode)
+{
+	if (mode == 1) {
+		core1_pause_req = false;
+		while (core1_paused)
+			;
+	}
+	else if (mode == 2) {
+		multicore_lockout_end_timeout_us(FLASH_LOCKOUT_TIMEOUT);
+	}
+}
+
+
+static int flash_lfs_prog(const struct lfs_config *c, lfs_block_t block,
+			lfs_off_t off, const void *buffer, lfs_size_t size)
+{
+	uint32_t irq;
+	int mode;
+
+	if ((mode = flash_core1_pause()) < 0) {
+		log_msg(LOG_ERR, "flash: cannot pause core1: %d", mode);
+		return LFS_ERR_IO;
+	}
+	irq = save_and_disable_interrupts();
+	flash_range_program(FS_OFFSET + block * c->block_size + off, buffer, size);
+	restore_interrupts(irq);
+	flash_core1_resume(mode);
+
+	return LFS_ERR_OK;
+}
+
+
+static int flash_lfs_erase(const struct lfs_config *c, lfs_block_t block)
+{
+	uint32_t irq;
+	int mode;
+
+	if ((mode = flash_core1_pause()) < 0) {
+		log_msg(LOG_ERR, "flash: cannot pause core1: %d", mode);
+		return LFS_ERR_IO;
+	}
+	irq = save_and_disable_interrupts();
+	flash_range_erase(FS_OFFSET + block * c->block_size, c->block_size);
+	restore_interrupts(irq);
+	flash_core1_resume(mode);
+
+	return LFS_ERR_OK;
+}
+
 
 void lfs_setup()
 {
 	int err;
 
 	//printf("lfs_setup\n");
-	lfs_cfg = pico_lfs_init(PICO_FLASH_SIZE_BYTES - FS_SIZE, FS_SIZE);
+	lfs_cfg = pico_lfs_init(FS_OFFSET, FS_SIZE);
 	if (!lfs_cfg)
 		panic("lfs_setup: not enough memory!");
+	/* Use our own erase/program functions, that keep core1 running */
+	lfs_cfg->prog = flash_lfs_prog;
+	lfs_cfg->erase = flash_lfs_erase;
 
 	/* Check if we need to initialize/format filesystem... */
 	err = lfs_mount(&lfs, lfs_cfg);
@@ -55,8 +231,165 @@ void lfs_setup()
 			return;
 		}
 		log_msg(LOG_NOTICE, "Filesystem successfully initialized: %d", err);
-	} else {
-		lfs_unmount(&lfs);
+		if ((err = lfs_mount(&lfs, lfs_cfg)) != LFS_ERR_OK) {
+			log_msg(LOG_ERR, "lfs_mount() failed: %d", err);
+			return;
+		}
+	}
+	lfs_mounted = true;
+	log_msg(LOG_DEBUG, "Filesystem mounted OK");
+}
+
+
+static void flash_wb_done(int res)
+{
+	struct flash_wb_entry *e = &wb_queue[0];
+	flash_write_cb_t done = e->done;
+
+	if (res) {
+		log_msg(LOG_ERR, "Failed to write file \"%s\": %d", e->name, res);
+		if (!wb_error && !done)
+			wb_error = res;
+		if (e->seq > wb_error_seq)
+			wb_error_seq = e->seq;
+	} else
+		log_msg(LOG_INFO, "File \"%s\" successfully saved: %lu bytes",
+			e->name, e->size);
+
+	free(e->buf);
+	wb_count--;
+	memmove(&wb_queue[0], &wb_queue[1], wb_count * sizeof(wb_queue[0]));
+	memset(&wb_queue[wb_count], 0, sizeof(wb_queue[0]));
+	wb_stage = WB_IDLE;
+
+	/* Called last, callback may queue new writes */
+	if (done)
+		done(res);
+}
+
+
+/* Perform next step of the (write-behind) file write in progress.
+ * Returns true if there is still work pending. */
+bool flash_poll()
+{
+	struct flash_wb_entry *e = &wb_queue[0];
+	uint32_t len;
+	int res;
+
+	if (wb_count < 1)
+		return false;
+	if (!lfs_mounted) {
+		flash_wb_done(-1);
+		return (wb_count > 0);
+	}
+
+	switch (wb_stage) {
+	case WB_IDLE:
+		if (e->after && wb_error_seq >= e->after) {
+			/* Write(s) this depends on failed */
+			flash_wb_done(-6);
+			break;
+		}
+		wb_stage = WB_OPEN;
+		/* fall through */
+	case WB_OPEN:
+		if (e->append) {
+			strncopy(wb_tmpname, e->name, sizeof(wb_tmpname));
+			res = lfs_file_open(&lfs, &wb_file, e->name,
+					LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND);
+		} else {
+			snprintf(wb_tmpname, sizeof(wb_tmpname), "%s%s", e->name, FLASH_WB_TMP_SUFFIX);
+			res = lfs_file_open(&lfs, &wb_file, wb_tmpname,
+					LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC);
+		}
+		if (res != LFS_ERR_OK) {
+			flash_wb_done(-2);
+			break;
+		}
+		wb_pos = 0;
+		wb_stage = WB_WRITE;
+		break;
+
+	case WB_WRITE:
+		len = e->size - wb_pos;
+		if (len > FLASH_WB_CHUNK_SIZE)
+			len = FLASH_WB_CHUNK_SIZE;
+		if (len > 0) {
+			lfs_ssize_t wrote = lfs_file_write(&lfs, &wb_file, e->buf + wb_pos, len);
+			if (wrote < (lfs_ssize_t)len) {
+				lfs_file_close(&lfs, &wb_file);
+				if (!e->append)
+					lfs_remove(&lfs, wb_tmpname);
+				flash_wb_done(-3);
+				break;
+			}
+			wb_pos += len;
+		}
+		if (wb_pos >= e->size)
+			wb_stage = WB_CLOSE;
+		break;
+
+	case WB_CLOSE:
+		if ((res = lfs_file_close(&lfs, &wb_file)) != LFS_ERR_OK) {
+			if (!e->append)
+				lfs_remove(&lfs, wb_tmpname);
+			flash_wb_done(-4);
+			break;
+		}
+		if (e->append) {
+			flash_wb_done(0);
+			break;
+		}
+		wb_stage = WB_RENAME;
+		break;
+
+	case WB_RENAME:
+		/* Rename is atomic (and replaces existing file) in LittleFS */
+		res = lfs_rename(&lfs, wb_tmpname, e->name);
+		if (res != LFS_ERR_OK)
+			lfs_remove(&lfs, wb_tmpname);
+		flash_wb_done(res != LFS_ERR_OK ? -5 : 0);
+		break;
+	}
+
+	return (wb_count > 0);
+}
+
+
+/* Complete all pending (write-behind) file writes. */
+static void flash_wb_drain()
+{
+	while (flash_poll()) {
+#if WATCHDOG_ENABLED
+		watchdog_update();
+#endif
+	}
+}
+
+
+/* Complete all pending (write-behind) file writes.
+ * Returns 0 if all writes completed successfully, or the first error
+ * seen since last call. */
+int flash_flush()
+{
+	int res;
+
+	flash_wb_drain();
+	res = wb_error;
+	wb_error = 0;
+
+	return res;
+}
+
+
+/* Flush pending write of given file, if any. */
+static void flash_flush_file(const char *filename)
+{
+	for (int i = 0; i < wb_count; i++) {
+		if (!strncmp(wb_queue[i].name, filename, sizeof(wb_queue[i].name))) {
+			flash_wb_drain();
+			return;
+		}
 	}
 }
 
@@ -71,12 +404,9 @@ int flash_read_file(char **bufptr, uint32_t *sizeptr, const char *filename)
 	*bufptr = NULL;
 	*sizeptr = 0;
 
-	/* Mount flash filesystem... */
-	if ((res = lfs_mount(&lfs, lfs_cfg)) != LFS_ERR_OK) {
-		log_msg(LOG_NOTICE, "lfs_mount() failed: %d", res);
+	if (!lfs_mounted)
 		return -1;
-	}
-	log_msg(LOG_DEBUG, "Filesystem mounted OK");
+	flash_flush_file(filename);
 
 	res = 0;
 
@@ -107,48 +437,97 @@ int flash_read_file(char **bufptr, uint32_t *sizeptr, const char *filename)
 		}
 		lfs_file_close(&lfs, &lfs_file);
 	}
-	lfs_unmount(&lfs);
 
 	return res;
 }
 
 
-int flash_write_file(const char *buf, uint32_t size, const char *filename)
+static int flash_queue_write(const char *buf, uint32_t size, const char *filename,
+			bool append, uint32_t after, flash_write_cb_t done)
 {
-	int res;
+	struct flash_wb_entry *e = NULL;
+	char *copy;
+	int i;
 
 	if (!buf || !filename)
 		return -42;
-
-	/* Mount flash filesystem... */
-	if ((res = lfs_mount(&lfs, lfs_cfg)) != LFS_ERR_OK) {
-		log_msg(LOG_ERR, "lfs_mount() failed: %d", res);
+	if (!lfs_mounted)
 		return -1;
-	}
+	if (strlen(filename) + strlen(FLASH_WB_TMP_SUFFIX) > LFS_NAME_MAX)
+		return -2;
 
-	/* Create file */
-	if ((res = lfs_file_open(&lfs, &lfs_file, filename, LFS_O_WRONLY | LFS_O_CREAT)) != LFS_ERR_OK) {
-		log_msg(LOG_ERR, "Failed to create file \"%s\": %d", filename, res);
-		res = -2;
-	} else {
-		/* Write to file */
-		lfs_size_t wrote = lfs_file_write(&lfs, &lfs_file, buf, size);
-		if (wrote < size) {
-			log_msg(LOG_ERR, "Failed to write to file \"%s\": %li",
-				filename, wrote);
-			res = -3;
-		} else {
-			log_msg(LOG_INFO, "File \"%s\" successfully created: %li bytes",
-				filename, wrote);
-			res = 0;
+	if (!(copy = malloc(size > 0 ? size : 1))) {
+		log_msg(LOG_ALERT, "Not enough memory to write file \"%s\": %lu",
+			filename, size);
+		return -4;
+	}
+	memcpy(copy, buf, size);
+
+	/* Replace data of the last queued write of this file, if it has not
+	 * been started yet (and is not an append)... */
+	for (i = (int)wb_count - 1; i >= 0 && !append; i--) {
+		if (!strncmp(wb_queue[i].name, filename, sizeof(wb_queue[i].name))) {
+			if (!wb_queue[i].append && !wb_queue[i].done
+				&& (i > 0 || wb_stage == WB_IDLE)) {
+				e = &wb_queue[i];
+				free(e->buf);
+			}
+			break;
 		}
-		lfs_file_close(&lfs, &lfs_file);
 	}
+	if (!e) {
+		/* Make room in the queue if needed... */
+		if (wb_count >= FLASH_WB_QUEUE_LEN)
+			flash_wb_drain();
+		e = &wb_queue[wb_count++];
+		strncopy(e->name, filename, sizeof(e->name));
+	}
+	e->seq = wb_seq++;
+	e->buf = copy;
+	e->size = size;
+	e->append = append;
+	e->after = after;
+	e->done = done;
+	log_msg(LOG_DEBUG, "File \"%s\" queued for %s: %lu bytes", filename,
+		(append ? "append" : "writing"), size);
+
+	return FLASH_WRITE_QUEUED;
+}
 
-	/* Unmount flash filesystem */
-	lfs_unmount(&lfs);
 
-	return res;
+/* Queue file to be written (in the background). Data is copied, so
+ * caller is free to release buffer immediately.
+ * Returns FLASH_WRITE_QUEUED, or < 0 on error. Use flash_flush()
+ * to wait for the write to complete (and to check for errors). */
+int flash_write_file(const char *buf, uint32_t size, const char *filename)
+{
+	return flash_queue_write(buf, size, filename, false, 0, NULL);
+}
+
+
+/* Queue file to be written (in the background) after the writes queued
+ * since flash_write_seq() returned 'after'. If any of those writes fail,
+ * this write is skipped. Result of the write is passed to 'done'
+ * (called from flash_poll()) instead of flash_flush().
+ * Returns FLASH_WRITE_QUEUED, or < 0 on error ('done' is not called). */
+int flash_write_file_after(const char *buf, uint32_t size, const char *filename,
+			uint32_t after, flash_write_cb_t done)
+{
+	return flash_queue_write(buf, size, filename, false, after, done);
+}
+
+
+/* Return sequence number that the next queued write will get. */
+uint32_t flash_write_seq()
+{
+	return wb_seq;
+}
+
+
+/* Queue data to be appended to a file (in the background). */
+int flash_append_file(const char *buf, uint32_t size, const char *filename)
+{
+	return flash_queue_write(buf, size, filename, true, 0, NULL);
 }
 
 
@@ -160,12 +539,9 @@ int flash_delete_file(const char *filename)
 
 	if (!filename)
 		return -42;
-
-	/* Mount flash filesystem... */
-	if ((res = lfs_mount(&lfs, lfs_cfg)) != LFS_ERR_OK) {
-		log_msg(LOG_ERR, "lfs_mount() failed: %d", res);
+	if (!lfs_mounted)
 		return -1;
-	}
+	flash_flush_file(filename);
 
 	/* Check if file exists... */
 	if ((res = lfs_stat(&lfs, filename, &stat)) != LFS_ERR_OK) {
@@ -180,7 +556,6 @@ int flash_delete_file(const char *filename)
 			ret = -3;
 		}
 	}
-	lfs_unmount(&lfs);
 
 	return ret;
 }
@@ -273,11 +648,9 @@ int flash_get_fs_info(size_t *size, size_t *free, size_t *files,
 	if (!size || !free)
 		return -1;
 
-	/* Mount flash filesystem... */
-	if ((res = lfs_mount(&lfs, lfs_cfg)) != LFS_ERR_OK) {
-		log_msg(LOG_ERR, "lfs_mount() failed: %d", res);
+	if (!lfs_mounted)
 		return -2;
-	}
+	flash_wb_drain();
 
 	used_blocks = lfs_fs_size(&lfs);
 	used = used_blocks * lfs_cfg->block_size;
@@ -297,8 +670,6 @@ int flash_get_fs_info(size_t *size, size_t *free, size_t *files,
 	if (filesizetotal)
 		*filesizetotal = fs_total;
 
-	lfs_unmount(&lfs);
-
 	return 0;
 }
 
@@ -0,0 +1,445 @@
+/* history.c
+   Copyright (C) 2021-2024 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of FanPico.
+
+   FanPico is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   FanPico is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with FanPico. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "pico/stdlib.h"
+
+#include "fanpico.h"
+
+
+/*
+ * On-device history of measurements (temperatures, fan speeds, duty cycles).
+ *
+ * History is kept in RAM at three resolutions:
+ *
+ *  - 1 second samples, stored in a byte ring buffer. Each sample (frame)
+ *    is stored as zigzag/varint encoded deltas from previous frame, with
+ *    a keyframe (absolute values) every HISTORY_KEYFRAME_INTERVAL frames.
+ *    Oldest frames are dropped as needed (ring always starts from
+ *    a keyframe).
+ *
+ *  - 1 minute and 1 hour rollups (min/avg/max of every channel).
+ *
+ * Values are stored as fixed point integers with one decimal.
+ */
+
+#define HISTORY_RAW_SIZE           4096
+#define HISTORY_KEYFRAME_INTERVAL  60
+#define HISTORY_MINUTES            60
+#define HISTORY_HOURS              24
+#define HISTORY_SCALE              10
+/* Worst case frame size: length + header + values (int32 varints) */
+#define HISTORY_FRAME_MAX ((2 + HISTORY_CHANNELS) * 5)
+
+struct history_rollup {
+	uint32_t t;
+	int16_t min[HISTORY_CHANNELS];
+	int16_t avg[HISTORY_CHANNELS];
+	int16_t max[HISTORY_CHANNELS];
+};
+
+struct history_acc {
+	uint32_t t;
+	uint32_t count;
+	int32_t min[HISTORY_CHANNELS];
+	int32_t max[HISTORY_CHANNELS];
+	int32_t sum[HISTORY_CHANNELS];
+};
+
+/* 1 second samples */
+static uint8_t raw_buf[HISTORY_RAW_SIZE];
+static uint32_t raw_head = 0;
+static uint32_t raw_tail = 0;
+static uint32_t raw_used = 0;
+static uint32_t raw_frames = 0;
+static uint32_t raw_first_seq = 0;
+static uint32_t raw_since_key = 0;
+static uint32_t raw_last_t = 0;
+static int32_t raw_prev[HISTORY_CHANNELS];
+
+/* Rollups */
+static struct history_rollup hist_min[HISTORY_MINUTES];
+static struct history_rollup hist_hour[HISTORY_HOURS];
+static uint32_t hist_min_count = 0;
+static uint32_t hist_hour_count = 0;
+static struct history_acc acc_min;
+static struct history_acc acc_hour;
+
+
+static inline uint32_t zigzag_encode(int32_t v)
+{
+	return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t zigzag_decode(uint32_t v)
+{
+	return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+static uint put_varint(uint8_t *buf, uint32_t v)
+{
+	uint len = 0;
+
+	while (v >= 0x80) {
+		buf[len++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	buf[len++] = v;
+
+	return len;
+}
+
+static uint32_t ring_get_varint(uint32_t *pos)
+{
+	uint32_t v = 0;
+	uint shift = 0;
+	uint8_t b;
+
+	do {
+		b = raw_buf[*pos];
+		*pos = (*pos + 1) % HISTORY_RAW_SIZE;
+		v |= (uint32_t)(b & 0x7f) << shift;
+		shift += 7;
+	} while ((b & 0x80) && shift < 35);
+
+	return v;
+}
+
+static void raw_evict_frame()
+{
+	uint32_t pos = raw_tail;
+	uint32_t len = ring_get_varint(&pos);
+	uint32_t size = len + (pos + HISTORY_RAW_SIZE - raw_tail) % HISTORY_RAW_SIZE;
+
+	raw_tail = (raw_tail + size) % HISTORY_RAW_SIZE;
+	raw_used -= size;
+	raw_frames--;
+	raw_first_seq++;
+}
+
+static bool raw_tail_is_keyframe()
+{
+	uint32_t pos = raw_tail;
+
+	ring_get_varint(&pos);
+	return (ring_get_varint(&pos) & 1);
+}
+
+static void raw_add_frame(uint32_t t, const int32_t *val)
+{
+	uint8_t frame[HISTORY_FRAME_MAX];
+	uint8_t hdr[5];
+	uint len, hlen, i;
+	bool key;
+
+	/* Make room for new frame, ring must always start with a keyframe. */
+	while (raw_frames > 0 && raw_used + HISTORY_FRAME_MAX > HISTORY_RAW_SIZE)
+		raw_evict_frame();
+	while (raw_frames > 0 && !raw_tail_is_keyframe())
+		raw_evict_frame();
+
+	key = (raw_frames == 0 || raw_since_key >= HISTORY_KEYFRAME_INTERVAL);
+
+	len = put_varint(frame, (key ? (t << 1) | 1 : (t - raw_last_t) << 1));
+	for (i = 0; i < HISTORY_CHANNELS; i++) {
+		int32_t delta = (key ? val[i] : val[i] - raw_prev[i]);
+		len += put_varint(&frame[len], zigzag_encode(delta));
+		raw_prev[i] = val[i];
+	}
+	hlen = put_varint(hdr, len);
+
+	for (i = 0; i < hlen; i++) {
+		raw_buf[raw_head] = hdr[i];
+		raw_head = (raw_head + 1) % HISTORY_RAW_SIZE;
+	}
+	for (i = 0; i < len; i++) {
+		raw_buf[raw_head] = frame[i];
+		raw_head = (raw_head + 1) % HISTORY_RAW_SIZE;
+	}
+	raw_used += hlen + len;
+	raw_frames++;
+	raw_since_key = (key ? 1 : raw_since_key + 1);
+	raw_last_t = t;
+}
+
+
+static void acc_reset(struct history_acc *acc, uint32_t t)
+{
+	acc->t = t;
+	acc->count = 0;
+	for (int i = 0; i < HISTORY_CHANNELS; i++) {
+		acc->min[i] = INT32_MAX;
+		acc->max[i] = INT32_MIN;
+		acc->sum[i] = 0;
+	}
+}
+
+static void acc_add(struct history_acc *acc, int i, int32_t min, int32_t max, int32_t avg)
+{
+	if (min < acc->min[i])
+		acc->min[i] = min;
+	if (max > acc->max[i])
+		acc->max[i] = max;
+	acc->sum[i] += avg;
+}
+
+static inline int16_t clamp16(int32_t v)
+{
+	return (v > INT16_MAX ? INT16_MAX : (v < INT16_MIN ? INT16_MIN : v));
+}
+
+static void acc_store(const struct history_acc *acc, struct history_rollup *r)
+{
+	r->t = acc->t;
+	for (int i = 0; i < HISTORY_CHANNELS; i++) {
+		r->min[i] = clamp16(acc->min[i]);
+		r->max[i] = clamp16(acc->max[i]);
+		r->avg[i] = clamp16(acc->sum[i] / (int32_t)acc->count);
+	}
+}
+
+
+/* Record new sample of current state (called once per second).
+ */
+void history_update(const struct fanpico_state *state)
+{
+	int32_t val[HISTORY_CHANNELS];
+	uint32_t t = to_us_since_boot(get_absolute_time()) / 1000000;
+	int i, c = 0;
+
+	for (i = 0; i < SENSOR_COUNT; i++)
+		val[c++] = lroundf(state->temp[i] * HISTORY_SCALE);
+	for (i = 0; i < VSENSOR_COUNT; i++)
+		val[c++] = lroundf(state->vtemp[i] * HISTORY_SCALE);
+	for (i = 0; i < FAN_COUNT; i++)
+		val[c++] = lroundf(state->fan_freq[i] * HISTORY_SCALE);
+	for (i = 0; i < FAN_COUNT; i++)
+		val[c++] = lroundf(state->fan_duty[i] * HISTORY_SCALE);
+	for (i = 0; i < MBFAN_COUNT; i++)
+		val[c++] = lroundf(state->mbfan_duty[i] * HISTORY_SCALE);
+	for (i = 0; i < MBFAN_COUNT; i++)
+		val[c++] = lroundf(state->mbfan_freq[i] * HISTORY_SCALE);
+
+	raw_add_frame(t, val);
+
+	/* 1 minute rollup */
+	if (acc_min.count > 0 && t / 60 != acc_min.t / 60) {
+		struct history_rollup *r = &hist_min[hist_min_count % HISTORY_MINUTES];
+
+		acc_store(&acc_min, r);
+		hist_min_count++;
+
+		/* 1 hour rollup (from minute rollups) */
+		if (acc_hour.count > 0 && r->t / 3600 != acc_hour.t / 3600) {
+			acc_store(&acc_hour, &hist_hour[hist_hour_count % HISTORY_HOURS]);
+			hist_hour_count++;
+			acc_hour.count = 0;
+		}
+		if (acc_hour.count == 0)
+			acc_reset(&acc_hour, r->t);
+		for (i = 0; i < HISTORY_CHANNELS; i++)
+			acc_add(&acc_hour, i, r->min[i], r->max[i], r->avg[i]);
+		acc_hour.count++;
+
+		acc_min.count = 0;
+	}
+	if (acc_min.count == 0)
+		acc_reset(&acc_min, t);
+	for (i = 0; i < HISTORY_CHANNELS; i++)
+		acc_add(&acc_min, i, val[i], val[i], val[i]);
+	acc_min.count++;
+}
+
+
+int str2history_res(const char *s)
+{
+	if (!s || !strncasecmp(s, "MIN", 3))
+		return HISTORY_MIN;
+	if (!strncasecmp(s, "SEC", 3))
+		return HISTORY_SEC;
+	if (!strncasecmp(s, "HOUR", 4))
+		return HISTORY_HOUR;
+	return -1;
+}
+
+
+static int history_channel_name(int ch, char *buf, size_t size)
+{
+	if (ch < SENSOR_COUNT)
+		return snprintf(buf, size, "sensor%d", ch + 1);
+	ch -= SENSOR_COUNT;
+	if (ch < VSENSOR_COUNT)
+		return snprintf(buf, size, "vsensor%d", ch + 1);
+	ch -= VSENSOR_COUNT;
+	if (ch < FAN_COUNT)
+		return snprintf(buf, size, "fan%d_freq", ch + 1);
+	ch -= FAN_COUNT;
+	if (ch < FAN_COUNT)
+		return snprintf(buf, size, "fan%d_duty", ch + 1);
+	ch -= FAN_COUNT;
+	if (ch < MBFAN_COUNT)
+		return snprintf(buf, size, "mbfan%d_duty", ch + 1);
+	ch -= MBFAN_COUNT;
+	return snprintf(buf, size, "mbfan%d_freq", ch + 1);
+}
+
+
+static bool history_raw_decode(struct history_iter *it)
+{
+	uint32_t hdr;
+	int i;
+
+	if (it->seq < raw_first_seq || it->seq >= raw_first_seq + raw_frames)
+		return false;
+
+	ring_get_varint(&it->pos);
+	hdr = ring_get_varint(&it->pos);
+	if (hdr & 1) {
+		it->t = hdr >> 1;
+		for (i = 0; i < HISTORY_CHANNELS; i++)
+			it->val[i] = zigzag_decode(ring_get_varint(&it->pos));
+	} else {
+		it->t += hdr >> 1;
+		for (i = 0; i < HISTORY_CHANNELS; i++)
+			it->val[i] += zigzag_decode(ring_get_varint(&it->pos));
+	}
+	it->seq++;
+
+	return true;
+}
+
+
+static const struct history_rollup* history_rollup_entry(const struct history_iter *it)
+{
+	if (it->res == HISTORY_MIN) {
+		if (it->idx + HISTORY_MINUTES < hist_min_count || it->idx >= hist_min_count)
+			return NULL;
+		return &hist_min[it->idx % HISTORY_MINUTES];
+	} else {
+		if (it->idx + HISTORY_HOURS < hist_hour_count || it->idx >= hist_hour_count)
+			return NULL;
+		return &hist_hour[it->idx % HISTORY_HOURS];
+	}
+}
+
+
+/* Initialize iterator for outputting (count latest) history entries
+ * in CSV format. If count is 0, all available entries are output.
+ */
+void history_iter_init(struct history_iter *it, enum history_resolution res, uint32_t count)
+{
+	uint32_t total, avail;
+
+	if (res == HISTORY_SEC) {
+		total = raw_first_seq + raw_frames;
+		avail = raw_frames;
+	} else if (res == HISTORY_MIN) {
+		total = hist_min_count;
+		avail = MIN(hist_min_count, HISTORY_MINUTES);
+	} else {
+		total = hist_hour_count;
+		avail = MIN(hist_hour_count, HISTORY_HOURS);
+	}
+	if (count > 0 && count < avail)
+		avail = count;
+
+	memset(it, 0, sizeof(*it));
+	it->res = res;
+	it->header = true;
+	it->ch = -1;
+	it->end = total;
+	it->idx = total - avail;
+	it->pos = raw_tail;
+	it->seq = raw_first_seq;
+}
+
+
+/* Output next fragment (column) of history CSV output into buf.
+ * Returns length of output or 0 when there is no more output.
+ */
+int history_iter_next(struct history_iter *it, char *buf, size_t size)
+{
+	const struct history_rollup *r;
+	int ch = it->ch;
+	int len;
+
+	if (it->header) {
+		if (ch < 0) {
+			it->ch = 0;
+			return snprintf(buf, size, "time");
+		}
+		if (ch < HISTORY_CHANNELS) {
+			it->ch++;
+			buf[0] = ',';
+			len = 1 + history_channel_name(ch, buf + 1, size - 1);
+			if (it->res != HISTORY_SEC) {
+				len += snprintf(buf + len, size - len, "_min,");
+				len += history_channel_name(ch, buf + len, size - len);
+				len += snprintf(buf + len, size - len, "_avg,");
+				len += history_channel_name(ch, buf + len, size - len);
+				len += snprintf(buf + len, size - len, "_max");
+			}
+			return len;
+		}
+		it->header = false;
+		it->ch = -1;
+		return snprintf(buf, size, "\n");
+	}
+
+	if (it->idx >= it->end)
+		return 0;
+
+	if (ch < 0) {
+		if (it->res == HISTORY_SEC) {
+			while (it->seq <= it->idx) {
+				if (!history_raw_decode(it))
+					return 0;
+			}
+		} else {
+			if (!(r = history_rollup_entry(it)))
+				return 0;
+			it->t = r->t;
+		}
+		it->ch = 0;
+		return snprintf(buf, size, "%lu", it->t);
+	}
+
+	if (ch < HISTORY_CHANNELS) {
+		it->ch++;
+		if (it->res == HISTORY_SEC)
+			return snprintf(buf, size, ",%.1f", (float)it->val[ch] / HISTORY_SCALE);
+		if (!(r = history_rollup_entry(it)))
+			return 0;
+		return snprintf(buf, size, ",%.1f,%.1f,%.1f",
+				(float)r->min[ch] / HISTORY_SCALE,
+				(float)r->avg[ch] / HISTORY_SCALE,
+				(float)r->max[ch] / HISTORY_SCALE);
+	}
+
+	it->ch = -1;
+	it->idx++;
+	return snprintf(buf, size, "\n");
+}
+
+
+/* eof :-) */
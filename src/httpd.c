@@ -25,218 +25,491 @@
 #include <assert.h>
 #include "hardware/rtc.h"
 #include "pico/stdlib.h"
-#include "cJSON.h"
+#include "lwip/apps/fs.h"
+#include "lwip/apps/httpd.h"
 
 #include "fanpico.h"
 
 
-#define BUF_LEN 1024
-
-u16_t csv_stats(char *insert, int insertlen, u16_t current_tag_part, u16_t *next_tag_part)
+void csv_status(struct sw_writer *w, const struct fanpico_state *st)
 {
-	const struct fanpico_state *st = fanpico_state;
-	static char *buf = NULL;
-	static char *p;
-	static u16_t part;
-	static size_t buf_left;
-	char row[128];
 	double rpm, pwm;
 	int i;
-	size_t printed, count;
 
-	if (current_tag_part == 0) {
-		/* Generate 'output' into a buffer that then will be fed in chunks to LwIP... */
-		if (!(buf = malloc(BUF_LEN)))
-			return 0;
-		buf[0] = 0;
-
-		for (i = 0; i < FAN_COUNT; i++) {
-			rpm = st->fan_freq[i] * 60 / cfg->fans[i].rpm_factor;
-			snprintf(row, sizeof(row), "fan%d,\"%s\",%.0lf,%.2f,%.1f\n",
-				i+1,
-				cfg->fans[i].name,
-				rpm,
-				st->fan_freq[i],
-				st->fan_duty[i]);
-			strncatenate(buf, row, BUF_LEN);
-		}
-		for (i = 0; i < MBFAN_COUNT; i++) {
-			rpm = st->mbfan_freq[i] * 60 / cfg->mbfans[i].rpm_factor;
-			snprintf(row, sizeof(row), "mbfan%d,\"%s\",%.0lf,%.2f,%.1f\n",
-				i+1,
-				cfg->mbfans[i].name,
-				rpm,
-				st->mbfan_freq[i],
-				st->mbfan_duty[i]);
-			strncatenate(buf, row, BUF_LEN);
-		}
-		for (i = 0; i < SENSOR_COUNT; i++) {
-			pwm = sensor_get_duty(&cfg->sensors[i].map, st->temp[i]);
-			snprintf(row, sizeof(row), "sensor%d,\"%s\",%.1lf,%.1lf\n",
-				i+1,
-				cfg->sensors[i].name,
-				st->temp[i],
-				pwm);
-			strncatenate(buf, row, BUF_LEN);
-		}
-		for (i = 0; i < VSENSOR_COUNT; i++) {
-			pwm = sensor_get_duty(&cfg->vsensors[i].map, st->vtemp[i]);
-			snprintf(row, sizeof(row), "vsensor%d,\"%s\",%.1lf,%.1lf\n",
-				i+1,
-				cfg->vsensors[i].name,
-				st->vtemp[i],
-				pwm);
-			strncatenate(buf, row, BUF_LEN);
-		}
+	for (i = 0; i < FAN_COUNT && !sw_full(w); i++) {
+		rpm = st->fan_freq[i] * 60 / cfg->fans[i].rpm_factor;
+		sw_printf(w, "fan%d,\"", i + 1);
+		sw_puts(w, cfg->fans[i].name);
+		sw_printf(w, "\",%.0lf,%.2f,%.1f\n",
+			rpm,
+			st->fan_freq[i],
+			st->fan_duty[i]);
+	}
+	for (i = 0; i < MBFAN_COUNT && !sw_full(w); i++) {
+		rpm = st->mbfan_freq[i] * 60 / cfg->mbfans[i].rpm_factor;
+		sw_printf(w, "mbfan%d,\"", i + 1);
+		sw_puts(w, cfg->mbfans[i].name);
+		sw_printf(w, "\",%.0lf,%.2f,%.1f\n",
+			rpm,
+			st->mbfan_freq[i],
+			st->mbfan_duty[i]);
+	}
+	for (i = 0; i < SENSOR_COUNT && !sw_full(w); i++) {
+		pwm = sensor_get_duty(&cfg->sensors[i].map, st->temp[i]);
+		sw_printf(w, "sensor%d,\"", i + 1);
+		sw_puts(w, cfg->sensors[i].name);
+		sw_printf(w, "\",%.1lf,%.1lf\n",
+			st->temp[i],
+			pwm);
+	}
+	for (i = 0; i < VSENSOR_COUNT && !sw_full(w); i++) {
+		pwm = sensor_get_duty(&cfg->vsensors[i].map, st->vtemp[i]);
+		sw_printf(w, "vsensor%d,\"", i + 1);
+		sw_puts(w, cfg->vsensors[i].name);
+		sw_printf(w, "\",%.1lf,%.1lf\n",
+			st->vtemp[i],
+			pwm);
+	}
+}
+
 
-		p = buf;
-		buf_left = strlen(buf);
-		part = 1;
+/* Generate status JSON, performance counters are taken from 'perf'
+   (snapshot of all PERF_PROBE_COUNT counters), or if NULL from live counters. */
+static void json_status_perf(struct sw_writer *w, const struct fanpico_state *st,
+			const struct perf_counter *perf)
+{
+	struct perf_counter c;
+	double rpm, pwm;
+	int i, j;
+
+	sw_json_begin(w, NULL, '{');
+
+	/* Fans */
+	sw_json_begin(w, "fans", '[');
+	for (i = 0; i < FAN_COUNT && !sw_full(w); i++) {
+		rpm = st->fan_freq[i] * 60 / cfg->fans[i].rpm_factor;
+		sw_json_begin(w, NULL, '{');
+		sw_json_int(w, "fan", i + 1);
+		sw_json_string(w, "name", cfg->fans[i].name);
+		sw_json_float(w, "rpm", rpm, 0);
+		sw_json_float(w, "frequency", st->fan_freq[i], 2);
+		sw_json_float(w, "duty_cycle", st->fan_duty[i], 1);
+		sw_json_end(w, '}');
+	}
+	sw_json_end(w, ']');
+
+	/* MB Fans */
+	sw_json_begin(w, "mbfans", '[');
+	for (i = 0; i < MBFAN_COUNT && !sw_full(w); i++) {
+		rpm = st->mbfan_freq[i] * 60 / cfg->mbfans[i].rpm_factor;
+		sw_json_begin(w, NULL, '{');
+		sw_json_int(w, "mbfan", i + 1);
+		sw_json_string(w, "name", cfg->mbfans[i].name);
+		sw_json_float(w, "rpm", rpm, 0);
+		sw_json_float(w, "frequency", st->mbfan_freq[i], 2);
+		sw_json_float(w, "duty_cycle", st->mbfan_duty[i], 1);
+		sw_json_end(w, '}');
+	}
+	sw_json_end(w, ']');
+
+	/* Sensors */
+	sw_json_begin(w, "sensors", '[');
+	for (i = 0; i < SENSOR_COUNT && !sw_full(w); i++) {
+		pwm = sensor_get_duty(&cfg->sensors[i].map, st->temp[i]);
+		sw_json_begin(w, NULL, '{');
+		sw_json_int(w, "sensor", i + 1);
+		sw_json_string(w, "name", cfg->sensors[i].name);
+		sw_json_float(w, "temperature", st->temp[i], 1);
+		sw_json_float(w, "duty_cycle", pwm, 1);
+		sw_json_end(w, '}');
+	}
+	sw_json_end(w, ']');
+
+	/* Virtual Sensors */
+	sw_json_begin(w, "vsensors", '[');
+	for (i = 0; i < VSENSOR_COUNT && !sw_full(w); i++) {
+		pwm = sensor_get_duty(&cfg->vsensors[i].map, st->vtemp[i]);
+		sw_json_begin(w, NULL, '{');
+		sw_json_int(w, "sensor", i + 1);
+		sw_json_string(w, "name", cfg->vsensors[i].name);
+		sw_json_float(w, "temperature", st->vtemp[i], 1);
+		sw_json_float(w, "duty_cycle", pwm, 1);
+		sw_json_end(w, '}');
+	}
+	sw_json_end(w, ']');
+
+	/* Performance counters */
+	sw_json_begin(w, "perf", '[');
+	for (i = 0; i < PERF_PROBE_COUNT && !sw_full(w); i++) {
+		if (perf)
+			c = perf[i];
+		else if (perf_get(i, &c))
+			continue;
+		sw_json_begin(w, NULL, '{');
+		sw_json_string(w, "probe", c.name);
+		sw_json_int(w, "core", c.core);
+		sw_json_int(w, "count", c.count);
+		sw_json_float(w, "mean_us",
+			(c.count > 0 ? perf_cycles_to_us(c.total / c.count) : 0), 1);
+		sw_json_float(w, "max_us", perf_cycles_to_us(c.max), 1);
+		sw_json_begin(w, "histogram", '[');
+		for (j = 0; j < PERF_HIST_BUCKETS; j++)
+			sw_json_int(w, NULL, c.hist[j]);
+		sw_json_end(w, ']');
+		sw_json_end(w, '}');
 	}
+	sw_json_end(w, ']');
+
+	sw_json_end(w, '}');
+}
+
+void json_status(struct sw_writer *w, const struct fanpico_state *st)
+{
+	json_status_perf(w, st, NULL);
+}
+
 
-	/* Copy a part of the multi-part response into LwIP buffer ...*/
-	count = (buf_left < insertlen - 1 ? buf_left : insertlen - 1);
-	memcpy(insert, p, count);
+/* Per connection SSI state...
+ *
+ * Each (SSI processed) status/history file gets its own state when file
+ * is opened by httpd, and state is released when file is closed (also when
+ * client aborts the connection). This allows multiple clients to fetch
+ * pages at the same time. State contains a snapshot of system state (and
+ * for JSON files, of performance counters) taken when request started, so
+ * all parts of a response are generated from same (consistent) data.
+ *
+ * States are allocated from a small static pool. If pool is exhausted,
+ * status outputs are generated from live state (output offset is derived
+ * from part number, so this still works) and history is not available.
+ */
+
+#define HTTPD_SSI_STATE_POOL 4
+#define HTTPD_HISTORY_FRAG_LEN 64
+
+struct httpd_ssi_state {
+	bool in_use;
+	struct fanpico_state st;
+	union {
+		/* csv_history() */
+		struct {
+			struct history_iter hist;
+			int hist_res;
+			char frag[HTTPD_HISTORY_FRAG_LEN];
+			int frag_len;
+			int frag_pos;
+		};
+		/* json_status_perf() */
+		struct perf_counter perf[PERF_PROBE_COUNT];
+	};
+};
+
+static struct httpd_ssi_state ssi_state_pool[HTTPD_SSI_STATE_POOL];
+
+
+static bool httpd_ssi_state_needed(const char *name)
+{
+	const char *ext;
+
+	if (!name || !(ext = strrchr(name, '.')))
+		return false;
+	return (!strcmp(ext, ".json") || !strcmp(ext, ".csv"));
+}
+
+
+void *fs_state_init(struct fs_file *file, const char *name)
+{
+	struct httpd_ssi_state *s = NULL;
 
-	p += count;
-	printed = count;
-	buf_left -= count;
+	if (!httpd_ssi_state_needed(name))
+		return NULL;
 
-	if (buf_left > 0) {
-		*next_tag_part = part++;
+	for (int i = 0; i < HTTPD_SSI_STATE_POOL; i++) {
+		if (!ssi_state_pool[i].in_use) {
+			s = &ssi_state_pool[i];
+			break;
+		}
+	}
+	if (!s) {
+		log_msg(LOG_DEBUG, "httpd: no free SSI state for %s", name);
+		return NULL;
+	}
+
+	s->in_use = true;
+	copy_system_state(&s->st);
+	if (!strcmp(strrchr(name, '.'), ".json")) {
+		for (int i = 0; i < PERF_PROBE_COUNT; i++)
+			perf_get(i, &s->perf[i]);
 	} else {
-		free(buf);
-		buf = p = NULL;
+		s->frag_len = s->frag_pos = 0;
 	}
 
-	return printed;
+	return s;
 }
 
 
-u16_t json_stats(char *insert, int insertlen, u16_t current_tag_part, u16_t *next_tag_part)
+void fs_state_free(struct fs_file *file, void *state)
 {
-	const struct fanpico_state *st = fanpico_state;
-	cJSON *json = NULL;
-	static char *buf = NULL;
-	static char *p;
-	static u16_t part;
-	static size_t buf_left;
-	int i;
-	size_t printed, count;
+	struct httpd_ssi_state *s = state;
 
-	if (current_tag_part == 0) {
-		/* Generate 'output' into a buffer that then will be fed in chunks to LwIP... */
-		cJSON *array, *o;
+	if (!s)
+		return;
+	s->in_use = false;
+}
 
-		if (!(json = cJSON_CreateObject()))
-			goto panic;
 
-		/* Fans */
-		if (!(array = cJSON_CreateArray()))
-			goto panic;
-		for (i = 0; i < FAN_COUNT; i++) {
-			double rpm = st->fan_freq[i] * 60 / cfg->fans[i].rpm_factor;
+/* Every part (except last one) is exactly insertlen - 1 bytes, so
+   offset into the output can be derived from the part number. */
+static void sw_ssi_init(struct sw_writer *w, char *insert, int insertlen, u16_t current_tag_part)
+{
+	sw_init(w, insert, insertlen, (size_t)current_tag_part * (insertlen - 1));
+}
 
-			if (!(o = cJSON_CreateObject()))
-				goto panic;
+static u16_t sw_ssi_finish(struct sw_writer *w, u16_t current_tag_part, u16_t *next_tag_part)
+{
+	if (sw_full(w))
+		*next_tag_part = current_tag_part + 1;
 
-			cJSON_AddItemToObject(o, "fan", cJSON_CreateNumber(i+1));
-			cJSON_AddItemToObject(o, "name", cJSON_CreateString(cfg->fans[i].name));
-			cJSON_AddItemToObject(o, "rpm", cJSON_CreateNumber(round_decimal(rpm, 0)));
-			cJSON_AddItemToObject(o, "frequency", cJSON_CreateNumber(round_decimal(st->fan_freq[i], 2)));
-			cJSON_AddItemToObject(o, "duty_cycle", cJSON_CreateNumber(round_decimal(st->fan_duty[i], 1)));
-			cJSON_AddItemToArray(array, o);
-		}
-		cJSON_AddItemToObject(json, "fans", array);
+	return sw_finish(w);
+}
 
-		/* MB Fans */
-		if (!(array = cJSON_CreateArray()))
-			goto panic;
-		for (i = 0; i < MBFAN_COUNT; i++) {
-			double rpm = st->mbfan_freq[i] * 60 / cfg->mbfans[i].rpm_factor;
+static u16_t sw_ssi_part(void (*generate)(struct sw_writer *w, const struct fanpico_state *st),
+			const struct fanpico_state *st,
+			char *insert, int insertlen, u16_t current_tag_part, u16_t *next_tag_part)
+{
+	struct sw_writer w;
 
-			if (!(o = cJSON_CreateObject()))
-				goto panic;
+	sw_ssi_init(&w, insert, insertlen, current_tag_part);
+	generate(&w, st);
 
-			cJSON_AddItemToObject(o, "mbfan", cJSON_CreateNumber(i+1));
-			cJSON_AddItemToObject(o, "name", cJSON_CreateString(cfg->mbfans[i].name));
-			cJSON_AddItemToObject(o, "rpm", cJSON_CreateNumber(round_decimal(rpm, 0)));
-			cJSON_AddItemToObject(o, "frequency", cJSON_CreateNumber(round_decimal(st->mbfan_freq[i], 2)));
-			cJSON_AddItemToObject(o, "duty_cycle", cJSON_CreateNumber(round_decimal(st->mbfan_duty[i], 1)));
-			cJSON_AddItemToArray(array, o);
-		}
-		cJSON_AddItemToObject(json, "mbfans", array);
-
-		/* Sensors */
-		if (!(array = cJSON_CreateArray()))
-			goto panic;
-		for (i = 0; i < SENSOR_COUNT; i++) {
-			double pwm = sensor_get_duty(&cfg->sensors[i].map, st->temp[i]);
-			if (!(o = cJSON_CreateObject()))
-				goto panic;
-
-			cJSON_AddItemToObject(o, "sensor", cJSON_CreateNumber(i+1));
-			cJSON_AddItemToObject(o, "name", cJSON_CreateString(cfg->sensors[i].name));
-			cJSON_AddItemToObject(o, "temperature", cJSON_CreateNumber(round_decimal(st->temp[i], 1)));
-			cJSON_AddItemToObject(o, "duty_cycle", cJSON_CreateNumber(round_decimal(pwm, 1)));
-			cJSON_AddItemToArray(array, o);
-		}
-		cJSON_AddItemToObject(json, "sensors", array);
-
-		/* Virtual Sensors */
-		if (!(array = cJSON_CreateArray()))
-			goto panic;
-		for (i = 0; i < VSENSOR_COUNT; i++) {
-			double pwm = sensor_get_duty(&cfg->vsensors[i].map, st->vtemp[i]);
-			if (!(o = cJSON_CreateObject()))
-				goto panic;
-
-			cJSON_AddItemToObject(o, "sensor", cJSON_CreateNumber(i+1));
-			cJSON_AddItemToObject(o, "name", cJSON_CreateString(cfg->vsensors[i].name));
-			cJSON_AddItemToObject(o, "temperature", cJSON_CreateNumber(round_decimal(st->vtemp[i], 1)));
-			cJSON_AddItemToObject(o, "duty_cycle", cJSON_CreateNumber(round_decimal(pwm, 1)));
-			cJSON_AddItemToArray(array, o);
+	return sw_ssi_finish(&w, current_tag_part, next_tag_part);
+}
+
+
+static u16_t csv_history(struct httpd_ssi_state *s, char *insert, int insertlen,
+		u16_t current_tag_part, u16_t *next_tag_part)
+{
+	size_t printed = 0;
+
+	if (!s)
+		return 0;
+
+	if (current_tag_part == 0) {
+		/* Output minute rollups first, then hourly rollups. */
+		s->hist_res = HISTORY_MIN;
+		history_iter_init(&s->hist, s->hist_res, 0);
+		s->frag_len = s->frag_pos = 0;
+	}
+
+	/* Fill LwIP buffer with fragments of CSV output... */
+	while (printed < insertlen - 1) {
+		if (s->frag_pos >= s->frag_len) {
+			s->frag_pos = 0;
+			s->frag_len = history_iter_next(&s->hist, s->frag, sizeof(s->frag));
+			if (s->frag_len <= 0 && s->hist_res == HISTORY_MIN) {
+				s->hist_res = HISTORY_HOUR;
+				history_iter_init(&s->hist, s->hist_res, 0);
+				s->frag_len = snprintf(s->frag, sizeof(s->frag), "\n");
+			}
+			if (s->frag_len <= 0)
+				break;
 		}
-		cJSON_AddItemToObject(json, "vsensors", array);
+		size_t count = s->frag_len - s->frag_pos;
+		if (count > insertlen - 1 - printed)
+			count = insertlen - 1 - printed;
+		memcpy(insert + printed, s->frag + s->frag_pos, count);
+		s->frag_pos += count;
+		printed += count;
+	}
+
+	if (s->frag_len > 0)
+		*next_tag_part = current_tag_part + 1;
+
+	return printed;
+}
 
-		if (!(buf = cJSON_Print(json)))
-			goto panic;
-		cJSON_Delete(json);
-		json = NULL;
 
-		p = buf;
-		buf_left = strlen(buf);
-		part = 1;
+/* Cached status outputs...
+ *
+ * status.json and status.csv are rendered (with HTTP headers) into a cache
+ * buffer and served as "custom" files. Cached output is reused as long
+ * as system state generation (and configuration) has not changed.
+ * Response includes ETag header, which clients can pass back with
+ * "etag" URL parameter (/status.json?etag=xxx) to get "304 Not Modified"
+ * response (without body) if status has not changed.
+ *
+ * lwIP httpd does not pass request headers to the application, so
+ * If-None-Match header cannot be used.
+ *
+ * If cache is in use (by another connection) when it would need
+ * to be updated, request falls back to the SSI processed file.
+ */
+
+#define HTTPD_SERVER_NAME "FanPico (https://github.com/tjko/fanpico)"
+#define HTTPD_CACHE_JSON_SIZE 6144
+#define HTTPD_CACHE_CSV_SIZE  1536
+#define HTTPD_NOT_MODIFIED_LEN 160
+#define HTTPD_NOT_MODIFIED_PREFIX "/304"
+
+struct httpd_cache_entry {
+	const char *uri;
+	const char *nm_uri;
+	const char *content_type;
+	void (*generate)(struct sw_writer *w, const struct fanpico_state *st);
+	char *buf;
+	size_t size;
+	size_t len;
+	char not_modified[HTTPD_NOT_MODIFIED_LEN];
+	size_t not_modified_len;
+	char etag[20];
+	bool valid;
+	uint16_t refs;
+};
+
+static char cache_json_buf[HTTPD_CACHE_JSON_SIZE];
+static char cache_csv_buf[HTTPD_CACHE_CSV_SIZE];
+static struct fanpico_state cache_state;
+
+static struct httpd_cache_entry httpd_cache[] = {
+	{ "/status.json", HTTPD_NOT_MODIFIED_PREFIX "/status.json", "application/json",
+	  json_status, cache_json_buf, sizeof(cache_json_buf) },
+	{ "/status.csv", HTTPD_NOT_MODIFIED_PREFIX "/status.csv", "text/plain",
+	  csv_status, cache_csv_buf, sizeof(cache_csv_buf) },
+};
+
+#define HTTPD_CACHE_ENTRIES (sizeof(httpd_cache) / sizeof(httpd_cache[0]))
+
+
+static bool httpd_cache_update(struct httpd_cache_entry *c)
+{
+	struct sw_writer w;
+	char etag[sizeof(c->etag)];
+
+	copy_system_state(&cache_state);
+	snprintf(etag, sizeof(etag), "%lx-%lx", cache_state.generation, config_generation);
+	if (c->valid && !strcmp(etag, c->etag))
+		return true;
+	if (c->refs > 0)
+		return false;
+
+	c->valid = false;
+	sw_init(&w, c->buf, c->size, 0);
+	sw_printf(&w, "HTTP/1.0 200 OK\r\nServer: %s\r\n", HTTPD_SERVER_NAME);
+	sw_printf(&w, "Cache-Control: no-cache\r\nETag: \"%s\"\r\n", etag);
+	sw_printf(&w, "Content-Type: %s\r\n\r\n", c->content_type);
+	c->generate(&w, &cache_state);
+	if (sw_full(&w)) {
+		log_msg(LOG_DEBUG, "httpd: cache buffer too small for %s", c->uri);
+		return false;
 	}
+	c->len = sw_finish(&w);
+	c->not_modified_len = snprintf(c->not_modified, sizeof(c->not_modified),
+				"HTTP/1.0 304 Not Modified\r\nServer: %s\r\n"
+				"Cache-Control: no-cache\r\nETag: \"%s\"\r\n\r\n",
+				HTTPD_SERVER_NAME, etag);
+	strncopy(c->etag, etag, sizeof(c->etag));
+	c->valid = true;
+
+	return true;
+}
+
+
+static bool httpd_etag_match(const char *etag, const char *val)
+{
+	size_t len;
+
+	if (!val)
+		return false;
+	/* Allow ETag to be passed with or without quotes */
+	if (*val == '"')
+		val++;
+	len = strlen(val);
+	if (len > 0 && val[len - 1] == '"')
+		len--;
+
+	return (len == strlen(etag) && !strncmp(etag, val, len));
+}
 
-	/* Copy a part of the multi-part response into LwIP buffer ...*/
-	count = (buf_left < insertlen - 1 ? buf_left : insertlen - 1);
-	memcpy(insert, p, count);
 
-	p += count;
-	printed = count;
-	buf_left -= count;
+static const char* httpd_cgi_status(int index, int num_params, char *param[], char *value[])
+{
+	struct httpd_cache_entry *c = &httpd_cache[index];
 
-	if (buf_left > 0) {
-		*next_tag_part = part++;
+	for (int i = 0; i < num_params; i++) {
+		if (!strcmp(param[i], "etag")) {
+			if (httpd_cache_update(c) && httpd_etag_match(c->etag, value[i]))
+				return c->nm_uri;
+		}
+	}
+
+	return c->uri;
+}
+
+
+static const tCGI httpd_cgi_handlers[] = {
+	{ "/status.json", httpd_cgi_status },
+	{ "/status.csv", httpd_cgi_status },
+};
+
+
+int fs_open_custom(struct fs_file *file, const char *name)
+{
+	struct httpd_cache_entry *c = NULL;
+	bool not_modified = false;
+
+	for (int i = 0; i < HTTPD_CACHE_ENTRIES; i++) {
+		if (!strcmp(name, httpd_cache[i].uri)) {
+			c = &httpd_cache[i];
+			break;
+		}
+		if (!strcmp(name, httpd_cache[i].nm_uri)) {
+			c = &httpd_cache[i];
+			not_modified = true;
+			break;
+		}
+	}
+	if (!c || !httpd_cache_update(c))
+		return 0;
+
+	memset(file, 0, sizeof(*file));
+	if (not_modified) {
+		file->data = c->not_modified;
+		file->len = c->not_modified_len;
 	} else {
-		free(buf);
-		buf = p = NULL;
+		file->data = c->buf;
+		file->len = c->len;
 	}
+	file->index = file->len;
+	file->flags = FS_FILE_FLAGS_HEADER_INCLUDED;
+	file->pextension = c;
+	c->refs++;
+
+	return 1;
+}
 
-	return printed;
 
-panic:
-	if (json)
-		cJSON_Delete(json);
-	return 0;
+void fs_close_custom(struct fs_file *file)
+{
+	struct httpd_cache_entry *c = file->pextension;
+
+	if (c && c->refs > 0)
+		c->refs--;
+	file->pextension = NULL;
+}
+
+
+void fanpico_httpd_init()
+{
+	http_set_ssi_handler(fanpico_ssi_handler, NULL, 0);
+	http_set_cgi_handlers(httpd_cgi_handlers,
+			sizeof(httpd_cgi_handlers) / sizeof(httpd_cgi_handlers[0]));
 }
 
 
 u16_t fanpico_ssi_handler(const char *tag, char *insert, int insertlen,
-			u16_t current_tag_part, u16_t *next_tag_part)
+			u16_t current_tag_part, u16_t *next_tag_part, void *connection_state)
 {
-	const struct fanpico_state *st = fanpico_state;
+	struct httpd_ssi_state *s = connection_state;
+	const struct fanpico_state *st = (s ? &s->st : fanpico_state);
 	size_t printed = 0;
 
 	/* printf("ssi_handler(\"%s\",%lx,%d,%u,%u)\n", tag, (uint32_t)insert, insertlen, current_tag_part, *next_tag_part); */
@@ -314,10 +587,18 @@ u16_t fanpico_ssi_handler(const char *tag, char *insert, int insertlen,
 		}
 	}
 	else if (!strncmp(tag, "csvstat", 7)) {
-		printed = csv_stats(insert, insertlen, current_tag_part, next_tag_part);
+		printed = sw_ssi_part(csv_status, st, insert, insertlen,
+				current_tag_part, next_tag_part);
 	}
 	else if (!strncmp(tag, "jsonstat", 8)) {
-		printed = json_stats(insert, insertlen, current_tag_part, next_tag_part);
+		struct sw_writer w;
+
+		sw_ssi_init(&w, insert, insertlen, current_tag_part);
+		json_status_perf(&w, st, (s ? s->perf : NULL));
+		printed = sw_ssi_finish(&w, current_tag_part, next_tag_part);
+	}
+	else if (!strncmp(tag, "histcsv", 7)) {
+		printed = csv_history(s, insert, insertlen, current_tag_part, next_tag_part);
 	}
 	else if (!strncmp(tag, "refresh", 8)) {
 		/* generate "random" refresh time for a page, to help spread out the load... */
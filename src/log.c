@@ -30,6 +30,7 @@
 #include <time.h>
 #include "pico/stdlib.h"
 #include "pico/mutex.h"
+#include "hardware/sync.h"
 #include "pico/unique_id.h"
 #include "pico/util/datetime.h"
 #include "hardware/watchdog.h"
@@ -183,21 +184,285 @@ void set_debug_level(int level)
 }
 
 
-void log_msg(int priority, const char *format, ...)
+/* Deferred logging...
+ *
+ * Messages logged from core1 (or from interrupt handlers) are not
+ * formatted by the caller. Instead a compact record (timestamp,
+ * priority, format string pointer and packed arguments) is stored in
+ * a per-core lock-free (single producer, single consumer) ring buffer.
+ * Core0 drains the rings (in main loop, and before logging its own
+ * messages) and does the formatting and output.
+ *
+ * Since format string is stored as pointer, it must be a string
+ * literal (or otherwise persistent). String arguments (%s) are copied
+ * into the record.
+ */
+
+#define LOG_RING_SIZE 32  /* records per core (power of 2) */
+#define LOG_RECORD_DATA_SIZE 96
+#define LOG_REC_TEXT 0x01 /* record contains preformatted text */
+
+struct log_record {
+	uint64_t t;
+	const char *format;
+	uint8_t priority;
+	uint8_t flags;
+	uint8_t data[LOG_RECORD_DATA_SIZE];
+};
+
+struct log_ring {
+	struct log_record rec[LOG_RING_SIZE];
+	volatile uint32_t head; /* updated by producer */
+	volatile uint32_t tail; /* updated by consumer (core0) */
+	volatile uint32_t dropped;
+	uint32_t dropped_reported;
+};
+
+struct log_fmt_spec {
+	char spec[16];
+	char conv;
+	uint8_t stars;
+	uint8_t size;
+};
+
+static struct log_ring log_rings[2];
+
+
+/* Parse printf conversion specification (p points to character after '%').
+ * Returns pointer to first character after the specification.
+ */
+static const char* log_parse_spec(const char *p, struct log_fmt_spec *s)
 {
-	va_list ap;
-	char buf[256];
-	int len;
-	uint64_t start, end;
-	uint core = get_core_num();
+	uint len = 0;
+	uint l = 0;
+
+	s->spec[len++] = '%';
+	s->stars = 0;
+	s->size = sizeof(int);
+
+	while (*p && strchr("-+ #0123456789.*hlLzjt", *p)) {
+		if (*p == '*')
+			s->stars++;
+		else if (*p == 'l')
+			s->size = (++l > 1 ? sizeof(long long) : sizeof(long));
+		else if (*p == 'j')
+			s->size = sizeof(intmax_t);
+		if (len < sizeof(s->spec) - 2)
+			s->spec[len++] = *p;
+		p++;
+	}
+	if (!*p || s->stars > 2)
+		return NULL;
 
-	if ((priority > global_log_level) && (priority > global_syslog_level))
+	s->conv = *p;
+	s->spec[len++] = *p++;
+	s->spec[len] = 0;
+
+	return p;
+}
+
+
+#define LOG_PACK(type) {					\
+		type v = va_arg(ap, type);			\
+		if (len + sizeof(v) > size)			\
+			return -1;				\
+		memcpy(data + len, &v, sizeof(v));		\
+		len += sizeof(v);				\
+	}
+
+/* Pack arguments (matching format string) into record data.
+ * Returns length of packed data or -1 if arguments did not fit.
+ */
+static int log_pack_args(const char *format, va_list ap, uint8_t *data, size_t size)
+{
+	struct log_fmt_spec s;
+	const char *p = format;
+	size_t len = 0;
+	int i;
+
+	while ((p = strchr(p, '%'))) {
+		if (p[1] == '%') {
+			p += 2;
+			continue;
+		}
+		if (!(p = log_parse_spec(p + 1, &s)))
+			return -1;
+
+		for (i = 0; i < s.stars; i++)
+			LOG_PACK(int);
+
+		switch (s.conv) {
+		case 'd':
+		case 'i':
+		case 'u':
+		case 'x':
+		case 'X':
+		case 'o':
+		case 'c':
+			if (s.size == sizeof(long long))
+				LOG_PACK(long long)
+			else
+				LOG_PACK(int)
+			break;
+		case 'f':
+		case 'F':
+		case 'e':
+		case 'E':
+		case 'g':
+		case 'G':
+		case 'a':
+		case 'A':
+			LOG_PACK(double);
+			break;
+		case 'p':
+			LOG_PACK(void*);
+			break;
+		case 's':
+		{
+			const char *str = va_arg(ap, const char*);
+			size_t n = strlen(str ? str : "(null)") + 1;
+			if (len + n > size)
+				return -1;
+			memcpy(data + len, (str ? str : "(null)"), n);
+			len += n;
+			break;
+		}
+		default:
+			return -1;
+		}
+	}
+
+	return len;
+}
+
+
+#define LOG_FORMAT(type) {						\
+		type v;							\
+		memcpy(&v, d, sizeof(v));				\
+		d += sizeof(v);						\
+		if (s.stars == 0)					\
+			n = snprintf(o, rem, s.spec, v);		\
+		else if (s.stars == 1)					\
+			n = snprintf(o, rem, s.spec, star[0], v);	\
+		else							\
+			n = snprintf(o, rem, s.spec, star[0], star[1], v); \
+	}
+
+/* Format log record into a string. */
+static void log_format_record(const struct log_record *r, char *buf, size_t size)
+{
+	struct log_fmt_spec s;
+	const char *p = r->format;
+	const uint8_t *d = r->data;
+	size_t pos = 0;
+	int star[2];
+	int i, n;
+
+	if (r->flags & LOG_REC_TEXT) {
+		strncopy(buf, (const char*)r->data, size);
 		return;
+	}
 
-	start = to_us_since_boot(get_absolute_time());
-	va_start(ap, format);
-	vsnprintf(buf, sizeof(buf), format, ap);
-	va_end(ap);
+	while (*p && pos < size - 1) {
+		if (*p != '%') {
+			buf[pos++] = *p++;
+			continue;
+		}
+		if (p[1] == '%') {
+			buf[pos++] = '%';
+			p += 2;
+			continue;
+		}
+		if (!(p = log_parse_spec(p + 1, &s)))
+			break;
+
+		for (i = 0; i < s.stars; i++) {
+			memcpy(&star[i], d, sizeof(int));
+			d += sizeof(int);
+		}
+
+		char *o = buf + pos;
+		size_t rem = size - pos;
+		n = 0;
+		switch (s.conv) {
+		case 'f':
+		case 'F':
+		case 'e':
+		case 'E':
+		case 'g':
+		case 'G':
+		case 'a':
+		case 'A':
+			LOG_FORMAT(double);
+			break;
+		case 'p':
+			LOG_FORMAT(void*);
+			break;
+		case 's':
+		{
+			const char *v = (const char*)d;
+			d += strlen(v) + 1;
+			if (s.stars == 0)
+				n = snprintf(o, rem, s.spec, v);
+			else if (s.stars == 1)
+				n = snprintf(o, rem, s.spec, star[0], v);
+			else
+				n = snprintf(o, rem, s.spec, star[0], star[1], v);
+			break;
+		}
+		default:
+			if (s.size == sizeof(long long))
+				LOG_FORMAT(long long)
+			else
+				LOG_FORMAT(int)
+			break;
+		}
+		if (n > 0)
+			pos += ((size_t)n < rem ? n : rem - 1);
+	}
+	buf[pos] = 0;
+}
+
+
+static void log_enqueue(uint core, int priority, const char *format, va_list ap)
+{
+	struct log_ring *ring = &log_rings[core];
+	struct log_record *r;
+	uint32_t irq, head;
+	va_list aq;
+
+	/* Disable interrupts, as interrupt handlers on this core may also log. */
+	irq = save_and_disable_interrupts();
+
+	head = ring->head;
+	if (head - ring->tail >= LOG_RING_SIZE) {
+		ring->dropped++;
+		restore_interrupts(irq);
+		return;
+	}
+
+	r = &ring->rec[head % LOG_RING_SIZE];
+	r->t = to_us_since_boot(get_absolute_time());
+	r->format = format;
+	r->priority = priority;
+	r->flags = 0;
+	va_copy(aq, ap);
+	if (log_pack_args(format, aq, r->data, sizeof(r->data)) < 0) {
+		/* Arguments did not fit, store (truncated) text instead. */
+		vsnprintf((char*)r->data, sizeof(r->data), format, ap);
+		r->flags |= LOG_REC_TEXT;
+	}
+	va_end(aq);
+
+	__dmb();
+	ring->head = head + 1;
+	restore_interrupts(irq);
+}
+
+
+static void log_output(uint core, uint64_t t, int priority, char *buf)
+{
+	int len;
 
 	if ((len = strlen(buf)) > 0) {
 		/* If string ends with \n, remove it. */
@@ -206,7 +471,6 @@ void log_msg(int priority, const char *format, ...)
 	}
 
 	if (priority <= global_log_level) {
-		uint64_t t = to_us_since_boot(get_absolute_time());
 		printf("[%6llu.%06llu][%u] %s\n", (t / 1000000), (t % 1000000), core, buf);
 	}
 
@@ -215,6 +479,83 @@ void log_msg(int priority, const char *format, ...)
 		syslog_msg(priority, "%s", buf);
 	}
 #endif
+}
+
+
+/* Output any deferred log messages. This is only done on core0
+ * (outside of interrupt handlers).
+ */
+void log_flush()
+{
+	static bool active = false;
+	struct log_ring *ring;
+	struct log_record *r;
+	char buf[256];
+	uint core;
+
+	if (get_core_num() != 0 || __get_current_exception() || active)
+		return;
+	active = true;
+
+	for (core = 0; core < 2; core++) {
+		ring = &log_rings[core];
+
+		while (ring->tail != ring->head) {
+			__dmb();
+			r = &ring->rec[ring->tail % LOG_RING_SIZE];
+			log_format_record(r, buf, sizeof(buf));
+			log_output(core, r->t, r->priority, buf);
+			__dmb();
+			ring->tail++;
+		}
+
+		uint32_t dropped = ring->dropped;
+		if (dropped != ring->dropped_reported) {
+			uint64_t t = to_us_since_boot(get_absolute_time());
+			snprintf(buf, sizeof(buf), "log ring full: %lu message(s) dropped (total %lu)",
+				dropped - ring->dropped_reported, dropped);
+			log_output(core, t, LOG_WARNING, buf);
+			ring->dropped_reported = dropped;
+		}
+	}
+
+	active = false;
+}
+
+
+uint32_t log_dropped_messages()
+{
+	return log_rings[0].dropped + log_rings[1].dropped;
+}
+
+
+void log_msg(int priority, const char *format, ...)
+{
+	va_list ap;
+	char buf[256];
+	uint64_t start, end;
+	uint core = get_core_num();
+
+	if ((priority > global_log_level) && (priority > global_syslog_level))
+		return;
+
+	if (core != 0 || __get_current_exception()) {
+		/* Defer formatting and output to core0 */
+		va_start(ap, format);
+		log_enqueue(core, priority, format, ap);
+		va_end(ap);
+		return;
+	}
+
+	/* Output any deferred messages first, to keep messages in order. */
+	log_flush();
+
+	start = to_us_since_boot(get_absolute_time());
+	va_start(ap, format);
+	vsnprintf(buf, sizeof(buf), format, ap);
+	va_end(ap);
+
+	log_output(core, to_us_since_boot(get_absolute_time()), priority, buf);
 
 	end = to_us_since_boot(get_absolute_time());
 	if (end - start > 10000) {
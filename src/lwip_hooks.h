@@ -12,4 +12,6 @@ void pico_dhcp_option_add_hook(struct netif *netif, struct dhcp *dhcp, u8_t stat
 void pico_dhcp_option_parse_hook(struct netif *netif, struct dhcp *dhcp, u8_t state, struct dhcp_msg *msg,
 				u8_t msg_type, u8_t option, u8_t option_len, struct pbuf *pbuf, u16_t option_value_offset);
 
+int pico_ip4_input_hook(struct pbuf *pbuf, struct netif *input_netif);
+
 #endif /* _LWIP_HOOKS_H */
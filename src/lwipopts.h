@@ -69,6 +69,9 @@ void pico_set_system_time(long int sec);
 #define LWIP_HOOK_FILENAME              "lwip_hooks.h"
 #define LWIP_HOOK_DHCP_APPEND_OPTIONS   pico_dhcp_option_add_hook
 #define LWIP_HOOK_DHCP_PARSE_OPTION     pico_dhcp_option_parse_hook
+#if PICO_CYW43_ARCH_POLL
+#define LWIP_HOOK_IP4_INPUT             pico_ip4_input_hook
+#endif
 
 #define MQTT_OUTPUT_RINGBUF_SIZE        4096
 #define MQTT_REQ_MAX_IN_FLIGHT          32
@@ -78,6 +81,11 @@ void pico_set_system_time(long int sec);
 #define LWIP_HTTPD_SSI_RAW              1
 #define LWIP_HTTPD_SSI_MULTIPART        1
 #define LWIP_HTTPD_SSI_INCLUDE_TAG      0
+#define LWIP_HTTPD_FILE_STATE           1
+#define LWIP_HTTPD_CGI                  1
+#define LWIP_HTTPD_CUSTOM_FILES         1
+/* Always copy data, (cached) custom files live in RAM */
+#define HTTP_IS_DATA_VOLATILE(hs)       TCP_WRITE_FLAG_COPY
 #define LWIP_HTTPD_SSI_EXTENSIONS       ".shtml", ".xml", ".json", ".csv"
 
 #if TLS_SUPPORT
@@ -40,19 +40,19 @@
 #ifdef WIFI_SUPPORT
 
 #define MQTT_CMD_MAX_LEN 100
+#define MQTT_STATUS_MAX_LEN 2048
 
 mqtt_client_t *mqtt_client = NULL;
 ip_addr_t mqtt_server_ip = IPADDR4_INIT_BYTES(0, 0, 0, 0);
 u16_t mqtt_server_port = 0;
 int incoming_topic = 0;
 int mqtt_qos = 1;
-char mqtt_scpi_cmd[MQTT_CMD_MAX_LEN];
-bool mqtt_scpi_cmd_queued = false;
 absolute_time_t ABSOLUTE_TIME_INITIALIZED_VAR(t_mqtt_disconnect, 0);
 u16_t mqtt_reconnect = 0;
 
 
 void mqtt_connect(mqtt_client_t *client);
+static void mqtt_reset_channels();
 
 
 
@@ -196,13 +196,11 @@ static void mqtt_incoming_data_cb(void *arg, const u8_t *data, u16_t len, u8_t f
 		}
 	}
 
-	if (mqtt_scpi_cmd_queued) {
+	if (cmdq_enqueue(CMD_SRC_MQTT, cmd)) {
 		log_msg(LOG_NOTICE, "MQTT SCPI command queue full: '%s'", cmd);
 		send_mqtt_command_response(cmd, 1, "SCPI command queue full");
 	} else {
 		log_msg(LOG_NOTICE, "MQTT SCPI command queued: '%s'", cmd);
-		strncopy(mqtt_scpi_cmd, cmd, sizeof(mqtt_scpi_cmd));
-		mqtt_scpi_cmd_queued = true;
 	}
 
 }
@@ -222,6 +220,8 @@ static void mqtt_connection_cb(mqtt_client_t *client, void *arg, mqtt_connection
 		log_msg(LOG_INFO, "MQTT connected to %s:%u", ipaddr_ntoa(&mqtt_server_ip),
 			mqtt_server_port);
 		mqtt_set_inpub_callback(client, mqtt_incoming_publish_cb, mqtt_incoming_data_cb, arg);
+		/* Make sure all values get published after (re)connect */
+		mqtt_reset_channels();
 		if (strlen(cfg->mqtt_cmd_topic) > 0) {
 			log_msg(LOG_INFO, "MQTT subscribe to command topic: %s", cfg->mqtt_cmd_topic);
 			err_t err = mqtt_subscribe(client, cfg->mqtt_cmd_topic, 1,
@@ -371,106 +371,170 @@ void fanpico_mqtt_reconnect()
 	}
 }
 
-char* json_status_message()
+int json_status_message(char *buf, size_t size)
 {
 	const struct fanpico_state *st = fanpico_state;
-	char *buf;
-	cJSON *json, *l, *o;
+	struct pmem_analytics a;
+	struct sw_writer w;
 	int i;
 	float rpm;
 
-	if (!(json = cJSON_CreateObject()))
-		goto panic;
-
-	cJSON_AddItemToObject(json, "name", cJSON_CreateString(cfg->name));
-	cJSON_AddItemToObject(json, "hostname", cJSON_CreateString(network_hostname()));
+	get_analytics(&a);
+	sw_init(&w, buf, size, 0);
+	sw_json_begin(&w, NULL, '{');
+	sw_json_string(&w, "name", cfg->name);
+	sw_json_string(&w, "hostname", network_hostname());
 	if (network_ip())
-		cJSON_AddItemToObject(json, "ip", cJSON_CreateString(network_ip()));
+		sw_json_string(&w, "ip", network_ip());
 
 	/* fans */
-	if (!(l = cJSON_CreateArray()))
-		goto panic;
-	cJSON_AddItemToObject(json, "fans", l);
+	sw_json_begin(&w, "fans", '[');
 	for (i = 0; i < FAN_COUNT; i++) {
 		rpm = st->fan_freq[i] * 60 / cfg->fans[i].rpm_factor;
-		if (!(o = cJSON_CreateObject()))
-			goto panic;
-		cJSON_AddItemToObject(o, "id", cJSON_CreateNumber(i + 1));
-		cJSON_AddItemToObject(o, "rpm", cJSON_CreateNumber(rpm));
-		cJSON_AddItemToObject(o, "pwm", cJSON_CreateNumber(st->fan_duty[i]));
-		cJSON_AddItemToArray(l, o);
-	}
+		sw_json_begin(&w, NULL, '{');
+		sw_json_int(&w, "id", i + 1);
+		sw_json_float(&w, "rpm", rpm, 0);
+		sw_json_float(&w, "pwm", st->fan_duty[i], 1);
+		sw_json_string(&w, "fault", fan_fault2str(st->fan_fault[i]));
+		sw_json_float(&w, "run_hours", a.fans[i].run_time / 3600.0, 2);
+		sw_json_int(&w, "stalls", a.fans[i].stalls);
+		sw_json_int(&w, "rpm_min", a.fans[i].rpm_min);
+		sw_json_int(&w, "rpm_max", a.fans[i].rpm_max);
+		sw_json_end(&w, '}');
+	}
+	sw_json_end(&w, ']');
 
 	/* mbfans */
-	if (!(l = cJSON_CreateArray()))
-		goto panic;
-	cJSON_AddItemToObject(json, "mbfans", l);
+	sw_json_begin(&w, "mbfans", '[');
 	for (i = 0; i < MBFAN_COUNT; i++) {
 		rpm = st->mbfan_freq[i] * 60 / cfg->mbfans[i].rpm_factor;
-		if (!(o = cJSON_CreateObject()))
-			goto panic;
-		cJSON_AddItemToObject(o, "id", cJSON_CreateNumber(i + 1));
-		cJSON_AddItemToObject(o, "rpm", cJSON_CreateNumber(rpm));
-		cJSON_AddItemToObject(o, "pwm", cJSON_CreateNumber(st->mbfan_duty[i]));
-		cJSON_AddItemToArray(l, o);
+		sw_json_begin(&w, NULL, '{');
+		sw_json_int(&w, "id", i + 1);
+		sw_json_float(&w, "rpm", rpm, 0);
+		sw_json_float(&w, "pwm", st->mbfan_duty[i], 1);
+		sw_json_end(&w, '}');
 	}
+	sw_json_end(&w, ']');
 
 	/* sensors */
-	if (!(l = cJSON_CreateArray()))
-		goto panic;
-	cJSON_AddItemToObject(json, "sensors", l);
+	sw_json_begin(&w, "sensors", '[');
 	for (i = 0; i < SENSOR_COUNT; i++) {
-		if (!(o = cJSON_CreateObject()))
-			goto panic;
-		cJSON_AddItemToObject(o, "id", cJSON_CreateNumber(i + 1));
-		cJSON_AddItemToObject(o, "temp", cJSON_CreateNumber(round_decimal(st->temp[i], 1)));
-		cJSON_AddItemToArray(l, o);
+		sw_json_begin(&w, NULL, '{');
+		sw_json_int(&w, "id", i + 1);
+		sw_json_float(&w, "temp", st->temp[i], 1);
+		if (a.temp_valid & (1 << i))
+			sw_json_float(&w, "temp_max", a.temp_max[i], 1);
+		sw_json_end(&w, '}');
 	}
+	sw_json_end(&w, ']');
+	sw_json_end(&w, '}');
 
-
-	if (!(buf = cJSON_Print(json)))
-		goto panic;
-	cJSON_Delete(json);
-	return buf;
-
-panic:
-	if (json)
-		cJSON_Delete(json);
-	return NULL;
+	if (sw_full(&w))
+		return -1;
+	return sw_finish(&w);
 }
 
 void fanpico_mqtt_publish()
 {
-	char *buf = NULL;
+	static char buf[MQTT_STATUS_MAX_LEN];
+	int len;
 
 	if (!mqtt_client || strlen(cfg->mqtt_status_topic) < 1)
 		return;
 
 	/* Generate status message */
-	if (!(buf = json_status_message())) {
+	if ((len = json_status_message(buf, sizeof(buf))) < 0) {
 		log_msg(LOG_WARNING,"json_status_message(): failed");
 		return;
 	}
-	mqtt_publish_message(cfg->mqtt_status_topic, buf, strlen(buf), mqtt_qos, 0,
+	mqtt_publish_message(cfg->mqtt_status_topic, buf, len, mqtt_qos, 0,
 			cfg->mqtt_status_topic);
-	free(buf);
 }
 
-void fanpico_mqtt_publish_temp()
+/* Change-only publishing...
+ *
+ * When 'mqtt_change_only' is enabled a value is only published if it
+ * has changed (by more than same threshold used for logging changes)
+ * since it was last published, or if it has not been published within
+ * last 'mqtt_heartbeat' seconds.
+ */
+
+#define MQTT_TEMP_THRESHOLD  0.5
+#define MQTT_FREQ_THRESHOLD  1.0
+#define MQTT_DUTY_THRESHOLD  1.0
+#define MQTT_BULK_MAX_LEN    768
+
+struct mqtt_channel {
+	float value;
+	absolute_time_t t_published;
+	bool published;
+};
+
+struct mqtt_channels {
+	struct mqtt_channel temp[SENSOR_COUNT];
+	struct mqtt_channel fan_freq[FAN_COUNT];
+	struct mqtt_channel fan_duty[FAN_COUNT];
+	struct mqtt_channel mbfan_freq[MBFAN_COUNT];
+	struct mqtt_channel mbfan_duty[MBFAN_COUNT];
+};
+
+static struct mqtt_channels mqtt_last;
+static struct mqtt_channels mqtt_bulk_last;
+
+
+static void mqtt_reset_channels()
+{
+	memset(&mqtt_last, 0, sizeof(mqtt_last));
+	memset(&mqtt_bulk_last, 0, sizeof(mqtt_bulk_last));
+}
+
+static bool mqtt_channel_due(const struct mqtt_channel *ch, float value, float threshold)
+{
+	if (!cfg->mqtt_change_only || !ch->published)
+		return true;
+	if (check_for_change(ch->value, value, threshold))
+		return true;
+	if (cfg->mqtt_heartbeat > 0 &&
+	    absolute_time_diff_us(ch->t_published, get_absolute_time())
+	    >= (int64_t)cfg->mqtt_heartbeat * 1000000)
+		return true;
+
+	return false;
+}
+
+static void mqtt_channel_published(struct mqtt_channel *ch, float value)
+{
+	ch->value = value;
+	ch->t_published = get_absolute_time();
+	ch->published = true;
+}
+
+static void mqtt_publish_channel(struct mqtt_channel *ch, float value, float threshold,
+				const char *topic_fmt, int id, const char *val_fmt, float val)
 {
-	const struct fanpico_state *st = fanpico_state;
 	char topic[MQTT_MAX_TOPIC_LEN + 8];
 	char buf[64];
 
+	if (!mqtt_channel_due(ch, value, threshold))
+		return;
+
+	snprintf(topic, sizeof(topic), topic_fmt, id);
+	snprintf(buf, sizeof(buf), val_fmt, val);
+	if (mqtt_publish_message(topic, buf, strlen(buf), mqtt_qos, 0, topic_fmt) == ERR_OK)
+		mqtt_channel_published(ch, value);
+}
+
+void fanpico_mqtt_publish_temp()
+{
+	const struct fanpico_state *st = fanpico_state;
+
 	if (!mqtt_client || strlen(cfg->mqtt_temp_topic) < 1)
 		return;
 
 	for (int i = 0; i < SENSOR_COUNT; i++) {
 		if (cfg->mqtt_temp_mask & (1 << i)) {
-			snprintf(topic, sizeof(topic), cfg->mqtt_temp_topic, i + 1);
-			snprintf(buf, sizeof(buf), "%.1f", st->temp[i]);
-			mqtt_publish_message(topic, buf, strlen(buf), mqtt_qos, 0,
-					cfg->mqtt_temp_topic);
+			mqtt_publish_channel(&mqtt_last.temp[i], st->temp[i], MQTT_TEMP_THRESHOLD,
+					cfg->mqtt_temp_topic, i + 1, "%.1f", st->temp[i]);
 		}
 	}
 }
@@ -478,8 +542,6 @@ void fanpico_mqtt_publish_temp()
 void fanpico_mqtt_publish_rpm()
 {
 	const struct fanpico_state *st = fanpico_state;
-	char topic[MQTT_MAX_TOPIC_LEN + 8];
-	char buf[64];
 
 	if (!mqtt_client)
 		return;
@@ -488,10 +550,9 @@ void fanpico_mqtt_publish_rpm()
 		for (int i = 0; i < FAN_COUNT; i++) {
 			if (cfg->mqtt_fan_rpm_mask & (1 << i)) {
 				float rpm = st->fan_freq[i] * 60 / cfg->fans[i].rpm_factor;
-				snprintf(topic, sizeof(topic), cfg->mqtt_fan_rpm_topic, i + 1);
-				snprintf(buf, sizeof(buf), "%.0f", rpm);
-				mqtt_publish_message(topic, buf, strlen(buf), mqtt_qos, 0,
-						cfg->mqtt_fan_rpm_topic);
+				mqtt_publish_channel(&mqtt_last.fan_freq[i], st->fan_freq[i],
+						MQTT_FREQ_THRESHOLD, cfg->mqtt_fan_rpm_topic,
+						i + 1, "%.0f", rpm);
 			}
 		}
 	}
@@ -499,10 +560,9 @@ void fanpico_mqtt_publish_rpm()
 		for (int i = 0; i < MBFAN_COUNT; i++) {
 			if (cfg->mqtt_mbfan_rpm_mask & (1 << i)) {
 				float rpm = st->mbfan_freq[i] * 60 / cfg->mbfans[i].rpm_factor;
-				snprintf(topic, sizeof(topic), cfg->mqtt_mbfan_rpm_topic, i + 1);
-				snprintf(buf, sizeof(buf), "%.0f", rpm);
-				mqtt_publish_message(topic, buf, strlen(buf), mqtt_qos, 0,
-						cfg->mqtt_mbfan_rpm_topic);
+				mqtt_publish_channel(&mqtt_last.mbfan_freq[i], st->mbfan_freq[i],
+						MQTT_FREQ_THRESHOLD, cfg->mqtt_mbfan_rpm_topic,
+						i + 1, "%.0f", rpm);
 			}
 		}
 	}
@@ -511,8 +571,6 @@ void fanpico_mqtt_publish_rpm()
 void fanpico_mqtt_publish_duty()
 {
 	const struct fanpico_state *st = fanpico_state;
-	char topic[MQTT_MAX_TOPIC_LEN + 8];
-	char buf[64];
 
 	if (!mqtt_client)
 		return;
@@ -520,49 +578,130 @@ void fanpico_mqtt_publish_duty()
 	if (strlen(cfg->mqtt_fan_duty_topic) > 0) {
 		for (int i = 0; i < FAN_COUNT; i++) {
 			if (cfg->mqtt_fan_duty_mask & (1 << i)) {
-				snprintf(topic, sizeof(topic), cfg->mqtt_fan_duty_topic, i + 1);
-				snprintf(buf, sizeof(buf), "%.1f", st->fan_duty[i]);
-				mqtt_publish_message(topic, buf, strlen(buf), mqtt_qos, 0,
-						cfg->mqtt_fan_duty_topic);
+				mqtt_publish_channel(&mqtt_last.fan_duty[i], st->fan_duty[i],
+						MQTT_DUTY_THRESHOLD, cfg->mqtt_fan_duty_topic,
+						i + 1, "%.1f", st->fan_duty[i]);
 			}
 		}
 	}
 	if (strlen(cfg->mqtt_mbfan_duty_topic) > 0) {
 		for (int i = 0; i < MBFAN_COUNT; i++) {
 			if (cfg->mqtt_mbfan_duty_mask & (1 << i)) {
-				snprintf(topic, sizeof(topic), cfg->mqtt_mbfan_duty_topic, i + 1);
-				snprintf(buf, sizeof(buf), "%.1f", st->mbfan_duty[i]);
-				mqtt_publish_message(topic, buf, strlen(buf), mqtt_qos, 0,
-						cfg->mqtt_mbfan_duty_topic);
+				mqtt_publish_channel(&mqtt_last.mbfan_duty[i], st->mbfan_duty[i],
+						MQTT_DUTY_THRESHOLD, cfg->mqtt_mbfan_duty_topic,
+						i + 1, "%.1f", st->mbfan_duty[i]);
 			}
 		}
 	}
 }
 
-void fanpico_mqtt_scpi_command()
+static void mqtt_bulk_group(struct sw_writer *w, const char *name,
+			uint16_t mask, int count, const float *val, int decimals,
+			struct mqtt_channel *last, const float *cval, float threshold,
+			bool *changed)
+{
+	char key[8];
+
+	if (!mask)
+		return;
+
+	sw_json_begin(w, name, '{');
+	for (int i = 0; i < count; i++) {
+		if (!(mask & (1 << i)))
+			continue;
+		if (mqtt_channel_due(&last[i], cval[i], threshold))
+			*changed = true;
+		snprintf(key, sizeof(key), "%d", i + 1);
+		sw_json_float(w, key, val[i], decimals);
+	}
+	sw_json_end(w, '}');
+}
+
+static void mqtt_bulk_group_published(uint16_t mask, int count,
+				struct mqtt_channel *last, const float *cval)
+{
+	for (int i = 0; i < count; i++) {
+		if (mask & (1 << i))
+			mqtt_channel_published(&last[i], cval[i]);
+	}
+}
+
+void fanpico_mqtt_publish_bulk()
 {
 	const struct fanpico_state *st = fanpico_state;
-	char cmd[MQTT_CMD_MAX_LEN];
-	int res;
+	static char buf[MQTT_BULK_MAX_LEN];
+	float fan_rpm[FAN_COUNT], mbfan_rpm[MBFAN_COUNT];
+	struct sw_writer w;
+	bool changed = false;
+	size_t len;
+
+	if (!mqtt_client || strlen(cfg->mqtt_bulk_topic) < 1)
+		return;
+
+	for (int i = 0; i < FAN_COUNT; i++)
+		fan_rpm[i] = st->fan_freq[i] * 60 / cfg->fans[i].rpm_factor;
+	for (int i = 0; i < MBFAN_COUNT; i++)
+		mbfan_rpm[i] = st->mbfan_freq[i] * 60 / cfg->mbfans[i].rpm_factor;
+
+	/* Generate compact (single line) JSON payload with all channels enabled in masks */
+	sw_init(&w, buf, sizeof(buf), 0);
+	sw_json_begin(&w, NULL, '{');
+	mqtt_bulk_group(&w, "temp", cfg->mqtt_temp_mask, SENSOR_COUNT,
+			st->temp, 1, mqtt_bulk_last.temp, st->temp,
+			MQTT_TEMP_THRESHOLD, &changed);
+	mqtt_bulk_group(&w, "fanrpm", cfg->mqtt_fan_rpm_mask, FAN_COUNT,
+			fan_rpm, 0, mqtt_bulk_last.fan_freq, st->fan_freq,
+			MQTT_FREQ_THRESHOLD, &changed);
+	mqtt_bulk_group(&w, "fanpwm", cfg->mqtt_fan_duty_mask, FAN_COUNT,
+			st->fan_duty, 1, mqtt_bulk_last.fan_duty, st->fan_duty,
+			MQTT_DUTY_THRESHOLD, &changed);
+	mqtt_bulk_group(&w, "mbfanrpm", cfg->mqtt_mbfan_rpm_mask, MBFAN_COUNT,
+			mbfan_rpm, 0, mqtt_bulk_last.mbfan_freq, st->mbfan_freq,
+			MQTT_FREQ_THRESHOLD, &changed);
+	mqtt_bulk_group(&w, "mbfanpwm", cfg->mqtt_mbfan_duty_mask, MBFAN_COUNT,
+			st->mbfan_duty, 1, mqtt_bulk_last.mbfan_duty, st->mbfan_duty,
+			MQTT_DUTY_THRESHOLD, &changed);
+	sw_json_end(&w, '}');
+
+	if (!changed)
+		return;
+	if (sw_full(&w)) {
+		log_msg(LOG_WARNING, "MQTT bulk message truncated");
+		return;
+	}
+	len = sw_finish(&w);
+
+	if (mqtt_publish_message(cfg->mqtt_bulk_topic, buf, len, mqtt_qos, 0,
+					cfg->mqtt_bulk_topic) == ERR_OK) {
+		mqtt_bulk_group_published(cfg->mqtt_temp_mask, SENSOR_COUNT,
+					mqtt_bulk_last.temp, st->temp);
+		mqtt_bulk_group_published(cfg->mqtt_fan_rpm_mask, FAN_COUNT,
+					mqtt_bulk_last.fan_freq, st->fan_freq);
+		mqtt_bulk_group_published(cfg->mqtt_fan_duty_mask, FAN_COUNT,
+					mqtt_bulk_last.fan_duty, st->fan_duty);
+		mqtt_bulk_group_published(cfg->mqtt_mbfan_rpm_mask, MBFAN_COUNT,
+					mqtt_bulk_last.mbfan_freq, st->mbfan_freq);
+		mqtt_bulk_group_published(cfg->mqtt_mbfan_duty_mask, MBFAN_COUNT,
+					mqtt_bulk_last.mbfan_duty, st->mbfan_duty);
+	}
+}
 
-	if (!mqtt_client || !mqtt_scpi_cmd_queued)
+/* Send response for a (queued) SCPI command received via MQTT. */
+void fanpico_mqtt_scpi_response(const char *cmd, int res)
+{
+	if (!mqtt_client)
 		return;
 
-	strncopy(cmd, mqtt_scpi_cmd, sizeof(cmd));
-	process_command(st, (struct fanpico_config *)cfg, cmd);
-	if ((res = last_command_status()) == 0) {
-		log_msg(LOG_INFO, "MQTT SCPI command successful: '%s'", mqtt_scpi_cmd);
-		send_mqtt_command_response(mqtt_scpi_cmd, res, "SCPI command successful");
+	if (res == 0) {
+		log_msg(LOG_INFO, "MQTT SCPI command successful: '%s'", cmd);
+		send_mqtt_command_response(cmd, res, "SCPI command successful");
 	} else {
-		log_msg(LOG_NOTICE, "MQTT SCPI command failed: '%s' (%d)", mqtt_scpi_cmd, res);
+		log_msg(LOG_NOTICE, "MQTT SCPI command failed: '%s' (%d)", cmd, res);
 		if (res == -113)
-			send_mqtt_command_response(mqtt_scpi_cmd, res, "SCPI unknown command");
+			send_mqtt_command_response(cmd, res, "SCPI unknown command");
 		else
-			send_mqtt_command_response(mqtt_scpi_cmd, res, "SCPI command failed");
+			send_mqtt_command_response(cmd, res, "SCPI command failed");
 	}
-
-	mqtt_scpi_cmd[0] = 0;
-	mqtt_scpi_cmd_queued = false;
 }
 
 #endif /* WIFI_SUPPORT */
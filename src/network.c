@@ -20,10 +20,12 @@
 */
 
 #include <stdio.h>
+#include <string.h>
 #include <time.h>
 #include <assert.h>
 #include "hardware/rtc.h"
 #include "hardware/watchdog.h"
+#include "hardware/pio.h"
 #include "pico/stdlib.h"
 #include "pico/util/datetime.h"
 #ifdef LIB_PICO_CYW43_ARCH
@@ -33,6 +35,7 @@
 #include "lwip/prot/dhcp.h"
 #include "lwip/apps/sntp.h"
 #include "lwip/apps/httpd.h"
+#include "lwip/timeouts.h"
 #endif
 
 #include "fanpico.h"
@@ -49,6 +52,39 @@ static uint8_t cyw43_mac[6];
 static char wifi_hostname[32];
 static ip_addr_t syslog_server;
 static ip_addr_t current_ip;
+static uint16_t cyw43_pio_reserve_instr[CYW43_PIO_PROGRAM_LEN];
+static const pio_program_t cyw43_pio_reserve = {
+	.instructions = cyw43_pio_reserve_instr,
+	.length = CYW43_PIO_PROGRAM_LEN,
+	.origin = -1,
+};
+static int cyw43_pio_reserve_offset = -1;
+static int cyw43_pio_reserve_sm = -1;
+
+
+/* Reserve room for cyw43 SPI program and a state machine in CYW43_PIO,
+ * so that PIO programs loaded during boot (before WiFi is initialized)
+ * do not use up the resources cyw43 driver needs. */
+void wifi_reserve_pio()
+{
+	if (pio_can_add_program(CYW43_PIO, &cyw43_pio_reserve))
+		cyw43_pio_reserve_offset = pio_add_program(CYW43_PIO, &cyw43_pio_reserve);
+	cyw43_pio_reserve_sm = pio_claim_unused_sm(CYW43_PIO, false);
+	if (cyw43_pio_reserve_offset < 0 || cyw43_pio_reserve_sm < 0)
+		log_msg(LOG_WARNING, "WiFi: cannot reserve PIO%d resources",
+			pio_get_index(CYW43_PIO));
+}
+
+/* Release reserved PIO resources (for cyw43 driver to allocate). */
+static void wifi_release_pio()
+{
+	if (cyw43_pio_reserve_offset >= 0)
+		pio_remove_program(CYW43_PIO, &cyw43_pio_reserve, cyw43_pio_reserve_offset);
+	if (cyw43_pio_reserve_sm >= 0)
+		pio_sm_unclaim(CYW43_PIO, cyw43_pio_reserve_sm);
+	cyw43_pio_reserve_offset = -1;
+	cyw43_pio_reserve_sm = -1;
+}
 
 void wifi_mac()
 {
@@ -103,6 +139,7 @@ void wifi_init()
 		}
 	}
 
+	wifi_release_pio();
 	if ((res = cyw43_arch_init_with_country(country_code))) {
 		log_msg(LOG_ALERT, "WiFi initialization failed: %d", res);
 		return;
@@ -204,7 +241,7 @@ void wifi_init()
 		httpd_inits(tls_config);
 	}
 #endif
-	http_set_ssi_handler(fanpico_ssi_handler, NULL, 0);
+	fanpico_httpd_init();
 
 	/* Enable Telnet server */
 	if (cfg->telnet_active) {
@@ -237,22 +274,160 @@ void wifi_status()
 }
 
 
+#if PICO_CYW43_ARCH_POLL
+/* Adaptive polling of cyw43 driver / lwIP (in poll mode)...
+ *
+ * Poll interval is reset to minimum whenever packets are received (or
+ * sent), and doubled on each idle poll up to the maximum. Interval is
+ * never longer than the time to next lwIP timeout.
+ */
+
+#define WIFI_POLL_MIN_INTERVAL  1   /* ms */
+#define WIFI_POLL_MAX_INTERVAL  16  /* ms */
+
+static volatile bool wifi_activity = false;
+
+/* LwIP hook called for every received IPv4 packet. */
+int pico_ip4_input_hook(struct pbuf *pbuf, struct netif *input_netif)
+{
+	wifi_activity = true;
+	return 0;
+}
+
+static void wifi_driver_poll(absolute_time_t t_now)
+{
+	static absolute_time_t ABSOLUTE_TIME_INITIALIZED_VAR(t_next_poll, 0);
+	static uint32_t interval = WIFI_POLL_MIN_INTERVAL;
+	uint32_t sleep;
+
+	if (absolute_time_diff_us(t_next_poll, t_now) < 0 && !wifi_activity)
+		return;
+
+	cyw43_arch_poll();
+
+	if (wifi_activity) {
+		wifi_activity = false;
+		interval = WIFI_POLL_MIN_INTERVAL;
+	} else if (interval < WIFI_POLL_MAX_INTERVAL) {
+		interval <<= 1;
+	}
+	sleep = sys_timeouts_sleeptime();
+	t_next_poll = delayed_by_ms(t_now, (sleep < interval ?
+						(sleep > WIFI_POLL_MIN_INTERVAL ? sleep : WIFI_POLL_MIN_INTERVAL)
+						: interval));
+}
+#endif
+
+
+/* Periodic network tasks...
+ *
+ * Tasks share a simple deadline scheduler (like core1 tasks): each task
+ * has a period and time of its last run, and the task list is only walked
+ * once the earliest deadline has been reached (or configuration / MQTT
+ * client state has changed). Periods are read from the configuration
+ * (in seconds) when 'period_cfg' is set, period of 0 disables the task.
+ * First period starts when network comes up (or MQTT client connects,
+ * for MQTT tasks), and first runs of tasks are staggered so that they
+ * do not all run at once.
+ */
+
+#define NETWORK_TASK_STAGGER 250 /* ms */
+
+struct network_task {
+	const char *name;
+	uint32_t period; /* ms */
+	size_t period_cfg; /* offset of (configurable) period in fanpico_config */
+	bool mqtt; /* task requires MQTT client */
+	void (*func)();
+	absolute_time_t last_run;
+};
+
+static void wifi_uptime_msg()
+{
+	uint32_t secs = to_us_since_boot(get_absolute_time()) / 1000000;
+	uint32_t mins =  secs / 60;
+	uint32_t hours = mins / 60;
+	uint32_t days = hours / 24;
+
+	syslog_msg(LOG_INFO, "Uptime: %lu days %02lu:%02lu:%02lu%s",
+		days, hours % 24, mins % 60, secs % 60,
+		(rebooted_by_watchdog ? " [Rebooted by watchdog]" : ""));
+}
+
+#define NET_CFG(field) offsetof(struct fanpico_config, field)
+
+static struct network_task network_tasks[] = {
+	{ "uptime",      3600 * 1000, 0, false, wifi_uptime_msg },
+	{ "mqtt_status", 0, NET_CFG(mqtt_status_interval), true, fanpico_mqtt_publish },
+	{ "mqtt_temp",   0, NET_CFG(mqtt_temp_interval), true, fanpico_mqtt_publish_temp },
+	{ "mqtt_rpm",    0, NET_CFG(mqtt_rpm_interval), true, fanpico_mqtt_publish_rpm },
+	{ "mqtt_duty",   0, NET_CFG(mqtt_duty_interval), true, fanpico_mqtt_publish_duty },
+	{ "mqtt_bulk",   0, NET_CFG(mqtt_bulk_interval), true, fanpico_mqtt_publish_bulk },
+	{ "mqtt_reconnect", 1000, 0, true, fanpico_mqtt_reconnect },
+	{ NULL, 0, 0, false, NULL }
+};
+
+
+/* Run network tasks that are due, returns next deadline. */
+static absolute_time_t network_tasks_poll(absolute_time_t t_now, bool mqtt_active)
+{
+	absolute_time_t t_next = at_the_end_of_time;
+	absolute_time_t t_deadline;
+	struct network_task *t;
+	uint32_t period;
+	int i;
+
+	for (t = network_tasks, i = 0; t->name; t++, i++) {
+		if (t->mqtt && !mqtt_active) {
+			/* Restart periods once MQTT client (re)connects */
+			t->last_run = nil_time;
+			continue;
+		}
+		period = t->period;
+		if (t->period_cfg)
+			period = *(const uint32_t*)((const char*)cfg + t->period_cfg) * 1000;
+		if (period == 0)
+			continue;
+
+		if (is_nil_time(t->last_run))
+			t->last_run = delayed_by_ms(t_now, i * NETWORK_TASK_STAGGER);
+		t_deadline = delayed_by_ms(t->last_run, period);
+		if (absolute_time_diff_us(t_deadline, t_now) >= 0) {
+			log_msg(LOG_DEBUG, "network: run task %s", t->name);
+			t->func();
+			t->last_run = t_now;
+#if PICO_CYW43_ARCH_POLL
+			/* Expect replies to anything that was sent */
+			wifi_activity = true;
+#endif
+			t_deadline = delayed_by_ms(t_now, period);
+		}
+		if (absolute_time_diff_us(t_deadline, t_next) > 0)
+			t_next = t_deadline;
+	}
+
+	return t_next;
+}
+
+
+
+
 void wifi_poll()
 {
-	static absolute_time_t ABSOLUTE_TIME_INITIALIZED_VAR(test_t, 0);
-	static absolute_time_t ABSOLUTE_TIME_INITIALIZED_VAR(publish_status_t, 0);
-	static absolute_time_t ABSOLUTE_TIME_INITIALIZED_VAR(publish_temp_t, 0);
-	static absolute_time_t ABSOLUTE_TIME_INITIALIZED_VAR(publish_rpm_t, 0);
-	static absolute_time_t ABSOLUTE_TIME_INITIALIZED_VAR(publish_duty_t, 0);
-	static absolute_time_t ABSOLUTE_TIME_INITIALIZED_VAR(command_t, 0);
-	static absolute_time_t ABSOLUTE_TIME_INITIALIZED_VAR(reconnect_t, 0);
+	static absolute_time_t ABSOLUTE_TIME_INITIALIZED_VAR(t_next_task, 0);
+	static uint32_t tasks_generation = 0;
+	static bool tasks_mqtt_active = false;
+	static uint8_t published_faults[FAN_MAX_COUNT];
 	static bool init_msg_sent = false;
+	absolute_time_t t_now;
+	bool mqtt_active;
 
 	if (!wifi_initialized)
 		return;
 
+	t_now = get_absolute_time();
 #if PICO_CYW43_ARCH_POLL
-	cyw43_arch_poll();
+	wifi_driver_poll(t_now);
 #endif
 
 	if (!network_initialized)
@@ -268,49 +443,31 @@ void wifi_poll()
 			}
 		}
 	}
-	if (time_passed(&test_t, 3600 * 1000)) {
-		uint32_t secs = to_us_since_boot(get_absolute_time()) / 1000000;
-		uint32_t mins =  secs / 60;
-		uint32_t hours = mins / 60;
-		uint32_t days = hours / 24;
-
-		syslog_msg(LOG_INFO, "Uptime: %lu days %02lu:%02lu:%02lu%s",
-			days, hours % 24, mins % 60, secs % 60,
-			(rebooted_by_watchdog ? " [Rebooted by watchdog]" : ""));
-	}
-	if (fanpico_mqtt_client_active()) {
-		/* Check for pending SCPI command received via MQTT */
-		if (time_passed(&command_t, 250)) {
-			fanpico_mqtt_scpi_command();
-		}
-
-		/* Publish status update to MQTT status topic */
-		if (cfg->mqtt_status_interval > 0) {
-			if (time_passed(&publish_status_t, cfg->mqtt_status_interval * 1000)) {
-				fanpico_mqtt_publish();
-			}
-		}
-		if (cfg->mqtt_temp_interval > 0) {
-			if (time_passed(&publish_temp_t, cfg->mqtt_temp_interval * 1000)) {
-				fanpico_mqtt_publish_temp();
-			}
-		}
-		if (cfg->mqtt_rpm_interval > 0) {
-			if (time_passed(&publish_rpm_t, cfg->mqtt_rpm_interval * 1000)) {
-				fanpico_mqtt_publish_rpm();
-			}
-		}
-		if (cfg->mqtt_duty_interval > 0) {
-			if (time_passed(&publish_duty_t, cfg->mqtt_duty_interval * 1000)) {
-				fanpico_mqtt_publish_duty();
-			}
-		}
-
-		if (time_passed(&reconnect_t, 1000)) {
-			fanpico_mqtt_reconnect();
+	/* Send any queued syslog messages */
+	syslog_poll();
+	/* Process input from telnet sessions */
+	if (cfg->telnet_active)
+		telnetserver_poll();
+	/* Send telemetry (if enabled) */
+	telemetry_poll();
+
+	mqtt_active = fanpico_mqtt_client_active();
+	if (mqtt_active) {
+		/* Publish status immediately when fan fault state changes */
+		if (memcmp(published_faults, fanpico_state->fan_fault, sizeof(published_faults))) {
+			memcpy(published_faults, fanpico_state->fan_fault, sizeof(published_faults));
+			fanpico_mqtt_publish();
 		}
 	}
 
+	/* Run periodic tasks (MQTT publishing, etc.) when next one is due */
+	if (absolute_time_diff_us(t_next_task, t_now) >= 0
+		|| tasks_generation != config_generation
+		|| tasks_mqtt_active != mqtt_active) {
+		tasks_generation = config_generation;
+		tasks_mqtt_active = mqtt_active;
+		t_next_task = network_tasks_poll(t_now, mqtt_active);
+	}
 }
 
 const char* wifi_ip()
@@ -425,6 +582,13 @@ void pico_set_system_time(long int sec)
 	log_msg(LOG_NOTICE, "SNTP Set System time: %s", asctime(ntp));
 }
 
+void network_reserve_pio()
+{
+#ifdef WIFI_SUPPORT
+	wifi_reserve_pio();
+#endif
+}
+
 void network_init()
 {
 #ifdef WIFI_SUPPORT
@@ -0,0 +1,110 @@
+/* onewire.c
+   Copyright (C) 2021-2024 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of FanPico.
+
+   FanPico is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   FanPico is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with FanPico. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "hardware/gpio.h"
+#include "hardware/pio.h"
+#include "hardware/clocks.h"
+
+#include "onewire.h"
+
+// Include the assembled PIO program
+#include "onewire.pio.h"
+
+
+/*
+ * Functions for PIO based 1-Wire bus master.
+ */
+
+#define ONEWIRE_PIO_CLOCK 500000  /* Hz */
+
+
+/* Function for loading 1-Wire program into a PIO.
+ * Returns program offset or -1 if there is no room in PIO instruction memory.
+ */
+int onewire_load_program(PIO pio)
+{
+	if (!pio_can_add_program(pio, &onewire_program))
+		return -1;
+
+	return pio_add_program(pio, &onewire_program);
+}
+
+
+/* Function to initialize PIO state machine to run 1-Wire program.
+ * State machine is left enabled and waiting for the first time slot.
+ */
+void onewire_program_init(PIO pio, uint sm, uint offset, uint pin)
+{
+	pio_sm_config config = onewire_program_get_default_config(offset);
+
+	/* Bus is driven low by switching pin to output */
+	pio_sm_set_pins_with_mask(pio, sm, 0, 1u << pin);
+	pio_sm_set_pindirs_with_mask(pio, sm, 0, 1u << pin);
+	pio_gpio_init(pio, pin);
+	gpio_pull_up(pin);
+
+	sm_config_set_sideset_pins(&config, pin);
+	sm_config_set_in_pins(&config, pin);
+	sm_config_set_out_shift(&config, true, true, 1);
+	sm_config_set_in_shift(&config, true, true, 1);
+	sm_config_set_clkdiv(&config, (float)clock_get_hz(clk_sys) / ONEWIRE_PIO_CLOCK);
+	pio_sm_init(pio, sm, offset + onewire_offset_slot, &config);
+	pio_sm_set_enabled(pio, sm, true);
+}
+
+
+/* Start reset (and presence detect) on the bus. This must only be
+ * called when there are no time slots in progress (or waiting in FIFO).
+ * Presence is reported by onewire_get_bit() (0 = device(s) present).
+ */
+void onewire_reset(PIO pio, uint sm, uint offset)
+{
+	pio_sm_clear_fifos(pio, sm);
+	pio_sm_exec(pio, sm, pio_encode_jmp(offset + onewire_offset_reset));
+}
+
+
+/* Queue a time slot (0 = write 0, 1 = write 1 or read bit).
+ * Returns false if TX FIFO is full.
+ */
+bool onewire_put_bit(PIO pio, uint sm, uint bit)
+{
+	if (pio_sm_is_tx_fifo_full(pio, sm))
+		return false;
+	pio_sm_put(pio, sm, bit & 1);
+	return true;
+}
+
+
+/* Get result of a time slot (or reset).
+ * Returns -1 if result is not yet available.
+ */
+int onewire_get_bit(PIO pio, uint sm)
+{
+	if (pio_sm_is_rx_fifo_empty(pio, sm))
+		return -1;
+	return pio_sm_get(pio, sm) >> 31;
+}
+
+
+/* eof :-) */
@@ -0,0 +1,31 @@
+/* onewire.h
+   Copyright (C) 2021-2024 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of FanPico.
+
+   FanPico is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   FanPico is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with FanPico. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef ONEWIRE_H
+#define ONEWIRE_H 1
+
+int onewire_load_program(PIO pio);
+void onewire_program_init(PIO pio, uint sm, uint offset, uint pin);
+void onewire_reset(PIO pio, uint sm, uint offset);
+bool onewire_put_bit(PIO pio, uint sm, uint bit);
+int onewire_get_bit(PIO pio, uint sm);
+
+#endif /* ONEWIRE_H */
@@ -0,0 +1,150 @@
+/* perf.c
+   Copyright (C) 2021-2024 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of FanPico.
+
+   FanPico is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   FanPico is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with FanPico. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+#include "hardware/structs/systick.h"
+
+#include "fanpico.h"
+
+
+/*
+ * Hot-path profiling counters.
+ *
+ * Cortex-M0+ has no DWT cycle counter, so each core's (24bit) SysTick
+ * timer is used as a free running cycle counter. SysTick wraps around
+ * every 2^24 cycles (~134ms @ 125MHz), so for longer measurements
+ * the (1us resolution) system timer is used instead.
+ *
+ * Each probe is only updated from one core. Resetting counters is done
+ * by bumping a generation number, the owning core then clears
+ * the counter on next update (so that core0 never writes to counters
+ * owned by core1).
+ */
+
+#define PERF_SYSTICK_MASK    0x00ffffff
+#define PERF_SYSTICK_MAX_US  100000
+
+static struct perf_counter perf_counters[PERF_PROBE_COUNT] = {
+	{ "tacho_read",      1 },
+	{ "pwm_read",        1 },
+	{ "sensor_read",     1 },
+	{ "vsensor_update",  1 },
+	{ "update_outputs",  1 },
+	{ "network_poll",    0 },
+	{ "display_status",  0 },
+	{ "process_command", 0 },
+};
+
+static volatile uint32_t perf_generation = 1;
+static uint32_t perf_cycles_per_us = 1;
+
+
+void perf_init()
+{
+	uint32_t clk = clock_get_hz(clk_sys) / 1000000;
+
+	perf_cycles_per_us = (clk > 0 ? clk : 1);
+
+	/* Setup SysTick on this core to run freely from processor clock. */
+	systick_hw->csr = 0;
+	systick_hw->rvr = PERF_SYSTICK_MASK;
+	systick_hw->cvr = 0;
+	systick_hw->csr = M0PLUS_SYST_CSR_CLKSOURCE_BITS | M0PLUS_SYST_CSR_ENABLE_BITS;
+}
+
+
+uint64_t perf_begin()
+{
+	uint32_t cycles = systick_hw->cvr;
+
+	return ((uint64_t)time_us_32() << 32) | cycles;
+}
+
+
+void perf_end(enum perf_probe probe, uint64_t start)
+{
+	uint32_t cycles = systick_hw->cvr;
+	uint32_t us = time_us_32() - (uint32_t)(start >> 32);
+	struct perf_counter *c;
+	uint32_t gen = perf_generation;
+	int bucket;
+
+	if (probe < 0 || probe >= PERF_PROBE_COUNT)
+		return;
+	c = &perf_counters[probe];
+
+	/* SysTick counts down... */
+	if (us < PERF_SYSTICK_MAX_US)
+		cycles = ((uint32_t)start - cycles) & PERF_SYSTICK_MASK;
+	else
+		cycles = (us < UINT32_MAX / perf_cycles_per_us ? us * perf_cycles_per_us : UINT32_MAX);
+
+	if (c->generation != gen) {
+		c->count = 0;
+		c->max = 0;
+		c->total = 0;
+		memset(c->hist, 0, sizeof(c->hist));
+		c->generation = gen;
+	}
+
+	bucket = (cycles > 1 ? 31 - __builtin_clz(cycles) : 0);
+	c->hist[bucket]++;
+	c->count++;
+	c->total += cycles;
+	if (cycles > c->max)
+		c->max = cycles;
+}
+
+
+void perf_reset()
+{
+	perf_generation++;
+}
+
+
+int perf_get(enum perf_probe probe, struct perf_counter *c)
+{
+	if (probe < 0 || probe >= PERF_PROBE_COUNT || !c)
+		return -1;
+
+	memcpy(c, &perf_counters[probe], sizeof(*c));
+	if (c->generation != perf_generation) {
+		/* Reset pending, owning core has not yet cleared the counter. */
+		c->count = 0;
+		c->max = 0;
+		c->total = 0;
+		memset(c->hist, 0, sizeof(c->hist));
+	}
+
+	return 0;
+}
+
+
+double perf_cycles_to_us(uint64_t cycles)
+{
+	return (double)cycles / perf_cycles_per_us;
+}
+
+
+/* eof :-) */
@@ -91,28 +91,39 @@ uint64_t pulseIn(int gpio, int value, uint32_t timeout_ms)
 
 uint pulse_pin = 0;
 volatile uint32_t pulse_counter = 0;
+volatile uint32_t pulse_target = 1;
 volatile bool measure_complete = false;
 absolute_time_t pulse_start;
 absolute_time_t pulse_end;
 uint32_t pulse_events;
 
 
-/* Interrupt handler to measure pulse interval
+/* Record (rising) edge seen at given time (in microseconds since boot).
+ * Called from interrupt handler, or when polling the pin (from RAM).
  */
-void __time_critical_func(pulse_measure_callback)(uint gpio, uint32_t events)
+void __time_critical_func(pulse_measure_edge)(uint64_t t_us)
 {
-	if (gpio != pulse_pin || pulse_counter > 1)
+	if (pulse_counter > pulse_target)
 		return;
 
 	if (pulse_counter == 0) {
-		pulse_start = get_absolute_time();
-		pulse_counter++;
-	}
-	else if (pulse_counter == 1) {
-		pulse_end = get_absolute_time();
-		measure_complete = true;
-		pulse_counter++;
+		update_us_since_boot(&pulse_start, t_us);
+	} else {
+		update_us_since_boot(&pulse_end, t_us);
+		if (pulse_counter == pulse_target)
+			measure_complete = true;
 	}
+	pulse_counter++;
+}
+
+/* Interrupt handler to measure pulse interval(s)
+ */
+void __time_critical_func(pulse_measure_callback)(uint gpio, uint32_t events)
+{
+	if (gpio != pulse_pin)
+		return;
+
+	pulse_measure_edge(to_us_since_boot(get_absolute_time()));
 }
 
 /* Setup a GPIO pin to be used for measurements */
@@ -120,6 +131,7 @@ void pulse_setup_interrupt(uint gpio, uint32_t events)
 {
 	pulse_pin = gpio;
 	pulse_events = events;
+	pulse_target = 1;
 	pulse_counter = 2;
 	measure_complete = false;
 
@@ -137,16 +149,25 @@ void pulse_enable_interrupt()
 	gpio_set_irq_enabled(pulse_pin, pulse_events, true);
 }
 
-/* Call to start measruement. */
-void pulse_start_measure()
+/* Call to start measurement over given number of pulse intervals. */
+void pulse_start_measure_intervals(uint intervals)
 {
 	pulse_disable_interrupt();
+	pulse_target = (intervals > 0 ? intervals : 1);
 	pulse_counter = 0;
 	measure_complete = false;
 	pulse_enable_interrupt();
 }
 
-/* Call to check if a pulse has been measured yet. */
+/* Call to start measruement. */
+void pulse_start_measure()
+{
+	pulse_start_measure_intervals(1);
+}
+
+/* Call to check if a pulse has been measured yet.
+ * Returns average pulse interval (when measuring multiple intervals).
+ */
 uint64_t pulse_interval()
 {
 	uint64_t delta;
@@ -157,7 +178,28 @@ uint64_t pulse_interval()
 	/* Calculate pulse length. */
 	delta = absolute_time_diff_us(pulse_start, pulse_end);
 
-	return delta;
+	return delta / pulse_target;
+}
+
+/* Call to stop measurement before it has completed.
+ * Returns average pulse interval based on the pulses seen so far
+ * (and number of intervals seen), or 0 if no complete intervals were seen.
+ */
+uint64_t pulse_stop_measure(uint *intervals)
+{
+	uint count;
+
+	pulse_disable_interrupt();
+	count = (pulse_counter > 1 ? pulse_counter - 1 : 0);
+	if (count > pulse_target)
+		count = pulse_target;
+	pulse_counter = pulse_target + 1;
+	if (intervals)
+		*intervals = count;
+	if (count < 1)
+		return 0;
+
+	return absolute_time_diff_us(pulse_start, pulse_end) / count;
 }
 
 
@@ -30,7 +30,10 @@ uint64_t pulseIn(int gpio, int value, uint32_t timeout_ms);
 void pulse_setup_interrupt(uint gpio, uint32_t events);
 void pulse_disable_interrupt();
 void pulse_start_measure();
+void pulse_start_measure_intervals(uint intervals);
 uint64_t pulse_interval();
+uint64_t pulse_stop_measure(uint *intervals);
+void pulse_measure_edge(uint64_t t_us);
 
 
 #endif /* PULSE_LEN_H */
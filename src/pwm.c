@@ -20,17 +20,26 @@
 */
 
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include "pico/stdlib.h"
 #include "hardware/gpio.h"
 #include "hardware/pwm.h"
 #include "hardware/clocks.h"
+#include "hardware/pio.h"
+#include "hardware/sync.h"
 
 #include "fanpico.h"
+#include "pwm_capture.h"
 
 #define PWM_IN_CLOCK_DIVIDER 100
 #define PWM_IN_SAMPLE_INTERVAL 10 /* milliseconds */
 
+#define PWM_CAPTURE_TIMEOUT 25 /* milliseconds */
+#define PWM_SIGNAL_LOST_TIMEOUT 100 /* milliseconds */
+#define PWM_OUT_SYNC_MARGIN 256 /* counts */
+#define PWM_OUT_SYNC_MAX_WAIT 1000 /* iterations */
+
 
 /*
  * Functions for generating (emulating) fan PWM control signal and
@@ -65,26 +74,108 @@ uint8_t mbfan_gpio_pwm_map[MBFAN_MAX_COUNT] = {
 
 /* Measured duty cycles from (motherboard) fan connectors.  */
 float mbfan_pwm_duty[MBFAN_MAX_COUNT];
+/* Measured frequencies of PWM signals (0 if not known).  */
+float mbfan_pwm_freq[MBFAN_MAX_COUNT];
+/* Flag for inputs that currently have no PWM signal.  */
+bool mbfan_pwm_lost[MBFAN_MAX_COUNT];
 
 uint pwm_out_top = 0;
 float pwm_in_count_rate = 0;
 
-/* Set PMW output signal duty cycle.
+/* PIO based PWM input capture. Each state machine handles inputs
+   where (input % pwm_capture_sm_count) equals state machine index. */
+struct pwm_capture_sm {
+	uint sm;
+	uint input;
+	bool skip;
+	absolute_time_t started;
+};
+
+struct pwm_capture_input {
+	uint64_t high_sum;
+	uint64_t period_sum;
+	uint32_t count;
+	absolute_time_t last_seen;
+};
+
+static PIO pwm_capture_pio = PWM_CAPTURE_PIO;
+static uint pwm_capture_offset = 0;
+static uint pwm_capture_sm_count = 0;
+static uint32_t pwm_capture_clk = 0;
+static struct pwm_capture_sm pwm_capture[PWM_CAPTURE_MAX_SM];
+static struct pwm_capture_input pwm_capture_inputs[MBFAN_MAX_COUNT];
+
+/* Fan PWM output levels. Changes are written to hardware in one batch
+   by apply_pwm_duty_cycles(). */
+static uint16_t pwm_out_level[FAN_MAX_COUNT];
+static uint32_t pwm_out_pending = 0;
+
+/* Set PMW output signal duty cycle (takes effect on next
+ * apply_pwm_duty_cycles() call).
  */
 void set_pwm_duty_cycle(uint fan, float duty)
 {
-	uint level, pin;
+	uint level;
 
 	assert(fan < FAN_COUNT);
-	pin = fan_gpio_pwm_map[fan];
-	if (duty >= 100.0) {
+	if (duty >= 100.0f) {
 		level = pwm_out_top + 1;
-	} else if (duty > 0.0) {
+	} else if (duty > 0.0f) {
 		level = (duty * (pwm_out_top + 1) / 100);
 	} else {
 		level = 0;
 	}
-	pwm_set_gpio_level(pin, level);
+	if (level == pwm_out_level[fan])
+		return;
+	pwm_out_level[fan] = level;
+	pwm_out_pending |= (1 << fan);
+}
+
+/* Write pending PWM output level changes to hardware.
+ *
+ * All fan output slices run in phase and counter-compare registers are
+ * latched by hardware when counter wraps, so writing all changed slices
+ * (both A and B channels at once) right after a wrap makes all changes
+ * take effect simultaneously at the next wrap.
+ */
+void apply_pwm_duty_cycles()
+{
+	uint32_t pending = pwm_out_pending;
+	uint slice, pin, a, b, c1, c2;
+	uint32_t irq;
+	int i;
+
+	if (!pending)
+		return;
+	pwm_out_pending = 0;
+
+	irq = save_and_disable_interrupts();
+
+	/* Avoid counter wrap (0 in phase-correct mode) during the update */
+	slice = pwm_gpio_to_slice_num(fan_gpio_pwm_map[0]);
+	for (i = 0; i < PWM_OUT_SYNC_MAX_WAIT; i++) {
+		c1 = pwm_get_counter(slice);
+		c2 = pwm_get_counter(slice);
+		if (c2 >= c1 || c2 > PWM_OUT_SYNC_MARGIN)
+			break;
+	}
+
+	for (i = 0; i < FAN_COUNT; i += 2) {
+		if (!(pending & (3 << i)))
+			continue;
+		pin = fan_gpio_pwm_map[i];
+		slice = pwm_gpio_to_slice_num(pin);
+		if (pwm_gpio_to_channel(pin) == PWM_CHAN_A) {
+			a = pwm_out_level[i];
+			b = pwm_out_level[i + 1];
+		} else {
+			a = pwm_out_level[i + 1];
+			b = pwm_out_level[i];
+		}
+		pwm_set_both_levels(slice, a, b);
+	}
+
+	restore_interrupts(irq);
 }
 
 
@@ -110,7 +201,7 @@ float get_pwm_duty_cycle(uint fan)
 	pwm_set_enabled(slice_num, false);
 	uint64_t t_end = to_us_since_boot(get_absolute_time());
 
-	float max_count = pwm_in_count_rate * ((t_end - t_start) / 1000000.0);
+	float max_count = pwm_in_count_rate * ((t_end - t_start) / 1000000.0f);
 
 	/* Get counter value and calculate duty cycle. */
 	counter = pwm_get_counter(slice_num);
@@ -120,9 +211,27 @@ float get_pwm_duty_cycle(uint fan)
 }
 
 
-/* Read multiple PWM signals simultaneously using PWM hardware.
+/* Apply configured filter to measured input duty cycle. */
+static float pwm_input_filter(const struct fanpico_control_config *config, int i, float duty)
+{
+	const struct mbfan_control *mbfan = &config->mbfans[i];
+
+	if (mbfan->filter != FILTER_NONE) {
+		float duty_f = filter(mbfan->filter, mbfan->filter_ctx, duty);
+		if (duty_f != duty) {
+			log_msg(LOG_DEBUG, "filter mbfan%d: %lf -> %lf\n", i+1, duty, duty_f);
+			duty = duty_f;
+		}
+	}
+
+	return duty;
+}
+
+
+/* Read multiple PWM signals simultaneously using PWM hardware
+ * (gated counters). This is used only if PIO capture is not available.
  */
-void get_pwm_duty_cycles(const struct fanpico_config *config)
+static void get_pwm_duty_cycles_gated(const struct fanpico_control_config *config)
 {
 	static uint state = 0;
 	static uint64_t t_start = 0;
@@ -145,7 +254,6 @@ void get_pwm_duty_cycles(const struct fanpico_config *config)
 		state = 1;
 	}
 	else if (state == 1) {
-		//busy_wait_ms(PWM_IN_SAMPLE_INTERVAL);
 		uint64_t t_end = to_us_since_boot(get_absolute_time());
 		if (t_end - t_start < PWM_IN_SAMPLE_INTERVAL * 1000)
 			return;
@@ -156,7 +264,7 @@ void get_pwm_duty_cycles(const struct fanpico_config *config)
 		}
 		t_end = to_us_since_boot(get_absolute_time());
 
-		float max_count = pwm_in_count_rate * ((t_end - t_start) / 1000000.0);
+		float max_count = pwm_in_count_rate * ((t_end - t_start) / 1000000.0f);
 		if (max_count >= 65535) {
 			log_msg(LOG_INFO, "get_pwm_duty_cycles(): counter overflow: %f (%llu)",
 				max_count, (t_end - t_start));
@@ -165,26 +273,127 @@ void get_pwm_duty_cycles(const struct fanpico_config *config)
 
 		/* Calculate duty cycles based on measurements. */
 		for (i = 0; i < MBFAN_COUNT; i++) {
-			const struct mb_input *mbfan = &config->mbfans[i];
 			uint16_t counter = pwm_get_counter(slices[i]);
 			float duty = counter * 100 / max_count;
 
-			/* Apply filter */
-			if (mbfan->filter != FILTER_NONE) {
-				float duty_f = filter(mbfan->filter, mbfan->filter_ctx, duty);
-				if (duty_f != duty) {
-					log_msg(LOG_DEBUG, "filter mbfan%d: %lf -> %lf\n", i+1, duty, duty_f);
-					duty = duty_f;
-				}
-			}
+			mbfan_pwm_duty[i] = pwm_input_filter(config, i, duty);
+		}
+
+	}
+}
+
+
+/* Collect completed measurements from PWM capture state machine.
+ * State machine is moved to next input assigned to it once measurements
+ * are available (or after timeout if there is no signal).
+ */
+static void pwm_capture_poll(uint c, absolute_time_t t_now)
+{
+	struct pwm_capture_sm *cap = &pwm_capture[c];
+	struct pwm_capture_input *in = &pwm_capture_inputs[cap->input];
+	uint level = pio_sm_get_rx_fifo_level(pwm_capture_pio, cap->sm);
+	uint found = 0;
+
+	/* Measurements are pushed as (high count, low count) pairs. */
+	while (level >= 2) {
+		uint32_t high = pio_sm_get(pwm_capture_pio, cap->sm);
+		uint32_t low = pio_sm_get(pwm_capture_pio, cap->sm);
+		level -= 2;
+
+		/* First measurement after restart is not aligned, skip it. */
+		if (cap->skip) {
+			cap->skip = false;
+			continue;
+		}
+		high = PWM_CAPTURE_HIGH_CYCLES + PWM_CAPTURE_LOOP_CYCLES * high;
+		low = PWM_CAPTURE_LOW_CYCLES + PWM_CAPTURE_LOOP_CYCLES * low;
+		in->high_sum += high;
+		in->period_sum += high + low;
+		in->count++;
+		found++;
+	}
+
+	if (found > 0)
+		in->last_seen = t_now;
+	else if (absolute_time_diff_us(cap->started, t_now) < PWM_CAPTURE_TIMEOUT * 1000)
+		return;
+
+	/* Move to next input handled by this state machine (restart
+	   capture also when state machine has only one input, so that
+	   RX FIFO always contains fresh measurements). */
+	do {
+		cap->input = (cap->input + 1) % MBFAN_COUNT;
+	} while (cap->input % pwm_capture_sm_count != c);
+	cap->skip = true;
+	cap->started = t_now;
+	pwm_capture_set_pin(pwm_capture_pio, cap->sm, pwm_capture_offset,
+			mbfan_gpio_pwm_map[cap->input]);
+}
+
+
+/* Read multiple PWM signals using PIO capture.
+ * High and low times of each input are averaged over sample interval.
+ */
+static void get_pwm_duty_cycles_capture(const struct fanpico_control_config *config)
+{
+	static absolute_time_t t_last;
+	absolute_time_t t_now = get_absolute_time();
+	int i;
+
+	for (i = 0; i < pwm_capture_sm_count; i++)
+		pwm_capture_poll(i, t_now);
+
+	if (absolute_time_diff_us(t_last, t_now) < PWM_IN_SAMPLE_INTERVAL * 1000)
+		return;
+	t_last = t_now;
 
-			mbfan_pwm_duty[i] = duty;
+	for (i = 0; i < MBFAN_COUNT; i++) {
+		struct pwm_capture_input *in = &pwm_capture_inputs[i];
+		float duty;
+
+		if (in->count > 0) {
+			duty = (in->high_sum * 100.0f) / in->period_sum;
+			mbfan_pwm_freq[i] = ((float)in->count * pwm_capture_clk) / in->period_sum;
+			in->high_sum = 0;
+			in->period_sum = 0;
+			in->count = 0;
+			if (mbfan_pwm_lost[i]) {
+				log_msg(LOG_NOTICE, "mbfan%d: PWM input signal restored", i + 1);
+				mbfan_pwm_lost[i] = false;
+			}
+		}
+		else if (absolute_time_diff_us(in->last_seen, t_now) > PWM_SIGNAL_LOST_TIMEOUT * 1000) {
+			/* No edges seen, signal is stuck at static level. */
+			bool pin_level = gpio_get(mbfan_gpio_pwm_map[i]);
+			duty = (pin_level ? 100.0f : 0.0f);
+			mbfan_pwm_freq[i] = 0.0;
+			if (!mbfan_pwm_lost[i]) {
+				log_msg(LOG_NOTICE, "mbfan%d: PWM input signal lost (stuck %s)",
+					i + 1, (pin_level ? "high" : "low"));
+				mbfan_pwm_lost[i] = true;
+			}
+		}
+		else {
+			/* No new measurements (yet) */
+			continue;
 		}
 
+		mbfan_pwm_duty[i] = pwm_input_filter(config, i, duty);
 	}
 }
 
 
+/* Read (update) duty cycles of all PWM input signals.
+ */
+void get_pwm_duty_cycles(const struct fanpico_control_config *config)
+{
+	if (pwm_capture_sm_count > 0)
+		get_pwm_duty_cycles_capture(config);
+	else
+		get_pwm_duty_cycles_gated(config);
+}
+
+
 /* Initialize PWM hardware to generate 25kHz PWM signal on output pins.
  */
 void setup_pwm_outputs()
@@ -192,6 +401,7 @@ void setup_pwm_outputs()
 	uint32_t sys_clock = clock_get_hz(clk_sys);
 	pwm_config config = pwm_get_default_config();
 	uint pwm_freq = 25000;
+	uint32_t mask = 0;
 	uint slice_num;
 	int i;
 
@@ -215,14 +425,80 @@ void setup_pwm_outputs()
 		slice_num = pwm_gpio_to_slice_num(pin1);
 		/* two consecutive pins must belong to same PWM slice... */
 		assert(slice_num == pwm_gpio_to_slice_num(pin2));
-		pwm_init(slice_num, &config, true);
+		pwm_init(slice_num, &config, false);
+		mask |= (1 << slice_num);
 	}
 
+	/* Start all output slices at once, so that they run in phase */
+	hw_set_bits(&pwm_hw->en, mask);
+
 }
 
 
 /* Initialize PWM hardware for measuring input signal duty cycle on input pins.
  */
+/* Initialize PIO based PWM input capture.
+ * Returns number of state machines in use (0 if PIO capture
+ * is not available).
+ */
+static uint setup_pwm_capture()
+{
+	int offset, sm, i;
+	uint count = 0;
+
+	if (!PWM_CAPTURE_SUPPORT) {
+		log_msg(LOG_NOTICE, "PWM capture: PIO%d reserved for tacho inputs and WiFi",
+			pio_get_index(pwm_capture_pio));
+		return 0;
+	}
+	if ((offset = pwm_capture_load_program(pwm_capture_pio)) < 0) {
+		log_msg(LOG_ERR, "PWM capture: no room for PIO%d program",
+			pio_get_index(pwm_capture_pio));
+		return 0;
+	}
+	pwm_capture_offset = offset;
+
+	while (count < PWM_CAPTURE_MAX_SM && count < MBFAN_COUNT) {
+		if ((sm = pio_claim_unused_sm(pwm_capture_pio, false)) < 0)
+			break;
+		pwm_capture[count].sm = sm;
+		count++;
+	}
+	if (count == 0) {
+		log_msg(LOG_ERR, "PWM capture: no free PIO%d state machines",
+			pio_get_index(pwm_capture_pio));
+		pwm_capture_unload_program(pwm_capture_pio, offset);
+		return 0;
+	}
+
+	pwm_capture_sm_count = count;
+	pwm_capture_clk = clock_get_hz(clk_sys);
+	absolute_time_t t_now = get_absolute_time();
+
+	for (i = 0; i < MBFAN_COUNT; i++) {
+		gpio_init(mbfan_gpio_pwm_map[i]);
+		pwm_capture_inputs[i].last_seen = t_now;
+	}
+
+	for (i = 0; i < count; i++) {
+		struct pwm_capture_sm *cap = &pwm_capture[i];
+		uint pin = mbfan_gpio_pwm_map[i];
+
+		cap->input = i;
+		cap->skip = true;
+		cap->started = t_now;
+		pwm_capture_program_init(pwm_capture_pio, cap->sm, pwm_capture_offset, pin);
+		pwm_capture_set_pin(pwm_capture_pio, cap->sm, pwm_capture_offset, pin);
+	}
+
+	log_msg(LOG_NOTICE, "PWM capture: PIO%d, %u state machine(s), resolution %.1fns",
+		pio_get_index(pwm_capture_pio), count,
+		PWM_CAPTURE_LOOP_CYCLES * 1000000000.0 / pwm_capture_clk);
+
+	return count;
+}
+
+
 void setup_pwm_inputs()
 {
 	pwm_config config = pwm_get_default_config();
@@ -231,6 +507,18 @@ void setup_pwm_inputs()
 
 	log_msg(LOG_NOTICE, "Initializing PWM Inputs...");
 
+	for (i = 0; i < MBFAN_COUNT; i++) {
+		mbfan_pwm_duty[i] = 0.0;
+		mbfan_pwm_freq[i] = 0.0;
+		mbfan_pwm_lost[i] = false;
+	}
+
+	if (setup_pwm_capture() > 0)
+		return;
+
+	/* Fallback to measuring duty cycle using PWM slices (gated counter) */
+	log_msg(LOG_NOTICE, "Using PWM slices for PWM input measurement.");
+
 	pwm_config_set_clkdiv_mode(&config, PWM_DIV_B_HIGH);
 	pwm_config_set_clkdiv(&config, PWM_IN_CLOCK_DIVIDER);
 
@@ -238,7 +526,6 @@ void setup_pwm_inputs()
 
 	for (i = 0; i < MBFAN_COUNT; i++) {
 		uint pin = mbfan_gpio_pwm_map[i];
-		mbfan_pwm_duty[i] = 0.0;
 
 		slice_num = pwm_gpio_to_slice_num(pin);
 		/* reading PWM signal must be done on B channel... */
@@ -250,40 +537,87 @@ void setup_pwm_inputs()
 }
 
 
-double pwm_map(const struct pwm_map *map, double val)
+/* Map value using PWM map. Control loop uses curves precompiled into
+ * fanpico_control_config, this is for other (core0) users. */
+float pwm_map(const struct pwm_map *map, float val)
 {
-	int i;
-	double newval;
+	struct curve c;
+
+	pwm_map_compile(map, &c);
+	return curve_eval(&c, val);
+}
 
-	// value is equal or smaller than first map point
-	if (val <= map->pwm[0][0])
-		return map->pwm[0][1];
 
-	// find the map points that the value falls in between of...
-	i = 1;
-	while(i < map->points-1 && map->pwm[i][0] < val)
-		i++;
+/* Determine order in which fan outputs should be evaluated, so that
+ * fans that use another fan as their source are evaluated after the
+ * source fan (topological sort of the fan "source graph").
+ * Fans that are part of a dependency loop are placed last (in index order).
+ * Returns number of fans that are in a loop.
+ */
+int pwm_fan_eval_order(const struct fanpico_control_config *config, uint8_t *order)
+{
+	uint8_t deps[FAN_MAX_COUNT];
+	uint8_t done[FAN_MAX_COUNT];
+	const struct fan_control *fan;
+	int i, loops, count = 0;
+	bool progress = true;
+
+	memset(done, 0, sizeof(done));
+	for (i = 0; i < FAN_COUNT; i++) {
+		fan = &config->fans[i];
+		deps[i] = (fan->s_type == PWM_FAN && fan->s_id < FAN_COUNT ? 1 : 0);
+	}
 
-	// value is larger or equal than last map point
-	if (val >= map->pwm[i][0])
-		return map->pwm[i][1];
+	while (progress) {
+		progress = false;
+		for (i = 0; i < FAN_COUNT; i++) {
+			if (done[i])
+				continue;
+			if (deps[i] && !done[config->fans[i].s_id])
+				continue;
+			order[count++] = i;
+			done[i] = 1;
+			progress = true;
+		}
+	}
 
-	// calculate mapping using the map points left (i-i) and right (i) of the value...
-	double a = (double)(map->pwm[i][1] - map->pwm[i-1][1]) / (double)(map->pwm[i][0] - map->pwm[i-1][0]);
-	newval = map->pwm[i-1][1] + a * (val - map->pwm[i-1][0]);
+	if (count == FAN_COUNT)
+		return 0;
+	loops = FAN_COUNT - count;
 
-	return newval;
+	/* Remaining fans are in dependency loop(s) */
+	for (i = 0; i < FAN_COUNT; i++) {
+		if (!done[i])
+			order[count++] = i;
+	}
+	return loops;
 }
 
 
-double calculate_pwm_duty(struct fanpico_state *state, const struct fanpico_config *config, int i)
+/* Check if setting given source for a fan would create a dependency loop.
+ */
+bool pwm_source_loop(const struct fanpico_config *config, int fan, enum pwm_source_types type, uint16_t s_id)
 {
-	const struct fan_output *fan;
-	double val = 0;
+	int count = 0;
 
-	fan = &config->fans[i];
+	while (type == PWM_FAN && s_id < FAN_COUNT) {
+		if (s_id == fan || ++count > FAN_COUNT)
+			return true;
+		type = config->fans[s_id].s_type;
+		s_id = config->fans[s_id].s_id;
+	}
+
+	return false;
+}
+
+
+/* Get (unfiltered) source value for a fan output.
+ */
+float pwm_source_value(struct fanpico_state *state, const struct fanpico_control_config *config, int i)
+{
+	const struct fan_control *fan = &config->fans[i];
+	float val = 0;
 
-	/* Get source value  */
 	switch (fan->s_type) {
 	case PWM_FIXED:
 		val = fan->s_id;
@@ -292,31 +626,52 @@ double calculate_pwm_duty(struct fanpico_state *state, const struct fanpico_conf
 		val = state->mbfan_duty[fan->s_id];
 		break;
 	case PWM_SENSOR:
-		val = sensor_get_duty(&config->sensors[fan->s_id].map, state->temp[fan->s_id]);
+		val = sensor_get_lut_duty(fan->s_id, config, state->temp[fan->s_id]);
 		break;
 	case PWM_VSENSOR:
-		val = sensor_get_duty(&config->vsensors[fan->s_id].map, state->vtemp[fan->s_id]);
+		val = curve_eval(&config->vsensors[fan->s_id].curve, state->vtemp[fan->s_id]);
 		break;
 	case PWM_FAN:
 		val = state->fan_duty[fan->s_id];
 		break;
 	}
 
+	return val;
+}
+
+
+float calculate_pwm_duty(struct fanpico_state *state, const struct fanpico_control_config *config, int i)
+{
+	const struct fan_control *fan;
+	float val;
+
+	fan = &config->fans[i];
+
+	/* Get source value  */
+	val = pwm_source_value(state, config, i);
+
 	/* Apply filter */
 	if (fan->filter != FILTER_NONE) {
-		double f_val = filter(fan->filter, fan->filter_ctx, val);
+		float f_val = filter(fan->filter, fan->filter_ctx, val);
 		if (f_val != val) {
-			log_msg(LOG_DEBUG, "filter fan%d: %lf -> %lf\n", i+1, val, f_val);
+			log_msg(LOG_DEBUG, "filter fan%d: %f -> %f\n", i+1, val, f_val);
 			val = f_val;
 		}
 	}
 
 	/* Apply mapping */
-	val = pwm_map(&fan->map, val);
+	val = curve_eval(&fan->curve, val);
 
 	/* Apply coefficient */
 	val *= fan->pwm_coefficient;
 
+	/* In RPM mode result is target speed (and limits apply to the PID output) */
+	if (rpm_control_enabled(fan)) {
+		if (val < 0.0f) val = 0.0f;
+		if (val > 100.0f) val = 100.0f;
+		return val;
+	}
+
 	/* Final step to enforce min/max limits for output */
 	if (val < fan->min_pwm) val = fan->min_pwm;
 	if (val > fan->max_pwm) val = fan->max_pwm;
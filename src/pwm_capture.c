@@ -0,0 +1,91 @@
+/* pwm_capture.c
+   Copyright (C) 2021-2024 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of FanPico.
+
+   FanPico is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   FanPico is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with FanPico. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "hardware/gpio.h"
+#include "hardware/pio.h"
+
+#include "pwm_capture.h"
+
+// Include the assembled PIO program
+#include "pwm_capture.pio.h"
+
+
+/*
+ * Functions for PIO based PWM input signal (high/low time) capture.
+ */
+
+
+/* Function for loading PWM capture program into a PIO.
+ * Returns program offset or -1 if there is no room in PIO instruction memory.
+ */
+int pwm_capture_load_program(PIO pio)
+{
+	if (!pio_can_add_program(pio, &pwm_capture_program))
+		return -1;
+
+	return pio_add_program(pio, &pwm_capture_program);
+}
+
+
+/* Function for removing PWM capture program from a PIO.
+ */
+void pwm_capture_unload_program(PIO pio, uint offset)
+{
+	pio_remove_program(pio, &pwm_capture_program, offset);
+}
+
+
+/* Function to initialize PIO state machine to run PWM capture program.
+ * State machine is left disabled, call pwm_capture_set_pin() to
+ * start capturing.
+ */
+void pwm_capture_program_init(PIO pio, uint sm, uint offset, uint pin)
+{
+	pio_sm_config config = pwm_capture_program_get_default_config(offset);
+
+	sm_config_set_in_pins(&config, pin);
+	sm_config_set_jmp_pin(&config, pin);
+	sm_config_set_in_shift(&config, false, false, 32);
+	sm_config_set_fifo_join(&config, PIO_FIFO_JOIN_RX);
+	sm_config_set_clkdiv(&config, 1.0);
+	pio_sm_init(pio, sm, offset, &config);
+}
+
+
+/* Function to (re)start PWM capture on given input pin.
+ */
+void pwm_capture_set_pin(PIO pio, uint sm, uint offset, uint pin)
+{
+	pio_sm_set_enabled(pio, sm, false);
+	pio_sm_clear_fifos(pio, sm);
+	pio_sm_restart(pio, sm);
+	pio_sm_set_in_pins(pio, sm, pin);
+	hw_write_masked(&pio->sm[sm].execctrl,
+			pin << PIO_SM0_EXECCTRL_JMP_PIN_LSB,
+			PIO_SM0_EXECCTRL_JMP_PIN_BITS);
+	pio_sm_exec(pio, sm, pio_encode_jmp(offset));
+	pio_sm_set_enabled(pio, sm, true);
+}
+
+
+/* eof :-) */
@@ -0,0 +1,37 @@
+/* pwm_capture.h
+   Copyright (C) 2021-2024 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of FanPico.
+
+   FanPico is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   FanPico is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with FanPico. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef PWM_CAPTURE_H
+#define PWM_CAPTURE_H 1
+
+/* Clock cycles not included in high time counter */
+#define PWM_CAPTURE_HIGH_CYCLES  5
+/* Clock cycles not included in low time counter */
+#define PWM_CAPTURE_LOW_CYCLES   2
+/* Clock cycles per counter loop iteration */
+#define PWM_CAPTURE_LOOP_CYCLES  2
+
+int pwm_capture_load_program(PIO pio);
+void pwm_capture_unload_program(PIO pio, uint offset);
+void pwm_capture_program_init(PIO pio, uint sm, uint offset, uint pin);
+void pwm_capture_set_pin(PIO pio, uint sm, uint offset, uint pin);
+
+#endif /* PWM_CAPTURE_H */
@@ -0,0 +1,180 @@
+/* rpm_control.c
+   Copyright (C) 2021-2024 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of FanPico.
+
+   FanPico is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   FanPico is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with FanPico. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "pico/stdlib.h"
+
+#include "fanpico.h"
+
+
+/*
+ * Closed-loop (RPM) fan control (runs on core1).
+ *
+ * For fans in RPM mode, output of the normal source/filter/map/coefficient
+ * chain is interpreted as target speed (in percent of fan's max_rpm).
+ * PID controller then adjusts PWM duty cycle (within min_pwm..max_pwm)
+ * to make the fan run at the target speed.
+ *
+ * Controller is stepped every time a new tacho measurement is available
+ * for the fan. Derivative term is calculated from the measurement (not
+ * the error) to avoid "kicks" when target changes, and integrator uses
+ * conditional integration (integrator is frozen while output is saturated
+ * in the direction of the error) to prevent windup.
+ */
+
+#define RPM_PID_MAX_DT  2.0f  /* s */
+
+struct rpm_pid {
+	bool active;
+	float target;
+	float integral;
+	float prev_rpm;
+	float out;
+	absolute_time_t last;
+};
+
+static struct rpm_pid rpm_pid[FAN_MAX_COUNT];
+
+
+bool rpm_control_enabled(const struct fan_control *fan)
+{
+	return (fan->rpm_mode && fan->max_rpm > 0);
+}
+
+
+/* Set new target speed (in percent of max_rpm). Returns current duty. */
+float rpm_control_set_target(int i, const struct fan_control *fan, float target, float duty)
+{
+	struct rpm_pid *p = &rpm_pid[i];
+
+	if (target < 0.0f)
+		target = 0.0f;
+	if (target > 100.0f)
+		target = 100.0f;
+	p->target = fan->max_rpm * target / 100;
+
+	if (!p->active) {
+		/* Bumpless start from the current duty cycle */
+		p->active = true;
+		p->integral = duty;
+		p->out = duty;
+		p->prev_rpm = fan_tacho_freq[i] * 60 / fan->rpm_factor;
+		p->last = fan_tacho_updated[i];
+	}
+
+	return p->out;
+}
+
+
+void rpm_control_reset(int i)
+{
+	memset(&rpm_pid[i], 0, sizeof(rpm_pid[i]));
+}
+
+
+float rpm_control_target(int i)
+{
+	return (rpm_pid[i].active ? rpm_pid[i].target : 0.0f);
+}
+
+
+static float rpm_pid_step(struct rpm_pid *p, const struct fan_control *fan,
+			float rpm, float dt)
+{
+	float err = p->target - rpm;
+	float integral, out, d;
+
+	if (p->target <= 0.0f) {
+		p->integral = fan->min_pwm;
+		return fan->min_pwm;
+	}
+
+	d = -fan->pid_kd * (rpm - p->prev_rpm) / dt;
+	integral = p->integral + fan->pid_ki * err * dt;
+	out = fan->pid_kp * err + integral + d;
+
+	if (out > fan->max_pwm) {
+		out = fan->max_pwm;
+		if (err < 0)
+			p->integral = integral;
+	} else if (out < fan->min_pwm) {
+		out = fan->min_pwm;
+		if (err > 0)
+			p->integral = integral;
+	} else {
+		p->integral = integral;
+	}
+
+	/* Keep integrator within output range */
+	if (p->integral > fan->max_pwm)
+		p->integral = fan->max_pwm;
+	if (p->integral < fan->min_pwm)
+		p->integral = fan->min_pwm;
+
+	return out;
+}
+
+
+/* Step controllers of all fans in RPM mode that have new tacho measurement. */
+void update_rpm_control(struct fanpico_state *state, const struct fanpico_control_config *config)
+{
+	const struct fan_control *fan;
+	struct rpm_pid *p;
+	float rpm, dt;
+	int i;
+
+	for (i = 0; i < FAN_COUNT; i++) {
+		p = &rpm_pid[i];
+		fan = &config->fans[i];
+		if (!p->active)
+			continue;
+		if (!rpm_control_enabled(fan)) {
+			rpm_control_reset(i);
+			continue;
+		}
+		dt = absolute_time_diff_us(p->last, fan_tacho_updated[i]) / 1000000.0f;
+		if (dt <= 0.0f)
+			continue;
+		if (dt > RPM_PID_MAX_DT)
+			dt = RPM_PID_MAX_DT;
+		p->last = fan_tacho_updated[i];
+
+		rpm = fan_tacho_freq[i] * 60 / fan->rpm_factor;
+		p->out = rpm_pid_step(p, fan, rpm, dt);
+		p->prev_rpm = rpm;
+
+		if (fault_fan_boost(i))
+			continue;
+		state->fan_duty[i] = p->out;
+		if (check_for_change(state->fan_duty_prev[i], state->fan_duty[i], 1.0)) {
+			log_msg(LOG_DEBUG, "fan%d: RPM control %.0f/%.0f RPM: PWM %.1f%% --> %.1f%%",
+				i + 1, rpm, p->target, state->fan_duty_prev[i], state->fan_duty[i]);
+			state->fan_duty_prev[i] = state->fan_duty[i];
+		}
+		set_pwm_duty_cycle(i, state->fan_duty[i]);
+	}
+	apply_pwm_duty_cycles();
+}
+
+
+/* eof :-) */
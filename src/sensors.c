@@ -25,6 +25,8 @@
 #include <assert.h>
 #include "pico/stdlib.h"
 #include "hardware/adc.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
 
 #include "fanpico.h"
 
@@ -38,14 +40,252 @@ uint8_t sensor_adc_map[SENSOR_MAX_COUNT] = {
 };
 
 
-double get_temperature(uint8_t input, const struct fanpico_config *config)
+/* Background ADC sampling.
+ *
+ * ADC runs freely in round-robin mode sampling all sensor inputs,
+ * and DMA copies samples from ADC FIFO alternating between two buffers.
+ * When a buffer is full, DMA interrupt handler calculates average for
+ * each sensor (decimation), so get_temperature() just needs to pick up
+ * the latest averaged value.
+ */
+
+#define ADC_SAMPLE_RATE     1000  /* samples/s (per sensor) */
+#define ADC_BLOCK_SAMPLES   64    /* samples per sensor averaged */
+#define ADC_RAW_FRAC_BITS   4
+#define ADC_BLOCK_TIME      (ADC_BLOCK_SAMPLES * 1000 / ADC_SAMPLE_RATE + 2)  /* ms */
+
+static int adc_dma = -1;
+static int adc_dma_ctrl = -1;
+static uint adc_channels = 0;
+static uint8_t sensor_adc_pos[SENSOR_MAX_COUNT];
+static uint16_t adc_buf[2][SENSOR_MAX_COUNT * ADC_BLOCK_SAMPLES];
+static uint16_t *adc_buf_addr[2] __attribute__((aligned(2 * sizeof(uint16_t*))));
+static uint adc_buf_done = 0;
+static volatile uint32_t sensor_adc_raw[SENSOR_MAX_COUNT];
+static volatile uint32_t adc_blocks = 0;
+static absolute_time_t adc_ready_time;
+
+
+/* Lookup tables for converting (averaged) raw ADC values to temperatures.
+ *
+ * Tables are built from sensor configuration by update_sensor_tables()
+ * and are indexed by the raw ADC value (SENSOR_LUT_SIZE segments), values
+ * in between table entries are linearly interpolated.
+ * Second table has sensor's temp_map "folded in" (raw ADC value to
+ * PWM duty cycle conversion).
+ */
+
+#define SENSOR_LUT_BITS   7
+#define SENSOR_LUT_SIZE   (1 << SENSOR_LUT_BITS)
+#define SENSOR_LUT_SHIFT  (12 + ADC_RAW_FRAC_BITS - SENSOR_LUT_BITS)
+#define SENSOR_RAW_MAX    (ADC_MAX_VALUE << ADC_RAW_FRAC_BITS)
+/* Readings within 0.1V of either rail are considered invalid */
+#define SENSOR_RAW_VALID_MIN ((uint32_t)(0.1 / ADC_REF_VOLTAGE * SENSOR_RAW_MAX))
+
+static float sensor_lut[SENSOR_MAX_COUNT][SENSOR_LUT_SIZE + 1];
+static float sensor_duty_lut[SENSOR_MAX_COUNT][SENSOR_LUT_SIZE + 1];
+static bool sensor_lut_valid[SENSOR_MAX_COUNT];
+static uint32_t sensor_last_raw[SENSOR_MAX_COUNT];
+static bool sensor_last_valid[SENSOR_MAX_COUNT];
+
+
+static void __time_critical_func(adc_dma_handler)()
+{
+	uint32_t sum[SENSOR_MAX_COUNT];
+	const uint16_t *buf;
+	uint len = adc_channels * ADC_BLOCK_SAMPLES;
+	uint i, c;
+
+	if (!dma_channel_get_irq1_status(adc_dma))
+		return;
+	dma_channel_acknowledge_irq1(adc_dma);
+
+	buf = adc_buf[adc_buf_done];
+	adc_buf_done ^= 1;
+
+	memset(sum, 0, sizeof(sum));
+	for (i = 0, c = 0; i < len; i++) {
+		sum[c] += buf[i] & 0x0fff;
+		if (++c >= adc_channels)
+			c = 0;
+	}
+
+	for (i = 0; i < SENSOR_COUNT; i++) {
+		sensor_adc_raw[i] = (sum[sensor_adc_pos[i]] << ADC_RAW_FRAC_BITS) / ADC_BLOCK_SAMPLES;
+	}
+	adc_blocks++;
+}
+
+
+/* Setup ADC for background (DMA) sampling of all sensor inputs.
+ * If DMA channels are not available, sensors are read (blocking)
+ * when get_temperature() is called.
+ */
+void setup_sensor_inputs()
+{
+	dma_channel_config c;
+	uint mask = 0;
+	uint first = 0;
+	int i, j;
+
+	for (i = 0; i < SENSOR_COUNT; i++)
+		mask |= (1 << sensor_adc_map[i]);
+	for (i = 0; i < SENSOR_COUNT; i++) {
+		sensor_adc_pos[i] = 0;
+		for (j = 0; j < sensor_adc_map[i]; j++) {
+			if (mask & (1 << j))
+				sensor_adc_pos[i]++;
+		}
+		if (sensor_adc_pos[i] == 0)
+			first = sensor_adc_map[i];
+	}
+	for (adc_channels = 0, j = mask; j; j &= j - 1)
+		adc_channels++;
+	adc_ready_time = get_absolute_time();
+
+	if ((adc_dma = dma_claim_unused_channel(false)) < 0 ||
+		(adc_dma_ctrl = dma_claim_unused_channel(false)) < 0) {
+		log_msg(LOG_NOTICE, "No free DMA channels for ADC sampling.");
+		if (adc_dma >= 0)
+			dma_channel_unclaim(adc_dma);
+		adc_dma = -1;
+		return;
+	}
+
+	adc_buf_addr[0] = adc_buf[1];
+	adc_buf_addr[1] = adc_buf[0];
+
+	adc_select_input(first);
+	adc_set_round_robin(mask);
+	adc_fifo_setup(true, true, 1, false, false);
+	adc_set_clkdiv(48000000.0 / (ADC_SAMPLE_RATE * adc_channels) - 1);
+
+	/* Control channel: switch data channel to the next buffer and restart it */
+	c = dma_channel_get_default_config(adc_dma_ctrl);
+	channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+	channel_config_set_read_increment(&c, true);
+	channel_config_set_write_increment(&c, false);
+	channel_config_set_ring(&c, false, 3);
+	dma_channel_configure(adc_dma_ctrl, &c,
+			&dma_hw->ch[adc_dma].al2_write_addr_trig,
+			adc_buf_addr, 1, false);
+
+	/* Data channel: copy samples from ADC FIFO into buffer */
+	c = dma_channel_get_default_config(adc_dma);
+	channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+	channel_config_set_read_increment(&c, false);
+	channel_config_set_write_increment(&c, true);
+	channel_config_set_dreq(&c, DREQ_ADC);
+	channel_config_set_chain_to(&c, adc_dma_ctrl);
+	dma_channel_configure(adc_dma, &c, adc_buf[0], &adc_hw->fifo,
+			adc_channels * ADC_BLOCK_SAMPLES, false);
+
+	dma_channel_set_irq1_enabled(adc_dma, true);
+	irq_add_shared_handler(DMA_IRQ_1, adc_dma_handler,
+			PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+	irq_set_enabled(DMA_IRQ_1, true);
+
+	dma_channel_start(adc_dma);
+	adc_run(true);
+	adc_ready_time = make_timeout_time_ms(ADC_BLOCK_TIME);
+
+	log_msg(LOG_NOTICE, "ADC sampling: %u channels @ %uHz, DMA%d/%d",
+		adc_channels, ADC_SAMPLE_RATE, adc_dma, adc_dma_ctrl);
+}
+
+
+/* Return time when first (averaged) readings are available from
+ * background sampling, sensors should not be read before this.
+ */
+absolute_time_t sensor_inputs_ready_time()
+{
+	return adc_ready_time;
+}
+
+
+/* Check if raw reading is within valid range for the sensor type. */
+static inline bool sensor_raw_valid(const struct sensor_control *sensor, uint32_t raw)
+{
+	if (sensor->type == TEMP_INTERNAL)
+		return true;
+	return (raw > SENSOR_RAW_VALID_MIN && raw < SENSOR_RAW_MAX - SENSOR_RAW_VALID_MIN);
+}
+
+
+/* Convert raw ADC reading (with ADC_RAW_FRAC_BITS fractional bits)
+ * to temperature.
+ */
+static double sensor_raw_to_temp(const struct sensor_control *sensor, uint32_t raw)
+{
+	double t, r;
+	double volt = raw * (ADC_REF_VOLTAGE / SENSOR_RAW_MAX);
+
+	if (sensor->type == TEMP_INTERNAL) {
+		t = 27.0 - ((volt - 0.706) / 0.001721);
+	} else {
+		if (raw < 1)
+			raw = 1;
+		if (raw >= SENSOR_RAW_MAX)
+			raw = SENSOR_RAW_MAX - 1;
+		r = SENSOR_SERIES_RESISTANCE / (((double)SENSOR_RAW_MAX / raw) - 1);
+		t = log(r / sensor->thermistor_nominal);
+		t /= sensor->beta_coefficient;
+		t += 1.0 / (sensor->temp_nominal + 273.15);
+		t = 1.0 / t;
+		t -= 273.15;
+	}
+
+	return t * sensor->temp_coefficient + sensor->temp_offset;
+}
+
+
+static inline float sensor_lut_lookup(const float *lut, uint32_t raw)
+{
+	uint idx = raw >> SENSOR_LUT_SHIFT;
+	uint frac = raw & ((1 << SENSOR_LUT_SHIFT) - 1);
+
+	if (idx >= SENSOR_LUT_SIZE)
+		return lut[SENSOR_LUT_SIZE];
+
+	return lut[idx] + (lut[idx + 1] - lut[idx]) * frac / (1 << SENSOR_LUT_SHIFT);
+}
+
+
+/* Build temperature lookup tables, this should be called whenever
+ * sensor configuration has changed.
+ */
+void update_sensor_tables(const struct fanpico_control_config *config)
+{
+	const struct sensor_control *sensor;
+	uint64_t start, end;
+	double t;
+	int i, j;
+
+	start = to_us_since_boot(get_absolute_time());
+
+	for (i = 0; i < SENSOR_COUNT; i++) {
+		sensor = &config->sensors[i];
+		for (j = 0; j <= SENSOR_LUT_SIZE; j++) {
+			t = sensor_raw_to_temp(sensor, j << SENSOR_LUT_SHIFT);
+			sensor_lut[i][j] = t;
+			sensor_duty_lut[i][j] = curve_eval(&sensor->curve, t);
+		}
+		sensor_lut_valid[i] = true;
+	}
+
+	end = to_us_since_boot(get_absolute_time());
+	log_msg(LOG_DEBUG, "update_sensor_tables(): duration=%llu", end - start);
+}
+
+
+float get_temperature(uint8_t input, const struct fanpico_control_config *config)
 {
 	uint8_t pin;
 	uint32_t raw = 0;
 	uint64_t start, end;
-	double t, r, volt;
+	float t, volt;
 	int i;
-	const struct sensor_input *sensor;
+	const struct sensor_control *sensor;
 
 	if (input >= SENSOR_COUNT)
 		return 0.0;
@@ -54,76 +294,99 @@ double get_temperature(uint8_t input, const struct fanpico_config *config)
 
 	sensor = &config->sensors[input];
 
-	pin = sensor_adc_map[input];
-	adc_select_input(pin);
-	for (i = 0; i < ADC_AVG_WINDOW; i++) {
-		raw += adc_read();
+	if (adc_dma >= 0) {
+		/* Use latest average from background sampling. */
+		while (adc_blocks == 0) {
+			/* Wait for the first block of samples */
+			if (time_reached(adc_ready_time))
+				return 0.0;
+			tight_loop_contents();
+		}
+		raw = sensor_adc_raw[input];
+		volt = raw * (float)(ADC_REF_VOLTAGE / SENSOR_RAW_MAX);
+	} else {
+		pin = sensor_adc_map[input];
+		adc_select_input(pin);
+		for (i = 0; i < ADC_AVG_WINDOW; i++) {
+			raw += adc_read();
+		}
+		raw /= ADC_AVG_WINDOW;
+		raw <<= ADC_RAW_FRAC_BITS;
+		volt = raw * (float)(ADC_REF_VOLTAGE / SENSOR_RAW_MAX);
 	}
-	raw /= ADC_AVG_WINDOW;
-	volt = raw * (ADC_REF_VOLTAGE / ADC_MAX_VALUE);
 
-	if (sensor->type == TEMP_INTERNAL) {
-		t = 27.0 - ((volt - 0.706) / 0.001721);
-		t = t * sensor->temp_coefficient + sensor->temp_offset;
+	sensor_last_raw[input] = raw;
+	sensor_last_valid[input] = sensor_raw_valid(sensor, raw);
+	if (!sensor_last_valid[input]) {
+		t = 0.0;
+	} else if (sensor_lut_valid[input]) {
+		t = sensor_lut_lookup(sensor_lut[input], raw);
 	} else {
-		if (volt > 0.1 && volt < ADC_REF_VOLTAGE - 0.1) {
-			r = SENSOR_SERIES_RESISTANCE / (((double)ADC_MAX_VALUE / raw) - 1);
-			t = log(r / sensor->thermistor_nominal);
-			t /= sensor->beta_coefficient;
-			t += 1.0 / (sensor->temp_nominal + 273.15);
-			t = 1.0 / t;
-			t -= 273.15;
-			t = t * sensor->temp_coefficient + sensor->temp_offset;
-		} else {
-			t = 0.0;
-		}
+		t = sensor_raw_to_temp(sensor, raw);
 	}
 
 	/* Apply filter */
 	if (sensor->filter != FILTER_NONE) {
-		double t_f = filter(sensor->filter, sensor->filter_ctx, t);
+		float t_f = filter(sensor->filter, sensor->filter_ctx, t);
 		if (t_f != t) {
-			log_msg(LOG_DEBUG, "filter sensor%d: %lf -> %lf\n", i+1, t, t_f);
+			log_msg(LOG_DEBUG, "filter sensor%d: %f -> %f\n", input+1, t, t_f);
 			t = t_f;
 		}
 	}
 
 	end = to_us_since_boot(get_absolute_time());
 
-	log_msg(LOG_DEBUG, "get_temperature(%d): sensor_type=%u, raw=%u,  volt=%lf, temp=%lf (duration=%llu)",
+	log_msg(LOG_DEBUG, "get_temperature(%d): sensor_type=%u, raw=%u,  volt=%f, temp=%f (duration=%llu)",
 		input, sensor->type, raw, volt, t, end - start);
 
 	return t;
 }
 
 
-double sensor_get_duty(const struct temp_map *map, double temp)
+/* Map temperature using temp map. Control loop uses curves precompiled
+ * into fanpico_control_config, this is for other (core0) users. */
+float sensor_get_duty(const struct temp_map *map, float temp)
 {
-	int i;
-	double a, t;
+	struct curve c;
 
-	t = temp;
+	temp_map_compile(map, &c);
+	return curve_eval(&c, temp);
+}
 
-	if (t <= map->temp[0][0])
-		return map->temp[0][1];
 
-	i = 1;
-	while (i < map->points-1 && map->temp[i][0] < t)
-		i++;
+/* Get PWM duty cycle for a sensor using the lookup table (with temp_map
+ * folded in), this is only possible if there is no filter configured for
+ * the sensor. Otherwise falls back to mapping the (filtered) temperature.
+ */
+float sensor_get_lut_duty(uint8_t input, const struct fanpico_control_config *config, float temp)
+{
+	const struct sensor_control *sensor = &config->sensors[input];
 
-	if (t >= map->temp[i][0])
-		return map->temp[i][1];
+	if (sensor_lut_valid[input] && sensor_last_valid[input]
+		&& sensor->filter == FILTER_NONE)
+		return sensor_lut_lookup(sensor_duty_lut[input], sensor_last_raw[input]);
 
-	a = (double)(map->temp[i][1] - map->temp[i-1][1]) / (double)(map->temp[i][0] - map->temp[i-1][0]);
-	return map->temp[i-1][1] + a * (t - map->temp[i-1][0]);
+	return curve_eval(&sensor->curve, temp);
 }
 
 
-double get_vsensor(uint8_t i, struct fanpico_config *config,
+/* Status of digital (1-Wire/I2C) sensors used by virtual sensors. */
+#define DSENSOR_STARTUP_TIME  15000  /* ms */
+
+enum dsensor_states {
+	DSENSOR_INIT = 0,
+	DSENSOR_OK,
+	DSENSOR_FAILED,
+};
+
+static uint8_t dsensor_state[VSENSOR_MAX_COUNT];
+
+
+float get_vsensor(uint8_t i, struct fanpico_control_config *config,
 		struct fanpico_state *state)
 {
-	struct vsensor_input *s = &config->vsensors[i];
-	double t = state->vtemp[i];
+	struct vsensor_control *s = &config->vsensors[i];
+	float t = state->vtemp[i];
 
 	if (s->mode == VSMODE_MANUAL) {
 		/* Copy over values from WRITE:VSENSORx commands ... */
@@ -139,12 +402,34 @@ double get_vsensor(uint8_t i, struct fanpico_config *config,
 				t = s->default_temp;
 			}
 		}
+	} else if (s->mode == VSMODE_ONEWIRE || s->mode == VSMODE_I2C) {
+		/* Latest reading from digital sensor (updated by core0) */
+		if (dsensor_get_temp(i, &t)) {
+			if (dsensor_state[i] == DSENSOR_FAILED)
+				log_msg(LOG_NOTICE, "vsensor%d: sensor readings resumed", i + 1);
+			dsensor_state[i] = DSENSOR_OK;
+		} else {
+			/* Missing or stale reading, use default (fail-safe) temperature */
+			if (dsensor_state[i] != DSENSOR_FAILED && (dsensor_state[i] == DSENSOR_OK
+					|| to_ms_since_boot(get_absolute_time()) > DSENSOR_STARTUP_TIME)) {
+				log_msg(LOG_WARNING, "vsensor%d: no valid sensor reading, using default temperature %.1fC",
+					i + 1, s->default_temp);
+				dsensor_state[i] = DSENSOR_FAILED;
+			}
+			t = s->default_temp;
+		}
 	} else  {
 		int count = 0;
-		t = 0.0;
+		t = 0.0f;
+
+		for (int j = 0; j < VSENSOR_SOURCE_MAX_COUNT && s->sensors[j]; j++) {
+			uint8_t src = s->sensors[j];
+			float val;
 
-		for (int j = 0; j < SENSOR_COUNT && s->sensors[j]; j++) {
-			float val = state->temp[s->sensors[j] - 1];
+			if (src & VSENSOR_SOURCE_VSENSOR)
+				val = state->vtemp[(src & ~VSENSOR_SOURCE_VSENSOR) - 1];
+			else
+				val = state->temp[src - 1];
 			count++;
 
 			if (s->mode == VSMODE_MAX) {
@@ -174,9 +459,9 @@ double get_vsensor(uint8_t i, struct fanpico_config *config,
 
 	/* Apply filter */
 	if (s->filter != FILTER_NONE) {
-		double t_f = filter(s->filter, s->filter_ctx, t);
+		float t_f = filter(s->filter, s->filter_ctx, t);
 		if (t_f != t) {
-			log_msg(LOG_DEBUG, "filter vsensor%d: %lf -> %lf\n", i+1, t, t_f);
+			log_msg(LOG_DEBUG, "filter vsensor%d: %f -> %f\n", i+1, t, t_f);
 			t = t_f;
 		}
 	}
@@ -20,6 +20,7 @@
 */
 
 #include <stdio.h>
+#include <math.h>
 #include "pico/stdlib.h"
 #include "hardware/gpio.h"
 #include "hardware/pio.h"
@@ -33,8 +34,19 @@
 
 /*
  * Functions for PIO based Adjustable Square Wave Generator.
+ *
+ * Length of output signal period is 2 * 'period' + SQUARE_WAVE_GEN_OVERHEAD
+ * (PIO clock) cycles. To get exact output frequency (regardless of
+ * the remainder), state machine clock divider is set to the (8.8 fixed point)
+ * fractional value that stretches the integer period to the exact length.
+ * Hardware fractional divider dithers between integer divisions, so this
+ * requires no CPU time.
  */
 
+#define SQUARE_WAVE_GEN_OVERHEAD 10
+
+static uint32_t square_wave_gen_clkdiv[NUM_PIOS][NUM_PIO_STATE_MACHINES];
+
 
 /* Function for loading Square Wave generator program into a PIO.
  */
@@ -56,6 +68,7 @@ void square_wave_gen_program_init(PIO pio, uint sm, uint offset, uint pin)
 	sm_config_set_sideset_pins(&config, pin);
 	sm_config_set_clkdiv(&config, 1.0);
 	pio_sm_init(pio, sm, offset, &config);
+	square_wave_gen_clkdiv[pio_get_index(pio)][sm] = 1 << 8;
 }
 
 
@@ -68,31 +81,48 @@ void square_wave_gen_enabled(PIO pio, uint sm, bool enabled)
 
 
 /* Function to set output signal 'period' of a Square Wave generator.
+ * This never blocks: if previous value has not yet been consumed by
+ * the state machine, it is replaced by the new value.
  */
 void square_wave_gen_set_period(PIO pio, uint sm, uint32_t period)
 {
+	if (!pio_sm_is_tx_fifo_empty(pio, sm))
+		pio_sm_clear_fifos(pio, sm);
+
 	/* Write 'period' to TX FIFO. State machine copies this into register X */
-	pio_sm_put_blocking(pio, sm, period);
+	pio_sm_put(pio, sm, period);
 }
 
 
 /* Function to set output signal frequency of a Square Wave generator.
  */
-void square_wave_gen_set_freq(PIO pio, uint sm, double freq)
+void square_wave_gen_set_freq(PIO pio, uint sm, float freq)
 {
-	uint32_t sys_clock = clock_get_hz(clk_sys);
-	uint32_t period;
-
-	if (freq > 0) {
-		// Calculate 'period' needed to produce requested frequency square wave...
-		period = sys_clock / (freq * 2);
-		if (period > 5)
-			period -= 5;
-	} else {
+	uint32_t *clkdiv = &square_wave_gen_clkdiv[pio_get_index(pio)][sm];
+	uint64_t cycles;
+	uint32_t mhz, period, div;
+
+	mhz = (freq > 0 ? roundf(freq * 1000) : 0);
+	if (mhz == 0) {
 		// no output if frequency <= 0 ...
-		period = 0;
+		square_wave_gen_set_period(pio, sm, 0);
+		return;
 	}
 
+	/* Length of output period in 1/256 clock cycles */
+	cycles = ((uint64_t)clock_get_hz(clk_sys) * 256000 + mhz / 2) / mhz;
+	if (cycles < (SQUARE_WAVE_GEN_OVERHEAD + 2) << 8)
+		cycles = (SQUARE_WAVE_GEN_OVERHEAD + 2) << 8;
+	if (cycles > (uint64_t)UINT32_MAX << 8)
+		cycles = (uint64_t)UINT32_MAX << 8;
+
+	period = ((cycles >> 8) - SQUARE_WAVE_GEN_OVERHEAD) / 2;
+	div = (cycles + period + SQUARE_WAVE_GEN_OVERHEAD / 2) / (2 * (uint64_t)period + SQUARE_WAVE_GEN_OVERHEAD);
+
+	if (div != *clkdiv) {
+		pio_sm_set_clkdiv_int_frac(pio, sm, div >> 8, div & 0xff);
+		*clkdiv = div;
+	}
 	square_wave_gen_set_period(pio, sm, period);
 }
 
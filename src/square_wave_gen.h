@@ -27,7 +27,7 @@ uint square_wave_gen_load_program(PIO pio);
 void square_wave_gen_program_init(PIO pio, uint sm, uint offset, uint pin);
 void square_wave_gen_enabled(PIO pio, uint sm, bool enabled);
 void square_wave_gen_set_period(PIO pio, uint sm, uint32_t period);
-void square_wave_gen_set_freq(PIO pio, uint sm, double freq);
+void square_wave_gen_set_freq(PIO pio, uint sm, float freq);
 
 #endif /* SQUARE_WAVE_GEN_H */
 
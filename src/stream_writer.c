@@ -0,0 +1,206 @@
+/* stream_writer.c
+   Copyright (C) 2021-2024 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of FanPico.
+
+   FanPico is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   FanPico is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with FanPico. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+#include "pico/stdlib.h"
+
+#include "fanpico.h"
+
+
+/*
+ * Allocation free (JSON/CSV) output writer.
+ *
+ * Output is written directly into caller provided buffer. Writer keeps
+ * track of "virtual" position in the output stream, so output can be
+ * generated in chunks: first 'skip' bytes of output are discarded and
+ * output stops (overflow is set) once buffer is full. To produce next
+ * chunk, output is simply generated again with 'skip' set to number
+ * of bytes already consumed. Generators can check sw_full() to stop
+ * early once buffer has been filled.
+ */
+
+#define SW_PRINTF_MAX_LEN 96
+
+
+void sw_init(struct sw_writer *w, char *buf, size_t size, size_t skip)
+{
+	w->buf = (size > 0 ? buf : NULL);
+	/* Reserve space for terminating null */
+	w->size = (size > 0 ? size - 1 : 0);
+	w->skip = skip;
+	w->pos = 0;
+	w->len = 0;
+	w->overflow = (w->buf ? false : true);
+	w->depth = 0;
+	w->comma = 0;
+	if (w->buf)
+		w->buf[0] = 0;
+}
+
+
+void sw_write(struct sw_writer *w, const char *s, size_t len)
+{
+	size_t start = 0;
+	size_t count;
+
+	if (w->overflow)
+		return;
+
+	if (w->pos + len <= w->skip) {
+		w->pos += len;
+		return;
+	}
+	if (w->pos < w->skip)
+		start = w->skip - w->pos;
+
+	count = len - start;
+	if (count > w->size - w->len) {
+		count = w->size - w->len;
+		w->overflow = true;
+	}
+	memcpy(w->buf + w->len, s + start, count);
+	w->len += count;
+	w->pos += start + count;
+	w->buf[w->len] = 0;
+}
+
+
+void sw_puts(struct sw_writer *w, const char *s)
+{
+	sw_write(w, s, strlen(s));
+}
+
+
+void sw_printf(struct sw_writer *w, const char *fmt, ...)
+{
+	char tmp[SW_PRINTF_MAX_LEN];
+	va_list ap;
+	int len;
+
+	if (w->overflow)
+		return;
+
+	va_start(ap, fmt);
+	len = vsnprintf(tmp, sizeof(tmp), fmt, ap);
+	va_end(ap);
+
+	if (len < 0)
+		return;
+	if (len >= sizeof(tmp))
+		len = sizeof(tmp) - 1;
+	sw_write(w, tmp, len);
+}
+
+
+size_t sw_finish(struct sw_writer *w)
+{
+	if (w->buf)
+		w->buf[w->len] = 0;
+	return w->len;
+}
+
+
+/* JSON output... */
+
+static void sw_json_key(struct sw_writer *w, const char *key)
+{
+	uint32_t bit = (1UL << (w->depth & 0x1f));
+
+	if (w->comma & bit)
+		sw_write(w, ",", 1);
+	w->comma |= bit;
+
+	if (key) {
+		sw_json_str(w, key);
+		sw_write(w, ":", 1);
+	}
+}
+
+
+void sw_json_str(struct sw_writer *w, const char *s)
+{
+	const char *start = s;
+	char esc[8];
+
+	sw_write(w, "\"", 1);
+	while (*s) {
+		unsigned char c = *s;
+		if (c == '"' || c == '\\' || c < 0x20) {
+			sw_write(w, start, s - start);
+			if (c == '"' || c == '\\')
+				snprintf(esc, sizeof(esc), "\\%c", c);
+			else
+				snprintf(esc, sizeof(esc), "\\u%04x", c);
+			sw_puts(w, esc);
+			start = s + 1;
+		}
+		s++;
+	}
+	sw_write(w, start, s - start);
+	sw_write(w, "\"", 1);
+}
+
+
+void sw_json_begin(struct sw_writer *w, const char *key, char type)
+{
+	sw_json_key(w, key);
+	sw_write(w, (type == '[' ? "[" : "{"), 1);
+	w->depth++;
+	w->comma &= ~(1UL << (w->depth & 0x1f));
+}
+
+
+void sw_json_end(struct sw_writer *w, char type)
+{
+	if (w->depth > 0)
+		w->depth--;
+	sw_write(w, (type == ']' ? "]" : "}"), 1);
+}
+
+
+void sw_json_string(struct sw_writer *w, const char *key, const char *val)
+{
+	sw_json_key(w, key);
+	sw_json_str(w, (val ? val : ""));
+}
+
+
+void sw_json_int(struct sw_writer *w, const char *key, long val)
+{
+	sw_json_key(w, key);
+	sw_printf(w, "%ld", val);
+}
+
+
+void sw_json_float(struct sw_writer *w, const char *key, double val, int decimals)
+{
+	sw_json_key(w, key);
+	if (isnan(val) || isinf(val))
+		sw_write(w, "null", 4);
+	else
+		sw_printf(w, "%.*f", decimals, val);
+}
+
+
+/* eof :-) */
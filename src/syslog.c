@@ -21,6 +21,7 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
 #include <time.h>
 #include <assert.h>
 #include "hardware/rtc.h"
@@ -44,6 +45,35 @@ typedef struct syslog_t_ {
 
 static syslog_t *syslog = NULL;
 
+/* Syslog messages are queued and sent by syslog_poll() (from main loop),
+ * so that a burst of messages is sent using single lwIP lock acquisition
+ * (and optionally coalesced into fewer UDP datagrams). Rate limiting
+ * drops messages exceeding configured rate (per second) and sends a
+ * summary of suppressed messages instead.
+ */
+
+#define SYSLOG_QUEUE_SIZE 16
+#define SYSLOG_BATCH_MAX_LEN 1400 /* max datagram size when coalescing */
+
+struct syslog_queue_entry {
+	uint16_t len;
+	char msg[SYSLOG_MAX_MSG_LEN];
+};
+
+static struct syslog_queue_entry syslog_queue[SYSLOG_QUEUE_SIZE];
+static uint syslog_queue_head = 0;
+static uint syslog_queue_count = 0;
+
+/* Rate limiting */
+static uint64_t syslog_rate_sec = 0;
+static uint32_t syslog_rate_count = 0;
+static uint32_t syslog_suppressed = 0;
+
+/* Cached timestamp + hostname prefix (updated once per second) */
+static char syslog_prefix[64];
+static datetime_t syslog_prefix_t;
+static bool syslog_prefix_valid = false;
+
 
 syslog_t* syslog_init(const ip_addr_t *ipaddr, u16_t port)
 {
@@ -94,6 +124,8 @@ int syslog_open(const ip_addr_t *server, u16_t port, int facility, const char *h
 		return 0;
 
 	syslog = syslog_init(server, port);
+	syslog_queue_count = 0;
+	syslog_prefix_valid = false;
 	if (syslog) {
 		syslog->facility = facility;
 		syslog->hostname = strdup(hostname);
@@ -121,48 +153,154 @@ void syslog_close()
 }
 
 
+static const char* syslog_get_prefix(const datetime_t *t)
+{
+	struct tm tm;
+	uint len;
+
+	if (syslog_prefix_valid && t->sec == syslog_prefix_t.sec
+		&& t->min == syslog_prefix_t.min && t->hour == syslog_prefix_t.hour
+		&& t->day == syslog_prefix_t.day)
+		return syslog_prefix;
+
+	datetime_to_tm(t, &tm);
+	strftime(syslog_prefix, 18, "%b %e %T ", &tm);
+	len = strlen(syslog_prefix);
+	snprintf(&syslog_prefix[len], sizeof(syslog_prefix) - len, "%s ", syslog->hostname);
+	syslog_prefix_t = *t;
+	syslog_prefix_valid = true;
+
+	return syslog_prefix;
+}
+
+
+static void syslog_enqueue(int severity, const datetime_t *t, const char *format, va_list args)
+{
+	struct syslog_queue_entry *e;
+	uint len;
+
+	if (syslog_queue_count >= SYSLOG_QUEUE_SIZE) {
+		syslog_suppressed++;
+		return;
+	}
+	e = &syslog_queue[(syslog_queue_head + syslog_queue_count) % SYSLOG_QUEUE_SIZE];
+
+	/* Build syslog 'packet' ... */
+	snprintf(e->msg, sizeof(e->msg), "<%u>%s",
+		(syslog->facility << 3) | (severity & 0x07), syslog_get_prefix(t));
+	len = strlen(e->msg);
+	vsnprintf(&e->msg[len], sizeof(e->msg) - len - 1, format, args);
+	e->len = strlen(e->msg);
+
+	syslog_queue_count++;
+}
+
+
+static void syslog_enqueue_fmt(int severity, const datetime_t *t, const char *format, ...)
+{
+	va_list args;
+
+	va_start(args, format);
+	syslog_enqueue(severity, t, format, args);
+	va_end(args);
+}
+
+
+/* Check (per second) rate limit. Returns true if message can be sent. */
+static bool syslog_rate_check(const datetime_t *t)
+{
+	uint64_t sec = to_us_since_boot(get_absolute_time()) / 1000000;
+	uint32_t limit = cfg->syslog_rate;
+
+	if (sec != syslog_rate_sec) {
+		syslog_rate_sec = sec;
+		syslog_rate_count = 0;
+		if (syslog_suppressed > 0) {
+			syslog_enqueue_fmt(LOG_WARNING, t, "syslog: %lu message(s) suppressed",
+					syslog_suppressed);
+			syslog_suppressed = 0;
+		}
+	}
+
+	if (limit > 0 && syslog_rate_count >= limit) {
+		syslog_suppressed++;
+		return false;
+	}
+	syslog_rate_count++;
+
+	return true;
+}
+
+
 int syslog_msg(int severity, const char *format, ...)
 {
 	va_list args;
-	char buf[SYSLOG_MAX_MSG_LEN];
 	datetime_t t;
-	struct tm tm;
-	uint16_t len;
 
 	if (!format || !syslog)
 		return 1;
 	if (!rtc_get_datetime(&t))
 		return 2;
 
-	/* Build syslog 'packet' ... */
+	if (!syslog_rate_check(&t))
+		return 3;
 
-	/* priority */
-	snprintf(buf, 6, "<%u>",  (syslog->facility << 3) | (severity & 0x07));
-	len = strlen(buf);
-	/* timestamp */
-	datetime_to_tm(&t, &tm);
-	strftime(&buf[len], 18, "%b %e %T ", &tm);
-	len = strlen(buf);
-	/* hostname */
-	snprintf(&buf[len], 34, "%s ", syslog->hostname);
-	len = strlen(buf);
-	/* message */
 	va_start(args, format);
-	vsnprintf(&buf[len], sizeof(buf) - len - 1, format, args);
+	syslog_enqueue(severity, &t, format, args);
 	va_end(args);
-	len = strlen(buf);
 
-	/* printf("SYSLOG: '%s'\n", buf); */
+	return 0;
+}
+
+
+/* Send queued syslog messages. */
+void syslog_poll()
+{
+	struct syslog_queue_entry *e;
+	struct pbuf *p;
+	datetime_t t;
+	uint len, count;
+
+	if (!syslog)
+		return;
+
+	/* Send summary of suppressed messages once rate limit period is over. */
+	if (syslog_suppressed > 0 && rtc_get_datetime(&t))
+		syslog_rate_check(&t);
+
+	if (syslog_queue_count == 0)
+		return;
 
-	/* Send syslog (UDP) packet */
 	cyw43_arch_lwip_begin();
-	struct pbuf *p = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_RAM);
-	if (p) {
-		memcpy(p->payload, buf, len);
-		udp_send(syslog->pcb, p);
-		pbuf_free(p);
+	while (syslog_queue_count > 0) {
+		/* Find out how many messages go into this datagram. */
+		len = syslog_queue[syslog_queue_head].len;
+		count = 1;
+		if (cfg->syslog_batch) {
+			while (count < syslog_queue_count) {
+				e = &syslog_queue[(syslog_queue_head + count) % SYSLOG_QUEUE_SIZE];
+				if (len + 1 + e->len > SYSLOG_BATCH_MAX_LEN)
+					break;
+				len += 1 + e->len;
+				count++;
+			}
+		}
+
+		if ((p = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_RAM))) {
+			uint8_t *buf = p->payload;
+			for (int i = 0; i < count; i++) {
+				e = &syslog_queue[(syslog_queue_head + i) % SYSLOG_QUEUE_SIZE];
+				if (i > 0)
+					*buf++ = '\n';
+				memcpy(buf, e->msg, e->len);
+				buf += e->len;
+			}
+			udp_send(syslog->pcb, p);
+			pbuf_free(p);
+		}
+
+		syslog_queue_head = (syslog_queue_head + count) % SYSLOG_QUEUE_SIZE;
+		syslog_queue_count -= count;
 	}
 	cyw43_arch_lwip_end();
-
-	return 0;
 }
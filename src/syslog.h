@@ -32,6 +32,7 @@
 int syslog_open(const ip_addr_t *server, u16_t port, int facility, const char *hostname);
 void syslog_close();
 int syslog_msg(int priority, const char *format, ...);
+void syslog_poll();
 
 
 #endif /* _FANPICO_SYSLOG_H_ */
@@ -26,7 +26,10 @@
 #include "pico/stdlib.h"
 #include "hardware/gpio.h"
 #include "hardware/pio.h"
+#include "hardware/dma.h"
+#include "hardware/clocks.h"
 #include "square_wave_gen.h"
+#include "tacho_edge.h"
 #include "pulse_len.h"
 #include "fanpico.h"
 
@@ -77,32 +80,89 @@ absolute_time_t fan_tacho_last_read;
  */
 float fan_tacho_freq[FAN_MAX_COUNT];
 
+/* Array holding time of last tachometer frequency measurement (for each fan).
+ */
+absolute_time_t fan_tacho_updated[FAN_MAX_COUNT];
 
-PIO pio = pio0;
+/* Array holding time when tachometer pulses were last seen (for each fan).
+ * Used for (sub-second) stall detection.
+ */
+absolute_time_t fan_tacho_last_edge[FAN_MAX_COUNT];
 
-static uint8_t queue[FAN_MAX_COUNT] = { 0, 0, 0, 0, 0, 0 , 0, 0 };
-static uint8_t queue_pos[2] = { 0, 0 };
 
+PIO pio = TACHO_OUTPUT_PIO;
 
-/* Get next fan in the given queue. */
-int next_in_queue(uint8_t q)
-{
-	assert(q < 2);
 
-	if (queue_pos[q] >= FAN_MAX_COUNT) {
-		queue_pos[q] = 0;
-		return -1;
-	}
+#if TACHO_READ_MULTIPLEX == 0
+/* PIO based edge timestamping for tachometer inputs.
+ *
+ * PIO state machine pushes (pin sample, timestamp) pairs into RX FIFO
+ * whenever any of the tacho input pins change state (other pins are
+ * ignored). DMA copies these into a ring buffer, that is then processed
+ * by read_tacho_inputs().
+ * Frequency is calculated from the time between first and last rising edge
+ * seen during the (minimum) gate time. If PIO or DMA resources are not
+ * available, fall back to counting pulses using GPIO interrupts.
+ */
 
-	while (queue[queue_pos[q]] != q) {
-		queue_pos[q]++;
-		if (queue_pos[q] >= FAN_MAX_COUNT) {
-			queue_pos[q] = 0;
-			return -1;
-		}
-	}
-	return queue_pos[q]++;
-}
+#define TACHO_RING_BITS      11  /* 2048 bytes */
+#define TACHO_RING_SIZE      ((1 << TACHO_RING_BITS) / sizeof(uint32_t))
+#define TACHO_DMA_COUNT      0x80000000
+#define TACHO_MIN_GATE_TIME  250  /* ms */
+#define TACHO_EDGE_TIMEOUT   2000 /* ms */
+
+struct tacho_edge_state {
+	uint64_t first;
+	uint64_t last;
+	uint32_t edges;
+	absolute_time_t last_seen;
+};
+
+static PIO tacho_pio = TACHO_INPUT_PIO;
+static int tacho_sm = -1;
+static int tacho_dma = -1;
+static int tacho_dma_ctrl = -1;
+static uint32_t tacho_ring[TACHO_RING_SIZE] __attribute__((aligned(1 << TACHO_RING_BITS)));
+/* Not const, DMA reads this (must be in RAM, not in flash) */
+static uint32_t tacho_dma_count = TACHO_DMA_COUNT;
+static uint32_t tacho_dma_last_n = 0;
+static uint32_t tacho_ring_avail = 0;
+static uint tacho_ring_pos = 0;
+static bool tacho_resync = true;
+static uint32_t tacho_pin_mask = 0;
+static uint8_t tacho_bit_fan[32];
+static uint tacho_loop_cycles = 0;
+static uint32_t tacho_last_sample = 0;
+static uint32_t tacho_last_ts = 0;
+static uint64_t tacho_cycles = 0;
+static uint64_t tacho_gate_cycles = 0;
+static uint32_t tacho_sys_clock = 0;
+static struct tacho_edge_state tacho_edges[FAN_MAX_COUNT];
+static uint32_t tacho_ring_overflows = 0;
+#endif
+
+#if TACHO_READ_MULTIPLEX > 0
+/* Multiplexed tacho input measurement.
+ *
+ * Only one fan can be measured at a time, so each fan is "visited"
+ * periodically. Fan with the earliest revisit time is measured next.
+ * Number of pulse intervals measured (and visit timeout) is based on
+ * the last known speed of the fan, so that fast spinning fans are
+ * measured over several pulses and stopped fans do not block
+ * measurement of other fans for longer than necessary.
+ */
+
+#define TACHO_MUX_SETTLE_TIME        50   /* us */
+#define TACHO_MUX_MIN_VISIT_TIME     20   /* ms */
+#define TACHO_MUX_MAX_VISIT_TIME    600   /* ms (down to 50 RPM) */
+#define TACHO_MUX_TARGET_TIME       100   /* ms */
+#define TACHO_MUX_MAX_INTERVALS       8
+#define TACHO_MUX_REVISIT_TIME      500   /* ms */
+#define TACHO_MUX_IDLE_REVISIT_TIME 3000  /* ms */
+
+static absolute_time_t mux_next_visit[FAN_MAX_COUNT];
+static float mux_freq_hint[FAN_MAX_COUNT];
+#endif
 
 
 /* Function to select active multiplexer port. */
@@ -125,34 +185,214 @@ void __time_critical_func(fan_tacho_read_callback)(uint gpio, uint32_t events)
 }
 
 
+#if TACHO_READ_MULTIPLEX == 0
+/* Setup PIO state machine and DMA ring buffer for edge timestamping.
+ */
+static void setup_tacho_edge_sampler()
+{
+	dma_channel_config c;
+	int offset = -1;
+	int len;
+
+	/* Check that the program fits in the PIO allocation plan (fanpico.h) */
+	len = tacho_edge_program_len(tacho_pin_mask);
+	if (len < 0 || len > TACHO_EDGE_PIO_BUDGET) {
+		log_msg(LOG_ERR, "Tacho input program too large for PIO%d: %d > %d",
+			pio_get_index(tacho_pio), len, TACHO_EDGE_PIO_BUDGET);
+		return;
+	}
+	tacho_sm = pio_claim_unused_sm(tacho_pio, false);
+	if (tacho_sm < 0) {
+		log_msg(LOG_ERR, "No free PIO%d state machines for tacho inputs.",
+			pio_get_index(tacho_pio));
+		return;
+	}
+	if ((offset = tacho_edge_load_program(tacho_pio, tacho_pin_mask)) < 0) {
+		log_msg(LOG_ERR, "No room in PIO%d for tacho input program (%d instructions).",
+			pio_get_index(tacho_pio), len);
+		goto fail;
+	}
+	if ((tacho_dma = dma_claim_unused_channel(false)) < 0 ||
+		(tacho_dma_ctrl = dma_claim_unused_channel(false)) < 0) {
+		log_msg(LOG_ERR, "No free DMA channels for tacho inputs.");
+		goto fail;
+	}
+
+	tacho_sys_clock = clock_get_hz(clk_sys);
+	tacho_gate_cycles = (uint64_t)tacho_sys_clock * TACHO_MIN_GATE_TIME / 1000;
+	tacho_loop_cycles = tacho_edge_loop_cycles();
+	for (int i = 0; i < FAN_COUNT; i++) {
+		tacho_edges[i].edges = 0;
+		tacho_edges[i].last_seen = get_absolute_time();
+	}
+	/* Map sample bits to fans */
+	memset(tacho_bit_fan, 0, sizeof(tacho_bit_fan));
+	for (int i = 0, pin; (pin = tacho_edge_sample_pin(i)) >= 0; i++)
+		tacho_bit_fan[i] = gpio_fan_tacho_map[pin];
+
+	/* Control channel: restarts data channel once its transfer count runs out */
+	c = dma_channel_get_default_config(tacho_dma_ctrl);
+	channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+	channel_config_set_read_increment(&c, false);
+	channel_config_set_write_increment(&c, false);
+	dma_channel_configure(tacho_dma_ctrl, &c,
+			&dma_hw->ch[tacho_dma].al1_transfer_count_trig,
+			&tacho_dma_count, 1, false);
+
+	/* Data channel: copies samples from PIO RX FIFO into ring buffer */
+	c = dma_channel_get_default_config(tacho_dma);
+	channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+	channel_config_set_read_increment(&c, false);
+	channel_config_set_write_increment(&c, true);
+	channel_config_set_ring(&c, true, TACHO_RING_BITS);
+	channel_config_set_dreq(&c, pio_get_dreq(tacho_pio, tacho_sm, false));
+	channel_config_set_chain_to(&c, tacho_dma_ctrl);
+	dma_channel_configure(tacho_dma, &c, tacho_ring, &tacho_pio->rxf[tacho_sm],
+			TACHO_DMA_COUNT, true);
+
+	tacho_edge_program_init(tacho_pio, tacho_sm, offset);
+	tacho_edge_enabled(tacho_pio, tacho_sm, true);
+
+	log_msg(LOG_NOTICE, "Tacho inputs: PIO%d SM%d, DMA%d/%d (%u cycles/sample)",
+		pio_get_index(tacho_pio), tacho_sm, tacho_dma, tacho_dma_ctrl,
+		tacho_loop_cycles);
+	return;
+
+fail:
+	if (tacho_dma >= 0)
+		dma_channel_unclaim(tacho_dma);
+	tacho_dma = -1;
+	if (offset >= 0)
+		tacho_edge_unload_program(tacho_pio, offset);
+	pio_sm_unclaim(tacho_pio, tacho_sm);
+	tacho_sm = -1;
+}
+
+
+/* Process samples captured by PIO edge sampler (from DMA ring buffer).
+ */
+static void tacho_edge_process()
+{
+	absolute_time_t now = get_absolute_time();
+	uint32_t n, sample, ts, rising;
+	struct tacho_edge_state *e;
+	bool stalled;
+	int i, fan;
+
+	/* Check if PIO has stalled on full RX FIFO (lost time)... */
+	stalled = tacho_edge_rx_stalled(tacho_pio, tacho_sm);
+
+	/* Check how much new data DMA has written into ring buffer... */
+	n = TACHO_DMA_COUNT - dma_hw->ch[tacho_dma].transfer_count;
+	tacho_ring_avail += (n - tacho_dma_last_n) & (TACHO_DMA_COUNT - 1);
+	tacho_dma_last_n = n;
+
+	if (stalled || tacho_ring_avail > TACHO_RING_SIZE) {
+		/* Ring buffer (or RX FIFO) overflow, skip to latest data. */
+		tacho_ring_overflows++;
+		log_msg(LOG_INFO, "tacho input %s overflow (%lu)",
+			(stalled ? "FIFO" : "buffer"), tacho_ring_overflows);
+		tacho_ring_pos = (tacho_ring_pos + (tacho_ring_avail & ~1)) & (TACHO_RING_SIZE - 1);
+		tacho_ring_avail &= 1;
+		tacho_resync = true;
+		for (i = 0; i < FAN_COUNT; i++)
+			tacho_edges[i].edges = 0;
+	}
+
+	while (tacho_ring_avail >= 2) {
+		sample = tacho_ring[tacho_ring_pos];
+		ts = tacho_ring[tacho_ring_pos + 1];
+		tacho_ring_pos = (tacho_ring_pos + 2) & (TACHO_RING_SIZE - 1);
+		tacho_ring_avail -= 2;
+
+		if (tacho_resync) {
+			tacho_last_sample = sample;
+			tacho_last_ts = ts;
+			tacho_resync = false;
+			continue;
+		}
+
+		/* Timestamp counter counts down once per sampling loop */
+		tacho_cycles += (uint64_t)(tacho_last_ts - ts) * tacho_loop_cycles
+			+ TACHO_EDGE_PUSH_CYCLES;
+		tacho_last_ts = ts;
+
+		rising = sample & ~tacho_last_sample;
+		tacho_last_sample = sample;
+		while (rising) {
+			fan = tacho_bit_fan[__builtin_ctz(rising)] - 1;
+			rising &= rising - 1;
+			e = &tacho_edges[fan];
+			if (e->edges++ == 0)
+				e->first = tacho_cycles;
+			e->last = tacho_cycles;
+			e->last_seen = now;
+			fan_tacho_last_edge[fan] = now;
+		}
+	}
+
+	/* Calculate new frequencies for fans that have seen enough edges... */
+	for (i = 0; i < FAN_COUNT; i++) {
+		e = &tacho_edges[i];
+		if (e->edges >= 2 && e->last - e->first >= tacho_gate_cycles) {
+			fan_tacho_freq[i] = (float)(e->edges - 1) * tacho_sys_clock
+				/ (e->last - e->first);
+			fan_tacho_updated[i] = now;
+			e->first = e->last;
+			e->edges = 1;
+		}
+		else if (absolute_time_diff_us(e->last_seen, now) > TACHO_EDGE_TIMEOUT * 1000) {
+			fan_tacho_freq[i] = 0.0;
+			fan_tacho_updated[i] = now;
+			e->edges = 0;
+			e->last_seen = now;
+		}
+	}
+}
+#endif
+
+
 /* Function to update tachometer frequencies in fan_tacho_freq[]
  */
 void read_tacho_inputs()
 #if TACHO_READ_MULTIPLEX == 0
 {
+	static uint counters_seen[FAN_MAX_COUNT];
 	uint counters[FAN_COUNT];
 	int64_t delta;
-	double s;
+	float s;
 	uint pulses;
-	double f;
+	float f;
 	int i;
 
+	if (tacho_sm >= 0) {
+		tacho_edge_process();
+		return;
+	}
+
 	/* Read current counter values. */
 	for (i = 0; i < FAN_COUNT; i++) {
 		counters[i] = fan_tacho_counters[i];
 	}
 	absolute_time_t read_time = get_absolute_time();
+	for (i = 0; i < FAN_COUNT; i++) {
+		if (counters[i] != counters_seen[i]) {
+			counters_seen[i] = counters[i];
+			fan_tacho_last_edge[i] = read_time;
+		}
+	}
 
 	/* Calculate new frequency values, if enough time has passed... */
 	delta = absolute_time_diff_us(fan_tacho_last_read, read_time);
 	if (delta < 1000000)
 		return;
 
-	s = delta / 1000000.0;
+	s = delta / 1000000.0f;
 	for (i = 0; i < FAN_COUNT; i++) {
 		pulses = counters[i] - fan_tacho_counters_last[i];
 		f = pulses / s;
 		fan_tacho_freq[i] = f;
+		fan_tacho_updated[i] = read_time;
 	}
 
 	/* Save counter values for next time... */
@@ -164,76 +404,154 @@ void read_tacho_inputs()
 #else
 {
 	static int state = 0;
-	static int q = 0;
-	static absolute_time_t start_t;
-	static int i;
+	static int i = 0;
+	static absolute_time_t t_settle, t_timeout;
+	static uint intervals;
+	absolute_time_t now = get_absolute_time();
 	uint64_t t;
-	double f;
-//	uint64_t start, end;
+	uint count;
+	float f;
+	int j;
 
 	if (state == 0) {
-		/* Pick next fan to 'measure' from queues... */
-		i = next_in_queue(q);
-		if (i < 0) {
-			/* End of queue reached, go to next queue. */
-			if (++q >= 2)
-				q = 0;
-			return;
+		/* Pick next fan to measure (the one with earliest revisit time)... */
+		i = 0;
+		for (j = 1; j < FAN_COUNT; j++) {
+			if (absolute_time_diff_us(mux_next_visit[j], mux_next_visit[i]) > 0)
+				i = j;
 		}
+		if (absolute_time_diff_us(now, mux_next_visit[i]) > 0)
+			return;
 
-		/* process only one entry from second queue at a time */
-		if (q == 1) {
-			log_msg(LOG_DEBUG, "queue2: fan%d: read", i+1);
-			q = 0;
+		/* Determine how many pulses to measure and how long to wait for them. */
+		f = mux_freq_hint[i];
+		if (f > 0) {
+			intervals = clamp_int(f * TACHO_MUX_TARGET_TIME / 1000,
+					1, TACHO_MUX_MAX_INTERVALS);
+			t_timeout = delayed_by_ms(now, clamp_int(1500 * (intervals + 1) / f + 5,
+							TACHO_MUX_MIN_VISIT_TIME,
+							TACHO_MUX_MAX_VISIT_TIME));
+		} else {
+			intervals = 1;
+			t_timeout = delayed_by_ms(now, TACHO_MUX_MAX_VISIT_TIME);
 		}
 
-		/* Switch multiplexer to the fan we want to measure from... */
+		/* Switch multiplexer to the fan we want to measure from, and
+		   let the signal settle while core1 does other work... */
 		multiplexer_select(fan_gpio_tacho_map[i]);
-		busy_wait_us(50);
-		pulse_start_measure();
-		start_t = get_absolute_time();
-		state++;
+		t_settle = delayed_by_us(now, TACHO_MUX_SETTLE_TIME);
+		state = 1;
 	}
 	else if (state == 1) {
-		// Measure pulse up to 600ms (down to 50 RPM)...
-		//t = pulse_measure(FAN_TACHO_READ_PIN, 1, 0, 600);
-
+		if (absolute_time_diff_us(t_settle, now) < 0)
+			return;
+		pulse_start_measure_intervals(intervals);
+		state = 2;
+	}
+	else if (state == 2) {
 		t = pulse_interval();
+		count = intervals;
 		if (t == 0) {
-			if (!time_passed(&start_t, 600))
+			if (absolute_time_diff_us(t_timeout, now) < 0)
 				return;
+			/* Timeout, use the pulses measured so far (if any). */
+			t = pulse_stop_measure(&count);
 		}
 
 		if (t > 0) {
-			/* Fan is spinning, make sure fan is in the first queue... */
-			if (queue[i] != 0)
-				queue[i] = 0;
-
-			f = 1 / (t / 1000000.0);
-		}
-		else {
-			/* Fan not spinning, put this fan into second queue */
-			if (queue[i] != 1)
-				queue[i] = 1;
-
+			f = 1000000.0f / t;
+		} else if (mux_freq_hint[i] > 0) {
+			/* Fan may have slowed down, retry using maximum timeout ... */
+			log_msg(LOG_DEBUG, "fan%d: no pulses seen, retry", i + 1);
+			mux_freq_hint[i] = 0;
+			state = 0;
+			return;
+		} else {
 			f = 0;
 		}
 
-		log_msg(LOG_DEBUG + 0, "fan%d: pulse len=%llu", i+1, t);
+		log_msg(LOG_DEBUG, "fan%d: pulse len=%llu (%u)", i + 1, t, count);
 
 		fan_tacho_freq[i] = f;
+		fan_tacho_updated[i] = now;
+		if (f > 0)
+			fan_tacho_last_edge[i] = now;
+		mux_freq_hint[i] = f;
+		mux_next_visit[i] = delayed_by_ms(now, (f > 0 ? TACHO_MUX_REVISIT_TIME
+							: TACHO_MUX_IDLE_REVISIT_TIME));
 		state = 0;
 	}
 }
 #endif
 
 
+static uint32_t tacho_poll_last = 0;
+static uint64_t tacho_poll_t64 = 0;
+
+/* Prepare for tacho_poll(), must be called before flash (XIP) is disabled.
+ */
+void tacho_poll_start()
+{
+	tacho_poll_t64 = time_us_64();
+	tacho_poll_last = gpio_get_all();
+}
+
+
+/* Sample tacho input pin(s) by polling, while core1 cannot execute
+ * from flash (nor take interrupts), during flash erase/program operation.
+ * This (and everything it calls) must be RAM resident.
+ */
+void __not_in_flash_func(tacho_poll)()
+{
+	uint32_t in = gpio_get_all();
+	uint32_t rising = in & ~tacho_poll_last;
+
+	tacho_poll_last = in;
+	if (!rising)
+		return;
+
+#if TACHO_READ_MULTIPLEX > 0
+	if (rising & (1 << FAN_TACHO_READ_PIN)) {
+		/* Low 32bits of time_us_64() are same as time_us_32() */
+		pulse_measure_edge(tacho_poll_t64
+				+ (uint32_t)(time_us_32() - (uint32_t)tacho_poll_t64));
+	}
+#else
+	/* PIO/DMA keep sampling on their own */
+	if (tacho_sm >= 0)
+		return;
+
+	for (int i = 0; i < FAN_COUNT; i++) {
+		if (rising & (1 << fan_gpio_tacho_map[i]))
+			fan_tacho_counters[i]++;
+	}
+#endif
+}
+
+
+/* Finish tacho_poll(), must be called before interrupts are enabled again.
+ * Edges seen by tacho_poll() are also latched as pending GPIO interrupts,
+ * acknowledge these so that they do not get counted twice.
+ */
+void tacho_poll_end()
+{
+	tacho_poll();
+#if TACHO_READ_MULTIPLEX > 0
+	gpio_acknowledge_irq(FAN_TACHO_READ_PIN, GPIO_IRQ_EDGE_RISE);
+#else
+	for (int i = 0; i < FAN_COUNT; i++)
+		gpio_acknowledge_irq(fan_gpio_tacho_map[i], GPIO_IRQ_EDGE_RISE);
+#endif
+}
+
+
 /* Function to calculate tachometer frequencies.
  */
 void update_tacho_input_freq(struct fanpico_state *st)
 {
 	for (int i = 0; i < FAN_COUNT; i++) {
-		st->fan_freq[i] = roundf(fan_tacho_freq[i]*100)/100.0;
+		st->fan_freq[i] = roundf(fan_tacho_freq[i] * 100) / 100;
+		st->fan_freq_updated[i] = fan_tacho_updated[i];
 		if (check_for_change(st->fan_freq_prev[i], st->fan_freq[i], 1.0)) {
 			log_msg(LOG_INFO, "fan%d: Input Tacho change %.2fHz --> %.2fHz",
 				i+1,
@@ -260,9 +578,15 @@ void setup_tacho_inputs()
 		fan_tacho_counters[i] = 0;
 		fan_tacho_counters_last[i] = 0;
 		fan_tacho_freq[i] = 0.0;
+		fan_tacho_updated[i] = get_absolute_time();
+#if TACHO_READ_MULTIPLEX > 0
+		mux_next_visit[i] = get_absolute_time();
+		mux_freq_hint[i] = 0.0;
+#endif
 		pin = fan_gpio_tacho_map[i];
 		gpio_fan_tacho_map[pin] = 1 + i;
 #if TACHO_READ_MULTIPLEX == 0
+		tacho_pin_mask |= (1 << pin);
 		gpio_init(pin);
 		gpio_set_dir(pin, GPIO_IN);
 #endif
@@ -279,6 +603,8 @@ void setup_tacho_inputs()
 	gpio_set_dir(FAN_TACHO_READ_S1_PIN, GPIO_OUT);
 	gpio_set_dir(FAN_TACHO_READ_S2_PIN, GPIO_OUT);
 	multiplexer_select(0);
+#else
+	setup_tacho_edge_sampler();
 #endif
 
 	fan_tacho_last_read = get_absolute_time();
@@ -292,6 +618,10 @@ void setup_tacho_input_interrupts()
 #if TACHO_READ_MULTIPLEX > 0
 	pulse_setup_interrupt(FAN_TACHO_READ_PIN, GPIO_IRQ_EDGE_RISE);
 #else
+	/* No interrupts needed if using PIO for reading tacho inputs */
+	if (tacho_sm >= 0)
+		return;
+
 	/* Enable interrupts on Fan Tacho input pins */
 	gpio_set_irq_enabled_with_callback(FAN1_TACHO_READ_PIN,	GPIO_IRQ_EDGE_RISE,
 					true, &fan_tacho_read_callback);
@@ -303,7 +633,7 @@ void setup_tacho_input_interrupts()
 
 /* Function to set output frequency for tachometer output pin.
  */
-void set_tacho_output_freq(uint fan, double frequency)
+void set_tacho_output_freq(uint fan, float frequency)
 {
 	assert(fan < MBFAN_COUNT);
 	square_wave_gen_set_freq(pio, fan, frequency);
@@ -321,10 +651,13 @@ void setup_tacho_outputs()
 	/* Load square wave generator program to PIO */
 	uint pio_program_addr = square_wave_gen_load_program(pio);
 
-	/* Initialize PIO State machines for each tachometer output pin. */
+	/* Initialize PIO State machines for each tachometer output pin.
+	 * State machine N is used for mbfan N (claimed, so that other users
+	 * of the PIO cannot get these). */
 	for (i = 0; i < MBFAN_COUNT; i++) {
 		uint pin = mbfan_gpio_tacho_map[i];
 		uint sm = i;
+		pio_sm_claim(pio, sm);
 		square_wave_gen_program_init(pio, sm, pio_program_addr, pin);
 		square_wave_gen_set_period(pio, sm, 0);
 		square_wave_gen_enabled(pio, sm, true);
@@ -333,38 +666,23 @@ void setup_tacho_outputs()
 }
 
 
-double tacho_map(const struct tacho_map *map, double val)
+/* Map value using tacho map. Control loop uses curves precompiled into
+ * fanpico_control_config, this is for other (core0) users. */
+float tacho_map(const struct tacho_map *map, float val)
 {
-	int i;
-	double newval;
-
-	/* Value is equal or smaller than first map point */
-	if (val <= map->tacho[0][0])
-		return map->tacho[0][1];
-
-	/* Find the map points that the value falls in between of... */
-	i = 1;
-	while(i < map->points-1 && map->tacho[i][0] < val)
-		i++;
-
-	/* Value is larger or equal than last map point */
-	if (val >= map->tacho[i][0])
-		return map->tacho[i][1];
-
-	/* Calculate mapping using the map points left (i-i) and right (i) of the value... */
-	double a = (double)(map->tacho[i][1] - map->tacho[i-1][1]) / (double)(map->tacho[i][0] - map->tacho[i-1][0]);
-	newval = map->tacho[i-1][1] + a * (val - map->tacho[i-1][0]);
+	struct curve c;
 
-	return newval;
+	tacho_map_compile(map, &c);
+	return curve_eval(&c, val);
 }
 
 
-double calculate_tacho_freq(struct fanpico_state *state, const struct fanpico_config *config, int i)
+float calculate_tacho_freq(struct fanpico_state *state, const struct fanpico_control_config *config, int i)
 {
-	const struct mb_input *mbfan;
+	const struct mbfan_control *mbfan;
 	int count = 0;
-	double val = 0;
-	double sum = 0;
+	float val = 0;
+	float sum = 0;
 
 	mbfan = &config->mbfans[i];
 
@@ -373,14 +691,14 @@ double calculate_tacho_freq(struct fanpico_state *state, const struct fanpico_co
 		val = mbfan->s_id;
 		break;
 	case TACHO_FAN:
-		val = state->fan_freq[mbfan->s_id] * 60.0 / config->fans[mbfan->s_id].rpm_factor;
+		val = state->fan_freq[mbfan->s_id] * 60 / config->fans[mbfan->s_id].rpm_factor;
 		break;
 	case TACHO_MIN:
 	case TACHO_MAX:
 	case TACHO_AVG:
 		for (int i = 0; i < FAN_COUNT; i++) {
 			if (mbfan->sources[i]) {
-				val = state->fan_freq[i] * 60.0 / config->fans[i].rpm_factor;
+				val = state->fan_freq[i] * 60 / config->fans[i].rpm_factor;
 				if (count == 0) {
 					sum = val;
 				} else {
@@ -411,7 +729,7 @@ double calculate_tacho_freq(struct fanpico_state *state, const struct fanpico_co
 
 
 	/* apply mapping */
-	val = tacho_map(&mbfan->map, val);
+	val = curve_eval(&mbfan->curve, val);
 
 	/* apply coefficient */
 	val *= mbfan->rpm_coefficient;
@@ -420,7 +738,7 @@ double calculate_tacho_freq(struct fanpico_state *state, const struct fanpico_co
 	if (val > mbfan->max_rpm) val = mbfan->max_rpm;
 
 	/* convert RPM to frequency */
-	val = val / 60.0 * mbfan->rpm_factor;
+	val = val / 60 * mbfan->rpm_factor;
 
 	return val;
 }
@@ -0,0 +1,247 @@
+/* tacho_edge.c
+   Copyright (C) 2021-2024 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of FanPico.
+
+   FanPico is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   FanPico is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with FanPico. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "hardware/gpio.h"
+#include "hardware/pio.h"
+
+#include "tacho_edge.h"
+
+
+/*
+ * Functions for PIO based edge timestamping input sampler.
+ *
+ * Samples the tachometer input pins continuously and whenever any of them
+ * changes state pushes two words to RX FIFO: the new (packed) pin sample
+ * and a timestamp. Timestamp is a free running counter (Y) that is
+ * decremented once per sampling loop.
+ *
+ * Only the selected input pins are compared, so that other (fast) signals
+ * like the PWM outputs do not generate samples. Since PIO has no logic
+ * operations, the program is generated at runtime for the given pin mask:
+ * all pins are read into OSR and the runs of selected pins are shifted
+ * into ISR (unselected runs are shifted out to null). So bit N of a
+ * sample is the Nth selected pin in the order returned by
+ * tacho_edge_sample_pin().
+ *
+ * Pushes are blocking, so sample and timestamp words always stay in pairs.
+ * If RX FIFO is full (DMA not keeping up), state machine stalls and
+ * timestamp counter stops, this sets FDEBUG RXSTALL flag that is checked
+ * by tacho_edge_rx_stalled().
+ *
+ * X = previous sample, Y = timestamp counter
+ *
+ *   changed:
+ *       mov x, y          ; Save sample as previous sample
+ *       push block        ; Push sample (ISR)
+ *       in osr, 32        ; ISR = timestamp
+ *       push block        ; Push timestamp
+ *       mov y, osr        ; Restore timestamp
+ *       jmp y-- loop      ; Decrement timestamp
+ *   .wrap_target
+ *   loop:
+ *       mov osr, pins     ; Sample all pins (starting from IN base)
+ *       in osr, <n>       ; Keep run of <n> selected pins...
+ *       out null, <n>     ; ...and skip over them (and unselected pins)
+ *       ...
+ *       in null, <32 - count> ; Align packed sample to bit 0
+ *       mov osr, y        ; Save timestamp in OSR
+ *       mov y, isr        ; Y = sample
+ *       jmp x!=y changed  ; Any pin changed state since last sample?
+ *       mov y, osr        ; Restore timestamp
+ *       jmp y-- loop      ; Decrement timestamp
+ *   .wrap
+ */
+
+#define TACHO_EDGE_MAX_LEN  32  /* PIO instruction memory size */
+#define TACHO_EDGE_CHANGED  0
+#define TACHO_EDGE_LOOP     6
+
+static uint16_t tacho_edge_instr[TACHO_EDGE_MAX_LEN];
+static pio_program_t tacho_edge_program = {
+	.instructions = tacho_edge_instr,
+	.length = 0,
+	.origin = -1,
+};
+static uint tacho_edge_in_base = 0;
+static uint8_t tacho_edge_pins[32];
+static uint tacho_edge_pin_count = 0;
+
+
+/* Function for generating edge sampler program for given input pins.
+ * Returns program length or -1 if program does not fit in PIO.
+ */
+static int tacho_edge_build_program(uint32_t pin_mask)
+{
+	uint16_t *p = tacho_edge_instr;
+	uint base, pin, run, skip, i;
+	int len = 0;
+
+	if (!pin_mask)
+		return -1;
+
+	/* Start from the first pin of a run of selected pins (IN base wraps
+	   around at GPIO31, so the pins are treated as a circular list). */
+	for (base = 0; base < 32; base++) {
+		if ((pin_mask & (1u << base)) && !(pin_mask & (1u << ((base + 31) & 31))))
+			break;
+	}
+	if (base >= 32)
+		base = 0;
+	tacho_edge_in_base = base;
+
+	p[len++] = pio_encode_mov(pio_x, pio_y);
+	p[len++] = pio_encode_push(false, true);
+	p[len++] = pio_encode_in(pio_osr, 32);
+	p[len++] = pio_encode_push(false, true);
+	p[len++] = pio_encode_mov(pio_y, pio_osr);
+	p[len++] = pio_encode_jmp_y_dec(TACHO_EDGE_LOOP);
+	p[len++] = pio_encode_mov(pio_osr, pio_pins);
+
+	tacho_edge_pin_count = 0;
+	i = 0;
+	while (i < 32) {
+		for (run = 0; i < 32 && (pin_mask & (1u << (pin = (base + i) & 31))); i++, run++)
+			tacho_edge_pins[tacho_edge_pin_count++] = pin;
+		for (skip = 0; i < 32 && !(pin_mask & (1u << ((base + i) & 31))); i++)
+			skip++;
+		if (len + 2 > TACHO_EDGE_MAX_LEN)
+			return -1;
+		p[len++] = pio_encode_in(pio_osr, run);
+		if (i < 32)
+			p[len++] = pio_encode_out(pio_null, run + skip);
+	}
+	if (tacho_edge_pin_count < 32)
+		p[len++] = pio_encode_in(pio_null, 32 - tacho_edge_pin_count);
+
+	if (len + 5 > TACHO_EDGE_MAX_LEN)
+		return -1;
+	p[len++] = pio_encode_mov(pio_osr, pio_y);
+	p[len++] = pio_encode_mov(pio_y, pio_isr);
+	p[len++] = pio_encode_jmp_x_ne_y(TACHO_EDGE_CHANGED);
+	p[len++] = pio_encode_mov(pio_y, pio_osr);
+	p[len++] = pio_encode_jmp_y_dec(TACHO_EDGE_LOOP);
+
+	tacho_edge_program.length = len;
+
+	return len;
+}
+
+
+/* Function to return length of edge sampler program for given input pins.
+ * Returns -1 if program does not fit in PIO.
+ */
+int tacho_edge_program_len(uint32_t pin_mask)
+{
+	return tacho_edge_build_program(pin_mask);
+}
+
+
+/* Function for loading edge sampler program (for given input pins) into
+ * a PIO. Returns program offset or -1 if there is no room in PIO
+ * instruction memory.
+ */
+int tacho_edge_load_program(PIO pio, uint32_t pin_mask)
+{
+	if (tacho_edge_build_program(pin_mask) < 0)
+		return -1;
+	if (!pio_can_add_program(pio, &tacho_edge_program))
+		return -1;
+
+	return pio_add_program(pio, &tacho_edge_program);
+}
+
+
+/* Function for removing edge sampler program from a PIO.
+ */
+void tacho_edge_unload_program(PIO pio, uint offset)
+{
+	pio_remove_program(pio, &tacho_edge_program, offset);
+}
+
+
+/* Function to initialize PIO state machine to run edge sampler program.
+ */
+void tacho_edge_program_init(PIO pio, uint sm, uint offset)
+{
+	pio_sm_config config = pio_get_default_sm_config();
+
+	sm_config_set_wrap(&config, offset + TACHO_EDGE_LOOP,
+			offset + tacho_edge_program.length - 1);
+	sm_config_set_in_pins(&config, tacho_edge_in_base);
+	sm_config_set_in_shift(&config, true, false, 32);
+	sm_config_set_out_shift(&config, true, false, 32);
+	sm_config_set_fifo_join(&config, PIO_FIFO_JOIN_RX);
+	sm_config_set_clkdiv(&config, 1.0);
+	pio_sm_init(pio, sm, offset + TACHO_EDGE_LOOP, &config);
+
+	/* Initialize X (previous sample) and Y (timestamp counter) */
+	pio_sm_exec(pio, sm, pio_encode_set(pio_x, 0));
+	pio_sm_exec(pio, sm, pio_encode_mov(pio_y, pio_null));
+}
+
+
+/* Function to enable/disable edge sampler.
+ */
+void tacho_edge_enabled(PIO pio, uint sm, bool enabled)
+{
+	pio_sm_set_enabled(pio, sm, enabled);
+}
+
+
+/* Function to check (and clear) RX FIFO stall flag.
+ * Returns true if state machine has stalled on full RX FIFO since last call
+ * (timestamps of samples are not continuous anymore).
+ */
+bool tacho_edge_rx_stalled(PIO pio, uint sm)
+{
+	uint32_t mask = 1u << (PIO_FDEBUG_RXSTALL_LSB + sm);
+
+	if (!(pio->fdebug & mask))
+		return false;
+	pio->fdebug = mask; /* write 1 to clear */
+
+	return true;
+}
+
+
+/* Function to return GPIO pin of given bit in samples, or -1 if
+ * there is no such bit.
+ */
+int tacho_edge_sample_pin(uint bit)
+{
+	if (bit >= tacho_edge_pin_count)
+		return -1;
+	return tacho_edge_pins[bit];
+}
+
+
+/* Function to return clock cycles per sampling loop (when no change is
+ * detected) of the loaded program.
+ */
+uint tacho_edge_loop_cycles()
+{
+	return tacho_edge_program.length - TACHO_EDGE_LOOP;
+}
+
+
+/* eof :-) */
@@ -0,0 +1,37 @@
+/* tacho_edge.h
+   Copyright (C) 2021-2024 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of FanPico.
+
+   FanPico is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   FanPico is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with FanPico. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef TACHO_EDGE_H
+#define TACHO_EDGE_H 1
+
+/* Additional clock cycles taken by a loop that pushes a sample to FIFO */
+#define TACHO_EDGE_PUSH_CYCLES   4
+
+int tacho_edge_program_len(uint32_t pin_mask);
+int tacho_edge_load_program(PIO pio, uint32_t pin_mask);
+void tacho_edge_unload_program(PIO pio, uint offset);
+void tacho_edge_program_init(PIO pio, uint sm, uint offset);
+void tacho_edge_enabled(PIO pio, uint sm, bool enabled);
+bool tacho_edge_rx_stalled(PIO pio, uint sm);
+int tacho_edge_sample_pin(uint bit);
+uint tacho_edge_loop_cycles();
+
+#endif /* TACHO_EDGE_H */
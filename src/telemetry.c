@@ -0,0 +1,219 @@
+/* telemetry.c
+   Copyright (C) 2021-2024 Timo Kokkonen <tjko@iki.fi>
+
+   SPDX-License-Identifier: GPL-3.0-or-later
+
+   This file is part of FanPico.
+
+   FanPico is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   FanPico is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with FanPico. If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "pico/stdlib.h"
+#include "pico/unique_id.h"
+#include "pico/cyw43_arch.h"
+#include "lwip/pbuf.h"
+#include "lwip/udp.h"
+
+#include "fanpico.h"
+
+
+/*
+ * Binary UDP telemetry.
+ *
+ * Periodically sends status of all channels as a single small (fixed
+ * layout) datagram to a (unicast or multicast) collector. All values
+ * are little-endian:
+ *
+ *  offset  size  field
+ *   0       4    magic "FPTL"
+ *   4       1    version (1)
+ *   5       1    header length (36)
+ *   6       1    number of fans (F)
+ *   7       1    number of mbfans (M)
+ *   8       1    number of sensors (S)
+ *   9       1    number of virtual sensors (V)
+ *  10       2    reserved (0)
+ *  12       4    packet sequence number
+ *  16       4    uptime (seconds)
+ *  20       4    state generation
+ *  24       2    fan fault bitmap (bit n set = fan n+1 has a fault)
+ *  26       2    mbfan PWM input signal lost bitmap
+ *  28       8    unit ID (RP2040 unique board ID)
+ *  36     F*4    fans: RPM (u16), PWM duty (u16, 0.01%)
+ *   .     M*4    mbfans: RPM (u16), PWM duty (u16, 0.01%)
+ *   .     S*2    sensors: temperature (s16, 0.01C)
+ *   .     V*2    virtual sensors: temperature (s16, 0.01C)
+ *
+ * New fields are only ever added to the end of the header (and header
+ * length updated), so decoders should use header length to find
+ * channel data. See contrib/telemetry_decoder.py.
+ */
+
+#define TELEMETRY_VERSION  1
+#define TELEMETRY_HDR_LEN  36
+#define TELEMETRY_MAX_LEN  (TELEMETRY_HDR_LEN + FAN_MAX_COUNT * 4 + MBFAN_MAX_COUNT * 4 \
+				+ SENSOR_MAX_COUNT * 2 + VSENSOR_MAX_COUNT * 2)
+
+static struct udp_pcb *telemetry_pcb = NULL;
+static uint32_t telemetry_seq = 0;
+static uint32_t telemetry_errors = 0;
+
+
+static inline uint8_t* put_u16(uint8_t *p, uint16_t val)
+{
+	p[0] = val & 0xff;
+	p[1] = val >> 8;
+	return p + 2;
+}
+
+
+static inline uint8_t* put_u32(uint8_t *p, uint32_t val)
+{
+	p[0] = val & 0xff;
+	p[1] = (val >> 8) & 0xff;
+	p[2] = (val >> 16) & 0xff;
+	p[3] = val >> 24;
+	return p + 4;
+}
+
+
+static inline uint16_t scale_u16(float val, float scale)
+{
+	val = roundf(val * scale);
+	if (val < 0.0f)
+		return 0;
+	if (val > 65535.0f)
+		return 65535;
+	return val;
+}
+
+
+static inline uint16_t scale_s16(float val, float scale)
+{
+	val = roundf(val * scale);
+	if (val < -32768.0f)
+		val = -32768.0f;
+	if (val > 32767.0f)
+		val = 32767.0f;
+	return (uint16_t)(int16_t)val;
+}
+
+
+/* Build telemetry datagram, returns length of the packet. */
+static size_t telemetry_packet(uint8_t *buf, const struct fanpico_state *st)
+{
+	pico_unique_board_id_t board_id;
+	uint8_t *p = buf;
+	uint16_t faults = 0;
+	uint16_t lost = 0;
+	int i;
+
+	for (i = 0; i < FAN_COUNT; i++) {
+		if (st->fan_fault[i] != FAULT_NONE)
+			faults |= (1 << i);
+	}
+	for (i = 0; i < MBFAN_COUNT; i++) {
+		if (st->mbfan_pwm_lost[i])
+			lost |= (1 << i);
+	}
+	pico_get_unique_board_id(&board_id);
+
+	memcpy(p, "FPTL", 4);
+	p += 4;
+	*p++ = TELEMETRY_VERSION;
+	*p++ = TELEMETRY_HDR_LEN;
+	*p++ = FAN_COUNT;
+	*p++ = MBFAN_COUNT;
+	*p++ = SENSOR_COUNT;
+	*p++ = VSENSOR_COUNT;
+	p = put_u16(p, 0);
+	p = put_u32(p, telemetry_seq++);
+	p = put_u32(p, to_us_since_boot(get_absolute_time()) / 1000000);
+	p = put_u32(p, st->generation);
+	p = put_u16(p, faults);
+	p = put_u16(p, lost);
+	memcpy(p, board_id.id, 8);
+	p += 8;
+
+	for (i = 0; i < FAN_COUNT; i++) {
+		p = put_u16(p, scale_u16(st->fan_freq[i] * 60 / cfg->fans[i].rpm_factor, 1));
+		p = put_u16(p, scale_u16(st->fan_duty[i], 100));
+	}
+	for (i = 0; i < MBFAN_COUNT; i++) {
+		p = put_u16(p, scale_u16(st->mbfan_freq[i] * 60 / cfg->mbfans[i].rpm_factor, 1));
+		p = put_u16(p, scale_u16(st->mbfan_duty[i], 100));
+	}
+	for (i = 0; i < SENSOR_COUNT; i++)
+		p = put_u16(p, scale_s16(st->temp[i], 100));
+	for (i = 0; i < VSENSOR_COUNT; i++)
+		p = put_u16(p, scale_s16(st->vtemp[i], 100));
+
+	return p - buf;
+}
+
+
+/* Send telemetry datagram, if telemetry is enabled and interval has passed.
+ * This is called from main loop (network_poll()).
+ */
+void telemetry_poll()
+{
+	static absolute_time_t ABSOLUTE_TIME_INITIALIZED_VAR(t_last, 0);
+	static uint8_t buf[TELEMETRY_MAX_LEN];
+	struct pbuf *pb;
+	size_t len;
+	err_t err;
+
+	if (ip_addr_isany(&cfg->telemetry_server) || cfg->telemetry_interval == 0)
+		return;
+	if (!time_passed(&t_last, cfg->telemetry_interval))
+		return;
+
+	len = telemetry_packet(buf, fanpico_state);
+
+	cyw43_arch_lwip_begin();
+	if (!telemetry_pcb) {
+		if (!(telemetry_pcb = udp_new_ip_type(IPADDR_TYPE_ANY))) {
+			cyw43_arch_lwip_end();
+			log_msg(LOG_ERR, "telemetry: failed to create pcb");
+			return;
+		}
+	}
+	if ((pb = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_RAM))) {
+		memcpy(pb->payload, buf, len);
+		err = udp_sendto(telemetry_pcb, pb, &cfg->telemetry_server,
+				(cfg->telemetry_port > 0 ? cfg->telemetry_port : DEFAULT_TELEMETRY_PORT));
+		if (err != ERR_OK)
+			telemetry_errors++;
+		pbuf_free(pb);
+	} else {
+		telemetry_errors++;
+	}
+	cyw43_arch_lwip_end();
+}
+
+
+void telemetry_status()
+{
+	printf("server: %s\n", ipaddr_ntoa(&cfg->telemetry_server));
+	printf("port: %lu\n", (cfg->telemetry_port > 0 ? cfg->telemetry_port : DEFAULT_TELEMETRY_PORT));
+	printf("interval: %lums\n", cfg->telemetry_interval);
+	printf("packets: %lu\n", telemetry_seq);
+	printf("errors: %lu\n", telemetry_errors);
+}
+
+
+/* eof :-) */
@@ -23,17 +23,87 @@
 #include <string.h>
 #include <time.h>
 #include <assert.h>
-#include "hardware/rtc.h"
 #include "pico/stdlib.h"
 #include "pico/stdio/driver.h"
 #include "pico/cyw43_arch.h"
 #include "lwip/pbuf.h"
 #include "lwip/tcp.h"
-#include "pico_telnetd.h"
 #include "pico_telnetd/util.h"
 #include "fanpico.h"
 
 
+/*
+ * Telnet server (supporting multiple concurrent sessions).
+ *
+ * Each session has its own (small) output ring. Command output is routed
+ * to the session that issued the command (see telnetserver_select()), and
+ * when the ring fills up, writer waits for TCP send buffer to drain (flow
+ * control) instead of output being buffered in RAM. So command output
+ * is streamed to the client while command is running.
+ *
+ * Received data is kept in the pbufs received from lwIP until main loop
+ * processes it, TCP receive window is only opened as input is consumed.
+ *
+ * Output that is not generated by a session's command (log messages,
+ * console commands) is sent to all logged in sessions, but without
+ * flow control (output is dropped if session's ring is full).
+ */
+
+#define TELNET_DEFAULT_PORT        23
+#define TELNET_MAX_SESSIONS        3
+#define TELNET_TX_BUF_SIZE         2048 /* per session (must be power of 2) */
+#define TELNET_LINE_MAX_LEN        256
+#define TELNET_FLOW_TIMEOUT        5000 /* ms (per command, < WATCHDOG_REBOOT_DELAY) */
+#define TELNET_MAX_AUTH_FAILURES   3
+#define TELNET_POLL_INTERVAL       2    /* lwIP poll interval (x 500ms) */
+
+#define TELNET_IAC       255
+#define TELNET_DONT      254
+#define TELNET_DO        253
+#define TELNET_WONT      252
+#define TELNET_WILL      251
+#define TELNET_SB        250
+#define TELNET_SE        240
+#define TELNET_OPT_ECHO  1
+#define TELNET_OPT_SGA   3
+
+enum telnet_session_states {
+	TS_FREE = 0,
+	TS_LOGIN,
+	TS_PASSWORD,
+	TS_ACTIVE,
+	TS_CLOSING,
+};
+
+enum telnet_parser_states {
+	TP_DATA = 0,
+	TP_CR,
+	TP_IAC,
+	TP_OPTION,
+	TP_SB,
+	TP_SB_IAC,
+};
+
+struct telnet_session {
+	struct tcp_pcb *pcb;
+	volatile enum telnet_session_states state;
+	enum telnet_parser_states parser;
+	uint8_t option_cmd;
+	uint8_t auth_failures;
+	bool echo;
+	struct pbuf *rx_pbuf;
+	uint16_t rx_offset;
+	char login[16 + 1];
+	char line[TELNET_LINE_MAX_LEN];
+	size_t line_len;
+	uint8_t tx[TELNET_TX_BUF_SIZE];
+	volatile uint32_t tx_head;
+	volatile uint32_t tx_tail;
+	uint32_t tx_dropped;
+	absolute_time_t flow_deadline;
+	bool flow_truncated;
+};
+
 static const char *telnet_banner = "\r\n"
 	"  _____           ____  _           \r\n"
 	" |  ___|_ _ _ __ |  _ \\(_) ___ ___  \r\n"
@@ -47,26 +117,570 @@ static user_pwhash_entry_t telnet_users[] = {
 	{ NULL, NULL }
 };
 
-static tcp_server_t *telnet_srv = NULL;
+static struct telnet_session sessions[TELNET_MAX_SESSIONS];
+static struct telnet_session *output_session = NULL;
+static struct tcp_pcb *telnet_listen_pcb = NULL;
+static bool telnet_raw_mode = false;
+static bool flow_wait = false;
 
-void telnetserver_init()
+
+/* Add data to session output ring. Returns number of bytes added.
+ * Ring may be written from interrupt context too (log messages from
+ * lwIP callbacks), so interrupts are disabled while ring is updated. */
+static size_t telnet_tx_put(struct telnet_session *s, const uint8_t *buf, size_t len)
+{
+	uint32_t irq, space;
+	size_t i, count;
+
+	irq = save_and_disable_interrupts();
+	space = TELNET_TX_BUF_SIZE - (s->tx_head - s->tx_tail);
+	count = (len < space ? len : space);
+	for (i = 0; i < count; i++)
+		s->tx[(s->tx_head + i) & (TELNET_TX_BUF_SIZE - 1)] = buf[i];
+	s->tx_head += count;
+	restore_interrupts(irq);
+
+	return count;
+}
+
+
+/* Move data from output ring into TCP send buffer.
+ * (must be called in lwIP context, or with lwIP lock held) */
+static void telnet_flush(struct telnet_session *s)
+{
+	uint32_t len, pos, space;
+	bool sent = false;
+
+	if (!s->pcb)
+		return;
+
+	while ((len = s->tx_head - s->tx_tail) > 0) {
+		pos = s->tx_tail & (TELNET_TX_BUF_SIZE - 1);
+		if (len > TELNET_TX_BUF_SIZE - pos)
+			len = TELNET_TX_BUF_SIZE - pos;
+		space = tcp_sndbuf(s->pcb);
+		if (len > space)
+			len = space;
+		if (len == 0)
+			break;
+		if (tcp_write(s->pcb, &s->tx[pos], len, TCP_WRITE_FLAG_COPY) != ERR_OK)
+			break;
+		s->tx_tail += len;
+		sent = true;
+	}
+	if (sent)
+		tcp_output(s->pcb);
+}
+
+
+static void telnet_session_flush(struct telnet_session *s)
+{
+	cyw43_arch_lwip_begin();
+	telnet_flush(s);
+	cyw43_arch_lwip_end();
+}
+
+
+/* Write data to session. If 'wait' is set, wait for output ring to drain
+ * when it is full, otherwise excess output is dropped. Total time a command
+ * may spend waiting is capped by session's flow_deadline (set when command
+ * starts), after that rest of the command output is dropped, so that slow
+ * client cannot keep main loop blocked (and trigger watchdog). */
+static void telnet_write(struct telnet_session *s, const uint8_t *buf, size_t len, bool wait)
+{
+	size_t n;
+
+	while (len > 0) {
+		n = telnet_tx_put(s, buf, len);
+		buf += n;
+		len -= n;
+		if (len == 0)
+			break;
+		if (wait && !s->flow_truncated && time_reached(s->flow_deadline)) {
+			log_msg(LOG_NOTICE, "Telnet: session %d output stalled, truncating output",
+				(int)(s - sessions) + 1);
+			s->flow_truncated = true;
+		}
+		if (!wait || s->flow_truncated || s->state == TS_CLOSING) {
+			s->tx_dropped += len;
+			break;
+		}
+
+		/* Output ring full, wait for client to receive data... */
+		flow_wait = true;
+		telnet_session_flush(s);
+		if (n == 0) {
+#if PICO_CYW43_ARCH_POLL
+			cyw43_arch_poll();
+#else
+			sleep_us(100);
+#endif
+		}
+		flow_wait = false;
+	}
+}
+
+
+static void telnet_puts(struct telnet_session *s, const char *str)
+{
+	telnet_write(s, (const uint8_t*)str, strlen(str), false);
+}
+
+
+static void telnet_option(struct telnet_session *s, uint8_t cmd, uint8_t option)
+{
+	uint8_t buf[3] = { TELNET_IAC, cmd, option };
+
+	telnet_write(s, buf, sizeof(buf), false);
+}
+
+
+/* Read next received byte (consuming pbufs as they become empty). */
+static int telnet_read_byte(struct telnet_session *s)
+{
+	struct pbuf *p, *q;
+	int c = -1;
+
+	cyw43_arch_lwip_begin();
+	if ((p = s->rx_pbuf)) {
+		c = pbuf_get_at(p, s->rx_offset++);
+		if (s->rx_offset >= p->len) {
+			/* Release first pbuf in the chain and open our receive window */
+			q = p->next;
+			p->next = NULL;
+			p->tot_len = p->len;
+			if (s->pcb)
+				tcp_recved(s->pcb, p->len);
+			pbuf_free(p);
+			s->rx_pbuf = q;
+			s->rx_offset = 0;
+		}
+	}
+	cyw43_arch_lwip_end();
+
+	return c;
+}
+
+
+/* Return next (data) character received from session, handling any
+ * Telnet protocol commands. Returns -1 if no input is available. */
+static int telnet_getchar(struct telnet_session *s)
+{
+	int c;
+
+	while ((c = telnet_read_byte(s)) >= 0) {
+		if (s->parser == TP_CR) {
+			s->parser = TP_DATA;
+			/* Skip LF or NUL following CR */
+			if (c == 10 || c == 0)
+				continue;
+		}
+		if (telnet_raw_mode) {
+			if (c == 13)
+				s->parser = TP_CR;
+			return c;
+		}
+
+		switch (s->parser) {
+		case TP_CR: /* handled above */
+		case TP_DATA:
+			if (c == TELNET_IAC) {
+				s->parser = TP_IAC;
+				break;
+			}
+			if (c == 13)
+				s->parser = TP_CR;
+			return c;
+		case TP_IAC:
+			if (c == TELNET_IAC) {
+				s->parser = TP_DATA;
+				return c;
+			}
+			if (c >= TELNET_WILL && c <= TELNET_DONT) {
+				s->option_cmd = c;
+				s->parser = TP_OPTION;
+			} else {
+				s->parser = (c == TELNET_SB ? TP_SB : TP_DATA);
+			}
+			break;
+		case TP_OPTION:
+			s->parser = TP_DATA;
+			/* Refuse any options we have not offered */
+			if (c == TELNET_OPT_ECHO || c == TELNET_OPT_SGA)
+				break;
+			if (s->option_cmd == TELNET_DO)
+				telnet_option(s, TELNET_WONT, c);
+			else if (s->option_cmd == TELNET_WILL)
+				telnet_option(s, TELNET_DONT, c);
+			break;
+		case TP_SB:
+			if (c == TELNET_IAC)
+				s->parser = TP_SB_IAC;
+			break;
+		case TP_SB_IAC:
+			s->parser = (c == TELNET_SE ? TP_DATA : TP_SB);
+			break;
+		}
+	}
+
+	return -1;
+}
+
+
+/* Line editing (similar to console). Returns true when input line is complete. */
+static bool telnet_edit_line(struct telnet_session *s, int c)
+{
+	bool echo = (s->echo && s->state != TS_PASSWORD);
+	char tmp[2];
+
+	if (c == 0xff || c == 0x00)
+		return false;
+	if (c == 0x7f || c == 0x08) {
+		if (s->line_len > 0) {
+			s->line_len--;
+			if (echo)
+				telnet_puts(s, "\b \b");
+		}
+		return false;
+	}
+	if (c == 10 || c == 13 || s->line_len >= sizeof(s->line) - 1) {
+		if (s->echo)
+			telnet_puts(s, "\r\n");
+		s->line[s->line_len] = 0;
+		s->line_len = 0;
+		return true;
+	}
+	s->line[s->line_len++] = c;
+	if (echo) {
+		tmp[0] = c;
+		tmp[1] = 0;
+		telnet_puts(s, tmp);
+	}
+
+	return false;
+}
+
+
+static void telnet_login_prompt(struct telnet_session *s)
+{
+	s->state = TS_LOGIN;
+	telnet_puts(s, "\r\nlogin: ");
+}
+
+
+static void telnet_process_line(struct telnet_session *s, int session)
+{
+	switch (s->state) {
+	case TS_LOGIN:
+		if (strlen(s->line) < 1) {
+			telnet_login_prompt(s);
+			break;
+		}
+		strncopy(s->login, s->line, sizeof(s->login));
+		telnet_puts(s, "Password: ");
+		s->state = TS_PASSWORD;
+		break;
+
+	case TS_PASSWORD:
+		if (sha512crypt_auth_cb(telnet_users, s->login, s->line) == 0) {
+			log_msg(LOG_NOTICE, "Telnet: session %d: user %s logged in",
+				session + 1, s->login);
+			telnet_puts(s, "\r\n");
+			s->state = TS_ACTIVE;
+		} else {
+			log_msg(LOG_NOTICE, "Telnet: session %d: login failed (%s)",
+				session + 1, s->login);
+			telnet_puts(s, "\r\nLogin incorrect\r\n");
+			if (++s->auth_failures >= TELNET_MAX_AUTH_FAILURES)
+				s->state = TS_CLOSING;
+			else
+				telnet_login_prompt(s);
+		}
+		memset(s->line, 0, sizeof(s->line));
+		break;
+
+	case TS_ACTIVE:
+		if (strlen(s->line) > 0)
+			cmdq_telnet_command(session, s->line);
+		break;
+
+	default:
+		break;
+	}
+}
+
+
+static void telnet_close(struct telnet_session *s)
+{
+	cyw43_arch_lwip_begin();
+	if (s->pcb) {
+		telnet_flush(s);
+		tcp_arg(s->pcb, NULL);
+		tcp_recv(s->pcb, NULL);
+		tcp_sent(s->pcb, NULL);
+		tcp_err(s->pcb, NULL);
+		tcp_poll(s->pcb, NULL, 0);
+		if (tcp_close(s->pcb) != ERR_OK)
+			tcp_abort(s->pcb);
+		s->pcb = NULL;
+	}
+	if (s->rx_pbuf) {
+		pbuf_free(s->rx_pbuf);
+		s->rx_pbuf = NULL;
+	}
+	if (output_session == s)
+		output_session = NULL;
+	s->state = TS_FREE;
+	cyw43_arch_lwip_end();
+}
+
+
+static err_t telnet_recv_cb(void *arg, struct tcp_pcb *pcb, struct pbuf *p, err_t err)
+{
+	struct telnet_session *s = (struct telnet_session*)arg;
+
+	if (!s) {
+		if (p)
+			pbuf_free(p);
+		return ERR_VAL;
+	}
+	if (!p) {
+		/* Connection closed by remote end */
+		s->state = TS_CLOSING;
+		return ERR_OK;
+	}
+	if (err != ERR_OK) {
+		pbuf_free(p);
+		return err;
+	}
+
+	/* Queue received data until main loop processes it */
+	if (s->rx_pbuf) {
+		pbuf_cat(s->rx_pbuf, p);
+	} else {
+		s->rx_pbuf = p;
+		s->rx_offset = 0;
+	}
+
+	return ERR_OK;
+}
+
+
+static err_t telnet_sent_cb(void *arg, struct tcp_pcb *pcb, u16_t len)
+{
+	struct telnet_session *s = (struct telnet_session*)arg;
+
+	if (s)
+		telnet_flush(s);
+
+	return ERR_OK;
+}
+
+
+static err_t telnet_poll_cb(void *arg, struct tcp_pcb *pcb)
+{
+	struct telnet_session *s = (struct telnet_session*)arg;
+
+	if (s)
+		telnet_flush(s);
+
+	return ERR_OK;
+}
+
+
+static void telnet_err_cb(void *arg, err_t err)
+{
+	struct telnet_session *s = (struct telnet_session*)arg;
+
+	if (!s)
+		return;
+
+	/* PCB has already been freed by lwIP */
+	s->pcb = NULL;
+	s->state = TS_CLOSING;
+}
+
+
+static err_t telnet_accept_cb(void *arg, struct tcp_pcb *pcb, err_t err)
+{
+	struct telnet_session *s = NULL;
+	int i;
+
+	if (err != ERR_OK || !pcb)
+		return ERR_VAL;
+
+	for (i = 0; i < TELNET_MAX_SESSIONS; i++) {
+		if (sessions[i].state == TS_FREE) {
+			s = &sessions[i];
+			break;
+		}
+	}
+	if (!s) {
+		log_msg(LOG_NOTICE, "Telnet: too many sessions, connection from %s refused",
+			ipaddr_ntoa(&pcb->remote_ip));
+		tcp_abort(pcb);
+		return ERR_ABRT;
+	}
+
+	memset(s, 0, sizeof(*s));
+	s->pcb = pcb;
+	tcp_arg(pcb, s);
+	tcp_recv(pcb, telnet_recv_cb);
+	tcp_sent(pcb, telnet_sent_cb);
+	tcp_err(pcb, telnet_err_cb);
+	tcp_poll(pcb, telnet_poll_cb, TELNET_POLL_INTERVAL);
+
+	log_msg(LOG_INFO, "Telnet: session %d: connection from %s",
+		i + 1, ipaddr_ntoa(&pcb->remote_ip));
+
+	if (!telnet_raw_mode) {
+		/* Server echoes input (and suppresses go-ahead) */
+		telnet_option(s, TELNET_WILL, TELNET_OPT_ECHO);
+		telnet_option(s, TELNET_WILL, TELNET_OPT_SGA);
+		s->echo = true;
+	}
+	telnet_puts(s, telnet_banner);
+	if (cfg->telnet_auth)
+		telnet_login_prompt(s);
+	else
+		s->state = TS_ACTIVE;
+	telnet_flush(s);
+
+	return ERR_OK;
+}
+
+
+/* Stdio driver: output goes to session selected with telnetserver_select(),
+ * or to all (logged in) sessions. */
+static void telnet_out_chars(const char *buf, int len)
 {
-	telnet_srv = telnet_server_init(4096, 10240);
-	if (!telnet_srv)
+	struct telnet_session *s = output_session;
+	bool irq = (__get_current_exception() != 0);
+	int i;
+
+	if (s && !irq) {
+		if (s->state == TS_ACTIVE)
+			telnet_write(s, (const uint8_t*)buf, len, !flow_wait);
 		return;
+	}
+
+	for (i = 0; i < TELNET_MAX_SESSIONS; i++) {
+		if (sessions[i].state == TS_ACTIVE)
+			telnet_write(&sessions[i], (const uint8_t*)buf, len, false);
+	}
+}
+
+
+/* Stdio driver: input is only available to commands issued from a session. */
+static int telnet_in_chars(char *buf, int len)
+{
+	struct telnet_session *s = output_session;
+	int c, count = 0;
+
+	if (!s || s->state != TS_ACTIVE || __get_current_exception() != 0)
+		return PICO_ERROR_NO_DATA;
+
+	while (count < len && (c = telnet_getchar(s)) >= 0)
+		buf[count++] = c;
+
+	return (count > 0 ? count : PICO_ERROR_NO_DATA);
+}
+
+
+static stdio_driver_t telnet_stdio_driver = {
+	.out_chars = telnet_out_chars,
+	.in_chars = telnet_in_chars,
+#if PICO_STDIO_ENABLE_CRLF_SUPPORT
+	.crlf_enabled = true,
+#endif
+};
+
+
+void telnetserver_init()
+{
+	struct tcp_pcb *pcb;
+	uint16_t port = (cfg->telnet_port > 0 ? cfg->telnet_port : TELNET_DEFAULT_PORT);
 
 	telnet_users[0].login = cfg->telnet_user;
 	telnet_users[0].hash = cfg->telnet_pwhash;
-	telnet_srv->mode = (cfg->telnet_raw_mode ? RAW_MODE : TELNET_MODE);
-	if (cfg->telnet_port > 0)
-		telnet_srv->port = cfg->telnet_port;
-	if (cfg->telnet_auth) {
-		telnet_srv->auth_cb = sha512crypt_auth_cb;
-		telnet_srv->auth_cb_param = (void*)telnet_users;
+	telnet_raw_mode = cfg->telnet_raw_mode;
+	memset(sessions, 0, sizeof(sessions));
+
+	if (!(pcb = tcp_new_ip_type(IPADDR_TYPE_ANY))) {
+		log_msg(LOG_ERR, "Telnet: failed to create PCB");
+		return;
 	}
-	telnet_srv->log_cb = log_msg;
-	telnet_srv->banner = telnet_banner;
+	if (tcp_bind(pcb, IP_ANY_TYPE, port) != ERR_OK) {
+		log_msg(LOG_ERR, "Telnet: failed to bind to port %u", port);
+		tcp_close(pcb);
+		return;
+	}
+	if (!(telnet_listen_pcb = tcp_listen_with_backlog(pcb, 1))) {
+		log_msg(LOG_ERR, "Telnet: failed to listen on port %u", port);
+		tcp_close(pcb);
+		return;
+	}
+	tcp_accept(telnet_listen_pcb, telnet_accept_cb);
 
-	telnet_server_start(telnet_srv, true);
+	stdio_set_driver_enabled(&telnet_stdio_driver, true);
+	log_msg(LOG_INFO, "Telnet: listening on port %u (max %d sessions)",
+		port, TELNET_MAX_SESSIONS);
 }
 
+
+/* Select session where (stdio) output is routed, -1 = all sessions. */
+void telnetserver_select(int session)
+{
+	struct telnet_session *s;
+
+	if (session >= 0 && session < TELNET_MAX_SESSIONS) {
+		s = &sessions[session];
+		s->flow_deadline = make_timeout_time_ms(TELNET_FLOW_TIMEOUT);
+		s->flow_truncated = false;
+		output_session = s;
+	} else if ((s = output_session)) {
+		output_session = NULL;
+		if (s->flow_truncated && s->state == TS_ACTIVE)
+			telnet_puts(s, "\r\n[output truncated]\r\n");
+		telnet_session_flush(s);
+	}
+}
+
+
+/* Process input from sessions (called from main loop). At most one
+ * command per session is processed per call. */
+void telnetserver_poll()
+{
+	struct telnet_session *s;
+	int i, c;
+
+	if (!telnet_listen_pcb)
+		return;
+
+	for (i = 0; i < TELNET_MAX_SESSIONS; i++) {
+		s = &sessions[i];
+
+		if (s->state == TS_FREE)
+			continue;
+		if (s->state == TS_CLOSING) {
+			log_msg(LOG_INFO, "Telnet: session %d closed", i + 1);
+			if (s->tx_dropped > 0)
+				log_msg(LOG_DEBUG, "Telnet: session %d: %lu bytes of output dropped",
+					i + 1, s->tx_dropped);
+			telnet_close(s);
+			continue;
+		}
+
+		while (s->state != TS_CLOSING && (c = telnet_getchar(s)) >= 0) {
+			if (telnet_edit_line(s, c)) {
+				telnet_process_line(s, i);
+				if (s->state == TS_ACTIVE)
+					break;
+			}
+		}
+		telnet_session_flush(s);
+	}
+}
+
+
+/* eof :-) */
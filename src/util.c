@@ -241,9 +241,9 @@ int valid_wifi_country(const char *country)
 }
 
 
-int check_for_change(double oldval, double newval, double threshold)
+int check_for_change(float oldval, float newval, float threshold)
 {
-	double delta = fabs(oldval - newval);
+	float delta = fabsf(oldval - newval);
 
 	if (delta >= threshold)
 		return 1;